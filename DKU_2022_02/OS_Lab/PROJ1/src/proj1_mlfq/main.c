@@ -16,6 +16,8 @@ int up_msg_q; // For upstream message queue: from child to parent.
 int time_quantum; // For storing time quantum.
 int time_tick; // For storing time tick.
 int queue_count; // For storing number of queues.
+int simulation = 0; // For storing whether if this is simulation mode, see sim.h.
+unsigned int sim_seed = 0; // For storing seed of the simulation.
 
 
  /**
@@ -26,15 +28,23 @@ int queue_count; // For storing number of queues.
   */
 int main(int argc, char* argv[]) {
      printf("----------=[ Scheduler ]=----------\n");
-     if (argc != 3) { // Check arguments, also check if they are valid.
-         printf("[-] Usage : ./this_file <number of levels> <time tick interval>\n");
+     if (argc >= 4 && !strcmp(argv[3], "-s")) { // Simulation mode, with an optional seed.
+         simulation = 1;
+         sim_seed = argc == 5 ? (unsigned int) strtoul(argv[4], NULL, 10) : 0;
+     }
+     if (argc != 3 && !(simulation && argc <= 5)) { // Check arguments, also check if they are valid.
+         printf("[-] Usage : ./this_file <number of levels> <time tick interval> [-s [seed]]\n");
          printf("Ex) ./sched 5 10\n");
+         printf("Ex) ./sched 5 10 -s 42\n");
+         printf("=> -s simulates the processes with a virtual clock instead of forking, same seed gives same result\n");
          return 0;
      }
 
-     // Initialize message queues before forking children processes.
-     dn_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
-     up_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
+     // Initialize message queues before forking children processes, simulated processes do not need them.
+     if (!simulation) {
+         dn_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
+         up_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
+     }
 
      queue_count = atoi(argv[1]) + 2; // Need two more for wait queue and terminated queue.
      time_tick = atoi(argv[2]);
@@ -10,6 +10,7 @@ extern int up_msg_q; // The upstream message queue from child to parent.
 extern int dn_msg_q; // The downstream message queue from parent to child.
 extern pid_t* pid_arr;
 extern int time_tick; // For storing time tick.
+extern int simulation; // For storing whether if this is simulation mode.
 
 int current_selected_queue = 2; // For tracking which level of queue we are using right now.
 unsigned long total_time_ticks = 0; // For storing how much time ticks had elapsed.
@@ -23,17 +24,23 @@ int* time_qs; // For storing values of each time quantum for queues.
  * @param ignored Will always be SIGINT. so ignore
  */
 void exit_handler(int ignored) {
-    printf("[Scheduler] Killing all child processes..\n");
-    for (int i = 0 ; i < 10 ; i++) {
-        printf("[Scheduler] Sending SIGKILL to child %d\n", pid_arr[i]);
-        kill(pid_arr[i], SIGKILL);
+    if (!simulation) { // Simulated child processes are not real processes, there is nothing to kill.
+        printf("[Scheduler] Killing all child processes..\n");
+        for (int i = 0 ; i < 10 ; i++) {
+            printf("[Scheduler] Sending SIGKILL to child %d\n", pid_arr[i]);
+            kill(pid_arr[i], SIGKILL);
+        }
+        printf("[Scheduler] Destroying all message queues.\n");
     }
-    printf("[Scheduler] Destroying all message queues.\n");
 
     print_stats();
     destroy_queues(); // Destroy all queues.
-    msgctl(up_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
-    msgctl(dn_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
+    if (simulation) {
+        sim_report();
+    } else {
+        msgctl(up_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
+        msgctl(dn_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
+    }
     exit(0);
 }
 
@@ -47,7 +54,7 @@ void move_wait_queue() {
 #endif
     fprintf(fp, "[Scheduler] Moving pid %d to wait queue / IO : %d\n", running->pid, running->io_left);
     running->queue_stat = current_selected_queue; // Store the queue where it was at.
-    kill(running->pid, SIGUSR2); // Send the process you are not using CPU time anymore.
+    signal_process(running->pid, SIGUSR2); // Send the process you are not using CPU time anymore.
     push_queue(QUEUE_WAIT, *running); // Push into the wait queue.
     dispatch_next(); // Dispatch next process.
 }
@@ -61,13 +68,13 @@ void move_wait_queue() {
 void check_ipc() {
     struct msg_q_data_t msg;
     memset(&msg, 0, sizeof(msg));
-    long res = msgrcv(up_msg_q, &msg, sizeof(struct msg_q_data_t), 0, IPC_NOWAIT);
+    long res = receive_msg(&msg);
     if (res != -1) { // Meaning that some child process issued an io request.
         pid_t pid = msg.pid;
         running->state = STATE_WAIT;
         unsigned int io_time = msg.io_request;
         int finished = msg.is_finished;
-        kill(SIGUSR2, pid); // Make process wait.
+        signal_process(pid, SIGUSR2); // Make process wait.
 #ifdef DEBUG
         printf("[DEBUG] Scheduler process received IO request from %d for duration %d / Terminated %d\n", pid, io_time, finished);
 #endif
@@ -155,11 +162,11 @@ void update_queue_stats() {
     }
 
     if (before_queue != current_selected_queue) { // If there was an update in the current selected queue, stop current.
-        kill(running->pid, SIGUSR2); // Stop current running process immediately.
+        signal_process(running->pid, SIGUSR2); // Stop current running process immediately.
         push_queue(before_queue, *running); // Store old one back to the queue where it was.
         running = pop_queue(current_selected_queue); // Pop the higher most priority process and let it have CPU.
         running->r_tq = time_qs[current_selected_queue - 2]; // Refill time quantum for the dispatched process.
-        kill(running->pid, SIGUSR1);
+        signal_process(running->pid, SIGUSR1);
     }
 }
 
@@ -203,7 +210,7 @@ void time_quantum_over() {
     printf("[DEBUG] Demoting pid %d to queue from %d to %d\n", running->pid, current_selected_queue - 2, dest - 2);
 #endif
     push_queue(dest, *running); // Push into the destination queue.
-    kill(running->pid, SIGUSR2); // Make the process stop.
+    signal_process(running->pid, SIGUSR2); // Make the process stop.
     dispatch_next(); // Dispatch next process from the queue.
 }
 
@@ -233,7 +240,7 @@ void parent_timer_handler(int ignored) {
 #endif
     if (running) { // If there was running process, check queue status.
         update_queue_stats(); // Might set running as NULL, check conditions!
-        kill(running->pid, SIGALRM); // Send time tick to the running process.
+        signal_process(running->pid, SIGALRM); // Send time tick to the running process.
         running->total_exec_time++;
         running->r_tq--;
         perform_priority_boost();
@@ -281,7 +288,7 @@ void dispatch_next() {
         running->wait_time = 0; // Reset waiting time when being scheduled.
         running->r_tq = time_qs[current_selected_queue - 2];
         running->queue_stat = current_selected_queue;
-        kill(running->pid, SIGUSR1);
+        signal_process(running->pid, SIGUSR1);
     }
 }
 
@@ -309,36 +316,38 @@ void log_status() {
 
 
 /**
- * A function for parent process.
- * This will run forever until all the processes are over.
+ * A function that checks if every PCB that can be dispatched belongs to a child process that exited.
+ * This is for simulation mode, see sim_is_stuck.
+ * @return 1 if only PCBs of exited child processes are left, 0 if not.
  */
-_Noreturn void parent() {
-    // Register Signal Handlers.
-    signal(SIGINT, exit_handler); // For exiting process gracefully.
-
-    // Register Timer ticks.
-    struct sigaction sa;
-    struct itimerval time_tick_dur;
-
-    // Init sigaction, register sigaction for SIGVTALRM
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = &parent_timer_handler;
-    sigaction(SIGALRM, &sa, NULL);
+int only_exited_pcbs_left() {
+    if (get_queue_size(QUEUE_WAIT) != 0) return 0; // Might still terminate processes.
+    if (running && !sim_is_exited(running->pid)) return 0;
+    int left = running != NULL;
+    for (int i = 2 ; i < queue_count ; i++) { // Iterate over all levels of queues.
+        for (struct pcb_t* tmp = queues[i] ; tmp ; tmp = tmp->next) {
+            if (!sim_is_exited(tmp->pid)) return 0;
+            left = 1;
+        }
+    }
+    return left;
+}
 
-    // Set time ticks using time_tick.
-    time_tick_dur.it_value.tv_sec = (int) time_tick / 1000; // Set second
-    time_tick_dur.it_value.tv_usec = (time_tick % 1000) * 1000; // Set microsecond (1000 microseconds = 1 millisecond)
-    time_tick_dur.it_interval.tv_sec = (int) time_tick / 1000;
-    time_tick_dur.it_interval.tv_usec = (time_tick % 1000) * 1000;
-    setitimer(ITIMER_REAL, &time_tick_dur, NULL);
 
+/**
+ * A function that initializes the scheduler.
+ * This will open the log file, set time quantum of each queue, generate PCBs of all child processes, then dispatch
+ * the first process.
+ * @param seed The seed for placing processes into random queues.
+ */
+void init_scheduler(unsigned int seed) {
     fp = fopen("schedule_dump.txt", "w");
 
     // Generate random time quantum for each queues.
     time_qs = malloc(sizeof(int) * queue_count);
     memset(time_qs, 0, sizeof(int) * queue_count);
     printf("[Scheduler] PID : %d and Time tick : %d\n", getpid(), time_tick);
-    srand(time(NULL));
+    srand(seed);
 
     for (int i = 0 ; i < queue_count - 2 ; i++) { // Make lower priority queue's time quantum bigger by TIME_TICK_JUMP time ticks.
         if (i > 0)
@@ -374,8 +383,36 @@ _Noreturn void parent() {
     }
 
     running = pop_queue(2);
-    kill(running->pid, SIGUSR1);
+    signal_process(running->pid, SIGUSR1);
+}
+
+
+/**
+ * A function for parent process.
+ * This will run forever until all the processes are over.
+ */
+_Noreturn void parent() {
+    // Register Signal Handlers.
+    signal(SIGINT, exit_handler); // For exiting process gracefully.
+
+    // Set up everything before the first time tick, the timer handler uses all of them.
+    init_scheduler(time(NULL));
+
+    // Register Timer ticks.
+    struct sigaction sa;
+    struct itimerval time_tick_dur;
+
+    // Init sigaction, register sigaction for SIGVTALRM
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &parent_timer_handler;
+    sigaction(SIGALRM, &sa, NULL);
+
+    // Set time ticks using time_tick.
+    time_tick_dur.it_value.tv_sec = (int) time_tick / 1000; // Set second
+    time_tick_dur.it_value.tv_usec = (time_tick % 1000) * 1000; // Set microsecond (1000 microseconds = 1 millisecond)
+    time_tick_dur.it_interval.tv_sec = (int) time_tick / 1000;
+    time_tick_dur.it_interval.tv_usec = (time_tick % 1000) * 1000;
+    setitimer(ITIMER_REAL, &time_tick_dur, NULL);
 
-    fp = fopen("schedule_dump.txt", "w");
     while (1); // Do nothing.
 }
\ No newline at end of file
@@ -22,6 +22,7 @@
 
 #include "common.h"
 #include "utils.h"
+#include "sim.h"
 
 #define TIME_TICK_JUMP 1
 #define S 50
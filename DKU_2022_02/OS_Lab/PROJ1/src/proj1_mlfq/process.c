@@ -9,6 +9,8 @@
 
 pid_t* pid_arr;
 extern int time_tick;
+extern int simulation;
+extern unsigned int sim_seed;
 
 
 /**
@@ -23,6 +25,10 @@ void run() {
     printf("[+] Starting job...\n");
     printf("    Total Queue count : %d\n", queue_count - 2);
     printf("    Output file : schedule_dump.txt\n");
+    if (simulation) {
+        printf("    Mode : Simulation (seed %u)\n", sim_seed);
+        simulate(sim_seed); // No real processes, everything runs in this process.
+    }
     start_processes();
 }
 
@@ -16,6 +16,7 @@
 #include "common.h"
 #include "child.h"
 #include "parent.h"
+#include "sim.h"
 
 void run();
 void start_processes();
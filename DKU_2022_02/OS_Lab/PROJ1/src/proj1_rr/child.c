@@ -36,7 +36,7 @@ void child_send_msg() {
     printf("[DEBUG] Child %d sent IPC communication: IO Time: %d / Is Finished: %d\n", getpid(), io_time, is_child_finished);
 #endif
     //io_time = rand() % RANDOM_MAX + 1; // Refill IO burst time.
-    io_time = 5;
+    io_time = CHILD_IO_BURST;
 }
 
 
@@ -64,7 +64,7 @@ void child_timer_handler(int ignored) {
         } else { // If we had enough time for IO burst, just use whole IO burst time.
             total_exec_time +=  io_time;
             //cpu_time = rand() % RANDOM_MAX; // Refill CPU burst time.
-            cpu_time = 5; // Refill CPU burst time.
+            cpu_time = CHILD_CPU_BURST; // Refill CPU burst time.
         }
         child_send_msg();
     }
@@ -106,9 +106,9 @@ void child() {
     // Initialize CPU time and IO time randomly.
     srand(time(NULL));
     //cpu_time = rand() % RANDOM_MAX;
-    cpu_time = 5;
+    cpu_time = CHILD_CPU_BURST;
     //io_time = rand() % RANDOM_MAX + 1; // At least IO time shall be 1 time tick.
-    io_time = 5;
+    io_time = CHILD_IO_BURST;
     //printf("[%d] child called\n", getpid());
     //printf("[%d] Executing with max execution %d.", getpid(), 10);
 
@@ -24,6 +24,8 @@
 
 #define RANDOM_MAX 20
 #define CHILD_MAX_EXECUTION_TIME 50
+#define CHILD_CPU_BURST 5 // For CPU burst time of each request.
+#define CHILD_IO_BURST 5 // For IO burst time of each request.
 
 void child_signal_handler(int);
 void child_send_msg(void);
@@ -15,6 +15,7 @@ int up_msg_q; // For upstream message queue: from child to parent.
 int parent_pid; // Not used currently.
 int time_quantum; // For storing time quantum
 int time_tick; // For storing time tick
+int simulation = 0; // For storing whether if this is simulation mode, see sim.h.
 
  /**
   * The almighty main function
@@ -30,16 +31,21 @@ int main(int argc, char* argv[]) {
     }
 
      printf("----------=[ Scheduler ]=----------\n");
-     if (argc != 3) { // Check arguments, also check if they are valid.
-         printf("[-] Usage : ./this_file <Time quantum (ticks)> <Time tick (ms)>\n");
+     simulation = argc == 4 && !strcmp(argv[3], "-s"); // Simulation mode.
+     if (argc != 3 && !simulation) { // Check arguments, also check if they are valid.
+         printf("[-] Usage : ./this_file <Time quantum (ticks)> <Time tick (ms)> [-s]\n");
          printf("Ex) ./sched 10 60 \n");
          printf("=> Time quantum 10ticks, time tick 60ms\n");
+         printf("Ex) ./sched 10 60 -s\n");
+         printf("=> -s simulates the processes with a virtual clock instead of forking\n");
          return 0;
      }
 
-     // Initialize message queues before forking children processes.
-     dn_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
-     up_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
+     // Initialize message queues before forking children processes, simulated processes do not need them.
+     if (!simulation) {
+         dn_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
+         up_msg_q = msgget(MSG_Q_KEY, 0666 | IPC_CREAT);
+     }
      parent_pid = getpid(); // Store parent scheduler's PID.
 
      // Parse command-line arguments
@@ -11,6 +11,7 @@ extern int dn_msg_q; // The downstream message queue from parent to child.
 extern pid_t* pid_arr;
 extern int time_quantum; // For storing time quantum.
 extern int time_tick; // For storing time tick.
+extern int simulation; // For storing whether if this is simulation mode.
 
 int current_ready_queue = QUEUE_READY; // For tracking which queue are we using for the ready queue.
 unsigned long total_time_ticks = 0; // For storing how much time ticks had elapsed.
@@ -24,17 +25,23 @@ FILE* fp = NULL; // For writing files.
  * @param ignored Will always be SIGINT. so ignore
  */
 void exit_handler(int ignored) {
-    printf("[Scheduler] Killing all child processes..\n");
-    for (int i = 0 ; i < 10 ; i++) {
-        printf("[Scheduler] Sending SIGKILL to child %d\n", pid_arr[i]);
-        kill(pid_arr[i], SIGKILL);
+    if (!simulation) { // Simulated child processes are not real processes, there is nothing to kill.
+        printf("[Scheduler] Killing all child processes..\n");
+        for (int i = 0 ; i < 10 ; i++) {
+            printf("[Scheduler] Sending SIGKILL to child %d\n", pid_arr[i]);
+            kill(pid_arr[i], SIGKILL);
+        }
+        printf("[Scheduler] Destroying all message queues.\n");
     }
-    printf("[Scheduler] Destroying all message queues.\n");
 
     print_stats();
     destroy_queues(); // Destroy all queues.
-    msgctl(up_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
-    msgctl(dn_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
+    if (simulation) {
+        sim_report();
+    } else {
+        msgctl(up_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
+        msgctl(dn_msg_q, IPC_RMID, NULL); // Clean IPC message queue with msgctl.
+    }
     exit(0);
 }
 
@@ -67,9 +74,9 @@ void dispatch_next() {
                 exit_handler(0); // Call exit handler.
             }
         } else  // This means there was a running process.
-            kill(running->pid, SIGUSR1); // Notify the child that you are scheduled.
+            signal_process(running->pid, SIGUSR1); // Notify the child that you are scheduled.
     } else
-        kill(running->pid, SIGUSR1); // Notify the child that you are dispatched.
+        signal_process(running->pid, SIGUSR1); // Notify the child that you are dispatched.
 }
 
 
@@ -78,7 +85,7 @@ void dispatch_next() {
  * This function will move current running process into inactive queue.
  */
 void time_quantum_over() {
-    kill(running->pid, SIGUSR2); // Send the process that time quantum was over.
+    signal_process(running->pid, SIGUSR2); // Send the process that time quantum was over.
     move_inactive_queue(running); // Move current running process into inactive queue.
     dispatch_next(); // Dispatch next one from the ready queue.
 }
@@ -92,7 +99,7 @@ void move_wait_queue() {
     printf("[DEBUG] Moving pid %d to wait queue / IO : %d\n", running->pid, running->io_left);
 #endif
     fprintf(fp, "[Scheduler] Moving pid %d to wait queue / IO : %d\n", running->pid, running->io_left);
-    kill(running->pid, SIGUSR2); // Send the process you are not using CPU time anymore.
+    signal_process(running->pid, SIGUSR2); // Send the process you are not using CPU time anymore.
     push_queue(QUEUE_WAIT, *running); // Push into the wait queue.
     dispatch_next(); // Dispatch next one from the ready queue.
 }
@@ -114,7 +121,7 @@ void parent_timer_handler(int ignored) {
         system("clear");
         printf("=============== [ Tick %lu ] ===============\n", total_time_ticks + 1);
 #endif
-        kill(running->pid, SIGALRM); // Send time tick to the running process.
+        signal_process(running->pid, SIGALRM); // Send time tick to the running process.
         running->total_exec_time++; // Increment total CPU time.
         running->r_tq--; // Decrement a time tick.
         if (running->r_tq <= 0) // If current process had its time tick over, move into inactive queue.
@@ -154,7 +161,7 @@ void parent_timer_handler(int ignored) {
         if (queues[current_ready_queue]) { // If the ready queue has something,
             running = pop_queue(current_ready_queue); // Pop one from the ready queue.
             total_time_ticks--;
-            kill(getpid(), SIGALRM); // Call handler again.
+            signal_process(getpid(), SIGALRM); // Call handler again.
             return;
         } else {
             // There is no running process at the moment. This means there is IO waiting in the queue.
@@ -211,13 +218,13 @@ void log_status() {
 void check_ipc() {
     struct msg_q_data_t msg;
     memset(&msg, 0, sizeof(msg));
-    long res = msgrcv(up_msg_q, &msg, sizeof(struct msg_q_data_t), 0, IPC_NOWAIT);
+    long res = receive_msg(&msg);
     if (res != -1) { // Meaning that some child process issued an io request.
         pid_t pid = msg.pid;
         running->state = STATE_WAIT;
         unsigned int io_time = msg.io_request;
         int finished = msg.is_finished;
-        kill(SIGUSR2, pid); // Make process wait.
+        signal_process(pid, SIGUSR2); // Make process wait.
 #ifdef DEBUG
         printf("[DEBUG] Scheduler process received IO request from %d for duration %d / Terminated %d\n", pid, io_time, finished);
 #endif
@@ -283,6 +290,26 @@ void move_inactive_queue(struct pcb_t* target) {
 }
 
 
+/**
+ * A function that checks if every PCB that can be dispatched belongs to a child process that exited.
+ * This is for simulation mode, see sim_is_stuck.
+ * @return 1 if only PCBs of exited child processes are left, 0 if not.
+ */
+int only_exited_pcbs_left() {
+    if (queues[QUEUE_WAIT] != NULL) return 0; // Might still terminate processes.
+    if (running && !sim_is_exited(running->pid)) return 0;
+    int left = running != NULL;
+    int ready_queues[2] = {QUEUE_READY, QUEUE_INACTIVE};
+    for (int i = 0 ; i < 2 ; i++) {
+        for (struct pcb_t* tmp = queues[ready_queues[i]] ; tmp ; tmp = tmp->next) {
+            if (!sim_is_exited(tmp->pid)) return 0;
+            left = 1;
+        }
+    }
+    return left;
+}
+
+
 /**
  * A function that prints out status of
  * - Turn around time.
@@ -307,16 +334,46 @@ void print_stats() {
 }
 
 
+/**
+ * A function that initializes the scheduler.
+ * This will open the log file, generate PCBs of all child processes, then dispatch the first process.
+ * @param ignored The seed for random choices, round robin does not have any. So ignore the argument.
+ */
+void init_scheduler(unsigned int ignored) {
+    printf("[Scheduler] PID : %d and Time tick : %d\n", getpid(), time_tick);
+
+    // Generate all PCBs by PID info.
+    for (int i = 0; i < 10; i++) {
+        // Generate a new PCB.
+        struct pcb_t tmp;
+        tmp.io_left = 0;
+        tmp.r_tq = time_quantum;
+        tmp.state = STATE_READY;
+        tmp.pid = pid_arr[i];
+        tmp.total_io_time = 0;
+        tmp.total_exec_time = 0;
+
+        push_queue(QUEUE_READY, tmp); // Push it into the queue.
+    }
+
+    fp = fopen("schedule_dump.txt", "w");
+
+    running = pop_queue(QUEUE_READY); // Pop a process from ready queue.
+    signal_process(running->pid, SIGUSR1); // Send signal that you are dispatched.
+}
+
+
 /**
  * A function for parent process.
  * This will run forever until all the processes are over.
  */
 _Noreturn void parent() {
-    printf("[Scheduler] PID : %d and Time tick : %d\n", getpid(), time_tick);
-
     // Register Signal Handlers.
     signal(SIGINT, exit_handler); // For exiting process gracefully.
 
+    // Set up everything before the first time tick, the timer handler uses all of them.
+    init_scheduler(0);
+
     // Register Timer ticks.
     struct sigaction sa;
     struct itimerval time_tick_dur;
@@ -333,23 +390,5 @@ _Noreturn void parent() {
     time_tick_dur.it_interval.tv_usec = (time_tick % 1000) * 1000;
     setitimer(ITIMER_REAL, &time_tick_dur, NULL);
 
-    // Generate all PCBs by PID info.
-    for (int i = 0; i < 10; i++) {
-        // Generate a new PCB.
-        struct pcb_t tmp;
-        tmp.io_left = 0;
-        tmp.r_tq = time_quantum;
-        tmp.state = STATE_READY;
-        tmp.pid = pid_arr[i];
-        tmp.total_io_time = 0;
-        tmp.total_exec_time = 0;
-
-        push_queue(QUEUE_READY, tmp); // Push it into the queue.
-    }
-
-    fp = fopen("schedule_dump.txt", "w");
-
-    running = pop_queue(QUEUE_READY); // Pop a process from ready queue.
-    kill(running->pid, SIGUSR1); // Send signal that you are dispatched.
     while (1); // Do nothing.
 }
\ No newline at end of file
@@ -22,6 +22,7 @@
 
 #include "common.h"
 #include "utils.h"
+#include "sim.h"
 
 void parent_timer_handler(int);
 void move_inactive_queue(struct pcb_t*);
@@ -10,6 +10,7 @@
 pid_t* pid_arr;
 extern int time_quantum;
 extern int time_tick;
+extern int simulation;
 
 
 /**
@@ -25,6 +26,10 @@ void run() {
     printf("    Time Quantum : %d time ticks\n", time_quantum);
     printf("    Time Tick : %d ms\n", time_tick);
     printf("    Output file : schedule_dump.txt\n");
+    if (simulation) {
+        printf("    Mode : Simulation\n");
+        simulate(0); // Everything runs in this process; round robin makes no random choices, so the seed is unused.
+    }
     start_processes();
 }
 
@@ -0,0 +1,187 @@
+//
+// @file : sim.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements simulation mode, which runs the scheduler without real processes or signals.
+//          Child processes are kept as structs in the scheduler process, signals to them are function calls and the
+//          message queue is a ring buffer. The timer tick is a loop calling parent_timer_handler, so the time ticks
+//          are virtual and a run does not depend on how fast the machine is. The same seed gives the same schedule.
+//          A message is received in the same time tick that it was sent, while a real child process sends it whenever
+//          it gets CPU time, so a simulated schedule can differ from a run with real processes.
+//
+
+#include "sim.h"
+#include "parent.h"
+#include "child.h"
+
+extern int simulation; // For storing whether if this is simulation mode.
+extern pid_t* pid_arr;
+extern int up_msg_q; // The upstream message queue from child to parent.
+extern int time_tick;
+extern unsigned long total_time_ticks;
+
+struct sim_child_t sim_children[10]; // For storing simulated child processes.
+struct msg_q_data_t sim_msgs[SIM_MSG_MAX]; // For storing messages that were not received yet, as a ring buffer.
+int sim_msg_head = 0; // For storing the index of the oldest message.
+int sim_msg_count = 0; // For storing count of messages in the ring buffer.
+struct timespec sim_started_at; // For storing when the simulation started.
+
+
+/**
+ * A function that sends message to parent process, just like child_send_msg.
+ * The message is stored into the simulated message queue.
+ * @param child The simulated child process that sends message.
+ */
+void sim_send_msg(struct sim_child_t* child) {
+    if (sim_msg_count == SIM_MSG_MAX) {
+        printf("[%d] Could not send upstream message queue : Queue is full\n", child->pid);
+    } else {
+        struct msg_q_data_t* msg = &sim_msgs[(sim_msg_head + sim_msg_count) % SIM_MSG_MAX];
+        memset(msg, 0, sizeof(struct msg_q_data_t));
+        msg->pid = child->pid;
+        msg->io_request = child->io_time;
+        msg->is_finished = child->is_child_finished;
+        sim_msg_count++;
+    }
+    child->io_time = CHILD_IO_BURST;
+}
+
+
+/**
+ * A function that handles time tick for a simulated child process, just like child_timer_handler.
+ * When the child process finishes, it sends one more message just like the end of child(), since a real child process
+ * leaves its busy loop and sends it right after the timer handler returns.
+ * @param child The simulated child process that got the time tick.
+ */
+void sim_child_tick(struct sim_child_t* child) {
+    child->total_exec_time++;
+    if (child->is_running && !child->is_child_finished)
+        child->cpu_time--;
+
+    if (child->cpu_time <= 0) { // If CPU burst was over, request IO burst.
+        child->is_running = 0;
+
+        if (child->total_exec_time + child->io_time > CHILD_MAX_EXECUTION_TIME) { // If IO burst was not enough, just use it as much.
+            child->io_time = CHILD_MAX_EXECUTION_TIME - child->total_exec_time;
+            child->io_time = child->io_time < 0 ? 1 : child->io_time;
+            child->is_child_finished = 1;
+        } else { // If we had enough time for IO burst, just use whole IO burst time.
+            child->total_exec_time += child->io_time;
+            child->cpu_time = CHILD_CPU_BURST; // Refill CPU burst time.
+        }
+        sim_send_msg(child);
+        if (child->is_child_finished) sim_send_msg(child); // The message at the end of child().
+    }
+}
+
+
+/**
+ * A function that sends a signal to a process.
+ * In simulation mode, signals to simulated child processes are handled right away just like child_signal_handler
+ * and child_timer_handler, and SIGALRM to the scheduler itself calls parent_timer_handler.
+ * Signals to a finished child are ignored, since the real process would have exited.
+ * @param pid The PID of the process.
+ * @param sig The signal to send.
+ */
+void signal_process(pid_t pid, int sig) {
+    if (!simulation) {
+        kill(pid, sig);
+        return;
+    }
+    if (pid == getpid() && sig == SIGALRM) {
+        parent_timer_handler(sig);
+        return;
+    }
+
+    int index = pid - SIM_PID_BASE;
+    if (index < 0 || index >= 10 || sim_children[index].is_child_finished) return;
+    struct sim_child_t* child = &sim_children[index];
+    if (sig == SIGUSR1) child->is_running = 1; // Dispatched.
+    else if (sig == SIGUSR2) child->is_running = 0; // Stopped.
+    else if (sig == SIGALRM) sim_child_tick(child);
+}
+
+
+/**
+ * A function that receives a message from child processes without waiting.
+ * In simulation mode, the message is taken from the simulated message queue.
+ * @param msg The message to store received data into.
+ * @return The size of received data, -1 if there was no message.
+ */
+long receive_msg(struct msg_q_data_t* msg) {
+    if (!simulation) return msgrcv(up_msg_q, msg, sizeof(struct msg_q_data_t), 0, IPC_NOWAIT);
+    if (sim_msg_count == 0) return -1;
+    memcpy(msg, &sim_msgs[sim_msg_head], sizeof(struct msg_q_data_t));
+    sim_msg_head = (sim_msg_head + 1) % SIM_MSG_MAX;
+    sim_msg_count--;
+    return sizeof(struct msg_q_data_t);
+}
+
+
+/**
+ * A function that checks if a simulated child process exited.
+ * @param pid The PID of the simulated child process.
+ * @return 1 if the child process exited, 0 if not.
+ */
+int sim_is_exited(pid_t pid) {
+    int index = pid - SIM_PID_BASE;
+    return index >= 0 && index < 10 && sim_children[index].is_child_finished;
+}
+
+
+/**
+ * A function that checks if the scheduler can never finish.
+ * This happens when every PCB that can be dispatched belongs to a child process that exited, for example when an IO
+ * request was received while another process was running, so the PCB of the wrong process was moved. Such PCBs
+ * never get an IO request again, so the real scheduler would keep dispatching them forever.
+ * @return 1 if the scheduler can never finish, 0 if not.
+ */
+int sim_is_stuck() {
+    if (sim_msg_count != 0) return 0; // Might still terminate processes.
+    return only_exited_pcbs_left();
+}
+
+
+/**
+ * A function that prints out how many time ticks were simulated and how long it took.
+ */
+void sim_report() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - sim_started_at.tv_sec) + (now.tv_nsec - sim_started_at.tv_nsec) / 1e9;
+    printf("[Simulation] Simulated %lu time ticks (%lu ms with time tick %d ms) in %.3f ms (%.0f time ticks/s)\n",
+           total_time_ticks, total_time_ticks * time_tick, time_tick, elapsed * 1000,
+           elapsed > 0 ? total_time_ticks / elapsed : 0);
+}
+
+
+/**
+ * A function that runs the scheduler in simulation mode.
+ * This will generate 10 simulated child processes, then call the timer tick handler until all of them are over.
+ * @param seed The seed for the random choices of the scheduler.
+ */
+_Noreturn void simulate(unsigned int seed) {
+    pid_arr = (pid_t*) malloc(sizeof(pid_t) * 10);
+    for (int i = 0 ; i < 10 ; i++) {
+        struct sim_child_t* child = &sim_children[i];
+        memset(child, 0, sizeof(struct sim_child_t));
+        child->pid = SIM_PID_BASE + i;
+        child->cpu_time = CHILD_CPU_BURST;
+        child->io_time = CHILD_IO_BURST;
+        pid_arr[i] = child->pid;
+    }
+    printf("[+] Simulating 10 child processes.\n");
+
+    init_scheduler(seed);
+    clock_gettime(CLOCK_MONOTONIC, &sim_started_at);
+    while (total_time_ticks < SIM_MAX_TICKS) {
+        parent_timer_handler(SIGALRM); // exit_handler is called when all processes are over.
+        if (sim_is_stuck()) {
+            printf("[-] Only PCBs of exited child processes are left at %lu, the scheduler can never finish.\n", total_time_ticks);
+            exit_handler(0);
+        }
+    }
+
+    printf("[-] Simulation did not finish in %d time ticks.\n", SIM_MAX_TICKS);
+    exit_handler(0);
+    exit(0);
+}
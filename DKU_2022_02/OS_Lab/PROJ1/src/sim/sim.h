@@ -0,0 +1,43 @@
+//
+// @file : sim.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines simulation mode, which runs the scheduler without real processes or signals.
+//          This is shared by both schedulers (proj1_mlfq and proj1_rr), each of them builds it with its own common.h,
+//          parent.h and child.h. A scheduler provides init_scheduler and only_exited_pcbs_left.
+//
+
+#ifndef PROJ1_SIM_H
+#define PROJ1_SIM_H
+#pragma once
+
+#include <signal.h>
+#include <time.h>
+#include <sys/msg.h>
+
+#include "common.h"
+
+#define SIM_PID_BASE 1000 // Simulated processes get PIDs from this value, so they look like real ones in the logs.
+#define SIM_MSG_MAX 64 // For maximum count of messages that can wait in the simulated message queue.
+#define SIM_MAX_TICKS 100000000 // The simulation stops after this many time ticks, even if processes did not finish.
+
+// A struct data type for storing a simulated child process, these are the global variables of child.c.
+struct sim_child_t {
+    pid_t pid;
+    int total_exec_time;
+    int is_child_finished;
+    int is_running;
+    int cpu_time;
+    int io_time;
+};
+
+void signal_process(pid_t, int);
+long receive_msg(struct msg_q_data_t*);
+int sim_is_exited(pid_t);
+void sim_report();
+_Noreturn void simulate(unsigned int);
+
+// Implemented by each scheduler.
+void init_scheduler(unsigned int);
+int only_exited_pcbs_left();
+
+#endif //PROJ1_SIM_H
@@ -0,0 +1,154 @@
+//
+// @file : mount_bench.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements mount benchmark of MyFS.
+//          An image is mounted and its whole directory tree is loaded repeatedly in a thread with a small stack.
+//          The thread's stack is filled with a pattern beforehand, so the deepest stack usage can be measured.
+//
+
+#include <time.h>
+
+#include "diskutil.h"
+
+
+#define BENCH_STACK_SIZE (256 * 1024) // Much smaller than struct partition, so no copy of it can fit.
+#define BENCH_STACK_PATTERN 0xA5
+#define BENCH_DEFAULT_ITERATIONS 20
+
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern int disk_count;
+extern struct entry_t* entries[MAX_IMG_COUNT];
+extern uint16_t loaded_partitions;
+
+
+/**
+ * A struct that implements result of a single benchmark iteration.
+ */
+struct bench_result_t {
+    int result;
+    double mount_us;         // Time taken by mount_disk.
+    double walk_us;          // Time taken by loading all directories.
+    unsigned int entry_count;
+};
+
+
+/**
+ * A function that returns current monotonic time in micro seconds.
+ * @return Current time in micro seconds.
+ */
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/**
+ * A function that loads all directories under a directory.
+ * @param dir The directory to walk.
+ * @return The count of entries under the directory.
+ */
+static unsigned int walk_tree(struct entry_t* dir) {
+    unsigned int count = 0;
+    for (struct entry_t *cur = dir_children(dir) ; cur != NULL ; cur = cur->sibling) {
+        count++;
+        count = count + walk_tree(cur); // dir_children returns NULL for regular files.
+    }
+    return count;
+}
+
+
+/**
+ * A function that is run by the benchmark thread, this mounts volume 0, walks it, then unmounts it.
+ * @param arg The struct bench_result_t to store result into.
+ * @return NULL.
+ */
+static void* bench_worker(void* arg) {
+    struct bench_result_t *res = (struct bench_result_t*) arg;
+    double start = now_us();
+    res->result = mount_disk(0);
+    res->mount_us = now_us() - start;
+    if (res->result == -1) return NULL;
+
+    start = now_us();
+    res->entry_count = walk_tree(entries[0]);
+    res->walk_us = now_us() - start;
+    res->result = unmount_disk(0);
+    return NULL;
+}
+
+
+/**
+ * A function that returns the count of stack bytes that were ever used.
+ * Stacks grow downwards, so the first byte that lost the pattern is the deepest point.
+ * @param stack The stack to look.
+ * @param size The size of the stack.
+ * @return The count of bytes used.
+ */
+static size_t stack_high_water(unsigned char* stack, size_t size) {
+    size_t i = 0;
+    while (i < size && stack[i] == BENCH_STACK_PATTERN) i++;
+    return size - i;
+}
+
+
+/**
+ * The main function of mount benchmark.
+ * @return 0 if terminated without any error, 1 if not.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <image> [iterations]\n", argv[0]);
+        printf("The image is mounted just like MyFS does, so a journal is created if it had none.\n");
+        return 1;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_ITERATIONS;
+    if (iterations <= 0 || strlen(argv[1]) >= MAX_STRING_LEN) {
+        printf("[ERROR] Invalid arguments\n");
+        return 1;
+    }
+    strcpy(disks[0], argv[1]);
+    disk_count = 1;
+
+    unsigned char *stack = malloc(BENCH_STACK_SIZE);
+    if (!stack) return 1;
+    double mount_total = 0, walk_total = 0, mount_min = 0, walk_min = 0;
+    size_t high_water = 0;
+    unsigned int entry_count = 0;
+
+    for (int i = 0 ; i < iterations ; i++) {
+        struct bench_result_t res = {-1, 0, 0, 0};
+        pthread_attr_t attr;
+        pthread_t thread;
+        memset(stack, BENCH_STACK_PATTERN, BENCH_STACK_SIZE);
+        pthread_attr_init(&attr);
+        pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+        if (pthread_create(&thread, &attr, bench_worker, &res) != 0) {
+            printf("[ERROR] Could not create benchmark thread\n");
+            return 1;
+        }
+        pthread_join(thread, NULL);
+        pthread_attr_destroy(&attr);
+        if (res.result == -1) {
+            printf("[ERROR] Could not mount %s\n", disks[0]);
+            return 1;
+        }
+
+        size_t used = stack_high_water(stack, BENCH_STACK_SIZE);
+        high_water = used > high_water ? used : high_water;
+        mount_total = mount_total + res.mount_us;
+        walk_total = walk_total + res.walk_us;
+        mount_min = (i == 0 || res.mount_us < mount_min) ? res.mount_us : mount_min;
+        walk_min = (i == 0 || res.walk_us < walk_min) ? res.walk_us : walk_min;
+        entry_count = res.entry_count;
+    }
+    free(stack);
+
+    printf("Image: %s (%d iterations, %u entries)\n", disks[0], iterations, entry_count);
+    printf("   Mount:      avg %10.1f us   min %10.1f us\n", mount_total / iterations, mount_min);
+    printf("   Tree walk:  avg %10.1f us   min %10.1f us\n", walk_total / iterations, walk_min);
+    printf("   Stack used: %zu bytes of %d (struct partition is %zu bytes)\n",
+           high_water, BENCH_STACK_SIZE, sizeof(struct partition));
+    return 0;
+}
@@ -0,0 +1,337 @@
+//
+// @file : ops_bench.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements operation throughput benchmark of MyFS.
+//          Commands of a script or a generated workload (mkdir, touch, then a mix of write, append, cp and rm) are run
+//          through the shell's command parser, each command is timed and grouped by its name.
+//          Output of commands is discarded unless -v is given, then ops/s, p50 and p99 latency of each group is printed.
+//
+
+#include <fcntl.h>
+#include <time.h>
+
+#include "diskutil.h"
+#include "ui.h"
+
+
+#define BENCH_MAX_CLASSES 32
+#define BENCH_DEFAULT_MKDIRS 100
+#define BENCH_DEFAULT_TOUCHES 1000
+#define BENCH_DEFAULT_MIXES 5000
+#define BENCH_DEFAULT_PAYLOAD 64
+#define BENCH_MAX_PAYLOAD (MAX_STRING_LEN - 64) // The command line holds the payload and the file name.
+#define BENCH_NAME_LEN 16
+
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern int disk_count;
+extern struct entry_t* entries[MAX_IMG_COUNT];
+extern uint16_t loaded_partitions;
+extern char cwd[MAX_STRING_LEN];
+
+
+/**
+ * A struct that implements latencies of a single class of commands, such as all mkdir commands.
+ */
+struct op_class_t {
+    char name[BENCH_NAME_LEN];
+    double *latencies;     // Micro seconds of each command.
+    unsigned int count;
+    unsigned int capacity;
+    unsigned int failed;
+    double total_us;
+};
+
+
+/**
+ * A struct that implements the state of a benchmark run.
+ */
+struct ops_bench_t {
+    struct op_class_t classes[BENCH_MAX_CLASSES];
+    unsigned int class_count;
+    struct entry_t *cur_dir;
+    unsigned char verbose;
+};
+
+static struct ops_bench_t bench;
+
+
+/**
+ * A function that returns current monotonic time in micro seconds.
+ * @return Current time in micro seconds.
+ */
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/**
+ * A function that records latency of a command into its class.
+ * @param name The name of the command.
+ * @param us The latency in micro seconds.
+ * @param failed Whether if the command failed.
+ * @return -1 if failure, 0 if successful.
+ */
+static int record_latency(const char* name, double us, unsigned char failed) {
+    struct op_class_t *cls = NULL;
+    for (unsigned int i = 0 ; i < bench.class_count && cls == NULL ; i++)
+        if (!strcmp(bench.classes[i].name, name)) cls = &bench.classes[i];
+    if (cls == NULL) {
+        if (bench.class_count == BENCH_MAX_CLASSES) return -1;
+        cls = &bench.classes[bench.class_count++];
+        snprintf(cls->name, BENCH_NAME_LEN, "%s", name);
+    }
+
+    if (cls->count == cls->capacity) {
+        unsigned int capacity = cls->capacity == 0 ? 256 : cls->capacity * 2;
+        double *latencies = realloc(cls->latencies, sizeof(double) * capacity);
+        if (!latencies) return -1;
+        cls->latencies = latencies;
+        cls->capacity = capacity;
+    }
+    cls->latencies[cls->count++] = us;
+    cls->total_us = cls->total_us + us;
+    if (failed) cls->failed++;
+    return 0;
+}
+
+
+/**
+ * A function that runs a single command line and records its latency.
+ * Unloading least recently used directories is not timed, the shell does it while waiting for input.
+ * @param line The command line, this may be modified.
+ * @return 1 if the command was quit or exit, -1 if the command failed, 0 if successful.
+ */
+static int run_timed(char* line) {
+    char name[BENCH_NAME_LEN] = {0};
+    for (unsigned int i = 0 ; i + 1 < BENCH_NAME_LEN && line[i] != ' ' && line[i] != 0 ; i++) name[i] = line[i];
+
+    dentry_cache_shrink(bench.cur_dir);
+    double start = now_us();
+    int ret = run_command(line, &bench.cur_dir);
+    double us = now_us() - start;
+    if (ret != 1) record_latency(name, us, ret == -1);
+    return ret;
+}
+
+
+/**
+ * A function that runs commands of a script, just like batch mode of MyFS.
+ * @param fp The script to run.
+ */
+static void run_script(FILE* fp) {
+    char line[MAX_STRING_LEN];
+    while (fgets(line, MAX_STRING_LEN * sizeof(char), fp) != NULL) {
+        char* newline = strchr(line, '\n');
+        if (newline != NULL) *newline = 0;
+        if (line[0] == 0 || line[0] == '#') continue;
+        if (run_timed(line) == 1) break;
+    }
+}
+
+
+/**
+ * A function that runs a generated workload in the root directory.
+ * Directories and empty files are made first, then each mixed command picks a live file at random:
+ * 30% write, 30% append, 20% cp (the copy becomes a live file) and 20% rm. Everything is committed by sync at the end.
+ * @param mkdirs The count of mkdir commands.
+ * @param touches The count of touch commands.
+ * @param mixes The count of mixed commands.
+ * @param payload The size of data of write and append.
+ * @param seed The seed of the random generator.
+ * @return -1 if failure, 0 if successful.
+ */
+static int run_workload(unsigned int mkdirs, unsigned int touches, unsigned int mixes, unsigned int payload,
+                        unsigned int seed) {
+    char (*names)[BENCH_NAME_LEN] = malloc(sizeof(*names) * ((size_t) touches + mixes + 1));
+    char *data = malloc(payload + 1);
+    char line[MAX_STRING_LEN];
+    unsigned int live = 0;
+    if (!names || !data) {
+        free(names);
+        free(data);
+        return -1;
+    }
+    for (unsigned int i = 0 ; i < payload ; i++) data[i] = (char) ('a' + i % 26);
+    data[payload] = 0;
+
+    for (unsigned int i = 0 ; i < mkdirs ; i++) {
+        snprintf(line, MAX_STRING_LEN, "mkdir d%u", i);
+        run_timed(line);
+    }
+    for (unsigned int i = 0 ; i < touches ; i++) {
+        snprintf(names[live], BENCH_NAME_LEN, "f%u", i);
+        snprintf(line, MAX_STRING_LEN, "touch %s", names[live++]);
+        run_timed(line);
+    }
+    for (unsigned int i = 0 ; i < mixes ; i++) {
+        unsigned int dice = rand_r(&seed) % 10;
+        unsigned int target = live == 0 ? 0 : rand_r(&seed) % live;
+        if (live == 0) { // Everything was removed, start over with a new file.
+            snprintf(names[live], BENCH_NAME_LEN, "m%u", i);
+            snprintf(line, MAX_STRING_LEN, "touch %s", names[live++]);
+        } else if (dice < 3) {
+            snprintf(line, MAX_STRING_LEN, "write %s \"%s\"", names[target], data);
+        } else if (dice < 6) {
+            snprintf(line, MAX_STRING_LEN, "append %s \"%s\"", names[target], data);
+        } else if (dice < 8) {
+            snprintf(names[live], BENCH_NAME_LEN, "c%u", i);
+            snprintf(line, MAX_STRING_LEN, "cp %s %s", names[target], names[live++]);
+        } else {
+            snprintf(line, MAX_STRING_LEN, "rm %s", names[target]);
+            memcpy(names[target], names[--live], BENCH_NAME_LEN); // The last live file takes its place.
+        }
+        run_timed(line);
+    }
+    strcpy(line, "sync");
+    run_timed(line);
+    free(names);
+    free(data);
+    return 0;
+}
+
+
+/**
+ * A function that compares two latencies, for qsort.
+ * @param a The first latency.
+ * @param b The second latency.
+ * @return Negative if a is smaller, positive if a is bigger, 0 if same.
+ */
+static int compare_latency(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * A function that returns a percentile of sorted latencies, using the nearest rank.
+ * @param sorted The sorted latencies.
+ * @param count The count of latencies.
+ * @param percent The percentile, from 1 to 100.
+ * @return The latency at the percentile.
+ */
+static double percentile(double* sorted, unsigned int count, unsigned int percent) {
+    unsigned int rank = (unsigned int) (((unsigned long long) count * percent + 99) / 100);
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+
+/**
+ * A function that prints ops/s, p50 and p99 latency of each class, then the total.
+ * ops/s of a class is the count of its commands divided by the time spent in them.
+ * @param wall_us The wall time of the whole run.
+ */
+static void print_report(double wall_us) {
+    unsigned int total = 0, failed = 0;
+    printf("   %-10s %8s %8s %12s %10s %10s\n", "Command", "Ops", "Failed", "ops/s", "p50 us", "p99 us");
+    for (unsigned int i = 0 ; i < bench.class_count ; i++) {
+        struct op_class_t *cls = &bench.classes[i];
+        qsort(cls->latencies, cls->count, sizeof(double), compare_latency);
+        printf("   %-10s %8u %8u %12.1f %10.1f %10.1f\n", cls->name, cls->count, cls->failed,
+               cls->total_us > 0 ? cls->count / (cls->total_us / 1e6) : 0, percentile(cls->latencies, cls->count, 50),
+               percentile(cls->latencies, cls->count, 99));
+        total = total + cls->count;
+        failed = failed + cls->failed;
+    }
+    printf("   %-10s %8u %8u %12.1f   (%.3f s wall time)\n", "total", total, failed,
+           wall_us > 0 ? total / (wall_us / 1e6) : 0, wall_us / 1e6);
+}
+
+
+/**
+ * A function that prints usage of the benchmark.
+ * @param prog The name of the program.
+ */
+static void usage(const char* prog) {
+    printf("Usage: %s [-s script] [-n mkdirs] [-m touches] [-k mixes] [-p payload] [-r seed] [-v] <image>\n", prog);
+    printf("   -s  run commands of a script instead of the generated workload\n");
+    printf("   -n, -m, -k  mkdir, touch and mixed write/append/cp/rm commands (default %d, %d, %d)\n",
+           BENCH_DEFAULT_MKDIRS, BENCH_DEFAULT_TOUCHES, BENCH_DEFAULT_MIXES);
+    printf("   -p  bytes written by each write and append, up to %d (default %d)\n", BENCH_MAX_PAYLOAD,
+           BENCH_DEFAULT_PAYLOAD);
+    printf("   -v  print output of commands\n");
+    printf("The image is changed by the commands, use a scratch image (see mkfs.myfs).\n");
+}
+
+
+/**
+ * The main function of operation throughput benchmark.
+ * @return 0 if terminated without any error, 1 if not.
+ */
+int main(int argc, char* argv[]) {
+    unsigned int mkdirs = BENCH_DEFAULT_MKDIRS, touches = BENCH_DEFAULT_TOUCHES, mixes = BENCH_DEFAULT_MIXES;
+    unsigned int payload = BENCH_DEFAULT_PAYLOAD, seed = 1;
+    char *script_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:m:k:p:r:vh")) != -1) {
+        switch (opt) {
+            case 's': script_path = optarg; break;
+            case 'n': mkdirs = strtoul(optarg, NULL, 10); break;
+            case 'm': touches = strtoul(optarg, NULL, 10); break;
+            case 'k': mixes = strtoul(optarg, NULL, 10); break;
+            case 'p': payload = strtoul(optarg, NULL, 10); break;
+            case 'r': seed = strtoul(optarg, NULL, 10); break;
+            case 'v': bench.verbose = 1; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || strlen(argv[optind]) >= MAX_STRING_LEN || payload > BENCH_MAX_PAYLOAD) {
+        usage(argv[0]);
+        return 1;
+    }
+    FILE *script = NULL;
+    if (script_path != NULL && (script = fopen(script_path, "r")) == NULL) {
+        printf("[ERROR] Could not open script %s\n", script_path);
+        return 1;
+    }
+
+    strcpy(disks[0], argv[optind]);
+    disk_count = 1;
+    if (mount_disk(0) == -1) {
+        printf("[ERROR] Could not mount %s\n", disks[0]);
+        return 1;
+    }
+    loaded_partitions = 0x1; // Commands like sync and vstat only look at loaded volumes.
+    strcpy(cwd, "root");
+    bench.cur_dir = entries[0];
+
+    // Output of commands would be timed as well, so it goes to /dev/null unless asked.
+    int saved_stdout = -1;
+    fflush(stdout);
+    if (!bench.verbose) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        saved_stdout = dup(STDOUT_FILENO);
+        if (null_fd != -1 && saved_stdout != -1) dup2(null_fd, STDOUT_FILENO);
+        if (null_fd != -1) close(null_fd);
+    }
+
+    double start = now_us();
+    int ret = 0;
+    if (script != NULL) run_script(script);
+    else ret = run_workload(mkdirs, touches, mixes, payload, seed);
+    double wall_us = now_us() - start;
+
+    fflush(stdout);
+    if (saved_stdout != -1) {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+    if (script != NULL) {
+        fclose(script);
+        printf("Script: %s on %s\n", script_path, disks[0]);
+    } else {
+        printf("Workload: %u mkdir, %u touch, %u mixed (%u bytes, seed %u) on %s\n", mkdirs, touches, mixes, payload,
+               seed, disks[0]);
+    }
+    print_report(wall_us);
+    char *trace_path = getenv(TRACE_ENV);
+    if (trace_path != NULL && trace_path[0] != 0) trace_save(trace_path); // Counters of the engine, see trace.h.
+
+    for (unsigned int i = 0 ; i < bench.class_count ; i++) free(bench.classes[i].latencies);
+    if (unmount_disk(0) == -1 || ret == -1) return 1;
+    return 0;
+}
@@ -0,0 +1,324 @@
+//
+// @file : bitmap.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements packed bitmaps for block and inode allocation.
+//          Searching uses __builtin_ctzll so that 64 entries are checked by a single instruction.
+//
+
+#include "bitmap.h"
+
+
+/**
+ * A function that marks all padding bits in the last word as being used.
+ * This way the search functions never have to check the bit count while scanning words.
+ * @param bm The bitmap to set padding bits.
+ */
+static void bitmap_fill_padding(struct bitmap_t* bm) {
+    unsigned int used_bits = bm->bit_count % BITMAP_WORD_BITS;
+    if (used_bits != 0)
+        bm->words[bm->word_count - 1] |= ~0ULL << used_bits;
+}
+
+
+/**
+ * A function that marks a word as changed, so that it is stored by the next bitmap_take_dirty.
+ * @param bm The bitmap that was changed.
+ * @param word The index of the word that was changed.
+ */
+static void bitmap_mark_dirty(struct bitmap_t* bm, unsigned int word) {
+    if (bm->dirty_last == 0 || word < bm->dirty_first) bm->dirty_first = word;
+    if (word >= bm->dirty_last) bm->dirty_last = word + 1;
+}
+
+
+/**
+ * A function that initializes a bitmap with all entries free.
+ * @param bm The bitmap to initialize.
+ * @param bit_count The total count of entries that this bitmap will be tracking.
+ * @return -1 if failure, 0 if successful.
+ */
+int bitmap_init(struct bitmap_t* bm, unsigned int bit_count) {
+    bm->bit_count = bit_count;
+    bm->word_count = (bit_count + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+    bm->words = calloc(bm->word_count, sizeof(uint64_t));
+    if (!bm->words) return -1;
+
+    bitmap_fill_padding(bm);
+    bm->free_count = bit_count;
+    bm->cursor = 0;
+    bm->dirty_first = 0;
+    bm->dirty_last = bm->word_count; // Nothing was stored yet.
+    return 0;
+}
+
+
+/**
+ * A function that releases a bitmap.
+ * @param bm The bitmap to release.
+ */
+void bitmap_release(struct bitmap_t* bm) {
+    free(bm->words);
+    memset(bm, 0, sizeof(struct bitmap_t));
+}
+
+
+/**
+ * A function that checks whether a specific entry is being used.
+ * @param bm The bitmap to look for.
+ * @param index The index of the entry.
+ * @return 1 if being used, 0 if free.
+ */
+int bitmap_test(struct bitmap_t* bm, unsigned int index) {
+    return (bm->words[index / BITMAP_WORD_BITS] >> (index % BITMAP_WORD_BITS)) & 0x1;
+}
+
+
+/**
+ * A function that marks a specific entry as being used.
+ * @param bm The bitmap to modify.
+ * @param index The index of the entry.
+ */
+void bitmap_set(struct bitmap_t* bm, unsigned int index) {
+    if (index >= bm->bit_count || bitmap_test(bm, index)) return;
+    bm->words[index / BITMAP_WORD_BITS] |= 1ULL << (index % BITMAP_WORD_BITS);
+    bm->free_count--;
+    bitmap_mark_dirty(bm, index / BITMAP_WORD_BITS);
+}
+
+
+/**
+ * A function that marks a specific entry as free.
+ * @param bm The bitmap to modify.
+ * @param index The index of the entry.
+ */
+void bitmap_clear(struct bitmap_t* bm, unsigned int index) {
+    if (index >= bm->bit_count || !bitmap_test(bm, index)) return;
+    bm->words[index / BITMAP_WORD_BITS] &= ~(1ULL << (index % BITMAP_WORD_BITS));
+    bm->free_count++;
+    bitmap_mark_dirty(bm, index / BITMAP_WORD_BITS);
+}
+
+
+/**
+ * A function that finds the first free entry in range of [from, limit).
+ * @param bm The bitmap to look for.
+ * @param from The first index to look for.
+ * @param limit The index to stop looking for.
+ * @return The index of the free entry, limit if there was no free entry.
+ */
+static unsigned int bitmap_next_clear(struct bitmap_t* bm, unsigned int from, unsigned int limit) {
+    if (from >= limit) return limit;
+    unsigned int word = from / BITMAP_WORD_BITS;
+    uint64_t free_bits = ~bm->words[word] & (~0ULL << (from % BITMAP_WORD_BITS));
+    while (!free_bits) { // Skip all words that are fully used.
+        word++;
+        if (word * BITMAP_WORD_BITS >= limit) return limit;
+        free_bits = ~bm->words[word];
+    }
+    unsigned int ret = word * BITMAP_WORD_BITS + __builtin_ctzll(free_bits);
+    return ret < limit ? ret : limit;
+}
+
+
+/**
+ * A function that finds the first used entry in range of [from, limit).
+ * @param bm The bitmap to look for.
+ * @param from The first index to look for.
+ * @param limit The index to stop looking for.
+ * @return The index of the used entry, limit if there was no used entry.
+ */
+static unsigned int bitmap_next_set(struct bitmap_t* bm, unsigned int from, unsigned int limit) {
+    if (from >= limit) return limit;
+    unsigned int word = from / BITMAP_WORD_BITS;
+    uint64_t used_bits = bm->words[word] & (~0ULL << (from % BITMAP_WORD_BITS));
+    while (!used_bits) { // Skip all words that are fully free.
+        word++;
+        if (word * BITMAP_WORD_BITS >= limit) return limit;
+        used_bits = bm->words[word];
+    }
+    unsigned int ret = word * BITMAP_WORD_BITS + __builtin_ctzll(used_bits);
+    return ret < limit ? ret : limit;
+}
+
+
+/**
+ * A function that finds a single free entry and marks it as being used.
+ * This works as next-fit: the search starts from the cursor and wraps around.
+ * @param bm The bitmap to look for.
+ * @param ret The pointer to store the found index into.
+ * @return -1 if there was no free entry, 0 if successful.
+ */
+int bitmap_find_free(struct bitmap_t* bm, unsigned int* ret) {
+    if (bm->free_count == 0) return -1;
+    unsigned int index = bitmap_next_clear(bm, bm->cursor, bm->bit_count);
+    if (index == bm->bit_count) { // Wrap around and look from the start.
+        index = bitmap_next_clear(bm, 0, bm->cursor);
+        if (index == bm->cursor) return -1;
+    }
+
+    bitmap_set(bm, index);
+    bm->cursor = (index + 1) % bm->bit_count;
+    *ret = index;
+    return 0;
+}
+
+
+/**
+ * A function that finds a contiguous run of free entries in range of [from, limit).
+ * @param bm The bitmap to look for.
+ * @param count The count of entries required.
+ * @param from The first index to look for.
+ * @param limit The index that the run must start before.
+ * @return The start index of the run, bm->bit_count if not found.
+ */
+static unsigned int bitmap_search_run(struct bitmap_t* bm, unsigned int count, unsigned int from, unsigned int limit) {
+    unsigned int start = from;
+    while (start < limit) {
+        start = bitmap_next_clear(bm, start, limit);
+        if (start >= limit) break;
+        unsigned int end = bitmap_next_set(bm, start, bm->bit_count);
+        if (end - start >= count) return start;
+        start = end;
+    }
+    return bm->bit_count;
+}
+
+
+/**
+ * A function that finds a contiguous run of free entries and marks them as being used.
+ * Like bitmap_find_free, the search starts from the cursor and wraps around.
+ * @param bm The bitmap to look for.
+ * @param count The count of entries required.
+ * @param ret The pointer to store the first index of the run.
+ * @return -1 if there was no contiguous run that is long enough, 0 if successful.
+ */
+int bitmap_find_run(struct bitmap_t* bm, unsigned int count, unsigned int* ret) {
+    if (count == 0 || bm->free_count < count) return -1;
+    if (count == 1) return bitmap_find_free(bm, ret);
+
+    unsigned int start = bitmap_search_run(bm, count, bm->cursor, bm->bit_count);
+    if (start == bm->bit_count) // Wrap around and look from the start.
+        start = bitmap_search_run(bm, count, 0, bm->cursor);
+    if (start == bm->bit_count) return -1;
+
+    for (unsigned int i = start ; i < start + count ; i++)
+        bitmap_set(bm, i);
+    bm->cursor = (start + count) % bm->bit_count;
+    *ret = start;
+    return 0;
+}
+
+
+/**
+ * A function that marks a specific run of entries as being used, only if all of them are free.
+ * This does not move the cursor, since it is for growing something that is already placed.
+ * @param bm The bitmap to look for.
+ * @param start The first index of the run.
+ * @param count The count of entries in the run.
+ * @return -1 if any of the entries was used, 0 if successful.
+ */
+int bitmap_claim_run(struct bitmap_t* bm, unsigned int start, unsigned int count) {
+    if (count == 0 || start >= bm->bit_count || count > bm->bit_count - start) return -1;
+    if (bitmap_next_set(bm, start, start + count) != start + count) return -1;
+    for (unsigned int i = start ; i < start + count ; i++)
+        bitmap_set(bm, i);
+    return 0;
+}
+
+
+/**
+ * A function that finds a contiguous run of free entries nearest after a hint and marks them as being used.
+ * The search starts from the hint instead of the cursor and wraps around, the cursor is not moved.
+ * This way a file grows next to its own blocks, while new files keep being placed by next-fit.
+ * @param bm The bitmap to look for.
+ * @param count The count of entries required.
+ * @param hint The index to start looking from.
+ * @param ret The pointer to store the first index of the run.
+ * @return -1 if there was no contiguous run that is long enough, 0 if successful.
+ */
+int bitmap_find_run_near(struct bitmap_t* bm, unsigned int count, unsigned int hint, unsigned int* ret) {
+    if (count == 0 || bm->free_count < count) return -1;
+    if (hint >= bm->bit_count) hint = 0;
+
+    unsigned int start = bitmap_search_run(bm, count, hint, bm->bit_count);
+    if (start == bm->bit_count) // Wrap around and look from the start.
+        start = bitmap_search_run(bm, count, 0, hint);
+    if (start == bm->bit_count) return -1;
+
+    for (unsigned int i = start ; i < start + count ; i++)
+        bitmap_set(bm, i);
+    *ret = start;
+    return 0;
+}
+
+
+/**
+ * A function that counts runs of free entries, which shows how fragmented the free space is.
+ * @param bm The bitmap to look for.
+ * @param largest The pointer to store the length of the largest run into.
+ * @return The count of runs of free entries.
+ */
+unsigned int bitmap_count_runs(struct bitmap_t* bm, unsigned int* largest) {
+    unsigned int runs = 0, start = 0;
+    *largest = 0;
+    while ((start = bitmap_next_clear(bm, start, bm->bit_count)) < bm->bit_count) {
+        unsigned int end = bitmap_next_set(bm, start, bm->bit_count);
+        if (end - start > *largest) *largest = end - start;
+        runs++;
+        start = end;
+    }
+    return runs;
+}
+
+
+/**
+ * A function that loads a bitmap from its packed on-disk representation.
+ * @param bm The bitmap to load into. This must be initialized beforehand.
+ * @param src The packed bytes. Bit n of the bitmap is bit (n % 8) of byte (n / 8).
+ * @param size The size of src in bytes.
+ */
+void bitmap_load(struct bitmap_t* bm, const unsigned char* src, unsigned int size) {
+    unsigned int bytes = bm->word_count * sizeof(uint64_t);
+    memset(bm->words, 0, bytes);
+    memcpy(bm->words, src, size < bytes ? size : bytes); // Little endian, thus bytes map directly into words.
+    bitmap_fill_padding(bm);
+
+    unsigned int used = 0;
+    for (unsigned int i = 0 ; i < bm->word_count ; i++)
+        used += __builtin_popcountll(bm->words[i]);
+    bm->free_count = bm->word_count * BITMAP_WORD_BITS - used;
+    bm->cursor = 0;
+    bm->dirty_first = 0;
+    bm->dirty_last = 0; // Same as the disk.
+}
+
+
+/**
+ * A function that stores a bitmap into its packed on-disk representation.
+ * @param bm The bitmap to store.
+ * @param dst The buffer to store packed bytes into.
+ * @param size The size of dst in bytes.
+ */
+void bitmap_store(struct bitmap_t* bm, unsigned char* dst, unsigned int size) {
+    unsigned int bytes = bm->word_count * sizeof(uint64_t);
+    memset(dst, 0, size);
+    memcpy(dst, bm->words, size < bytes ? size : bytes);
+}
+
+
+/**
+ * A function that returns the range of packed bytes that were changed since the last call, then marks it as clean.
+ * This way only the changed part of a big bitmap has to be written into the disk.
+ * @param bm The bitmap to look for.
+ * @param first The pointer to store the first changed byte into.
+ * @param length The pointer to store the length of the changed bytes into.
+ * @return 1 if something was changed, 0 if not.
+ */
+int bitmap_take_dirty(struct bitmap_t* bm, unsigned int* first, unsigned int* length) {
+    if (bm->dirty_last == 0) return 0;
+    *first = bm->dirty_first * sizeof(uint64_t);
+    *length = (bm->dirty_last - bm->dirty_first) * sizeof(uint64_t);
+    bm->dirty_first = 0;
+    bm->dirty_last = 0;
+    return 1;
+}
@@ -0,0 +1,46 @@
+//
+// @file : bitmap.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines packed bitmaps for block and inode allocation.
+//
+
+#ifndef MYFS_BITMAP_H
+#define MYFS_BITMAP_H
+#pragma once
+
+#include "common.h"
+
+#define BITMAP_WORD_BITS 64
+
+
+/**
+ * A struct that implements a packed bitmap.
+ * Each bit represents a single block or inode. 1 means being used, 0 means free.
+ * Bits that are out of range (the padding of the last word) are always set as being used.
+ */
+struct bitmap_t {
+    uint64_t *words;         // Packed bits, 64 entries per word.
+    unsigned int bit_count;  // Total count of valid bits.
+    unsigned int word_count; // Total count of words.
+    unsigned int free_count; // Count of bits that are 0.
+    unsigned int cursor;     // Rotating next-fit cursor. This is the bit to start the next search from.
+    unsigned int dirty_first; // The first word changed since the last bitmap_take_dirty.
+    unsigned int dirty_last;  // The last word changed plus 1, this is 0 if nothing was changed.
+};
+
+
+int bitmap_init(struct bitmap_t*, unsigned int);
+void bitmap_release(struct bitmap_t*);
+int bitmap_test(struct bitmap_t*, unsigned int);
+void bitmap_set(struct bitmap_t*, unsigned int);
+void bitmap_clear(struct bitmap_t*, unsigned int);
+int bitmap_find_free(struct bitmap_t*, unsigned int*);
+int bitmap_find_run(struct bitmap_t*, unsigned int, unsigned int*);
+int bitmap_claim_run(struct bitmap_t*, unsigned int, unsigned int);
+int bitmap_find_run_near(struct bitmap_t*, unsigned int, unsigned int, unsigned int*);
+unsigned int bitmap_count_runs(struct bitmap_t*, unsigned int*);
+void bitmap_load(struct bitmap_t*, const unsigned char*, unsigned int);
+void bitmap_store(struct bitmap_t*, unsigned char*, unsigned int);
+int bitmap_take_dirty(struct bitmap_t*, unsigned int*, unsigned int*);
+
+#endif //MYFS_BITMAP_H
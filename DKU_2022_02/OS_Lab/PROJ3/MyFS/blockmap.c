@@ -0,0 +1,415 @@
+//
+// @file : blockmap.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements mapping between file blocks and disk blocks.
+//          Inodes in the original format have 6 direct blocks (6 blocks max).
+//          Inodes with INODE_MODE_INDIRECT have 1 direct block, a single indirect block and a double indirect block.
+//          Indirect blocks are arrays of 32 bit block indexes, 0 means unassigned.
+//
+
+#include "diskutil.h"
+
+
+
+/**
+ * A function that calculates how many blocks are required for storing a specific size.
+ * Every file has at least one block assigned, even when it is empty.
+ * @param disk_index The disk index, blocks of each disk have their own size.
+ * @param size The size in bytes.
+ * @return The count of blocks.
+ */
+unsigned int size_to_blocks(unsigned int disk_index, unsigned int size) {
+    unsigned int block_size = get_block_size(disk_index);
+    if (size == 0) return 1;
+    return (unsigned int) (((unsigned long long) size + block_size - 1) / block_size);
+}
+
+
+/**
+ * A function that returns the count of block pointers that an indirect block of a disk holds.
+ * @param disk_index The disk index to look for.
+ * @return The count of 32 bit block pointers.
+ */
+unsigned int block_ptr_count(unsigned int disk_index) {
+    return get_block_size(disk_index) / sizeof(unsigned int);
+}
+
+
+/**
+ * A function that returns the max count of blocks that a file can have in a disk.
+ * This is 1 direct block + single indirect block + double indirect block, as long as the size fits in 32 bits.
+ * @param disk_index The disk index to look for.
+ * @return The max count of blocks.
+ */
+unsigned int max_file_blocks(unsigned int disk_index) {
+    unsigned long long ptrs = block_ptr_count(disk_index);
+    unsigned long long count = 1 + ptrs + ptrs * ptrs;
+    unsigned long long limit = 0xFFFFFFFFULL / get_block_size(disk_index);
+    return (unsigned int) (count < limit ? count : limit);
+}
+
+
+/**
+ * A function that returns the table of an indirect block.
+ * @param disk_index The disk index that the block is located at.
+ * @param block The index of the indirect block.
+ * @return The array of block pointers that is stored in the block.
+ */
+static unsigned int* indirect_table(unsigned int disk_index, unsigned int block) {
+    return (unsigned int*) get_block(disk_index, block);
+}
+
+
+/**
+ * A function that reads list of blocks that an inode is using in file order.
+ * Original format directories have been treated as contiguous blocks starting from blocks[0].
+ * Therefore, unassigned direct blocks in the original format are considered as blocks[0] + i.
+ * @param disk_index The disk index that the inode is located at.
+ * @param in The inode to read block list from.
+ * @param ret The array to store block indexes into.
+ * @param max The size of the ret array.
+ * @return The count of blocks that were stored into ret.
+ */
+int read_block_map(unsigned int disk_index, struct inode* in, unsigned int* ret, unsigned int max) {
+    unsigned int count = size_to_blocks(disk_index, in->size);
+    if (count > max) count = max;
+
+    if ((in->mode & INODE_MODE_INDIRECT) != INODE_MODE_INDIRECT) { // Original format.
+        if (count > 6) count = 6;
+        for (unsigned int i = 0 ; i < count ; i++)
+            ret[i] = (i == 0 || in->blocks[i] != 0) ? in->blocks[i] : in->blocks[0] + i;
+        return (int) count;
+    }
+
+    // Direct block.
+    unsigned int n = 0, ptrs = block_ptr_count(disk_index);
+    if (count == 0) return 0;
+    ret[n++] = in->iblocks[0];
+
+    // Single indirect block.
+    if (n < count && in->iblocks[1] != 0) {
+        unsigned int *single = indirect_table(disk_index, in->iblocks[1]);
+        for (unsigned int i = 0 ; i < ptrs && n < count ; i++)
+            ret[n++] = single[i];
+    }
+
+    // Double indirect block.
+    if (n < count && in->iblocks[2] != 0) {
+        unsigned int *dbl = indirect_table(disk_index, in->iblocks[2]);
+        for (unsigned int i = 0 ; i < ptrs && n < count && dbl[i] != 0 ; i++) {
+            unsigned int *child = indirect_table(disk_index, dbl[i]);
+            for (unsigned int j = 0 ; j < ptrs && n < count ; j++)
+                ret[n++] = child[j];
+        }
+    }
+    return (int) n;
+}
+
+
+/**
+ * A function that finds the disk block of a single file block without reading the whole block list.
+ * @param disk_index The disk index that the inode is located at.
+ * @param in The inode to look for.
+ * @param file_block The index of the block in the file.
+ * @param ret The pointer to store the disk block index into.
+ * @return -1 if the file block was out of range, 0 if successful.
+ */
+int lookup_block(unsigned int disk_index, struct inode* in, unsigned int file_block, unsigned int* ret) {
+    if (file_block >= size_to_blocks(disk_index, in->size)) return -1;
+
+    if ((in->mode & INODE_MODE_INDIRECT) != INODE_MODE_INDIRECT) { // Original format.
+        if (file_block >= 6) return -1;
+        *ret = (file_block == 0 || in->blocks[file_block] != 0) ? in->blocks[file_block] : in->blocks[0] + file_block;
+        return 0;
+    }
+
+    if (file_block == 0) { // Direct block.
+        *ret = in->iblocks[0];
+        return 0;
+    }
+    unsigned int ptrs = block_ptr_count(disk_index);
+    file_block = file_block - 1;
+    if (file_block < ptrs) { // Single indirect block.
+        if (in->iblocks[1] == 0) return -1;
+        *ret = indirect_table(disk_index, in->iblocks[1])[file_block];
+        return 0;
+    }
+    file_block = file_block - ptrs;
+    if (in->iblocks[2] == 0) return -1; // Double indirect block.
+    unsigned int child = indirect_table(disk_index, in->iblocks[2])[file_block / ptrs];
+    if (child == 0) return -1;
+    *ret = indirect_table(disk_index, child)[file_block % ptrs];
+    return 0;
+}
+
+
+/**
+ * A function that reads list of indirect blocks (blocks that store block pointers) of an inode.
+ * @param disk_index The disk index that the inode is located at.
+ * @param in The inode to read indirect blocks from.
+ * @param ret The array to store block indexes into.
+ * @param max The size of the ret array.
+ * @return The count of indirect blocks that were stored into ret.
+ */
+int read_indirect_blocks(unsigned int disk_index, struct inode* in, unsigned int* ret, unsigned int max) {
+    unsigned int n = 0, ptrs = block_ptr_count(disk_index);
+    if ((in->mode & INODE_MODE_INDIRECT) != INODE_MODE_INDIRECT) return 0;
+    if (in->iblocks[1] != 0 && n < max) ret[n++] = in->iblocks[1];
+    if (in->iblocks[2] != 0 && n < max) {
+        ret[n++] = in->iblocks[2];
+        unsigned int *dbl = indirect_table(disk_index, in->iblocks[2]);
+        for (unsigned int i = 0 ; i < ptrs && n < max && dbl[i] != 0 ; i++)
+            ret[n++] = dbl[i];
+    }
+    return (int) n;
+}
+
+
+/**
+ * A function that makes sure an indirect block pointer has a block assigned.
+ * Newly assigned indirect blocks are cleared with 0.
+ * @param disk_index The disk index to assign block from.
+ * @param ptr The pointer to the block index.
+ * @return -1 if failure, 0 if successful.
+ */
+static int assign_indirect_block(unsigned int disk_index, unsigned int* ptr) {
+    if (*ptr != 0) return 0;
+    unsigned int assigned = 0;
+    if (assign_empty_blocks(disk_index, 1, &assigned) == -1) return -1;
+    memset(get_block(disk_index, assigned), 0, get_block_size(disk_index));
+    *ptr = assigned;
+    return 0;
+}
+
+
+/**
+ * A function that releases an indirect block and sets its pointer as 0.
+ * @param disk_index The disk index to release block from.
+ * @param ptr The pointer to the block index.
+ */
+static void release_indirect_block(unsigned int disk_index, unsigned int* ptr) {
+    if (*ptr == 0) return;
+    if (is_snapshot_block(disk_index, *ptr)) { // Kept by a snapshot, just stop using it.
+        *ptr = 0;
+        return;
+    }
+    memset(get_block(disk_index, *ptr), 0, get_block_size(disk_index));
+    release_blocks(disk_index, 1, ptr);
+    *ptr = 0;
+}
+
+
+/**
+ * A function that releases the double indirect block including all blocks that it is pointing to.
+ * @param disk_index The disk index to release blocks from.
+ * @param ptr The pointer to the double indirect block index.
+ */
+static void release_double_indirect(unsigned int disk_index, unsigned int* ptr) {
+    if (*ptr == 0) return;
+    if (is_snapshot_block(disk_index, *ptr)) { // Kept by a snapshot including its children, which must not change.
+        *ptr = 0;
+        return;
+    }
+    unsigned int *dbl = indirect_table(disk_index, *ptr);
+    for (unsigned int i = 0 ; i < block_ptr_count(disk_index) ; i++)
+        release_indirect_block(disk_index, &dbl[i]);
+    release_indirect_block(disk_index, ptr);
+}
+
+
+/**
+ * A function that fills an indirect block with block indexes and writes it into the disk.
+ * Indirect blocks kept by snapshots are never overwritten, a new block is assigned instead.
+ * @param disk_index The disk index.
+ * @param ptr The pointer to the indirect block index. A block will be assigned if this was 0.
+ * @param blocks The block indexes to store.
+ * @param count The count of block indexes to store.
+ * @return -1 if failure, 0 if successful.
+ */
+static int fill_indirect_block(unsigned int disk_index, unsigned int* ptr, unsigned int* blocks, unsigned int count) {
+    if (*ptr != 0 && is_snapshot_block(disk_index, *ptr)) *ptr = 0;
+    if (assign_indirect_block(disk_index, ptr) == -1) return -1;
+    unsigned int *table = indirect_table(disk_index, *ptr);
+    memset(table, 0, get_block_size(disk_index));
+    memcpy(table, blocks, sizeof(unsigned int) * count);
+    return write_meta_block(disk_index, *ptr, get_block(disk_index, *ptr));
+}
+
+
+/**
+ * A function that stores list of blocks into an inode.
+ * If the blocks fit into the original format (6 blocks, 16 bit indexes), the original format is used.
+ * Otherwise, the inode is converted into INODE_MODE_INDIRECT and indirect blocks are assigned as required.
+ * Indirect blocks that are no longer required are released.
+ * This only updates the inode in memory, call write_inode to emit the inode itself.
+ * @param disk_index The disk index that the inode is located at.
+ * @param in The inode to store block list into.
+ * @param blocks The array of block indexes in file order.
+ * @param count The count of blocks.
+ * @return -1 if failure, 0 if successful.
+ */
+int write_block_map(unsigned int disk_index, struct inode* in, unsigned int* blocks, unsigned int count) {
+    unsigned int ptrs = block_ptr_count(disk_index);
+    if (count > max_file_blocks(disk_index)) {
+        printf("[ERROR] File is too big: %d blocks\n", count);
+        return -1;
+    }
+
+    unsigned char fits_direct = count <= 6;
+    for (unsigned int i = 0 ; i < count && fits_direct ; i++)
+        fits_direct = blocks[i] <= 0xFFFF;
+
+    if (fits_direct) { // Use the original format.
+        if ((in->mode & INODE_MODE_INDIRECT) == INODE_MODE_INDIRECT) {
+            release_indirect_block(disk_index, &in->iblocks[1]);
+            release_double_indirect(disk_index, &in->iblocks[2]);
+            in->mode = in->mode ^ INODE_MODE_INDIRECT;
+        }
+        for (unsigned int i = 0 ; i < 6 ; i++)
+            in->blocks[i] = i < count ? blocks[i] : 0;
+        return 0;
+    }
+
+    if ((in->mode & INODE_MODE_INDIRECT) != INODE_MODE_INDIRECT) { // Convert into indirect format.
+        memset(in->iblocks, 0, sizeof(in->iblocks));
+        in->mode = in->mode | INODE_MODE_INDIRECT;
+    }
+    in->iblocks[0] = blocks[0];
+
+    // Single indirect block for the next block_ptr_count blocks.
+    unsigned int remain = count - 1;
+    unsigned int single_count = remain < ptrs ? remain : ptrs;
+    if (single_count == 0) release_indirect_block(disk_index, &in->iblocks[1]);
+    else if (fill_indirect_block(disk_index, &in->iblocks[1], blocks + 1, single_count) == -1) return -1;
+    remain = remain - single_count;
+
+    // Double indirect block for the rest.
+    if (remain == 0) {
+        release_double_indirect(disk_index, &in->iblocks[2]);
+        return 0;
+    }
+    if (in->iblocks[2] != 0 && is_snapshot_block(disk_index, in->iblocks[2])) in->iblocks[2] = 0; // Do not change it.
+    if (assign_indirect_block(disk_index, &in->iblocks[2]) == -1) return -1;
+    unsigned int *dbl = indirect_table(disk_index, in->iblocks[2]);
+    unsigned int *cur = blocks + 1 + single_count;
+    for (unsigned int i = 0 ; i < ptrs ; i++) {
+        if (remain == 0) { // Release children that are no longer used.
+            release_indirect_block(disk_index, &dbl[i]);
+            continue;
+        }
+        unsigned int child_count = remain < ptrs ? remain : ptrs;
+        if (fill_indirect_block(disk_index, &dbl[i], cur, child_count) == -1) return -1;
+        cur = cur + child_count;
+        remain = remain - child_count;
+    }
+    return write_meta_block(disk_index, in->iblocks[2], get_block(disk_index, in->iblocks[2]));
+}
+
+
+/**
+ * A function that releases all blocks that an inode is using, including indirect blocks.
+ * This only updates the inode in memory, call write_inode to emit the inode itself.
+ * @param disk_index The disk index that the inode is located at.
+ * @param in The inode to release blocks from.
+ * @return -1 if failure, 0 if successful.
+ */
+int release_block_map(unsigned int disk_index, struct inode* in) {
+    unsigned int count = size_to_blocks(disk_index, in->size);
+    unsigned int *blocks = malloc(sizeof(unsigned int) * count);
+    if (!blocks) return -1;
+
+    count = read_block_map(disk_index, in, blocks, count);
+    release_blocks(disk_index, count, blocks);
+    if ((in->mode & INODE_MODE_INDIRECT) == INODE_MODE_INDIRECT) {
+        release_indirect_block(disk_index, &in->iblocks[1]);
+        release_double_indirect(disk_index, &in->iblocks[2]);
+    }
+    memset(in->blocks, 0, sizeof(in->blocks));
+    free(blocks);
+    return 0;
+}
+
+
+/**
+ * A function that counts how many blocks starting from the first one are contiguous in disk.
+ * @param blocks The array of block indexes.
+ * @param count The count of blocks in the array.
+ * @return The length of the contiguous run.
+ */
+static unsigned int run_length(unsigned int* blocks, unsigned int count) {
+    unsigned int len = 1;
+    while (len < count && blocks[len] == blocks[0] + len) len++;
+    return len;
+}
+
+
+/**
+ * A function that copies data of blocks in memory into a buffer.
+ * Contiguous blocks are copied with a single memcpy.
+ * @param disk_index The disk index to read blocks from.
+ * @param blocks The array of block indexes in file order.
+ * @param count The count of blocks.
+ * @param dst The buffer to copy data into. This must be at least count blocks long.
+ * @return 0.
+ */
+int read_block_runs(unsigned int disk_index, unsigned int* blocks, unsigned int count, unsigned char* dst) {
+    unsigned int block_size = get_block_size(disk_index);
+    unsigned int i = 0;
+    while (i < count) {
+        unsigned int len = run_length(blocks + i, count - i);
+        memcpy(dst + (size_t) i * block_size, get_block(disk_index, blocks[i]), (size_t) len * block_size);
+        i = i + len;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that copies a buffer into blocks in memory and writes them into the disk.
+ * The remaining bytes of the last block are filled with 0.
+ * Contiguous blocks are copied and written at once.
+ * @param disk_index The disk index to write blocks into.
+ * @param blocks The array of block indexes in file order.
+ * @param count The count of blocks.
+ * @param src The buffer to copy data from.
+ * @param size The size of the buffer in bytes.
+ * @return 0.
+ */
+int store_block_runs(unsigned int disk_index, unsigned int* blocks, unsigned int count, unsigned char* src,
+                     unsigned int size) {
+    unsigned int block_size = get_block_size(disk_index);
+    unsigned int i = 0;
+    while (i < count) {
+        unsigned int len = run_length(blocks + i, count - i);
+        unsigned char *dst = (unsigned char*) get_block(disk_index, blocks[i]);
+        unsigned int offset = i * block_size;
+        unsigned int bytes = len * block_size;
+        unsigned int valid = 0; // The bytes that come from the buffer.
+        if (offset < size) valid = size - offset < bytes ? size - offset : bytes;
+
+        memcpy(dst, src + offset, valid);
+        memset(dst + valid, 0, bytes - valid);
+        write_data_block(disk_index, blocks[i], len, (struct blocks*) dst);
+        i = i + len;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that writes blocks in memory into the disk.
+ * Contiguous blocks are written at once.
+ * @param disk_index The disk index to write blocks into.
+ * @param blocks The array of block indexes.
+ * @param count The count of blocks.
+ * @return 0.
+ */
+int write_block_runs(unsigned int disk_index, unsigned int* blocks, unsigned int count) {
+    unsigned int i = 0;
+    while (i < count) {
+        unsigned int len = run_length(blocks + i, count - i);
+        write_data_block(disk_index, blocks[i], len, get_block(disk_index, blocks[i]));
+        i = i + len;
+    }
+    return 0;
+}
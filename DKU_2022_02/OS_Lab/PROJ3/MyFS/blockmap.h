@@ -0,0 +1,29 @@
+//
+// @file : blockmap.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines mapping between file blocks and disk blocks.
+//
+
+#ifndef MYFS_BLOCKMAP_H
+#define MYFS_BLOCKMAP_H
+#pragma once
+
+#include "common.h"
+
+unsigned int size_to_blocks(unsigned int, unsigned int);
+unsigned int block_ptr_count(unsigned int);
+unsigned int max_file_blocks(unsigned int);
+
+// For translating inode into list of blocks and vice versa.
+int read_block_map(unsigned int, struct inode*, unsigned int*, unsigned int);
+int lookup_block(unsigned int, struct inode*, unsigned int, unsigned int*);
+int read_indirect_blocks(unsigned int, struct inode*, unsigned int*, unsigned int);
+int write_block_map(unsigned int, struct inode*, unsigned int*, unsigned int);
+int release_block_map(unsigned int, struct inode*);
+
+// For moving data in contiguous runs of blocks.
+int read_block_runs(unsigned int, unsigned int*, unsigned int, unsigned char*);
+int store_block_runs(unsigned int, unsigned int*, unsigned int, unsigned char*, unsigned int);
+int write_block_runs(unsigned int, unsigned int*, unsigned int);
+
+#endif //MYFS_BLOCKMAP_H
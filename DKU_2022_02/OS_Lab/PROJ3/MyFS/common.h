@@ -14,13 +14,14 @@
 #include <string.h>
 #include <dirent.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include "fs.h"
 
 #define MAX_STRING_LEN 1024
 #define MAX_IMG_COUNT 10
-#define MAX_BLOCK_COUNT 4088
-#define MAX_INODE_COUNT 224
+#define MAX_BLOCK_COUNT 4088 // Blocks of the original format, v2 disks have s.num_blocks blocks.
+#define MAX_INODE_COUNT 224  // Inodes of the original format, v2 disks have s.num_inodes inodes.
 
 
 
@@ -0,0 +1,222 @@
+//
+// @file : compress.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements compression of file data.
+//          A block is a list of sequences: a token, literals, then a match of earlier data as an offset and a length.
+//
+
+#include "compress.h"
+
+
+/**
+ * A function that hashes 4 bytes for finding matches.
+ * @param p The bytes to hash.
+ * @return The hash, LZ4_HASH_BITS bits.
+ */
+static unsigned int lz4_hash(const unsigned char* p) {
+    uint32_t value = 0;
+    memcpy(&value, p, sizeof(uint32_t));
+    return (value * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+
+/**
+ * A function that stores the rest of a length that did not fit into the token, as 255s and the remainder.
+ * @param op Where to store the length.
+ * @param len The rest of the length.
+ * @return The position after the length.
+ */
+static unsigned char* lz4_put_length(unsigned char* op, unsigned int len) {
+    for ( ; len >= 255 ; len -= 255) *op++ = 255;
+    *op++ = (unsigned char) len;
+    return op;
+}
+
+
+/**
+ * A function that stores a sequence: the literals from anchor, then a match if there was one.
+ * @param op Where to store the sequence.
+ * @param end The end of the destination.
+ * @param literals The literals.
+ * @param literal_len The length of the literals.
+ * @param offset The offset of the match, 0 for the last sequence which has no match.
+ * @param match_len The length of the match.
+ * @return The position after the sequence, NULL if the destination was too small.
+ */
+static unsigned char* lz4_put_sequence(unsigned char* op, unsigned char* end, const unsigned char* literals,
+                                       unsigned int literal_len, unsigned int offset, unsigned int match_len) {
+    size_t need = 1 + literal_len / 255 + 1 + literal_len + (offset != 0 ? 2 + match_len / 255 + 1 : 0);
+    if (need > (size_t) (end - op)) return NULL;
+
+    unsigned char *token = op++;
+    *token = (unsigned char) ((literal_len >= 15 ? 15 : literal_len) << 4);
+    if (literal_len >= 15) op = lz4_put_length(op, literal_len - 15);
+    memcpy(op, literals, literal_len);
+    op = op + literal_len;
+    if (offset == 0) return op;
+
+    *op++ = (unsigned char) (offset & 0xFF);
+    *op++ = (unsigned char) (offset >> 8);
+    match_len = match_len - LZ4_MIN_MATCH;
+    *token = *token | (unsigned char) (match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15) op = lz4_put_length(op, match_len - 15);
+    return op;
+}
+
+
+/**
+ * A function that compresses data into an LZ4 block, finding matches greedily with a hash table.
+ * @param src The data to compress.
+ * @param size The size of the data.
+ * @param dst The buffer to store the block into.
+ * @param capacity The size of the buffer.
+ * @return The size of the block, -1 if it did not fit into the buffer.
+ */
+static int lz4_compress(const unsigned char* src, unsigned int size, unsigned char* dst, unsigned int capacity) {
+    unsigned int *table = calloc(1 << LZ4_HASH_BITS, sizeof(unsigned int)); // Positions + 1, 0 is empty.
+    unsigned char *op = dst, *end = dst + capacity;
+    unsigned int anchor = 0, pos = 0;
+    if (!table) return -1;
+
+    while (size > LZ4_MATCH_LIMIT && pos < size - LZ4_MATCH_LIMIT) {
+        unsigned int hash = lz4_hash(src + pos), candidate = table[hash];
+        table[hash] = pos + 1;
+        if (candidate == 0 || pos - (candidate - 1) > LZ4_MAX_OFFSET || memcmp(src + candidate - 1, src + pos, 4)) {
+            pos++;
+            continue;
+        }
+
+        // Extend the match, the last literals are never part of a match.
+        unsigned int match = candidate - 1, len = LZ4_MIN_MATCH;
+        while (pos + len < size - LZ4_LAST_LITERALS && src[match + len] == src[pos + len]) len++;
+        op = lz4_put_sequence(op, end, src + anchor, pos - anchor, pos - match, len);
+        if (op == NULL) {
+            free(table);
+            return -1;
+        }
+        pos = pos + len;
+        anchor = pos;
+    }
+    free(table);
+
+    op = lz4_put_sequence(op, end, src + anchor, size - anchor, 0, 0);
+    return op == NULL ? -1 : (int) (op - dst);
+}
+
+
+/**
+ * A function that reads the rest of a length that did not fit into the token.
+ * @param src The block.
+ * @param size The size of the block.
+ * @param ip The pointer to the position in the block, this is moved after the length.
+ * @param len The pointer to the length to add the rest to.
+ * @return -1 if the block ended, 0 if successful.
+ */
+static int lz4_get_length(const unsigned char* src, unsigned int size, unsigned int* ip, unsigned int* len) {
+    unsigned char byte = 255;
+    while (byte == 255) {
+        if (*ip >= size) return -1;
+        byte = src[(*ip)++];
+        *len = *len + byte;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that decompresses an LZ4 block. Broken blocks never write outside of the destination.
+ * @param src The block.
+ * @param size The size of the block.
+ * @param dst The buffer to store the data into.
+ * @param raw_size The size of the data, the block must decompress into exactly this many bytes.
+ * @return -1 if the block was broken, 0 if successful.
+ */
+static int lz4_decompress(const unsigned char* src, unsigned int size, unsigned char* dst, unsigned int raw_size) {
+    unsigned int ip = 0, op = 0;
+    while (ip < size) {
+        unsigned char token = src[ip++];
+        unsigned int literal_len = token >> 4, match_len = token & 0x0F;
+        if (literal_len == 15 && lz4_get_length(src, size, &ip, &literal_len) == -1) return -1;
+        if (literal_len > size - ip || literal_len > raw_size - op) return -1;
+        memcpy(dst + op, src + ip, literal_len);
+        ip = ip + literal_len;
+        op = op + literal_len;
+        if (ip == size) break; // The last sequence has no match.
+
+        if (size - ip < 2) return -1;
+        unsigned int offset = src[ip] | (src[ip + 1] << 8);
+        ip = ip + 2;
+        if (match_len == 15 && lz4_get_length(src, size, &ip, &match_len) == -1) return -1;
+        match_len = match_len + LZ4_MIN_MATCH;
+        if (offset == 0 || offset > op || match_len > raw_size - op) return -1;
+        for (unsigned int i = 0 ; i < match_len ; i++) dst[op + i] = dst[op - offset + i]; // Matches may overlap.
+        op = op + match_len;
+    }
+    return op == raw_size ? 0 : -1;
+}
+
+
+/**
+ * A function that returns the size of a buffer that compressed data always fits into.
+ * @param size The size of the data.
+ * @return The size of the buffer.
+ */
+unsigned int compress_bound(unsigned int size) {
+    return size + size / 255 + 16;
+}
+
+
+/**
+ * A function that compresses data.
+ * @param method The compression method, MYFS_COMPRESS_*.
+ * @param src The data to compress.
+ * @param size The size of the data.
+ * @param dst The buffer to store compressed data into.
+ * @param capacity The size of the buffer.
+ * @return The size of the compressed data, -1 if the method was unknown or the data did not fit into the buffer.
+ */
+int compress_data(unsigned int method, const unsigned char* src, unsigned int size, unsigned char* dst,
+                  unsigned int capacity) {
+    if (method == MYFS_COMPRESS_LZ4) return lz4_compress(src, size, dst, capacity);
+    return -1;
+}
+
+
+/**
+ * A function that decompresses data made by compress_data.
+ * @param method The compression method, MYFS_COMPRESS_*.
+ * @param src The compressed data.
+ * @param size The size of the compressed data.
+ * @param dst The buffer to store the data into, this must be at least raw_size bytes.
+ * @param raw_size The size of the data before compression.
+ * @return -1 if the method was unknown or the data was broken, 0 if successful.
+ */
+int decompress_data(unsigned int method, const unsigned char* src, unsigned int size, unsigned char* dst,
+                    unsigned int raw_size) {
+    if (method == MYFS_COMPRESS_LZ4) return lz4_decompress(src, size, dst, raw_size);
+    return -1;
+}
+
+
+/**
+ * A function that returns the name of a compression method.
+ * @param method The compression method, MYFS_COMPRESS_*.
+ * @return The name, "unknown" if the method was unknown.
+ */
+const char* compress_name(unsigned int method) {
+    if (method == MYFS_COMPRESS_NONE) return "none";
+    if (method == MYFS_COMPRESS_LZ4) return "lz4";
+    return "unknown";
+}
+
+
+/**
+ * A function that finds a compression method by its name.
+ * @param name The name of the method.
+ * @return The compression method, -1 if the name was unknown.
+ */
+int compress_method(const char* name) {
+    if (!strcmp(name, "none")) return MYFS_COMPRESS_NONE;
+    if (!strcmp(name, "lz4")) return MYFS_COMPRESS_LZ4;
+    return -1;
+}
@@ -0,0 +1,26 @@
+//
+// @file : compress.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines compression of file data.
+//          LZ4 is implemented here in the block format, so images can be read by any LZ4 block decoder.
+//
+
+#ifndef MYFS_COMPRESS_H
+#define MYFS_COMPRESS_H
+#pragma once
+
+#include "common.h"
+
+#define LZ4_MIN_MATCH 4       // Matches shorter than this are stored as literals.
+#define LZ4_HASH_BITS 12      // Entries of the match finder, 4096 positions.
+#define LZ4_LAST_LITERALS 5   // The last bytes of a block are always literals.
+#define LZ4_MATCH_LIMIT 12    // The last match must start this far from the end of a block.
+#define LZ4_MAX_OFFSET 0xFFFF // Matches are found within 64 KB.
+
+unsigned int compress_bound(unsigned int);
+int compress_data(unsigned int, const unsigned char*, unsigned int, unsigned char*, unsigned int);
+int decompress_data(unsigned int, const unsigned char*, unsigned int, unsigned char*, unsigned int);
+const char* compress_name(unsigned int);
+int compress_method(const char*);
+
+#endif //MYFS_COMPRESS_H
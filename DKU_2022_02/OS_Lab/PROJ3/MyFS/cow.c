@@ -0,0 +1,105 @@
+//
+// @file : cow.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements the reverse map of CoW (copy on write) indirections.
+//          The caller must hold the CoW lock of the volume.
+//
+
+#include "cow.h"
+
+
+/**
+ * A function that initializes a CoW map with no indirections.
+ * @param map The map to initialize.
+ * @param inode_count The count of inodes of the volume.
+ * @return -1 if failure, 0 if successful.
+ */
+int cow_map_init(struct cow_map_t* map, unsigned int inode_count) {
+    unsigned short *arrays = malloc(sizeof(unsigned short) * inode_count * 5); // All arrays in a single allocation.
+    if (!arrays) return -1;
+    map->first = arrays;
+    map->count = arrays + inode_count;
+    map->original = arrays + inode_count * 2;
+    map->next = arrays + inode_count * 3;
+    map->prev = arrays + inode_count * 4;
+    map->inode_count = inode_count;
+    for (unsigned int i = 0 ; i < inode_count ; i++) {
+        map->first[i] = COW_NONE;
+        map->count[i] = 0;
+        map->original[i] = COW_NONE;
+        map->next[i] = COW_NONE;
+        map->prev[i] = COW_NONE;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that releases a CoW map.
+ * @param map The map to release.
+ */
+void cow_map_release(struct cow_map_t* map) {
+    free(map->first);
+    memset(map, 0, sizeof(struct cow_map_t));
+}
+
+
+/**
+ * A function that adds a sharer of an original inode. This takes O(1).
+ * @param map The map to add into.
+ * @param original The original inode that owns the blocks.
+ * @param sharer The inode sharing blocks of the original.
+ */
+void cow_map_add(struct cow_map_t* map, unsigned int original, unsigned int sharer) {
+    if (map->original[sharer] != COW_NONE) cow_map_remove(map, sharer); // Sharing another one, move it.
+    map->original[sharer] = original;
+    map->prev[sharer] = COW_NONE;
+    map->next[sharer] = map->first[original];
+    if (map->first[original] != COW_NONE) map->prev[map->first[original]] = sharer;
+    map->first[original] = sharer;
+    map->count[original]++;
+}
+
+
+/**
+ * A function that removes a sharer from its original inode. This takes O(1).
+ * @param map The map to remove from.
+ * @param sharer The inode that no longer shares blocks.
+ */
+void cow_map_remove(struct cow_map_t* map, unsigned int sharer) {
+    unsigned int original = map->original[sharer];
+    if (original == COW_NONE) return; // Not a sharer.
+    if (map->prev[sharer] != COW_NONE) map->next[map->prev[sharer]] = map->next[sharer];
+    else map->first[original] = map->next[sharer];
+    if (map->next[sharer] != COW_NONE) map->prev[map->next[sharer]] = map->prev[sharer];
+    map->original[sharer] = COW_NONE;
+    map->next[sharer] = COW_NONE;
+    map->prev[sharer] = COW_NONE;
+    map->count[original]--;
+}
+
+
+/**
+ * A function that returns the count of sharers of an original inode.
+ * @param map The map to look.
+ * @param original The original inode.
+ * @return The count of sharers.
+ */
+unsigned int cow_map_count(struct cow_map_t* map, unsigned int original) {
+    return map->count[original];
+}
+
+
+/**
+ * A function that lists sharers of an original inode, most recent copy first.
+ * @param map The map to look.
+ * @param original The original inode.
+ * @param ret The array to store sharers into, this must hold cow_map_count of the original.
+ * @return The count of sharers.
+ */
+unsigned int cow_map_sharers(struct cow_map_t* map, unsigned int original, unsigned int* ret) {
+    unsigned int count = 0;
+    for (unsigned int cur = map->first[original] ; cur != COW_NONE ; cur = map->next[cur])
+        ret[count++] = cur;
+    return count;
+}
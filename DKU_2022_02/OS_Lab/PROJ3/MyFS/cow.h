@@ -0,0 +1,40 @@
+//
+// @file : cow.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines the reverse map of CoW (copy on write) indirections.
+//          Every original inode keeps a doubly linked list of inodes sharing its blocks, so sharers are found,
+//          added and removed without scanning the inode table.
+//
+
+#ifndef MYFS_COW_H
+#define MYFS_COW_H
+#pragma once
+
+#include "common.h"
+
+#define COW_NONE 0xFFFF
+
+
+/**
+ * A struct that implements the reverse map of CoW indirections of a single volume.
+ * The count of sharers is the reference count of the original's blocks: they are shared as a whole,
+ * so blocks are released only when the original is deleted without any sharer left.
+ */
+struct cow_map_t {
+    unsigned short *first;    // The first sharer of each original inode.
+    unsigned short *count;    // The count of sharers of each original inode.
+    unsigned short *original; // The original inode of each sharer.
+    unsigned short *next;     // The next sharer of the same original inode.
+    unsigned short *prev;     // The previous sharer of the same original inode.
+    unsigned int inode_count; // The count of inodes of the volume, the size of each array.
+};
+
+
+int cow_map_init(struct cow_map_t*, unsigned int);
+void cow_map_release(struct cow_map_t*);
+void cow_map_add(struct cow_map_t*, unsigned int, unsigned int);
+void cow_map_remove(struct cow_map_t*, unsigned int);
+unsigned int cow_map_count(struct cow_map_t*, unsigned int);
+unsigned int cow_map_sharers(struct cow_map_t*, unsigned int, unsigned int*);
+
+#endif //MYFS_COW_H
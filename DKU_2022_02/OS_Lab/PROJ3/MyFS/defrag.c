@@ -0,0 +1,310 @@
+//
+// @file : defrag.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements the online defragmenter of MyFS.
+//          A file is moved by copying its blocks into a free run and replacing its block map in a single journal
+//          operation, so the file is either in its old blocks or in the new run after a crash.
+//          CoW copies share the block map of the original, so they are moved together with the original.
+//          Files with blocks kept by snapshots are not moved, since that would only copy them.
+//
+
+#include <time.h>
+
+#include "diskutil.h"
+
+extern struct partition partitions[MAX_IMG_COUNT];
+extern struct bitmap_t block_bitmaps[MAX_IMG_COUNT];
+extern struct bitmap_t inode_bitmaps[MAX_IMG_COUNT];
+extern struct cow_map_t cow_maps[MAX_IMG_COUNT];
+extern struct defrag_t defrags[MAX_IMG_COUNT];
+
+
+/**
+ * A function that initializes the defragmenter of a volume.
+ * @param disk_index The disk index to initialize the defragmenter of.
+ * @return 0. This function will not fail.
+ */
+int defrag_init(unsigned int disk_index) {
+    struct defrag_t *d = &defrags[disk_index];
+    d->cursor = 0;
+    d->files = 0;
+    d->blocks = 0;
+    d->budget = DEFRAG_DEFAULT_BUDGET;
+    d->running = 0;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_mutex_init(&d->control, NULL);
+    pthread_cond_init(&d->wake, NULL);
+    return 0;
+}
+
+
+/**
+ * A function that stops the background defragmenter and releases the defragmenter of a volume.
+ * @param disk_index The disk index to release the defragmenter of.
+ */
+void defrag_release(unsigned int disk_index) {
+    struct defrag_t *d = &defrags[disk_index];
+    defrag_stop(disk_index);
+    pthread_mutex_destroy(&d->lock);
+    pthread_mutex_destroy(&d->control);
+    pthread_cond_destroy(&d->wake);
+}
+
+
+/**
+ * A function that reads the block map of a regular file that is worth moving.
+ * CoW copies are skipped, they are moved together with their original.
+ * The caller must hold the lock of the inode.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param blocks The array to store blocks of the file into, this must hold max_file_blocks.
+ * @return The count of blocks of the file if it has more than a single extent, 0 if the file is not moved.
+ */
+static unsigned int fragmented_blocks(unsigned int disk_index, unsigned int inode_index, unsigned int* blocks) {
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
+    lock_alloc(disk_index); // Inodes next to this one could be assigned right now.
+    unsigned char used = bitmap_test(&inode_bitmaps[disk_index], inode_index);
+    unlock_alloc(disk_index);
+    if (!used || in->indirect_inode != -1 || (in->mode & INODE_MODE_REG_FILE) != INODE_MODE_REG_FILE) return 0;
+
+    unsigned int count = read_block_map(disk_index, in, blocks, size_to_blocks(disk_index, in->size));
+    unsigned char fragmented = 0;
+    for (unsigned int i = 1 ; i < count && !fragmented ; i++)
+        fragmented = blocks[i] != blocks[i - 1] + 1;
+    return fragmented ? count : 0;
+}
+
+
+/**
+ * A function that assigns a contiguous run of free blocks, nearest after a hint.
+ * Unlike place_file_blocks, this never falls back into blocks that are not contiguous.
+ * @param disk_index The disk index to assign blocks from.
+ * @param count The count of blocks required.
+ * @param hint The block to start looking from.
+ * @param ret The pointer to store the first block of the run.
+ * @return -1 if there was no free run that is long enough, 0 if successful.
+ */
+static int assign_block_run(unsigned int disk_index, unsigned int count, unsigned int hint, unsigned int* ret) {
+    struct partition *cur_p = &partitions[disk_index];
+    lock_alloc(disk_index);
+    if (cur_p->s.num_free_blocks < count || bitmap_find_run_near(&block_bitmaps[disk_index], count, hint, ret) == -1) {
+        unlock_alloc(disk_index);
+        return -1;
+    }
+    cur_p->s.num_free_blocks = cur_p->s.num_free_blocks - count;
+    write_super_block(disk_index); // Emit bitmap change to disk.
+    unlock_alloc(disk_index);
+    return 0;
+}
+
+
+/**
+ * A function that moves a fragmented file into a single contiguous run.
+ * Data is copied into the new run first, then the block maps of the file and its CoW copies are replaced and
+ * the old blocks are released, all in the same journal operation.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param blocks The array to use for blocks of the file, this must hold max_file_blocks.
+ * @return -1 if failure, the count of blocks moved if successful. 0 if the file was not moved.
+ */
+static int relocate_file(unsigned int disk_index, unsigned int inode_index, unsigned int* blocks) {
+    struct partition *cur_p = &partitions[disk_index];
+    struct inode *in = &cur_p->inode_table[inode_index];
+    journal_begin(disk_index);
+    lock_cow(disk_index); // Copies must not be made, written or deleted while the block map is replaced.
+
+    // Copies read blocks through their own block map, so they are locked as well.
+    unsigned int sharer_count = cow_map_count(&cow_maps[disk_index], inode_index);
+    unsigned int *sharers = malloc(sizeof(unsigned int) * (sharer_count + 1));
+    if (!sharers) {
+        unlock_cow(disk_index);
+        journal_end(disk_index);
+        return -1;
+    }
+    sharer_count = cow_map_sharers(&cow_maps[disk_index], inode_index, sharers);
+    lock_inode_write(disk_index, inode_index);
+    for (unsigned int i = 0 ; i < sharer_count ; i++)
+        lock_inode_write(disk_index, sharers[i]);
+
+    int ret = 0;
+    unsigned int count = fragmented_blocks(disk_index, inode_index, blocks), start = 0;
+    for (unsigned int i = 0 ; i < count ; i++)
+        if (is_snapshot_block(disk_index, blocks[i])) count = 0;
+    if (count == 0 || assign_block_run(disk_index, count, blocks[0], &start) == -1) goto unlock; // Not moved.
+
+    // Copy the data into the new run and write the whole run at once.
+    unsigned int block_size = get_block_size(disk_index);
+    unsigned int *fresh = blocks + count; // The rest of the array is not used by the file.
+    if (count * 2 > max_file_blocks(disk_index)) fresh = malloc(sizeof(unsigned int) * count);
+    if (!fresh) {
+        ret = -1;
+        goto unlock;
+    }
+    for (unsigned int i = 0 ; i < count ; i++) {
+        fresh[i] = start + i;
+        memcpy(get_block(disk_index, start + i), get_block(disk_index, blocks[i]), block_size);
+    }
+    write_data_block(disk_index, start, count, get_block(disk_index, start));
+
+    if (write_block_map(disk_index, in, fresh, count) == -1) { // Keep the file in the old blocks.
+        printf("[ERROR] Could not move inode %d\n", inode_index);
+        write_block_map(disk_index, in, blocks, count);
+        release_blocks(disk_index, count, fresh);
+        ret = -1;
+    } else {
+        for (unsigned int i = 0 ; i < sharer_count ; i++) { // Copies share the block map of the original.
+            struct inode *copy = &cur_p->inode_table[sharers[i]];
+            copy->mode = (copy->mode & ~INODE_MODE_INDIRECT) | (in->mode & INODE_MODE_INDIRECT);
+            memcpy(copy->iblocks, in->iblocks, sizeof(in->iblocks));
+            write_inode(disk_index, sharers[i], copy);
+        }
+        write_inode(disk_index, inode_index, in);
+        release_blocks(disk_index, count, blocks);
+        ret = (int) count;
+    }
+    if (fresh != blocks + count) free(fresh);
+
+unlock:
+    for (unsigned int i = 0 ; i < sharer_count ; i++)
+        unlock_inode(disk_index, sharers[i]);
+    unlock_inode(disk_index, inode_index);
+    free(sharers);
+    unlock_cow(disk_index);
+    journal_end(disk_index);
+    return ret;
+}
+
+
+/**
+ * A function that runs a single round of the defragmenter, starting from the inode where the last round stopped.
+ * Files are moved until the budget is used up. A file that does not fit into the rest of the budget is left for
+ * the next round, unless it is the first file of the round, so that files larger than the budget are moved as well.
+ * @param disk_index The disk index to defragment.
+ * @param budget The count of blocks that this round may move.
+ * @param files The pointer to store the count of files moved in this round, this can be NULL.
+ * @return -1 if failure, the count of blocks moved if successful.
+ */
+int defrag_volume(unsigned int disk_index, unsigned int budget, unsigned int* files) {
+    struct defrag_t *d = &defrags[disk_index];
+    unsigned int inode_count = partitions[disk_index].s.num_inodes;
+    unsigned int *blocks = malloc(sizeof(unsigned int) * max_file_blocks(disk_index));
+    if (!blocks) return -1;
+
+    unsigned int moved = 0, moved_files = 0;
+    int ret = 0;
+    pthread_mutex_lock(&d->lock);
+    for (unsigned int i = 0 ; i < inode_count && moved < budget ; i++) {
+        unsigned int inode_index = d->cursor % inode_count;
+        lock_inode_read(disk_index, inode_index);
+        unsigned int count = fragmented_blocks(disk_index, inode_index, blocks);
+        unlock_inode(disk_index, inode_index);
+        if (count > budget - moved && moved != 0) break; // Next round.
+
+        d->cursor = (inode_index + 1) % inode_count;
+        if (count == 0) continue;
+        if ((ret = relocate_file(disk_index, inode_index, blocks)) == -1) break;
+        moved = moved + ret;
+        moved_files = moved_files + (ret != 0);
+    }
+    d->files = d->files + moved_files;
+    d->blocks = d->blocks + moved;
+    pthread_mutex_unlock(&d->lock);
+
+    free(blocks);
+    if (files != NULL) *files = moved_files;
+    return ret == -1 ? -1 : (int) moved;
+}
+
+
+/**
+ * A function that is run by the background defragmenter, a round is run every DEFRAG_INTERVAL_MS.
+ * @param arg The disk index to defragment.
+ * @return NULL.
+ */
+static void* defrag_worker(void* arg) {
+    unsigned int disk_index = (unsigned int) (uintptr_t) arg;
+    struct defrag_t *d = &defrags[disk_index];
+    pthread_mutex_lock(&d->control);
+    while (d->running) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec = until.tv_nsec + DEFRAG_INTERVAL_MS * 1000000L;
+        until.tv_sec = until.tv_sec + until.tv_nsec / 1000000000L;
+        until.tv_nsec = until.tv_nsec % 1000000000L;
+        pthread_cond_timedwait(&d->wake, &d->control, &until);
+        if (!d->running) break;
+
+        unsigned int budget = d->budget;
+        pthread_mutex_unlock(&d->control);
+        if (defrag_volume(disk_index, budget, NULL) == -1)
+            printf("[ERROR] Background defragmenter of volume %d failed a round\n", disk_index);
+        pthread_mutex_lock(&d->control);
+    }
+    pthread_mutex_unlock(&d->control);
+    return NULL;
+}
+
+
+/**
+ * A function that starts the background defragmenter of a volume.
+ * If it was already running, only the budget is changed.
+ * @param disk_index The disk index to defragment.
+ * @param budget The count of blocks to move per round.
+ * @return -1 if failure, 0 if successful.
+ */
+int defrag_start(unsigned int disk_index, unsigned int budget) {
+    struct defrag_t *d = &defrags[disk_index];
+    pthread_mutex_lock(&d->control);
+    d->budget = budget;
+    if (!d->running) {
+        d->running = 1;
+        if (pthread_create(&d->thread, NULL, defrag_worker, (void*) (uintptr_t) disk_index) != 0) {
+            d->running = 0;
+            pthread_mutex_unlock(&d->control);
+            printf("[ERROR] Could not start the defragmenter of volume %d\n", disk_index);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&d->control);
+    return 0;
+}
+
+
+/**
+ * A function that stops the background defragmenter of a volume and waits for its round to finish.
+ * @param disk_index The disk index to stop defragmenting.
+ * @return -1 if it was not running, 0 if successful.
+ */
+int defrag_stop(unsigned int disk_index) {
+    struct defrag_t *d = &defrags[disk_index];
+    pthread_mutex_lock(&d->control);
+    if (!d->running) {
+        pthread_mutex_unlock(&d->control);
+        return -1;
+    }
+    d->running = 0;
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->control);
+    pthread_join(d->thread, NULL);
+    return 0;
+}
+
+
+/**
+ * A function that looks up what the defragmenter of a volume has done since the volume was mounted.
+ * @param disk_index The disk index to look for.
+ * @param files The pointer to store the count of files moved.
+ * @param blocks The pointer to store the count of blocks moved.
+ * @return 1 if the background defragmenter is running, 0 if not.
+ */
+int defrag_status(unsigned int disk_index, unsigned int* files, unsigned int* blocks) {
+    struct defrag_t *d = &defrags[disk_index];
+    pthread_mutex_lock(&d->lock);
+    *files = d->files;
+    *blocks = d->blocks;
+    pthread_mutex_unlock(&d->lock);
+    pthread_mutex_lock(&d->control);
+    int running = d->running;
+    pthread_mutex_unlock(&d->control);
+    return running;
+}
@@ -0,0 +1,48 @@
+//
+// @file : defrag.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines the online defragmenter of MyFS.
+//          Fragmented files are moved into a single contiguous run while the volume stays mounted.
+//          The volume is defragmented in rounds that move up to a budget of blocks, so it can run in the background.
+//
+
+#ifndef MYFS_DEFRAG_H
+#define MYFS_DEFRAG_H
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+
+#define DEFRAG_DEFAULT_BUDGET 256 // Blocks that a single round moves by default.
+#define DEFRAG_INTERVAL_MS 100    // Time between rounds of the background defragmenter.
+
+
+/**
+ * A struct that implements the defragmenter of a single volume.
+ */
+struct defrag_t {
+    unsigned int cursor;      // The inode that the next round starts from.
+    unsigned int files;       // The count of files moved into a single run.
+    unsigned int blocks;      // The count of blocks moved.
+    pthread_mutex_t lock;     // The cursor and the counts, held during a round.
+
+    unsigned int budget;      // Blocks that the background defragmenter moves per round.
+    unsigned char running;    // Whether if the background defragmenter is running.
+    pthread_t thread;
+    pthread_mutex_t control;  // The budget and running, for starting and stopping the background defragmenter.
+    pthread_cond_t wake;      // Signaled to stop the background defragmenter before its next round.
+};
+
+
+// For mounting.
+int defrag_init(unsigned int);
+void defrag_release(unsigned int);
+
+// For defrag commands.
+int defrag_volume(unsigned int, unsigned int, unsigned int*);
+int defrag_start(unsigned int, unsigned int);
+int defrag_stop(unsigned int);
+int defrag_status(unsigned int, unsigned int*, unsigned int*);
+
+#endif //MYFS_DEFRAG_H
@@ -0,0 +1,110 @@
+//
+// @file : delalloc.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements delayed allocation of appended data.
+//          The caller must hold the write lock of the inode, except for looking up the pending sizes.
+//
+
+#include "delalloc.h"
+
+
+/**
+ * A function that initializes delayed allocation of a volume with no pending data.
+ * @param da The delayed allocation to initialize.
+ * @param inode_count The count of inodes of the volume.
+ * @return -1 if failure, 0 if successful.
+ */
+int delalloc_init(struct delalloc_t* da, unsigned int inode_count) {
+    da->bufs = calloc(inode_count, sizeof(struct delalloc_buf_t));
+    if (!da->bufs) return -1;
+    da->inode_count = inode_count;
+    da->total = 0;
+    return 0;
+}
+
+
+/**
+ * A function that releases delayed allocation of a volume, pending data is thrown away.
+ * Flush the volume beforehand to keep the data.
+ * @param da The delayed allocation to release.
+ */
+void delalloc_release(struct delalloc_t* da) {
+    for (unsigned int i = 0 ; da->bufs != NULL && i < da->inode_count ; i++)
+        free(da->bufs[i].data);
+    free(da->bufs);
+    memset(da, 0, sizeof(struct delalloc_t));
+}
+
+
+/**
+ * A function that returns the size of pending data of an inode. This can be called without locks.
+ * @param da The delayed allocation to look for.
+ * @param inode_index The inode to look for.
+ * @return The size of pending data.
+ */
+unsigned int delalloc_pending(struct delalloc_t* da, unsigned int inode_index) {
+    if (da->bufs == NULL || inode_index >= da->inode_count) return 0;
+    return __atomic_load_n(&da->bufs[inode_index].size, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * A function that returns the size of pending data of the whole volume. This can be called without locks.
+ * @param da The delayed allocation to look for.
+ * @return The size of pending data.
+ */
+unsigned int delalloc_total(struct delalloc_t* da) {
+    return __atomic_load_n(&da->total, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * A function that returns pending data of an inode.
+ * @param da The delayed allocation to look for.
+ * @param inode_index The inode to look for.
+ * @return The pending data, NULL if there is none.
+ */
+unsigned char* delalloc_data(struct delalloc_t* da, unsigned int inode_index) {
+    return da->bufs[inode_index].data;
+}
+
+
+/**
+ * A function that appends data into the pending data of an inode.
+ * @param da The delayed allocation to append into.
+ * @param inode_index The inode to append into.
+ * @param size The size of data.
+ * @param data The data to append.
+ * @return -1 if failure, 0 if successful.
+ */
+int delalloc_add(struct delalloc_t* da, unsigned int inode_index, unsigned int size, unsigned char* data) {
+    struct delalloc_buf_t *buf = &da->bufs[inode_index];
+    if (buf->size + size > buf->capacity) { // Grow twice as much, so that a lot of small appends do not copy a lot.
+        unsigned int capacity = buf->capacity == 0 ? 256 : buf->capacity;
+        while (capacity < buf->size + size) capacity = capacity * 2;
+        unsigned char *grown = realloc(buf->data, capacity);
+        if (!grown) return -1;
+        buf->data = grown;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->size, data, size);
+    __atomic_store_n(&buf->size, buf->size + size, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&da->total, size, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+/**
+ * A function that throws away the pending data of an inode, after it was written or when the file is gone.
+ * @param da The delayed allocation to drop from.
+ * @param inode_index The inode to drop.
+ */
+void delalloc_drop(struct delalloc_t* da, unsigned int inode_index) {
+    struct delalloc_buf_t *buf = &da->bufs[inode_index];
+    if (buf->data == NULL) return;
+    __atomic_sub_fetch(&da->total, buf->size, __ATOMIC_RELAXED);
+    __atomic_store_n(&buf->size, 0, __ATOMIC_RELEASE);
+    free(buf->data);
+    buf->data = NULL;
+    buf->capacity = 0;
+}
@@ -0,0 +1,48 @@
+//
+// @file : delalloc.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines delayed allocation of appended data.
+//          Appends are kept in memory and blocks are assigned only when the data is flushed,
+//          so that a file growing by small appends gets a single contiguous run instead of a block per append.
+//
+
+#ifndef MYFS_DELALLOC_H
+#define MYFS_DELALLOC_H
+#pragma once
+
+#include "common.h"
+
+#define DELALLOC_FILE_BLOCKS 16             // Blocks of appended data that a single file may keep in memory.
+#define DELALLOC_VOLUME_BYTES (8 * 1024 * 1024) // Bytes of appended data that a single volume may keep in memory.
+
+
+/**
+ * A struct that implements the appended data of a single file that was not written yet.
+ */
+struct delalloc_buf_t {
+    unsigned char *data;   // The appended data.
+    unsigned int size;     // The size of the appended data, read without locks by callers looking for the size.
+    unsigned int capacity; // The size of the allocated data.
+};
+
+
+/**
+ * A struct that implements delayed allocation of a single volume.
+ * The buffer of each inode is guarded by the write lock of the inode.
+ */
+struct delalloc_t {
+    struct delalloc_buf_t *bufs; // Buffers of each inode.
+    unsigned int inode_count;    // The count of inodes of the volume, the size of bufs.
+    unsigned int total;          // Bytes kept in all buffers.
+};
+
+
+int delalloc_init(struct delalloc_t*, unsigned int);
+void delalloc_release(struct delalloc_t*);
+unsigned int delalloc_pending(struct delalloc_t*, unsigned int);
+unsigned int delalloc_total(struct delalloc_t*);
+unsigned char* delalloc_data(struct delalloc_t*, unsigned int);
+int delalloc_add(struct delalloc_t*, unsigned int, unsigned int, unsigned char*);
+void delalloc_drop(struct delalloc_t*, unsigned int);
+
+#endif //MYFS_DELALLOC_H
@@ -0,0 +1,153 @@
+//
+// @file : direntry.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements blocks of directory files made of variable length entries.
+//          Each block is a chain of entries covering the whole block. Inserting splits the free space after an entry,
+//          removing gives the space of the entry to the previous one, so nothing else is moved.
+//
+
+#include "direntry.h"
+
+
+/**
+ * A function that calculates the space that an entry takes with its name.
+ * @param name_len The length of the name.
+ * @return The size of the entry, 4 byte aligned.
+ */
+unsigned int dir_entry_size(unsigned int name_len) {
+    return (sizeof(struct dir_entry) + name_len + 3) & ~3U;
+}
+
+
+/**
+ * A function that returns the entry at an offset of a block, checking that it lies in the block.
+ * @param block The block of the directory file.
+ * @param block_size The block size.
+ * @param pos The offset of the entry in the block.
+ * @return The entry, NULL if this was the end of the block or the entry was broken.
+ */
+struct dir_entry* dir_entry_at(unsigned char* block, unsigned int block_size, unsigned int pos) {
+    if (pos % 4 != 0 || pos + sizeof(struct dir_entry) > block_size) return NULL;
+    struct dir_entry *de = (struct dir_entry*) (block + pos);
+    if (de->dir_length < sizeof(struct dir_entry) || de->dir_length % 4 != 0 || de->dir_length > block_size - pos)
+        return NULL;
+    if (de->inode != 0 && (de->name_len == 0 || dir_entry_size(de->name_len) > de->dir_length)) return NULL;
+    return de;
+}
+
+
+/**
+ * A function that makes an empty block, a single free entry covering the whole block.
+ * @param block The block to initialize.
+ * @param block_size The block size.
+ */
+void dir_block_init(unsigned char* block, unsigned int block_size) {
+    memset(block, 0, block_size);
+    ((struct dir_entry*) block)->dir_length = block_size;
+}
+
+
+/**
+ * A function that returns the free space of a block, which is the largest entry that can be inserted.
+ * @param block The block of the directory file.
+ * @param block_size The block size.
+ * @return The largest free space in bytes, 0 if the block was full or broken.
+ */
+unsigned int dir_block_space(unsigned char* block, unsigned int block_size) {
+    unsigned int largest = 0;
+    struct dir_entry *de = NULL;
+    for (unsigned int pos = 0 ; (de = dir_entry_at(block, block_size, pos)) != NULL ; pos += de->dir_length) {
+        unsigned int used = de->inode == 0 ? 0 : dir_entry_size(de->name_len);
+        if (de->dir_length - used > largest) largest = de->dir_length - used;
+    }
+    return largest;
+}
+
+
+/**
+ * A function that inserts an entry into the first free space of a block that is large enough.
+ * @param block The block of the directory file.
+ * @param block_size The block size.
+ * @param inode The inode of the entry.
+ * @param file_type The type of the entry, DENTRY_TYPE_REG_FILE or DENTRY_TYPE_DIR_FILE.
+ * @param name The name of the entry, up to DIR_ENTRY_NAME_MAX characters.
+ * @param ret The pointer to store the offset of the new entry in the block.
+ * @return -1 if the block did not have enough space, 0 if successful.
+ */
+int dir_block_insert(unsigned char* block, unsigned int block_size, unsigned int inode, unsigned char file_type,
+                     const char* name, unsigned int* ret) {
+    unsigned int name_len = strlen(name), need = dir_entry_size(name_len);
+    struct dir_entry *de = NULL;
+    for (unsigned int pos = 0 ; (de = dir_entry_at(block, block_size, pos)) != NULL ; pos += de->dir_length) {
+        unsigned int used = de->inode == 0 ? 0 : dir_entry_size(de->name_len);
+        if (de->dir_length - used < need) continue;
+
+        // Split the free space after the entry, a free entry is just taken over.
+        struct dir_entry *new_de = (struct dir_entry*) (block + pos + used);
+        new_de->dir_length = de->dir_length - used;
+        if (used != 0) de->dir_length = used;
+        new_de->inode = inode;
+        new_de->name_len = name_len;
+        new_de->file_type = file_type;
+        memcpy(new_de + 1, name, name_len);
+        *ret = pos + used;
+        return 0;
+    }
+    return -1;
+}
+
+
+/**
+ * A function that removes an entry from a block.
+ * The space of the entry is given to the previous entry, the first entry of a block just becomes free.
+ * @param block The block of the directory file.
+ * @param block_size The block size.
+ * @param pos The offset of the entry in the block.
+ * @return -1 if there was no entry at the offset, 0 if successful.
+ */
+int dir_block_remove(unsigned char* block, unsigned int block_size, unsigned int pos) {
+    struct dir_entry *de = NULL, *prev = NULL;
+    unsigned int cur = 0;
+    for ( ; (de = dir_entry_at(block, block_size, cur)) != NULL && cur < pos ; cur += de->dir_length)
+        prev = de;
+    if (de == NULL || cur != pos || de->inode == 0) return -1;
+
+    if (prev != NULL) {
+        prev->dir_length = prev->dir_length + de->dir_length;
+    } else {
+        de->inode = 0;
+        de->name_len = 0;
+        de->file_type = 0;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that renames an entry in place.
+ * @param block The block of the directory file.
+ * @param block_size The block size.
+ * @param pos The offset of the entry in the block.
+ * @param name The new name.
+ * @return -1 if there was no entry at the offset or the new name does not fit into the entry, 0 if successful.
+ */
+int dir_block_rename(unsigned char* block, unsigned int block_size, unsigned int pos, const char* name) {
+    struct dir_entry *de = dir_entry_at(block, block_size, pos);
+    unsigned int name_len = strlen(name);
+    if (de == NULL || de->inode == 0 || dir_entry_size(name_len) > de->dir_length) return -1;
+    de->name_len = name_len;
+    memcpy(de + 1, name, name_len);
+    return 0;
+}
+
+
+/**
+ * A function that checks if a block has no entries.
+ * @param block The block of the directory file.
+ * @param block_size The block size.
+ * @return 1 if the block was a single free entry, 0 if not.
+ */
+int dir_block_empty(unsigned char* block, unsigned int block_size) {
+    struct dir_entry *de = dir_entry_at(block, block_size, 0);
+    return de != NULL && de->inode == 0 && de->dir_length == block_size;
+}
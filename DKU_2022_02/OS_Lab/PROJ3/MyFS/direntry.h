@@ -0,0 +1,26 @@
+//
+// @file : direntry.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines blocks of directory files made of variable length entries (MYFS_FEATURE_DIR_ENTRY).
+//          These only work on a single block in memory, writing the block into the disk is up to the caller.
+//
+
+#ifndef MYFS_DIRENTRY_H
+#define MYFS_DIRENTRY_H
+#pragma once
+
+#include "common.h"
+#include "fs.h"
+
+unsigned int dir_entry_size(unsigned int);
+struct dir_entry* dir_entry_at(unsigned char*, unsigned int, unsigned int);
+
+// For updating a single block of a directory file.
+void dir_block_init(unsigned char*, unsigned int);
+unsigned int dir_block_space(unsigned char*, unsigned int);
+int dir_block_insert(unsigned char*, unsigned int, unsigned int, unsigned char, const char*, unsigned int*);
+int dir_block_remove(unsigned char*, unsigned int, unsigned int);
+int dir_block_rename(unsigned char*, unsigned int, unsigned int, const char*);
+int dir_block_empty(unsigned char*, unsigned int);
+
+#endif //MYFS_DIRENTRY_H
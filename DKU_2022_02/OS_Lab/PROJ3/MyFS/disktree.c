@@ -5,180 +5,684 @@
 //
 
 #include "disktree.h"
+#include "diskutil.h"
+#include "locks.h"
 
 
-extern char disks[MAX_STRING_LEN][MAX_IMG_COUNT];
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
 extern struct partition partitions[MAX_IMG_COUNT];
 extern int disk_count;
 extern struct entry_t* entries[MAX_IMG_COUNT];
 extern uint16_t loaded_partitions;
-extern unsigned char block_stats[MAX_BLOCK_COUNT][MAX_IMG_COUNT];
-extern unsigned char inode_stats[MAX_INODE_COUNT][MAX_IMG_COUNT];
+extern struct dentry_cache_t dentry_cache;
+extern pthread_mutex_t dentry_lock;
+extern struct path_cache_t path_cache;
+extern pthread_mutex_t path_lock;
 
 
 /**
- * A function that loads entries from root directory recursively.
- * This function will generate all files according to the left child right sibling tree.
- * @param partition The partition to scan directories and files from.
+ * A function that generates the root entry of a partition.
+ * Children are not loaded here, directories are loaded lazily when they are first accessed.
+ * This way, mount time and memory usage do not depend on the count of files in the partition.
+ * @param disk_index The disk index to generate root entry for.
  * @return The head entry.
  */
-struct entry_t* load_entries(struct partition partition) {
+struct entry_t* load_entries(unsigned int disk_index) {
     // Generate head of the entries. This will represent the root directory.
     struct entry_t *head = malloc(sizeof(struct entry_t));
     if (!head) return NULL;
-    else {
-        // Store root's inode.
-        memset(head, 0, sizeof(struct entry_t));
-        head->inode_index = partition.s.first_inode;
 
-        struct inode root = partition.inode_table[partition.s.first_inode];
-        struct blocks tmp_blocks[6];
+    // Store root's inode.
+    memset(head, 0, sizeof(struct entry_t));
+    head->disk_index = disk_index;
+    head->inode_index = partitions[disk_index].s.first_inode;
+    return head;
+}
+
 
-        // Copy 6 blocks from the inode's block.
-        unsigned short start_block = root.blocks[0];
-        unsigned short block_count = root.size / sizeof(struct blocks) + 1; // Calculate the last block.
+/**
+ * A function that removes a loaded directory from the LRU list.
+ * The caller must hold dentry_lock.
+ * @param dir The directory to remove.
+ */
+static void lru_remove(struct entry_t* dir) {
+    if (dir->lru_prev != NULL) dir->lru_prev->lru_next = dir->lru_next;
+    else if (dentry_cache.head == dir) dentry_cache.head = dir->lru_next;
+    if (dir->lru_next != NULL) dir->lru_next->lru_prev = dir->lru_prev;
+    else if (dentry_cache.tail == dir) dentry_cache.tail = dir->lru_prev;
+    dir->lru_prev = NULL;
+    dir->lru_next = NULL;
+}
 
-        // Copy tmp blocks from start to the end the inode's pointer.
-        memcpy(tmp_blocks, &partition.data_blocks[start_block], sizeof(struct blocks) * block_count);
 
-        // Start loading entries into the tree.
-        insert_entry(head, head, (unsigned char *) tmp_blocks, 0, root.size, partition.disk_index, partition.inode_table, 1, 1);
-        return head;
-    }
+/**
+ * A function that puts a loaded directory at the front of the LRU list.
+ * The caller must hold dentry_lock.
+ * @param dir The directory to put.
+ */
+static void lru_push_front(struct entry_t* dir) {
+    dir->lru_prev = NULL;
+    dir->lru_next = dentry_cache.head;
+    if (dentry_cache.head != NULL) dentry_cache.head->lru_prev = dir;
+    dentry_cache.head = dir;
+    if (dentry_cache.tail == NULL) dentry_cache.tail = dir;
 }
 
 
 /**
- * A function that inserts entry to the left child right sibling tree.
- * This will work recursively and load all siblings.
- * TODO: Add directory recursive support.
- * @param node The current node that we are going to put sibling or child into.
- * @param head The head of this whole entry system.
- * @param tmp_blocks The blocks that this directory is using in the disk.
- * @param block_offset The offset of current dirent information in the block.
- * @param size The total size to read off from the disk block.
- * @param disk_index The disk's index. This is to store which disk this entry is located at.
- * @param inode_table The inode table to look for from the partition.
- * @param is_first_child Whether if this entry is the first child for root directory.
+ * A function that links a single directory entry of a directory file as the last child of the directory.
+ * The caller must hold the directory lock.
+ * @param dir The directory that the entry belongs to.
+ * @param name The name of the entry, in the mounted data block.
+ * @param name_len The length of the name.
+ * @param inode_index The inode of the entry.
+ * @param offset The offset of the entry in the directory file.
  * @return -1 if unsuccessful, 0 if successful.
  */
-int insert_entry(struct entry_t* node, struct entry_t* head, unsigned char* tmp_blocks, unsigned int block_offset,
-                 unsigned int size, unsigned int disk_index, struct inode* inode_table, unsigned char is_first_child,
-                 unsigned char is_child) {
-    if (block_offset + 0x20 > size) return 0;
-    else {
-        // Generate a new node and init its values.
-        struct entry_t* new_entry = malloc(sizeof(struct entry_t));
-        unsigned char* entry_val = malloc(sizeof(unsigned char) * 0x20);
-        if ((void*) new_entry == (void*) entry_val) return -1; // If malloc failed, return -1.
-        memset(new_entry, 0, sizeof(struct entry_t));
-        memset(entry_val, 0, sizeof(unsigned char) * 0x20);
-
-        // Store values from the binary data.
-        memcpy(entry_val, tmp_blocks + block_offset, 0x20); // Dump values from block.
-        memcpy(new_entry->name, entry_val +  0x10, 0x10); // Store current entry's name;
-        new_entry->disk_index = disk_index; // Store disk index value.
-
-        // If this entry was .. or ., just skip this.
-        if (strcmp(new_entry->name, "..") == 0 || strcmp(new_entry->name, ".") == 0) {
-            // TODO HERE
-            insert_entry(node, head, tmp_blocks, block_offset + 0x20, size, disk_index, inode_table, is_first_child, 1);
-            return 0;
-        }
+static int load_child(struct entry_t* dir, char* name, unsigned int name_len, unsigned int inode_index,
+                      unsigned int offset) {
+    // If this entry was .. or ., just skip this.
+    if (name_len == 0 || name[0] == 0 || (name_len == 1 && name[0] == '.')
+        || (name_len == 2 && name[0] == '.' && name[1] == '.'))
+        return 0;
 
-        // Store inode's information.
-        unsigned int inode_index;
-        memcpy(&inode_index, entry_val, sizeof(unsigned char) * 2);
-        new_entry->inode_index = inode_index;
-
-        // Check if current node was a directory, and take action accordingly.
-        struct inode node_in = partitions[disk_index].inode_table[node->inode_index];
-        if (((node_in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) && is_child){
-            // If the node was directory and is setting a child
-            // The reason of checking if this node was setting child is that we do not have any method of knowing
-            // why the current node's child is NULL or not. That means, if we do not check the condition,
-            // loading an empty directory and loading a sibling will be treated together,
-            // therefore will be losing directories.
-            node->child = new_entry;
-            new_entry->parent = is_first_child ? head : node;
-            //printf("%s is first child of %s\n", new_entry->name, node->name);
-        } else { // If node was just a regular file, set entry as sibling.
-            new_entry->parent = node->parent;
-            node->sibling = new_entry;
-            //printf("%s is sibling of %s\n", new_entry->name, node->name);
-        }
+    // Generate a new node and init its values.
+    struct entry_t* new_entry = malloc(sizeof(struct entry_t));
+    if (!new_entry) return -1;
+    memset(new_entry, 0, sizeof(struct entry_t));
 
-        struct inode cur_in = partitions[disk_index].inode_table[inode_index];
-        // If this sibling was a directory file, go recursive and find more entries.
-        // However, if the name was . or .., do not go recursion, otherwise it will get stuck.
-        if (((cur_in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE)){
-#ifdef DEBUG
-        printf("[DEBUG] Registering directory %s: (Inode %d) - parent %s\n", new_entry->name, inode_index, new_entry->parent->name);
-#endif
-            // Copy directory file's data and go recursive.
-            struct blocks dir_blocks[6];
-            unsigned int start_block = cur_in.blocks[0];
-            unsigned short block_count = cur_in.size / sizeof(struct blocks) + 1; // Calculate the last block.
-            memcpy(dir_blocks, &partitions[disk_index].data_blocks[start_block], sizeof(struct blocks) * block_count);
-            insert_entry(new_entry, head, (unsigned char *) dir_blocks, 0, cur_in.size, disk_index, inode_table, 0, 1);
+    // Store values from the binary data.
+    memcpy(new_entry->name, name, name_len); // Store current entry's name;
+    new_entry->inode_index = inode_index; // Store inode's information.
+    new_entry->disk_index = dir->disk_index; // Store disk index value.
+    new_entry->dir_offset = offset; // Store where this entry is in the directory file.
+
+    // Link this as the last sibling.
+    new_entry->parent = dir;
+    if (dir->child == NULL) dir->child = new_entry;
+    else dir->last_child->sibling = new_entry;
+    dir->last_child = new_entry;
+    dir->child_count++;
 #ifdef DEBUG
-        printf("[DEBUG] Registered directory %s: (Inode %d) - parent %s\n", new_entry->name, inode_index, new_entry->parent->name);
+    printf("[DEBUG] Registered file - %s: (Inode %d) - parent %s\n", new_entry->name, new_entry->inode_index, dir->name);
 #endif
+    return 0;
+}
+
+
+/**
+ * A function that loads entries of a part of a directory file, which ends at a block boundary.
+ * The caller must hold the directory lock.
+ * @param dir The directory that the entries belong to.
+ * @param base The part of the directory file, in the mounted data blocks.
+ * @param length The length of the part.
+ * @param offset The offset of the part in the directory file.
+ * @return -1 if unsuccessful, 0 if successful.
+ */
+static int load_view(struct entry_t* dir, unsigned char* base, unsigned int length, unsigned int offset) {
+    if (!check_feature(dir->disk_index, MYFS_FEATURE_DIR_ENTRY)) {
+        for (unsigned int pos = 0 ; pos + DIR_SLOT_SIZE <= length ; pos += DIR_SLOT_SIZE) {
+            char *name = (char*) base + pos + 0x10;
+            unsigned int inode_index = base[pos] | (base[pos + 1] << 8);
+            if (load_child(dir, name, strnlen(name, DIR_SLOT_NAME_MAX), inode_index, offset + pos) == -1) return -1;
         }
-#ifdef DEBUG
-        // for (int i = 0 ; i < 0x20 ; i++) printf("%x", entry_val[i]);
-        printf("[DEBUG] Registered file - %s: (Inode %d) - parent %s\n", new_entry->name, inode_index, new_entry->parent->name);
-#endif
-        // Store sibling information and look for other siblings recursively and free read value.
-        free(entry_val);
-        insert_entry(new_entry, head, tmp_blocks, block_offset + 0x20, size, disk_index, inode_table, 0, 0);
         return 0;
     }
+
+    unsigned int block_size = get_block_size(dir->disk_index);
+    for (unsigned int start = 0 ; start + block_size <= length ; start += block_size) {
+        unsigned char *block = base + start;
+        struct dir_entry *de = NULL;
+        for (unsigned int pos = 0 ; (de = dir_entry_at(block, block_size, pos)) != NULL ; pos += de->dir_length) {
+            if (de->inode != 0
+                && load_child(dir, (char*) (de + 1), de->name_len, de->inode, offset + start + pos) == -1)
+                return -1;
+        }
+    }
+    return 0;
 }
 
 
+/**
+ * A function that loads children of a directory from its directory file.
+ * Entries are parsed in place from the mounted data blocks, nothing is copied except the entries themselves.
+ * Subdirectories are not loaded. The caller must hold the directory lock.
+ * @param dir The directory to load children.
+ * @return -1 if the directory file was broken, 0 if successful.
+ */
+static int load_children(struct entry_t* dir) {
+    struct inode *in = &partitions[dir->disk_index].inode_table[dir->inode_index];
+    struct iovec views[DIR_VIEW_COUNT];
+    unsigned int offset = 0;
+    int count = 0;
+
+    // Views end at block boundaries, so an entry never spans two views.
+    while ((count = map_inode_range(dir->disk_index, dir->inode_index, offset, in->size - offset, views, DIR_VIEW_COUNT)) > 0) {
+        for (int i = 0 ; i < count ; i++) {
+            if (load_view(dir, views[i].iov_base, views[i].iov_len, offset) == -1) break;
+            offset = offset + views[i].iov_len;
+        }
+    }
+
+    // Keep what was loaded even if the directory file was broken, otherwise the entries would be loaded twice.
+    if (count == -1) printf("[ERROR] Could not read directory %s\n", dir->name);
+
+    dir->loaded = 1;
+    pthread_mutex_lock(&dentry_lock);
+    dentry_cache.entry_count += dir->child_count;
+    lru_push_front(dir);
+    pthread_mutex_unlock(&dentry_lock);
+    return 0;
+}
+
+
+/**
+ * A function that returns the first child of a directory.
+ * If the directory was not loaded yet, this loads the directory from the disk.
+ * This also marks the directory as recently used.
+ * Concurrent callers shall hold the directory lock while walking through the children.
+ * @param dir The directory to get children.
+ * @return The first child, NULL if the directory was empty or was not a directory.
+ */
+struct entry_t* dir_children(struct entry_t* dir) {
+    if (dir == NULL) return NULL;
+    lock_dir(dir);
+    if (dir->loaded) {
+        pthread_mutex_lock(&dentry_lock);
+        if (dentry_cache.head != dir) { // Mark as recently used.
+            lru_remove(dir);
+            lru_push_front(dir);
+        }
+        pthread_mutex_unlock(&dentry_lock);
+    } else {
+        struct inode *in = &partitions[dir->disk_index].inode_table[dir->inode_index];
+        if ((in->mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) load_children(dir);
+    }
+    struct entry_t *child = dir->child;
+    unlock_dir(dir);
+    return child;
+}
+
 
 /**
  * A function that releases entries from lcrs tree.
  * This will recursively look for all entries and delete the elements.
- * @param head The head of the tree. This shall always be the root directory.
+ * The directory itself is not released, it is just marked as not loaded.
+ * @param head The directory to release children of.
  * @return -1 if unsuccessful, 0 if successful.
  */
 int release_entries(struct entry_t* head) {
     if (head == NULL) {
         return -1;
     }
+    path_cache_invalidate(head->disk_index, PATH_CACHE_FOUND); // Found paths may point to the entries released here.
     struct entry_t *peer = head->child;
     while (peer != NULL) {
         struct entry_t *temp = peer;
-        struct inode in = partitions[peer->disk_index].inode_table[peer->inode_index];
-        if ((in.mode & 0xF0000) == INODE_MODE_DIR_FILE) { // If this was a directory, release children as well.
-            release_entries(temp->child);
-        }
+        peer = peer->sibling; // Store next one before releasing current one.
+        release_entries(temp); // If this was a directory, release children as well.
         free(temp);
-        peer = peer->sibling;
     }
+    dir_index_release(head);
+    free(head->dir_space); // This is built again on the next insert.
+    head->dir_space = NULL;
+    head->dir_space_count = 0;
+    if (head->loaded) {
+        pthread_mutex_lock(&dentry_lock);
+        dentry_cache.entry_count -= head->child_count;
+        lru_remove(head);
+        pthread_mutex_unlock(&dentry_lock);
+    }
+    head->child = NULL;
+    head->last_child = NULL;
+    head->child_count = 0;
+    head->loaded = 0;
+    return 0;
+}
+
+
+/**
+ * A function that checks whether if a directory is the entry itself or one of its parents.
+ * @param dir The directory to check.
+ * @param entry The entry to check.
+ * @return 1 if dir was the entry or its parent, 0 if not.
+ */
+static unsigned char is_ancestor(struct entry_t* dir, struct entry_t* entry) {
+    for (struct entry_t *cur = entry ; cur != NULL ; cur = cur->parent)
+        if (cur == dir) return 1;
+    return 0;
+}
+
+
+/**
+ * A function that unloads least recently used directories until the cache gets smaller than its limit.
+ * The pinned entry (current working directory) and its parents are never unloaded.
+ * This must be called between commands, since unloading releases entries that commands may be using.
+ * Entries retired by retire_entry are freed here as well.
+ * @param pinned The entry to keep loaded.
+ */
+void dentry_cache_shrink(struct entry_t* pinned) {
+    pthread_mutex_lock(&dentry_lock);
+    struct entry_t *retired = dentry_cache.retired;
+    dentry_cache.retired = NULL;
+    pthread_mutex_unlock(&dentry_lock);
+    while (retired != NULL) {
+        struct entry_t *next = retired->hash_next;
+        free(retired->dir_space);
+        free(retired);
+        retired = next;
+    }
+
+    while (dentry_cache.entry_count > dentry_cache.max_entries) {
+        struct entry_t *victim = dentry_cache.tail;
+        while (victim != NULL && is_ancestor(victim, pinned)) victim = victim->lru_prev;
+        if (victim == NULL) return; // Everything left is pinned.
+#ifdef DEBUG
+        printf("[DEBUG] Unloading directory %s (%d entries)\n", victim->name, victim->child_count);
+#endif
+        release_entries(victim);
+    }
+}
+
+
+/**
+ * A function that retires a deleted entry.
+ * Other callers may still be holding the entry, so it is freed later by dentry_cache_shrink.
+ * The entry must be unlinked from its directory and must not have children.
+ * @param entry The entry to retire.
+ */
+void retire_entry(struct entry_t* entry) {
+    entry->deleted = 1;
+    pthread_mutex_lock(&dentry_lock);
+    entry->hash_next = dentry_cache.retired;
+    dentry_cache.retired = entry;
+    pthread_mutex_unlock(&dentry_lock);
+}
+
+
+/**
+ * A function that calculates hash value of a file name.
+ * This uses 32 bit FNV-1a, which is good enough for short names.
+ * @param name The name to calculate hash.
+ * @return The hash value.
+ */
+static unsigned int name_hash(const char* name) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0 ; i <= DIR_ENTRY_NAME_MAX && name[i] != '\0' ; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/**
+ * A function that puts an entry into the directory's hash index.
+ * When the index gets full (entries > buckets), the buckets are doubled and all entries are rehashed.
+ * @param index The hash index of the directory.
+ * @param entry The entry to put.
+ * @return -1 if unsuccessful, 0 if successful.
+ */
+static int dir_index_put(struct dir_index_t* index, struct entry_t* entry) {
+    if (index->entry_count + 1 > index->bucket_count) { // Grow buckets and rehash.
+        unsigned int new_count = index->bucket_count * 2;
+        struct entry_t **new_buckets = calloc(new_count, sizeof(struct entry_t*));
+        if (!new_buckets) return -1;
+        for (unsigned int i = 0 ; i < index->bucket_count ; i++) {
+            struct entry_t *cur = index->buckets[i];
+            while (cur != NULL) {
+                struct entry_t *next = cur->hash_next;
+                unsigned int bucket = name_hash(cur->name) & (new_count - 1);
+                cur->hash_next = new_buckets[bucket];
+                new_buckets[bucket] = cur;
+                cur = next;
+            }
+        }
+        free(index->buckets);
+        index->buckets = new_buckets;
+        index->bucket_count = new_count;
+    }
+
+    unsigned int bucket = name_hash(entry->name) & (index->bucket_count - 1);
+    entry->hash_next = index->buckets[bucket];
+    index->buckets[bucket] = entry;
+    index->entry_count++;
+    return 0;
+}
+
+
+/**
+ * A function that removes an entry from the directory's hash index.
+ * @param index The hash index of the directory.
+ * @param entry The entry to remove.
+ */
+static void dir_index_remove(struct dir_index_t* index, struct entry_t* entry) {
+    struct entry_t **cur = &index->buckets[name_hash(entry->name) & (index->bucket_count - 1)];
+    while (*cur != NULL) {
+        if (*cur == entry) {
+            *cur = entry->hash_next;
+            entry->hash_next = NULL;
+            index->entry_count--;
+            return;
+        }
+        cur = &(*cur)->hash_next;
+    }
+}
+
+
+/**
+ * A function that builds hash index of a directory.
+ * This is called lazily on the first lookup, so directories that are never looked up do not use any memory.
+ * @param dir The directory to build index for.
+ * @return -1 if unsuccessful, 0 if successful.
+ */
+static int dir_index_build(struct entry_t* dir) {
+    struct dir_index_t *index = malloc(sizeof(struct dir_index_t));
+    if (!index) return -1;
+    index->bucket_count = DIR_INDEX_INIT_BUCKETS;
+    index->entry_count = 0;
+    index->buckets = calloc(index->bucket_count, sizeof(struct entry_t*));
+    if (!index->buckets) {
+        free(index);
+        return -1;
+    }
+
+    for (struct entry_t *peer = dir->child ; peer != NULL ; peer = peer->sibling) {
+        if (dir_index_put(index, peer) == -1) {
+            free(index->buckets);
+            free(index);
+            return -1;
+        }
+    }
+    dir->index = index;
     return 0;
 }
 
 
 /**
- * A function that finds entry struct that matches target file's name.
- * @param cur_dir Current directory's entry.
+ * A function that releases hash index of a directory.
+ * @param dir The directory to release index.
+ */
+void dir_index_release(struct entry_t* dir) {
+    if (dir->index == NULL) return;
+    free(dir->index->buckets);
+    free(dir->index);
+    dir->index = NULL;
+}
+
+
+/**
+ * A function that finds a child entry of a directory with the directory's hash index.
+ * @param dir The directory to look for.
  * @param ret The struct* to store found data into.
- * @param target The target file or directory to look for.
+ * @param name The name of the child to look for.
+ * @return -1 if The file was not found, 0 if file was found.
+ */
+int find_child(struct entry_t* dir, struct entry_t** ret, char* name) {
+    *ret = NULL;
+    if (dir == NULL) return -1;
+    lock_dir(dir);
+    dir_children(dir); // Load the directory if it was not loaded yet.
+    if (dir->index == NULL && dir_index_build(dir) == -1) { // Could not build index, fall back to linear search.
+        for (struct entry_t *peer = dir->child ; peer != NULL ; peer = peer->sibling)
+            if (!strcmp(peer->name, name)) *ret = peer;
+    } else {
+        struct entry_t *cur = dir->index->buckets[name_hash(name) & (dir->index->bucket_count - 1)];
+        while (cur != NULL && strcmp(cur->name, name) != 0) cur = cur->hash_next;
+        *ret = cur;
+    }
+    unlock_dir(dir);
+    return *ret == NULL ? -1 : 0;
+}
+
+
+/**
+ * A function that finds the root directory of a volume from a path component like vol1.
+ * @param name The path component.
+ * @return The root directory of the volume, NULL if the component was not a mounted volume.
+ */
+struct entry_t* find_volume(char* name) {
+    unsigned int vol_index = 0;
+    int len = 0;
+    if (sscanf(name, "vol%u%n", &vol_index, &len) != 1 || name[len] != 0) return NULL;
+    if (vol_index >= MAX_IMG_COUNT || !((loaded_partitions >> vol_index) & 0x1)) return NULL;
+    return entries[vol_index];
+}
+
+
+/**
+ * A function that makes resolved paths of a volume stale.
+ * This is called whenever entries of the volume are linked, unlinked, renamed or unloaded.
+ * @param disk_index The volume that changed.
+ * @param what PATH_CACHE_FOUND, PATH_CACHE_MISSING or both.
+ */
+void path_cache_invalidate(unsigned int disk_index, unsigned char what) {
+    if (what & PATH_CACHE_FOUND) __atomic_fetch_add(&path_cache.found_generations[disk_index], 1, __ATOMIC_RELEASE);
+    if (what & PATH_CACHE_MISSING) __atomic_fetch_add(&path_cache.missing_generations[disk_index], 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * A function that returns statistics of the path cache.
+ * @param hits The pointer to store the count of lookups that found the entry in the cache.
+ * @param negative_hits The pointer to store the count of lookups that found that the path did not exist.
+ * @param misses The pointer to store the count of lookups that walked the path.
+ */
+void path_cache_status(unsigned int* hits, unsigned int* negative_hits, unsigned int* misses) {
+    pthread_mutex_lock(&path_lock);
+    *hits = path_cache.hits;
+    *negative_hits = path_cache.negative_hits;
+    *misses = path_cache.misses;
+    pthread_mutex_unlock(&path_lock);
+}
+
+
+/**
+ * A function that walks a path component by component.
+ * . stays and .. goes to the parent, .. of the root directory is the root directory itself.
+ * @param dir The directory to start from.
+ * @param path The relative path.
+ * @param ret The struct* to store found entry into.
+ * @return -1 if a component was not found or was not a directory, 0 if found.
+ */
+static int walk_path(struct entry_t* dir, char* path, struct entry_t** ret) {
+    char tmp[MAX_STRING_LEN] = {0};
+    strncpy(tmp, path, MAX_STRING_LEN - 1);
+    char* save = NULL;
+    for (char* name = strtok_r(tmp, "/", &save) ; name != NULL ; name = strtok_r(NULL, "/", &save)) {
+        struct inode *in = &partitions[dir->disk_index].inode_table[dir->inode_index];
+        if ((in->mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) return -1; // A file in the middle of the path.
+        if (!strcmp(name, "..")) {
+            if (dir->parent != NULL) dir = dir->parent;
+        } else if (strcmp(name, ".") != 0 && find_child(dir, &dir, name) == -1) {
+            return -1;
+        }
+    }
+    *ret = dir;
+    return 0;
+}
+
+
+/**
+ * A function that finds entry of a path, which can have multiple components. Ex) a/b/../c
+ * Absolute paths start from the root directory of the volume, /volN starts from the root directory of volume N.
+ * Resolved paths are kept in the path cache, including paths that did not exist.
+ * @param cur_dir The directory that relative paths start from.
+ * @param ret The struct* to store found data into.
+ * @param target The path of the file or directory to look for.
  * @return -1 if The file was not found, 0 if file was found.
  */
 int find_entry(struct entry_t* cur_dir, struct entry_t** ret, char* target) {
-    struct entry_t* peer = cur_dir;
     *ret = NULL;
-    char* file_name = strrchr(target, '/'); // Get last file name.
-    if (file_name == NULL) file_name = target;
-    while (peer != NULL) {
-        if (!(strcmp(peer->name, file_name))) { // Entry found.
-            *ret = peer;
+    if (cur_dir == NULL || target == NULL) return -1;
+    if (target[0] == '/') { // Absolute path.
+        cur_dir = entries[cur_dir->disk_index];
+        while (target[0] == '/') target++;
+        char volume[MAX_STRING_LEN] = {0};
+        unsigned int len = strcspn(target, "/");
+        memcpy(volume, target, len < MAX_STRING_LEN ? len : MAX_STRING_LEN - 1);
+        struct entry_t *root = find_volume(volume);
+        if (root != NULL) {
+            cur_dir = root;
+            target = target + len;
+        }
+    }
+    if (strlen(target) >= PATH_CACHE_PATH_MAX) return walk_path(cur_dir, target, ret);
+
+    // Look up the cache, the slot is chosen by the directory and the path.
+    unsigned int hash = 2166136261u ^ (unsigned int) ((uintptr_t) cur_dir >> 4);
+    for (char* c = target ; *c != 0 ; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 16777619u;
+    }
+    unsigned int disk_index = cur_dir->disk_index;
+    struct path_cache_slot_t *slot = &path_cache.slots[hash & (PATH_CACHE_SLOTS - 1)];
+    unsigned int found_generation = __atomic_load_n(&path_cache.found_generations[disk_index], __ATOMIC_ACQUIRE);
+    unsigned int missing_generation = __atomic_load_n(&path_cache.missing_generations[disk_index], __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&path_lock);
+    if (slot->base == cur_dir && slot->disk_index == disk_index && !strcmp(slot->path, target)
+        && slot->generation == (slot->entry != NULL ? found_generation : missing_generation)) {
+        *ret = slot->entry;
+        if (*ret == NULL) path_cache.negative_hits++;
+        else path_cache.hits++;
+        pthread_mutex_unlock(&path_lock);
+        return *ret == NULL ? -1 : 0;
+    }
+    path_cache.misses++;
+    pthread_mutex_unlock(&path_lock);
+
+    // Walk the path and keep the result, the generations were read before the walk so that a change during the
+    // walk makes this slot stale.
+    int found = walk_path(cur_dir, target, ret);
+    pthread_mutex_lock(&path_lock);
+    slot->base = cur_dir;
+    slot->entry = *ret;
+    slot->disk_index = disk_index;
+    slot->generation = *ret != NULL ? found_generation : missing_generation;
+    strcpy(slot->path, target);
+    pthread_mutex_unlock(&path_lock);
+    return found;
+}
+
+
+/**
+ * A function that finds the directory of a path and the last component of the path. Ex) a/b/c is c in a/b
+ * Nothing is looked up for the last component, so this is for creating, removing and renaming.
+ * @param cur_dir The directory that relative paths start from.
+ * @param target The path, this is not modified.
+ * @param dir The pointer to store the directory into.
+ * @param name The pointer to store the last component into, this points into target.
+ * @return -1 if the directory was not found or was not a directory, 0 if successful.
+ */
+int find_parent(struct entry_t* cur_dir, char* target, struct entry_t** dir, char** name) {
+    *dir = NULL;
+    *name = NULL;
+    if (cur_dir == NULL || target == NULL) return -1;
+    char* last = strrchr(target, '/');
+    if (last == NULL) { // Just a name in the directory.
+        *dir = cur_dir;
+        *name = target;
+        return 0;
+    }
+
+    char path[MAX_STRING_LEN] = {0};
+    unsigned int len = last == target ? 1 : last - target; // Keep / of paths like /a.
+    memcpy(path, target, len < MAX_STRING_LEN ? len : MAX_STRING_LEN - 1);
+    if (find_entry(cur_dir, dir, path) == -1) return -1;
+    struct inode *in = &partitions[(*dir)->disk_index].inode_table[(*dir)->inode_index];
+    if ((in->mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) {
+        *dir = NULL;
+        return -1;
+    }
+    *name = last + 1;
+    return 0;
+}
+
+
+/**
+ * A function that links an entry as the last child of a directory.
+ * This also sets the parent of the entry and registers it in the directory's index.
+ * @param dir The directory to link entry into.
+ * @param child The entry to link.
+ * @return -1 if unsuccessful, 0 if successful.
+ */
+int dir_link_entry(struct entry_t* dir, struct entry_t* child) {
+    lock_dir(dir);
+    dir_children(dir); // Load the directory first, otherwise the new child will be loaded twice.
+    child->parent = dir;
+    child->sibling = NULL;
+
+    if (dir->child == NULL) { // If current directory was an empty directory, just link this as child.
+        dir->child = child;
+    } else { // Otherwise, attach this after the last sibling.
+        if (dir->last_child == NULL) { // Find the last sibling once, it is kept afterwards.
+            dir->last_child = dir->child;
+            while (dir->last_child->sibling != NULL) dir->last_child = dir->last_child->sibling;
         }
+        dir->last_child->sibling = child;
+    }
+    dir->last_child = child;
+    dir->child_count++;
+    pthread_mutex_lock(&dentry_lock);
+    dentry_cache.entry_count++;
+    pthread_mutex_unlock(&dentry_lock);
+    path_cache_invalidate(dir->disk_index, PATH_CACHE_MISSING);
+
+    if (dir->index != NULL && dir_index_put(dir->index, child) == -1) dir_index_release(dir); // Rebuild later.
+    unlock_dir(dir);
+    return 0;
+}
+
+
+/**
+ * A function that unlinks an entry from a directory.
+ * @param dir The directory that the entry is located at.
+ * @param child The entry to unlink.
+ * @return -1 if the entry was not in the directory, 0 if successful.
+ */
+int dir_unlink_entry(struct entry_t* dir, struct entry_t* child) {
+    lock_dir(dir);
+    struct entry_t *prev = NULL;
+    struct entry_t *peer = dir->child;
+    while (peer != NULL && peer != child) { // Find the sibling that is connected to current entry.
+        prev = peer;
         peer = peer->sibling;
     }
-    return *ret == NULL ? -1 : 0;
+    if (peer == NULL) {
+        unlock_dir(dir);
+        return -1;
+    }
+
+    if (prev == NULL) dir->child = child->sibling; // If this was the first child in the directory.
+    else prev->sibling = child->sibling; // Connect before and next.
+    if (dir->last_child == child) dir->last_child = prev;
+
+    if (dir->index != NULL) dir_index_remove(dir->index, child);
+    child->sibling = NULL;
+    dir->child_count--;
+    pthread_mutex_lock(&dentry_lock);
+    dentry_cache.entry_count--;
+    pthread_mutex_unlock(&dentry_lock);
+    path_cache_invalidate(dir->disk_index, PATH_CACHE_FOUND);
+    unlock_dir(dir);
+    return 0;
+}
+
+
+/**
+ * A function that renames an entry and updates its parent's index.
+ * @param entry The entry to rename.
+ * @param name The new name.
+ * @return 0.
+ */
+int rename_entry(struct entry_t* entry, char* name) {
+    if (entry->parent != NULL) lock_dir(entry->parent);
+    struct dir_index_t *index = entry->parent != NULL ? entry->parent->index : NULL;
+    if (index != NULL) dir_index_remove(index, entry);
+    memset(entry->name, 0, sizeof(entry->name));
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    if (index != NULL && dir_index_put(index, entry) == -1) dir_index_release(entry->parent);
+    path_cache_invalidate(entry->disk_index, PATH_CACHE_FOUND | PATH_CACHE_MISSING);
+    if (entry->parent != NULL) unlock_dir(entry->parent);
+    return 0;
 }
@@ -11,26 +11,117 @@
 #include "common.h"
 
 
+#define DIR_INDEX_INIT_BUCKETS 16
+#define DIR_VIEW_COUNT 8 // Views of a directory file that are mapped at once when loading it.
+
+#ifndef DENTRY_CACHE_MAX
+#define DENTRY_CACHE_MAX 1024 // Soft limit of entries that are kept in memory.
+#endif
+#define PATH_CACHE_SLOTS 256   // Resolved paths that are kept, this must be a power of 2.
+#define PATH_CACHE_PATH_MAX 120 // Longer paths are resolved without the path cache.
+#define PATH_CACHE_FOUND 0x01   // For path_cache_invalidate, paths that were found may have changed.
+#define PATH_CACHE_MISSING 0x02 // For path_cache_invalidate, paths that did not exist may exist now.
+
+
+/**
+ * A struct that implements hash index of a directory.
+ * Entries are chained with entry_t's hash_next, so this does not allocate anything per entry.
+ */
+struct dir_index_t {
+    struct entry_t **buckets;
+    unsigned int bucket_count;
+    unsigned int entry_count;
+};
+
+
 /**
  * A struct that implements Left child right sibling tree.
  */
 struct entry_t {
-    char name[16];       // name
+    char name[DIR_ENTRY_NAME_MAX + 1]; // name, volumes in the original format keep up to DIR_SLOT_NAME_MAX characters.
 
     unsigned int disk_index; // For storing which disk this entry is stored at.
     unsigned int inode_index;
+    unsigned int dir_offset; // The offset of this entry in the parent directory file.
     //struct inode in; // For storing this entry's inode.
 
     struct entry_t *sibling;
     struct entry_t *child;
     struct entry_t *parent;
+
+    struct entry_t *last_child;  // The last child of this directory, NULL if not known yet.
+    struct entry_t *hash_next;   // The next entry in the same bucket of the parent's index.
+    struct dir_index_t *index;   // Hash index of the children, NULL until the first lookup.
+    unsigned int *dir_space;     // Free space of each block of the directory file, NULL until the first insert.
+    unsigned int dir_space_count; // The count of blocks in dir_space.
+
+    unsigned char loaded;        // Whether if the children of this directory were loaded from the disk.
+    unsigned int child_count;    // The count of children that are loaded.
+    struct entry_t *lru_prev;    // The more recently used loaded directory.
+    struct entry_t *lru_next;    // The less recently used loaded directory.
+    unsigned char deleted;       // Whether if this entry was deleted and is waiting to be freed.
 };
 
 
-struct entry_t* load_entries(struct partition);
+/**
+ * A struct that implements cache of loaded directories.
+ * Loaded directories are kept in LRU order, so that least recently used ones can be unloaded.
+ */
+struct dentry_cache_t {
+    struct entry_t *head;      // The most recently used loaded directory.
+    struct entry_t *tail;      // The least recently used loaded directory.
+    unsigned int entry_count;  // The count of entries that are loaded in total.
+    unsigned int max_entries;  // The count of entries to shrink the cache into.
+    struct entry_t *retired;   // Deleted entries that are freed when nobody is using entries, chained by hash_next.
+};
+
+
+/**
+ * A struct that implements a single resolved path in the path cache.
+ */
+struct path_cache_slot_t {
+    struct entry_t *base;        // The directory that the path was resolved from.
+    struct entry_t *entry;       // The entry of the path, NULL if the path did not exist (negative entry).
+    unsigned int disk_index;     // The volume of base, base itself may be freed once the slot is stale.
+    unsigned int generation;     // The generation of the volume for the kind of this slot, found or missing.
+    char path[PATH_CACHE_PATH_MAX];
+};
+
+
+/**
+ * A struct that implements cache of resolved paths, so that a path is not walked component by component every time.
+ * Slots are never invalidated one by one, changes of a volume bump its generations instead.
+ * Unlinking, renaming or unloading entries makes all paths that were found stale, linking or renaming entries makes
+ * all paths that did not exist stale. So creating files keeps the found paths, and deleting keeps the missing ones.
+ */
+struct path_cache_t {
+    struct path_cache_slot_t slots[PATH_CACHE_SLOTS];
+    unsigned int found_generations[MAX_IMG_COUNT];
+    unsigned int missing_generations[MAX_IMG_COUNT];
+    unsigned int hits;           // Statistics: lookups that found the entry in the cache.
+    unsigned int negative_hits;  // Statistics: lookups that found that the path did not exist in the cache.
+    unsigned int misses;         // Statistics: lookups that walked the path.
+};
+
+
+struct entry_t* load_entries(unsigned int);
 int release_entries(struct entry_t*);
-int insert_entry(struct entry_t*, struct entry_t*, unsigned char*, unsigned int, unsigned int,
-                 unsigned int, struct inode*, unsigned char, unsigned char);
+struct entry_t* dir_children(struct entry_t*);
+void dentry_cache_shrink(struct entry_t*);
+void retire_entry(struct entry_t*);
+
+// For path resolution.
 int find_entry(struct entry_t*, struct entry_t**, char*);
+int find_parent(struct entry_t*, char*, struct entry_t**, char**);
+struct entry_t* find_volume(char*);
+void path_cache_invalidate(unsigned int, unsigned char);
+void path_cache_status(unsigned int*, unsigned int*, unsigned int*);
+
+// For directory index.
+int find_child(struct entry_t*, struct entry_t**, char*);
+int dir_link_entry(struct entry_t*, struct entry_t*);
+int dir_unlink_entry(struct entry_t*, struct entry_t*);
+int rename_entry(struct entry_t*, char*);
+void dir_index_release(struct entry_t*);
 
 #endif //MYFS_DISKTREE_H
@@ -5,15 +5,23 @@
 //
 
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "diskutil.h"
 
-extern char disks[MAX_STRING_LEN][MAX_IMG_COUNT];
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
 extern struct partition partitions[MAX_IMG_COUNT];
 extern int disk_count;
 extern struct entry_t* entries[MAX_IMG_COUNT];
 extern uint16_t loaded_partitions;
-extern unsigned char block_stats[MAX_BLOCK_COUNT][MAX_IMG_COUNT];
-extern unsigned char inode_stats[MAX_INODE_COUNT][MAX_IMG_COUNT];
+extern struct bitmap_t block_bitmaps[MAX_IMG_COUNT];
+extern struct bitmap_t inode_bitmaps[MAX_IMG_COUNT];
+extern struct journal_t journals[MAX_IMG_COUNT];
+extern struct cow_map_t cow_maps[MAX_IMG_COUNT];
+extern struct bitmap_t snapshot_blocks[MAX_IMG_COUNT];
+extern struct delalloc_t delallocs[MAX_IMG_COUNT];
 
 
 /**
@@ -31,14 +39,22 @@ int scan_disks() {
     if (d) {
         while ((dir = readdir(d)) != NULL) {
             if (strstr(dir->d_name, ".img")) { // If the file ends in .img, consider it a disk.
-                strcpy(disks[disk_count], dir->d_name);
-#ifdef DEBUG
-                printf("[DEBUG] Found disk %d: %s\n", disk_count, disks[disk_count]);
-#endif
+                if (disk_count == MAX_IMG_COUNT) { // We can't handle more disks than MAX_IMG_COUNT.
+                    printf("[WARNING] Too many disks, ignoring %s\n", dir->d_name);
+                    continue;
+                }
+                strncpy(disks[disk_count], dir->d_name, MAX_STRING_LEN - 1);
                 disk_count++;
             }
         }
         closedir(d);
+
+        // readdir does not have any order, so sort disks by name to keep volume indexes the same every time.
+        qsort(disks, disk_count, sizeof(disks[0]), (int (*)(const void*, const void*)) strcmp);
+#ifdef DEBUG
+        for (int i = 0 ; i < disk_count ; i++)
+            printf("[DEBUG] Found disk %d: %s\n", i, disks[i]);
+#endif
         return disk_count == 0 ? -1 : 0; // If there were no disk available, return -1;
     } else {
         printf("[ERROR] Could not get information of current directory.\n");
@@ -47,6 +63,37 @@ int scan_disks() {
 }
 
 
+/**
+ * A function that checks geometry of a disk.
+ * Disks in the original format have a fixed geometry, which is filled into the super block in memory.
+ * @param disk_index The disk index to check geometry.
+ * @return -1 if the geometry was invalid, 0 if successful.
+ */
+static int load_geometry(int disk_index) {
+    struct super_block *sb = &partitions[disk_index].s;
+    if (!check_feature(disk_index, MYFS_FEATURE_GEOMETRY)) { // Original format, 4MB.
+        sb->block_size = BLOCK_SIZE;
+        sb->num_inodes = MAX_INODE_COUNT;
+        sb->num_blocks = MAX_BLOCK_COUNT;
+        sb->first_data_block = 0x2000 / BLOCK_SIZE;
+        return 0;
+    }
+
+    unsigned long long data_start = (unsigned long long) sb->first_data_block * sb->block_size;
+    unsigned long long end = data_start + (unsigned long long) sb->num_blocks * sb->block_size;
+    if (sb->block_size < MIN_BLOCK_SIZE || sb->block_size > MAX_BLOCK_SIZE || (sb->block_size & (sb->block_size - 1))
+        || sb->num_inodes <= sb->first_inode || sb->num_inodes > MAX_VOLUME_INODES || sb->num_blocks == 0
+        || end > MAX_VOLUME_SIZE || sb->inode_table_start < sizeof(struct super_block)
+        || sb->inode_table_start + sb->num_inodes * sizeof(struct inode) > sb->inode_bitmap_start
+        || sb->inode_bitmap_start + (sb->num_inodes + 7) / 8 > sb->block_bitmap_start
+        || sb->block_bitmap_start + (sb->num_blocks + 7) / 8 > data_start) {
+        printf("[ERROR] Disk %d (%s) has invalid geometry.\n", disk_index, disks[disk_index]);
+        return -1;
+    }
+    return 0;
+}
+
+
 /**
  * A function that reads disk's super block.
  * @param disk_index The disk index to look super block from.
@@ -87,9 +134,10 @@ int load_super_block(int disk_index) {
         }
 
         // Dump values into the struct
+        // Everything after the volume name (MyFS extensions and padding) is read at once.
         memcpy(&tmp_sp, values, sizeof(unsigned int) * 10);
         (void)! fread(tmp_sp.volume_name, sizeof(char) * 24, 1, fp);
-        (void)! fread(tmp_sp.padding, sizeof(char) * 960, 1, fp);
+        (void)! fread(&tmp_sp.features, sizeof(struct super_block) - offsetof(struct super_block, features), 1, fp);
 
 #ifdef DEBUG
         // Print partition information.
@@ -106,17 +154,92 @@ int load_super_block(int disk_index) {
         printf("[DEBUG] Number of Free Blocks: %08x\n", tmp_sp.num_free_blocks);
         printf("[DEBUG] First Data Block: %08x\n", tmp_sp.first_data_block);
         printf("       └ Volume Name: %s\n", tmp_sp.volume_name);
+        printf("[DEBUG] Features: %08x\n", tmp_sp.features);
 #endif
         cur_p->disk_index = disk_index;
         fclose(fp);
         cur_p->s = tmp_sp;
-        return 0;
+        return load_geometry(disk_index);
     } else {
         return -1;
     }
 }
 
 
+/**
+ * A function that maps the whole disk into memory.
+ * The mapping is private, so changes in memory reach the disk only when they are written (or journaled).
+ * A shared mapping would let the kernel write changed metadata back at any time, even before its transaction was
+ * committed, which breaks the ordering that the journal relies on.
+ * The cost is that every changed page becomes a private copy, which is kept even after it was written back.
+ * To bound that, the journal calls trim_disk_image every IMAGE_TRIM_BYTES bytes written back, which drops the copies
+ * so that the pages are read again from the disk.
+ * Pages are read when they are first accessed, therefore mounting a big disk does not read all of it.
+ * @param disk_index The disk index to map.
+ * @return -1 if not successful, 0 if successful.
+ */
+int map_disk_image(int disk_index) {
+    struct partition* cur_p = &partitions[disk_index];
+    size_t size = ((size_t) cur_p->s.first_data_block + cur_p->s.num_blocks) * cur_p->s.block_size;
+    struct stat st;
+    int fd = open(disks[disk_index], O_RDONLY);
+    if (fd == -1) return -1;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < size) { // Pages past the end of file can not be accessed.
+        printf("[ERROR] Disk %d (%s) is smaller than its geometry (%zu bytes).\n", disk_index, disks[disk_index], size);
+        close(fd);
+        return -1;
+    }
+
+    void *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) return -1;
+    cur_p->image = image;
+    cur_p->image_size = size;
+    cur_p->image_written = 0;
+    return 0;
+}
+
+
+/**
+ * A function that counts bytes written back from the mapping of a disk, see trim_disk_image.
+ * @param disk_index The disk index that was written.
+ * @param length The count of bytes.
+ */
+void count_image_write(unsigned int disk_index, unsigned int length) {
+    __atomic_add_fetch(&partitions[disk_index].image_written, length, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * A function that drops the private copies of pages of the disk mapping, so their memory is given back.
+ * The next access reads the page from the disk again, which has the same data since every change was written back.
+ * Pages of writes that are still pending in the running transaction are not on the disk yet, so they are kept.
+ * Every operation writes what it changed in the mapping before it ends, so this must be called while no operation is
+ * running and after the writes in flight completed (the journal does it under its lock, after ioring_drain).
+ * Readers may still run, they see the same data before and after.
+ * @param disk_index The disk index to trim.
+ * @param keep Pending writes whose pages must be kept, sorted by their offsets.
+ * @param keep_count The count of pending writes.
+ * @return -1 if failure, 0 if successful.
+ */
+int trim_disk_image(unsigned int disk_index, struct journal_entry_t* keep, unsigned int keep_count) {
+    struct partition *cur_p = &partitions[disk_index];
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = 0; // The first page that can be dropped.
+    int ret = 0;
+    for (unsigned int i = 0 ; i <= keep_count ; i++) {
+        size_t end = i < keep_count ? keep[i].offset / page * page : cur_p->image_size;
+        if (end > start && madvise(cur_p->image + start, end - start, MADV_DONTNEED) == -1) ret = -1;
+        if (i < keep_count) {
+            size_t next = ((size_t) keep[i].offset + keep[i].length + page - 1) / page * page;
+            start = next > start ? next : start;
+        }
+    }
+    __atomic_store_n(&cur_p->image_written, 0, __ATOMIC_RELAXED);
+    return ret;
+}
+
+
 /**
  * A function that loads inode table from the disk partition.
  * @param disk_index The disk index to look inode table from.
@@ -124,31 +247,22 @@ int load_super_block(int disk_index) {
  */
 int load_inode_table(int disk_index) {
     struct partition* cur_p = &partitions[disk_index];
-    FILE *fp = fopen(disks[disk_index], "rb");
 #ifdef DEBUG
     printf("[INFO] Loading inode table from disk %d: %s...\n", disk_index, disks[disk_index]);
 #endif
-
-    unsigned char buffer[sizeof(struct inode) * 224]; // Generate a buffer for inode table.
-    if (fp) {
-        fseek(fp, 0x400, SEEK_SET); // This is where the inode table starts
-        (void)! fread(buffer, sizeof(struct inode) * 224, 1, fp);
-        memcpy(&(cur_p->inode_table), buffer, sizeof(struct inode) * 224); // Dump values into inode table.
-        fclose(fp);
+    if (cur_p->image == NULL) return -1;
+    cur_p->inode_table = (struct inode*) (cur_p->image + inode_table_offset(disk_index)); // This is where the inode table starts
 
 #ifdef DEBUG
-        // Print partition information.
-        for (int i = 0 ; i < 224 ; i++) {
-            printf("[DEBUG] Inode table %d: Mode %x, Locked %x, Date %x, Size %x, Indirect Block %d\n",
-                   i, cur_p->inode_table[i].mode, cur_p->inode_table[i].locked, cur_p->inode_table[i].date,
-                   cur_p->inode_table[i].size, cur_p->inode_table[i].indirect_inode);
-        }
-        printf("[INFO] Loaded inode table from disk %d: %s...\n", disk_index, disks[disk_index]);
-#endif
-        return 0;
-    } else {
-        return -1;
+    // Print partition information.
+    for (unsigned int i = 0 ; i < cur_p->s.num_inodes ; i++) {
+        printf("[DEBUG] Inode table %d: Mode %x, Locked %x, Date %x, Size %x, Indirect Block %d\n",
+               i, cur_p->inode_table[i].mode, cur_p->inode_table[i].locked, cur_p->inode_table[i].date,
+               cur_p->inode_table[i].size, cur_p->inode_table[i].indirect_inode);
     }
+    printf("[INFO] Loaded inode table from disk %d: %s...\n", disk_index, disks[disk_index]);
+#endif
+    return 0;
 }
 
 
@@ -159,23 +273,15 @@ int load_inode_table(int disk_index) {
  */
 int load_data_blocks(int disk_index) {
     struct partition* cur_p = &partitions[disk_index];
-    FILE *fp = fopen(disks[disk_index], "rb");
 #ifdef DEBUG
     printf("[INFO] Loading data blocks from disk %d: %s...\n", disk_index, disks[disk_index]);
 #endif
-    unsigned char buffer[sizeof(struct blocks) * 4088]; // Generate a buffer for inode table.
-    if (fp) {
-        fseek(fp, 0x2000, SEEK_SET); // This is where the inode table starts
-        (void)! fread(buffer, sizeof(struct blocks) * 4088, 1, fp);
-        memcpy(&(cur_p->data_blocks), buffer, sizeof(struct blocks) * 4088); // Dump values into inode table.
-        fclose(fp);
+    if (cur_p->image == NULL) return -1;
+    cur_p->block_data = cur_p->image + block_offset(disk_index, 0); // This is where the data blocks start
 #ifdef DEBUG
-        printf("[INFO] Loaded data blocks from disk %d: %s...\n", disk_index, disks[disk_index]);
+    printf("[INFO] Loaded data blocks from disk %d: %s...\n", disk_index, disks[disk_index]);
 #endif
-        return 0;
-    } else {
-        return -1;
-    }
+    return 0;
 }
 
 
@@ -185,15 +291,263 @@ int load_data_blocks(int disk_index) {
  * @return -1 if failure, 0 if success.
  */
 int load_root(int disk_index) {
-    struct partition* cur_p = &partitions[disk_index];
-    entries[disk_index] = load_entries(*cur_p);
-    if (entries[disk_index] == NULL) {
+    entries[disk_index] = load_entries(disk_index);
+    return entries[disk_index] == NULL ? -1 : 0;
+}
+
+
+/**
+ * A function that mounts a single disk.
+ * This loads super block, replays journal, sets up the write ring, maps the disk, loads inode table, data blocks,
+ * scans blocks, inodes, CoW copies and snapshots, sets up delayed allocation and the defragmenter,
+ * enables journal then loads root directory.
+ * Everything this touches belongs to the disk itself, so disks can be mounted concurrently.
+ * @param disk_index The disk index to mount.
+ * @return -1 if failure, 0 if successful.
+ */
+int mount_disk(int disk_index) {
+    if (load_super_block(disk_index) || init_volume_locks(disk_index) || journal_replay(disk_index)
+        || ioring_init(disk_index) || map_disk_image(disk_index) || load_inode_table(disk_index) || load_data_blocks(disk_index)
+        || scan_disk_blocks(disk_index) || scan_disk_inodes(disk_index) || scan_cow_inodes(disk_index)
+        || scan_snapshots(disk_index) || delalloc_init(&delallocs[disk_index], partitions[disk_index].s.num_inodes)
+        || defrag_init(disk_index) || journal_init(disk_index) || load_root(disk_index)) {
+        printf("[ERROR] Could not mount disk %d: %s\n", disk_index, disks[disk_index]);
         return -1;
-    } else {
-        printf("[INFO] Successfully mounted disk %d: %s\n", disk_index, disks[disk_index]);
-        loaded_partitions = loaded_partitions | (0x1 << disk_index); // Set current partition as loaded.
-        return 0;
     }
+    return 0;
+}
+
+
+/**
+ * A function that is run by mount threads.
+ * @param arg The mount job of this thread.
+ * @return NULL.
+ */
+static void* mount_worker(void* arg) {
+    struct mount_job_t *job = (struct mount_job_t*) arg;
+    job->result = mount_disk(job->disk_index);
+    return NULL;
+}
+
+
+/**
+ * A function that mounts all disks that were found by scan_disks.
+ * Each disk is mounted in its own thread, so mounting takes as long as the slowest disk.
+ * loaded_partitions is only updated after all threads were joined.
+ * @return -1 if no disk could be mounted, 0 if successful.
+ */
+int mount_disks() {
+    struct mount_job_t jobs[MAX_IMG_COUNT];
+    for (int i = 0 ; i < disk_count ; i++) {
+        jobs[i].disk_index = i;
+        jobs[i].result = -1;
+        jobs[i].started = pthread_create(&jobs[i].thread, NULL, mount_worker, &jobs[i]) == 0;
+        if (!jobs[i].started) mount_worker(&jobs[i]); // Could not create thread, just mount it here.
+    }
+
+    for (int i = 0 ; i < disk_count ; i++) {
+        if (jobs[i].started) pthread_join(jobs[i].thread, NULL);
+        if (jobs[i].result == 0) {
+            printf("[INFO] Successfully mounted disk %d: %s\n", i, disks[i]);
+            loaded_partitions = loaded_partitions | (0x1 << i); // Set current partition as loaded.
+        }
+    }
+    return (loaded_partitions & 0x1) ? 0 : -1; // Volume 0 is the default volume, so it must be mounted.
+}
+
+
+/**
+ * A function that unmounts a single disk.
+ * The background defragmenter is stopped, delayed appends are written, the journal is closed and writes in flight
+ * are waited for first, then the directory tree, bitmaps, locks and the mapping of the disk are released.
+ * The caller must make sure that nobody is using the disk anymore.
+ * @param disk_index The disk index to unmount.
+ * @return -1 if failure, 0 if successful.
+ */
+int unmount_disk(int disk_index) {
+    defrag_release(disk_index); // The background defragmenter must not touch the disk anymore.
+    int ret = flush_delayed_writes(disk_index);
+    if (journal_close(disk_index) == -1) ret = -1;
+    if (ioring_release(disk_index) == -1) ret = -1;
+    if (release_entries(entries[disk_index]) == -1) ret = -1;
+    free(entries[disk_index]);
+    entries[disk_index] = NULL;
+    path_cache_invalidate(disk_index, PATH_CACHE_FOUND | PATH_CACHE_MISSING); // The next mount may be another image.
+    bitmap_release(&block_bitmaps[disk_index]);
+    bitmap_release(&inode_bitmaps[disk_index]);
+    bitmap_release(&snapshot_blocks[disk_index]);
+    cow_map_release(&cow_maps[disk_index]);
+    delalloc_release(&delallocs[disk_index]);
+    release_volume_locks(disk_index);
+    struct partition *cur_p = &partitions[disk_index];
+    if (cur_p->image != NULL) munmap(cur_p->image, cur_p->image_size);
+    cur_p->image = NULL;
+    cur_p->inode_table = NULL;
+    cur_p->block_data = NULL;
+    return ret;
+}
+
+
+/**
+ * A function that writes the changed part of a bitmap of a v2 disk, which is stored outside of the super block.
+ * The bitmap is written in chunks of 1KB that always start at the same offsets, so that writing a chunk again
+ * replaces the earlier write in the running transaction.
+ * @param disk_index The disk index to write bitmap into.
+ * @param bm The bitmap to write.
+ * @param start The offset of the bitmap in the disk.
+ * @param size The size of the bitmap in the disk.
+ * @return -1 if failure, 0 if successful.
+ */
+static int write_bitmap_chunks(unsigned int disk_index, struct bitmap_t* bm, unsigned int start, unsigned int size) {
+    unsigned char *area = partitions[disk_index].image + start;
+    unsigned int first = 0, length = 0;
+    if (bm->words == NULL || !bitmap_take_dirty(bm, &first, &length)) return 0;
+
+    for (unsigned int chunk = first - first % BLOCK_SIZE ; chunk < first + length && chunk < size ; chunk += BLOCK_SIZE) {
+        unsigned int len = size - chunk < BLOCK_SIZE ? size - chunk : BLOCK_SIZE;
+        memcpy(area + chunk, (unsigned char*) bm->words + chunk, len); // Little endian, bytes map directly.
+        if (journal_write(disk_index, start + chunk, area + chunk, len) == -1) return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that writes super block of a disk into the disk.
+ * The block and inode bitmaps are stored into the super block before being written.
+ * v2 disks have bitmaps outside of the super block, only their changed parts are written.
+ * This goes through the journal, so it reaches the disk when the running transaction is committed.
+ * @param disk_index The disk index to write super block into.
+ * @return -1 if failure, 0 if successful.
+ */
+int write_super_block(unsigned int disk_index) {
+    struct partition *cur_p = &partitions[disk_index];
+    if (check_feature(disk_index, MYFS_FEATURE_GEOMETRY)) {
+        if (write_bitmap_chunks(disk_index, &block_bitmaps[disk_index], cur_p->s.block_bitmap_start,
+                                (cur_p->s.num_blocks + 7) / 8) == -1
+            || write_bitmap_chunks(disk_index, &inode_bitmaps[disk_index], cur_p->s.inode_bitmap_start,
+                                   (cur_p->s.num_inodes + 7) / 8) == -1) return -1;
+        return journal_write(disk_index, 0, &cur_p->s, sizeof(struct super_block));
+    }
+
+    // Store bitmaps into the super block, skip the ones that were not loaded yet.
+    if (block_bitmaps[disk_index].words != NULL)
+        bitmap_store(&block_bitmaps[disk_index], cur_p->s.block_bitmap, sizeof(cur_p->s.block_bitmap));
+    if (inode_bitmaps[disk_index].words != NULL)
+        bitmap_store(&inode_bitmaps[disk_index], cur_p->s.inode_bitmap, sizeof(cur_p->s.inode_bitmap));
+    return journal_write(disk_index, 0, &cur_p->s, sizeof(struct super_block));
+}
+
+
+/**
+ * A function that checks if a disk has a specific MyFS feature enabled.
+ * Disks that came from the original format have no feature magic, therefore have no features.
+ * @param disk_index The disk index to check.
+ * @param feature The feature flag to check. Ex) MYFS_FEATURE_BLOCK_BITMAP
+ * @return 1 if the feature was enabled, 0 if not.
+ */
+int check_feature(unsigned int disk_index, unsigned int feature) {
+    unsigned int features = partitions[disk_index].s.features;
+    if ((features & ~MYFS_FEATURE_MASK) != MYFS_FEATURE_MAGIC) return 0;
+    return (features & feature) == feature;
+}
+
+
+/**
+ * A function that enables a specific MyFS feature in the super block.
+ * This only sets the flag in memory, call write_super_block to emit it to the disk.
+ * @param disk_index The disk index to set feature.
+ * @param feature The feature flag to set.
+ */
+void set_feature(unsigned int disk_index, unsigned int feature) {
+    struct super_block *sb = &partitions[disk_index].s;
+    if ((sb->features & ~MYFS_FEATURE_MASK) != MYFS_FEATURE_MAGIC) sb->features = MYFS_FEATURE_MAGIC;
+    sb->features = sb->features | (feature & MYFS_FEATURE_MASK);
+}
+
+
+/**
+ * A function that returns the compression method that whole file writes of a disk use.
+ * @param disk_index The disk index to look for.
+ * @return The compression method, MYFS_COMPRESS_*.
+ */
+unsigned int get_compression(unsigned int disk_index) {
+    if (!check_feature(disk_index, MYFS_FEATURE_COMPRESSION)) return MYFS_COMPRESS_NONE;
+    return partitions[disk_index].s.compression;
+}
+
+
+/**
+ * A function that changes the compression method of a disk.
+ * Files keep their data until they are written again, the method is stored in each compressed file.
+ * @param disk_index The disk index to change.
+ * @param method The compression method, MYFS_COMPRESS_*.
+ * @return -1 if failure, 0 if successful.
+ */
+int set_compression(unsigned int disk_index, unsigned int method) {
+    journal_begin_exclusive(disk_index); // Writers read the method during their operation.
+    set_feature(disk_index, MYFS_FEATURE_COMPRESSION);
+    partitions[disk_index].s.compression = method;
+    int ret = write_super_block(disk_index);
+    journal_end(disk_index);
+    return ret;
+}
+
+
+/**
+ * A function that returns the block size of a disk.
+ * @param disk_index The disk index to look for.
+ * @return The block size in bytes.
+ */
+unsigned int get_block_size(unsigned int disk_index) {
+    return partitions[disk_index].s.block_size;
+}
+
+
+/**
+ * A function that returns a data block of a disk in memory.
+ * Blocks are s.block_size bytes long, so this must be used instead of indexing struct blocks.
+ * @param disk_index The disk index to look for.
+ * @param block_index The index of the data block.
+ * @return The data block.
+ */
+struct blocks* get_block(unsigned int disk_index, unsigned int block_index) {
+    struct partition *cur_p = &partitions[disk_index];
+    return (struct blocks*) (cur_p->block_data + (size_t) block_index * cur_p->s.block_size);
+}
+
+
+/**
+ * A function that returns the offset of a data block in the disk.
+ * @param disk_index The disk index to look for.
+ * @param block_index The index of the data block.
+ * @return The offset in bytes.
+ */
+unsigned int block_offset(unsigned int disk_index, unsigned int block_index) {
+    struct super_block *sb = &partitions[disk_index].s;
+    return (sb->first_data_block + block_index) * sb->block_size;
+}
+
+
+/**
+ * A function that returns the offset of the inode table in the disk.
+ * @param disk_index The disk index to look for.
+ * @return The offset in bytes.
+ */
+unsigned int inode_table_offset(unsigned int disk_index) {
+    if (!check_feature(disk_index, MYFS_FEATURE_GEOMETRY)) return INODE_TABLE_START;
+    return partitions[disk_index].s.inode_table_start;
+}
+
+
+/**
+ * A function that returns the longest file name that directories of a disk can store.
+ * @param disk_index The disk index to look for.
+ * @return The maximum length of a file name.
+ */
+unsigned int max_name_len(unsigned int disk_index) {
+    if (check_feature(disk_index, MYFS_FEATURE_DIR_ENTRY)) return DIR_ENTRY_NAME_MAX;
+    return DIR_SLOT_NAME_MAX;
 }
 
 
@@ -206,9 +560,9 @@ int load_root(int disk_index) {
  */
 __attribute__((unused)) int generate_dentry(int disk_index, int inode_index, struct dentry* ret) {
     ret->inode = inode_index;
-    struct partition cur_p = partitions[disk_index];
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
     // Parse file mode and set file type into dentry.
-    switch (cur_p.inode_table[inode_index].mode & 0x10000) {
+    switch (in->mode & 0x10000) {
         case 0x10000: // Regular file
             ret->file_type = DENTRY_TYPE_REG_FILE;
             break;
@@ -266,10 +620,11 @@ int generate_prefix_str(unsigned int mode, char* ret) {
  * @return 0.
  */
 int impl_ls(struct entry_t* dir, unsigned char level) {
+    TRACE_OP(TRACE_LS);
 #ifdef DEBUG
     printf("[DEBUG] Current directory : %s\n", dir->name);
 #endif
-    struct entry_t* tmp = dir->child;
+    struct entry_t* tmp = dir_children(dir);
     unsigned int entry_count = 0;
     while(tmp != NULL) {
         // Skip .. and .
@@ -277,11 +632,12 @@ int impl_ls(struct entry_t* dir, unsigned char level) {
             char perm_info[11];
             struct inode in = partitions[tmp->disk_index].inode_table[tmp->inode_index];
             generate_prefix_str(in.mode, perm_info);
+            unsigned int size = get_file_size(tmp); // Before compression, including delayed appends.
             if (level == 3 && (strlen(tmp->name) >= 1))
-                printf("%s %10d %s(Inode %d @ disk %d)\n", perm_info, in.size, tmp->name,
+                printf("%s %10d %s(Inode %d @ disk %d)\n", perm_info, size, tmp->name,
                        tmp->inode_index, tmp->disk_index);
             else if (level == 2 && (strlen(tmp->name) >= 1))
-                printf("%s %10d %s\n", perm_info, in.size, tmp->name);
+                printf("%s %10d %s\n", perm_info, size, tmp->name);
             else {
                 printf("%s  ", tmp->name);
                 if ((entry_count % LS_SPLIT_COUNT) == 0 && (tmp->sibling != NULL) && entry_count != 0){
@@ -300,24 +656,50 @@ int impl_ls(struct entry_t* dir, unsigned char level) {
 /**
  * A function that mimics cat in bash.
  * @param cur_dir The current directory's entry.
- * @param target The target file's name.
+ * @param target The path of the target file.
  * @return -1 if unsuccessful, 0 if successful.
  */
 int impl_cat(struct entry_t* cur_dir, char* target) {
+    TRACE_OP(TRACE_CAT);
     struct entry_t* res;
     if (find_entry(cur_dir, &res, target) == 0) {
-        unsigned char* buf = NULL;
-        if (read_file_data(res, &buf) == -1) {
-            printf("cat: Could not read file\n");
-            return -1;
-        } else {
-            struct inode in = partitions[cur_dir->disk_index].inode_table[res->inode_index];
-            if ((in.mode & INODE_MODE_REG_FILE) == INODE_MODE_REG_FILE) { // rmdir cannot delete file.
-                printf("%s", buf);
-                free(buf);
-            } else { // Disable 'cat'ing a directory.
-                printf("cat: %s: is a directory\n", target);
+        TRACE_BYTES(get_file_size(res));
+        struct inode *in = &partitions[res->disk_index].inode_table[res->inode_index];
+        if ((in->mode & INODE_MODE_REG_FILE) != INODE_MODE_REG_FILE) { // Disable 'cat'ing a directory.
+            printf("cat: %s: is a directory\n", target);
+            return 0;
+        }
+
+        // Compressed data can not be printed in place, print the decompressed data instead.
+        if ((in->mode & INODE_MODE_COMPRESSED) == INODE_MODE_COMPRESSED) {
+            unsigned char *data = NULL;
+            if (read_file_data(res, &data) == -1) {
+                printf("cat: Could not read file\n");
+                return -1;
+            }
+            fputs((char*) data, stdout);
+            free(data);
+            return 0;
+        }
+
+        // Print the blocks in place, just like printf("%s") this stops at the first NULL.
+        struct iovec views[CAT_VIEW_COUNT];
+        unsigned int offset = 0;
+        unsigned char done = 0;
+        while (!done) {
+            int count = read_file_view(res, offset, in->size, views, CAT_VIEW_COUNT);
+            if (count == -1) {
+                printf("cat: Could not read file\n");
+                return -1;
             }
+            done = count == 0;
+            for (int i = 0 ; i < count && !done ; i++) {
+                size_t len = strnlen(views[i].iov_base, views[i].iov_len);
+                fwrite(views[i].iov_base, 1, len, stdout);
+                offset = offset + views[i].iov_len;
+                done = len < views[i].iov_len;
+            }
+            release_file_view(res);
         }
     } else {
         printf("cat: %s: No such file or directory\n", target);
@@ -330,21 +712,26 @@ int impl_cat(struct entry_t* cur_dir, char* target) {
 /**
  * A function that performs chmod action to a specific file.
  * @param cur_dir The current directory's entry.
- * @param target The file name to change permission.
+ * @param target The path of the file to change permission.
  * @param permission The permission to set the file as.
  * @return -1 if failure, 0 if success.
  */
 int impl_chmod(struct entry_t* cur_dir, char* target, unsigned int permission) {
-    struct entry_t* res = malloc(sizeof(struct entry_t));
+    TRACE_OP(TRACE_CHMOD);
+    struct entry_t* res;
     if (find_entry(cur_dir, &res, target) == 0) {
-        handle_cow(res->disk_index, res); // Handle CoW.
+        // Copies have their own inodes, so changing permission does not need CoW.
+        journal_begin(res->disk_index);
+        lock_inode_write(res->disk_index, res->inode_index); // Read the inode after writers are done with it.
         struct inode new_inode; // Generate temp inode for new permission.
         struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
         unsigned int mode = 0xFF000 & in.mode; // Copy MSB 2 digits (file or dir)
         mode = mode | (permission & 0xFFF); // Set permission 3 digits.
         memcpy(&new_inode, &in, sizeof(struct inode));
         new_inode.mode = mode; // Store new permission.
-        update_inode(res->disk_index, res->inode_index, &new_inode);
+        if (!res->deleted) update_inode(res->disk_index, res->inode_index, &new_inode);
+        unlock_inode(res->disk_index, res->inode_index);
+        journal_end(res->disk_index);
     } else {
         printf("chmod: cannot access '%s': No such file or directory\n", target);
         return -1;
@@ -356,19 +743,23 @@ int impl_chmod(struct entry_t* cur_dir, char* target, unsigned int permission) {
 /**
  * A function that prints out stat of a specific file.
  * @param cur_dir The current directory's entry.
- * @param target The file name to get stats from.
+ * @param target The path of the file to get stats from.
  * @return -1 if failure, 0 if success.
  */
 int impl_stat(struct entry_t* cur_dir, char* target) {
-    struct entry_t* res = malloc(sizeof(struct entry_t));
+    TRACE_OP(TRACE_STAT);
+    struct entry_t* res;
     if (find_entry(cur_dir, &res, target) == 0) {
+        flush_file(res); // Show the blocks that delayed appends will take as well.
         char perm_info[11];
         struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
         generate_prefix_str(in.mode, perm_info);
         unsigned char is_empty = (in.mode & INODE_MODE_EMPTY_FILE) == INODE_MODE_EMPTY_FILE;
         printf("   File: %s    Empty file: %d\n", res->name, is_empty);
-        printf("   Size: %d    ", in.size);
-        printf("IO Block: %d    \n", in.size / 1024 + 1);
+        printf("   Size: %d    ", get_file_size(res));
+        printf("IO Block: %u    \n", size_to_blocks(res->disk_index, in.size)); // Blocks taken with the block size of the disk.
+        if ((in.mode & INODE_MODE_COMPRESSED) == INODE_MODE_COMPRESSED)
+            printf("   Compressed: %d bytes stored\n", in.size);
         printf("   Disk: %s (%d)    ", disks[res->disk_index], res->disk_index);
         printf("Inode: %d    \n", res->inode_index);
         printf("   Access: (%04x/%s)\n", (in.mode & 0x0FFF), perm_info);
@@ -377,19 +768,22 @@ int impl_stat(struct entry_t* cur_dir, char* target) {
         }
 
         // Print indirections into this inode.
-        unsigned int indirections[MAX_INODE_COUNT] = {0};
-        int indirection_count = find_indirection_inodes(cur_dir->disk_index, res->inode_index, indirections);
+        unsigned int *indirections = malloc(sizeof(unsigned int) * partitions[res->disk_index].s.num_inodes);
+        if (!indirections) return -1;
+        lock_cow(res->disk_index);
+        int indirection_count = cow_map_sharers(&cow_maps[res->disk_index], res->inode_index, indirections);
+        unlock_cow(res->disk_index);
         if (indirection_count != 0) {
             printf("   Indirection(s) from: ");
             for (int i = 0; i < indirection_count; i++)
                 printf("%d, ", indirections[i]);
             printf("\n");
         }
+        free(indirections);
 
         return 0;
     } else {
         printf("cat: cannot stat '%s': No such file or directory\n", target);
-        free(res);
         return -1;
     }
 }
@@ -402,9 +796,15 @@ int impl_stat(struct entry_t* cur_dir, char* target) {
  * @return -1 if failure, 0 if successful.
  */
 int impl_touch(struct entry_t* cur_dir, char* target) {
-    struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, target) == -1)  // If file does not exist, create file.
-        return create_file(cur_dir->disk_index, cur_dir, target, 0);
+    TRACE_OP(TRACE_TOUCH);
+    struct entry_t *dir, *res;
+    char *name;
+    if (find_parent(cur_dir, target, &dir, &name) == -1) {
+        printf("touch: cannot touch '%s': No such file or directory\n", target);
+        return -1;
+    }
+    if (find_child(dir, &res, name) == -1)  // If file does not exist, create file.
+        return create_file(dir->disk_index, dir, name, 0);
     else
         return 0;
 }
@@ -417,9 +817,15 @@ int impl_touch(struct entry_t* cur_dir, char* target) {
  * @return -1 if failure, 0 if successful.
  */
 int impl_mkdir(struct entry_t* cur_dir, char* target) {
-    struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, target) == -1) { // If directory does not exist, create directory.
-        return create_file(cur_dir->disk_index, cur_dir, target, 1);
+    TRACE_OP(TRACE_MKDIR);
+    struct entry_t *dir, *res;
+    char *name;
+    if (find_parent(cur_dir, target, &dir, &name) == -1) {
+        printf("mkdir: cannot create directory ‘%s’: No such file or directory\n", target);
+        return -1;
+    }
+    if (find_child(dir, &res, name) == -1) { // If directory does not exist, create directory.
+        return create_file(dir->disk_index, dir, name, 1);
     } else {
         printf("mkdir: cannot create directory ‘%s’: File exists\n", target);
         return -1;
@@ -436,35 +842,129 @@ int impl_mkdir(struct entry_t* cur_dir, char* target) {
  * @return -1 if failure, 0 if successful.
  */
 int impl_rm(struct entry_t* cur_dir, char* target) {
-    struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, target) == -1) { // If directory does not exist, we can't delete it.
+    TRACE_OP(TRACE_RM);
+    struct entry_t *dir, *res;
+    char *name;
+    if (find_parent(cur_dir, target, &dir, &name) == -1 || find_child(dir, &res, name) == -1) {
         printf("rm: cannot remove ‘%s’: No such file or directory\n", target);
         return -1;
     } else {
-        struct inode in = partitions[cur_dir->disk_index].inode_table[res->inode_index];
+        struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
         if ((in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) { // rm cannot delete directory.
             printf("rm: cannot remove '%s': Is a directory\n", target);
             return -1;
         } else {
-            handle_cow(res->disk_index, res); // Handle CoW.
-            return delete_file(cur_dir->disk_index, cur_dir, target);
+            return delete_file(dir->disk_index, dir, name); // This handles CoW as well.
+        }
+    }
+}
+
+
+/**
+ * A function that counts extents (contiguous runs of blocks) of regular files in a volume.
+ * CoW copies are skipped since their blocks belong to the original.
+ * @param disk_index The index of volume to look for.
+ * @param files The pointer to store the count of files into.
+ * @param fragmented The pointer to store the count of files with more than a single extent into.
+ * @return The count of extents of all files.
+ */
+static unsigned int count_file_extents(unsigned int disk_index, unsigned int* files, unsigned int* fragmented) {
+    struct partition *cur_p = &partitions[disk_index];
+    unsigned int *blocks = malloc(sizeof(unsigned int) * max_file_blocks(disk_index));
+    unsigned int extents = 0;
+    *files = 0;
+    *fragmented = 0;
+    if (!blocks) return 0;
+
+    for (unsigned int i = 0 ; i < cur_p->s.num_inodes ; i++) {
+        lock_inode_read(disk_index, i);
+        struct inode *in = &cur_p->inode_table[i];
+        if (bitmap_test(&inode_bitmaps[disk_index], i) && (in->mode & INODE_MODE_REG_FILE) == INODE_MODE_REG_FILE
+            && in->indirect_inode == -1) {
+            unsigned int count = read_block_map(disk_index, in, blocks, size_to_blocks(disk_index, in->size));
+            unsigned int runs = count > 0 ? 1 : 0;
+            for (unsigned int j = 1 ; j < count ; j++)
+                if (blocks[j] != blocks[j - 1] + 1) runs++;
+            extents = extents + runs;
+            *fragmented = *fragmented + (runs > 1);
+            *files = *files + 1;
+        }
+        unlock_inode(disk_index, i);
+    }
+    free(blocks);
+    return extents;
+}
+
+
+/**
+ * A function that counts compressed regular files in a volume and the blocks that compression saves.
+ * CoW copies are skipped since their blocks belong to the original.
+ * @param disk_index The index of volume to look for.
+ * @param saved The pointer to store the count of saved blocks into.
+ * @return The count of compressed files.
+ */
+static unsigned int count_compressed_files(unsigned int disk_index, unsigned int* saved) {
+    struct partition *cur_p = &partitions[disk_index];
+    unsigned int files = 0;
+    *saved = 0;
+
+    for (unsigned int i = 0 ; i < cur_p->s.num_inodes ; i++) {
+        lock_inode_read(disk_index, i);
+        struct inode *in = &cur_p->inode_table[i];
+        if (bitmap_test(&inode_bitmaps[disk_index], i) && (in->mode & INODE_MODE_COMPRESSED) == INODE_MODE_COMPRESSED
+            && in->indirect_inode == -1) {
+            unsigned int raw = size_to_blocks(disk_index, get_inode_size(disk_index, i));
+            unsigned int stored = size_to_blocks(disk_index, in->size);
+            *saved = *saved + (raw > stored ? raw - stored : 0);
+            files++;
         }
+        unlock_inode(disk_index, i);
     }
+    return files;
 }
 
 
 /**
  * A function that prints out the volume status.
+ * The fragmentation of files and free space is printed as well.
  * @param target_volume The index of volume to get stats from.
  * @return 0. This function will not fail.
  */
 int impl_vstat(unsigned int target_volume) {
-    struct partition cur_p = partitions[target_volume];
-    printf("   Volume Name: %s\n", cur_p.s.volume_name);
-    printf("   Used Inodes: %d   Free Inodes: %d\n",
-           cur_p.s.num_inodes - cur_p.s.num_free_inodes, cur_p.s.num_free_inodes);
-    printf("   Used Blocks: %d   Free Blocks: %d\n",
-           cur_p.s.num_blocks - cur_p.s.num_free_blocks, cur_p.s.num_free_blocks);
+    TRACE_OP(TRACE_VSTAT);
+    struct super_block *sb = &partitions[target_volume].s;
+    printf("   Volume Name: %s\n", sb->volume_name);
+    printf("   Used Inodes: %d   Free Inodes: %d\n", sb->num_inodes - sb->num_free_inodes, sb->num_free_inodes);
+    printf("   Used Blocks: %d   Free Blocks: %d\n", sb->num_blocks - sb->num_free_blocks, sb->num_free_blocks);
+    if (check_feature(target_volume, MYFS_FEATURE_GEOMETRY))
+        printf("   Block Size: %d   Inodes: %d   Blocks: %d\n", sb->block_size, sb->num_inodes, sb->num_blocks);
+    struct journal_t *j = &journals[target_volume];
+    if (j->enabled)
+        printf("   Journal: %d blocks   Commits: %d   Operations: %d\n", j->blocks, j->commit_count, j->op_count);
+
+    unsigned int files = 0, fragmented = 0, largest = 0;
+    unsigned int extents = count_file_extents(target_volume, &files, &fragmented);
+    lock_alloc(target_volume);
+    unsigned int free_runs = bitmap_count_runs(&block_bitmaps[target_volume], &largest);
+    unlock_alloc(target_volume);
+    printf("   Files: %d   Fragmented: %d   Extents per File: %.2f\n", files, fragmented,
+           files == 0 ? 0.0 : (double) extents / files);
+    printf("   Free Extents: %d   Largest Free Extent: %d blocks\n", free_runs, largest);
+    unsigned int pending = delalloc_total(&delallocs[target_volume]);
+    if (pending != 0) printf("   Delayed Appends: %d bytes\n", pending);
+    unsigned int moved_files = 0, moved_blocks = 0;
+    int running = defrag_status(target_volume, &moved_files, &moved_blocks);
+    if (running || moved_files != 0)
+        printf("   Defragmented Files: %d   Moved Blocks: %d%s\n", moved_files, moved_blocks,
+               running ? "   (running)" : "");
+    unsigned int saved = 0, compressed = count_compressed_files(target_volume, &saved);
+    unsigned int method = get_compression(target_volume);
+    if (method != MYFS_COMPRESS_NONE || compressed != 0)
+        printf("   Compression: %s   Compressed Files: %d   Saved Blocks: %d\n", compress_name(method), compressed,
+               saved);
+    unsigned int writes = 0, ordered = 0, max_in_flight = 0;
+    if (ioring_status(target_volume, &writes, &ordered, &max_in_flight))
+        printf("   Async Writes: %d   Ordered: %d   Most In Flight: %d\n", writes, ordered, max_in_flight);
 
     return 0;
 }
@@ -479,17 +979,25 @@ int impl_vstat(unsigned int target_volume) {
  * @return -1 if failure, 0 if successful.
  */
 int impl_rmdir(struct entry_t* cur_dir, char* target) {
-    struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, target) == -1) { // If directory does not exist, we can't delete directory.
+    TRACE_OP(TRACE_RMDIR);
+    struct entry_t *dir, *res;
+    char *name;
+    if (find_parent(cur_dir, target, &dir, &name) == -1 || find_child(dir, &res, name) == -1) {
         printf("rmdir: cannot remove ‘%s’: No such file or directory\n", target);
         return -1;
     } else {
-        struct inode in = partitions[cur_dir->disk_index].inode_table[res->inode_index];
+        struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
         if ((in.mode & INODE_MODE_REG_FILE) == INODE_MODE_REG_FILE) { // rmdir cannot delete file.
             printf("rmdir: failed to remove '%s': Not a directory\n", target);
             return -1;
-        } else
-            return delete_directory(cur_dir->disk_index, cur_dir, target);
+        }
+        for (struct entry_t *cur = cur_dir ; cur != NULL ; cur = cur->parent) { // Keep the current directory.
+            if (cur == res) {
+                printf("rmdir: failed to remove '%s': Device or resource busy\n", target);
+                return -1;
+            }
+        }
+        return delete_directory(dir->disk_index, dir, name);
     }
 }
 
@@ -504,17 +1012,18 @@ int impl_rmdir(struct entry_t* cur_dir, char* target) {
  * @return -1 if failure, 0 if successful.
  */
 int impl_write(struct entry_t* cur_dir, char* target, char* context) {
+    TRACE_OP(TRACE_WRITE);
+    TRACE_BYTES(strlen(context));
     struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, target) == -1) { // If the file does not exist, we can't write it.
+    if (find_entry(cur_dir, &res, target) == -1) { // If the file does not exist, we can't write it.
         printf("write: cannot write to ‘%s’: No such file\n", target);
         return -1;
     } else {
-        struct inode in = partitions[cur_dir->disk_index].inode_table[res->inode_index];
+        struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
         if ((in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) { // Write can't write directory files.
             printf("write: failed to write '%s': Is a directory\n", target);
             return -1;
         } else {
-            handle_cow(res->disk_index, res); // Handle CoW.
             return write_file_data(res, strlen(context), (unsigned char *) context);
         }
     }
@@ -531,17 +1040,18 @@ int impl_write(struct entry_t* cur_dir, char* target, char* context) {
  * @return -1 if failure, 0 if successful.
  */
 int impl_append(struct entry_t* cur_dir, char* target, char* context) {
+    TRACE_OP(TRACE_APPEND);
+    TRACE_BYTES(strlen(context));
     struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, target) == -1) { // If the file does not exist, we can't write it.
+    if (find_entry(cur_dir, &res, target) == -1) { // If the file does not exist, we can't write it.
         printf("append: cannot append to ‘%s’: No such file\n", target);
         return -1;
     } else {
-        struct inode in = partitions[cur_dir->disk_index].inode_table[res->inode_index];
+        struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
         if ((in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) { // Write can't write directory files.
             printf("append: failed to append '%s': Is a directory\n", target);
             return -1;
         } else {
-            handle_cow(res->disk_index, res); // Handle CoW.
             return append_file_data(res, strlen(context), (unsigned char *) context);
         }
     }
@@ -550,266 +1060,924 @@ int impl_append(struct entry_t* cur_dir, char* target, char* context) {
 
 /**
  * A function that performs file copy.
- * This will work as a CoW way.
+ * This will work as a CoW way, so the destination must be in the same volume as the source.
  * When this function gets an existing file as dst, this will overwrite to the destination file.
+ * When dst is a directory, the file is copied into it with the same name.
  * @param cur_dir The current directory.
- * @param src The source to copy.
- * @param dst The destination to copy as.
+ * @param src The path of the source to copy.
+ * @param dst The path of the destination to copy as.
  * @return -1 if failure, 0 if successful.
  */
 int impl_cp(struct entry_t* cur_dir, char* src, char* dst) {
-    struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, src) == -1) { // If the file does not exist, we can't copy it.
+    TRACE_OP(TRACE_CP);
+    struct entry_t *res, *dir, *dst_entry;
+    char *name;
+    if (find_entry(cur_dir, &res, src) == -1) { // If the file does not exist, we can't copy it.
         printf("cp: cannot stat '%s': No such file or directory\n", src);
         return -1;
-    } else {
-        struct inode in = partitions[cur_dir->disk_index].inode_table[res->inode_index];
-        if ((in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) { // Write can't copy directory files.
-            printf("cp: copying directory is not permitted; omitting directory '%s'\n", src);
+    }
+    struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
+    if ((in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) { // Write can't copy directory files.
+        printf("cp: copying directory is not permitted; omitting directory '%s'\n", src);
+        return -1;
+    }
+    TRACE_BYTES(get_file_size(res));
+
+    if (find_entry(cur_dir, &dst_entry, dst) == 0
+        && (partitions[dst_entry->disk_index].inode_table[dst_entry->inode_index].mode & INODE_MODE_DIR_FILE)) {
+        dir = dst_entry; // Copy into the directory.
+        name = res->name;
+    } else if (find_parent(cur_dir, dst, &dir, &name) == -1) {
+        printf("cp: cannot create regular file '%s': No such file or directory\n", dst);
+        return -1;
+    }
+    if (dir->disk_index != res->disk_index) { // Copies share blocks with the original.
+        printf("cp: cannot copy '%s' to '%s': Not in the same volume\n", src, dst);
+        return -1;
+    }
+
+    // Check if name with destination exists, if so, delete it.
+    struct entry_t *existing;
+    if (find_child(dir, &existing, name) != -1) {
+        if (existing == res) {
+            printf("cp: '%s' and '%s' are the same file\n", src, dst);
+            return -1;
+        }
+        struct inode existing_in = partitions[existing->disk_index].inode_table[existing->inode_index];
+        if ((existing_in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) {
+            printf("cp: cannot overwrite directory '%s' with non-directory\n", dst);
+            return -1;
+        }
+        if (delete_file(dir->disk_index, dir, name) == -1) {
+            printf("[ERROR] Could not delete %s\n", dst);
             return -1;
-        } else {
-            struct entry_t *ignored;
-            // Check if name with destination exists, if so, delete it.
-            if (find_entry(cur_dir->child, &ignored, dst) != -1) {
-                if (delete_file(cur_dir->disk_index, cur_dir, dst) == -1) {
-                    printf("[ERROR] Could not delete %s\n", dst);
-                    return -1;
-                }
-            }
-            return copy_file(cur_dir->disk_index, res, dst); // Copy file.
         }
     }
+    return copy_file(dir->disk_index, res, dir, name); // Copy file.
 }
 
 
 /**
  * A function that performs file rename.
  * When this function gets an existing file as dst, this will overwrite to the destination file.
- * For moving files into another directory, use impl_move instead.
+ * When dst is in another directory of the same volume, the file is moved there as well. Ex) rename a/x b/y
+ * For moving files into another directory with the same name, use impl_move instead.
  * @param cur_dir The current directory.
- * @param src The source to copy.
- * @param dst The destination to copy as.
+ * @param src The path of the source to rename.
+ * @param dst The path to rename as.
  * @return -1 if failure, 0 if successful.
  */
 int impl_rename(struct entry_t* cur_dir, char* src, char* dst) {
-    struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, src) == -1) { // If the file does not exist, we can't move it.
+    TRACE_OP(TRACE_RENAME);
+    struct entry_t *res, *dir;
+    char *name;
+    if (find_entry(cur_dir, &res, src) == -1 || res->parent == NULL) { // If the file does not exist, we can't move it.
         printf("rename: cannot stat '%s': No such file or directory\n", src);
         return -1;
-    } else {
-        struct entry_t *dst_entry;
-        // Check if name with destination exists, if so, delete it.
-        if (find_entry(cur_dir->child, &dst_entry, dst) != -1) {
-            handle_cow(dst_entry->disk_index, dst_entry); // Handle CoW.
-            if (delete_file(cur_dir->disk_index, cur_dir, dst) == -1) {
-                printf("[ERROR] Could not delete %s\n", dst);
-                return -1;
-            }
+    }
+    if (find_parent(cur_dir, dst, &dir, &name) == -1) {
+        printf("rename: cannot move '%s' to '%s': No such file or directory\n", src, dst);
+        return -1;
+    }
+    if (name[0] == '\0' || strlen(name) > max_name_len(dir->disk_index)) {
+        printf("rename: invalid name: '%s'\n", name);
+        return -1;
+    }
+    if (dir->disk_index != res->disk_index) {
+        printf("rename: cannot move '%s' to '%s': Not in the same volume\n", src, dst);
+        return -1;
+    }
+    for (struct entry_t *cur = dir ; cur != NULL ; cur = cur->parent) { // A directory can not go into itself.
+        if (cur == res) {
+            printf("rename: cannot move '%s' to a subdirectory of itself, '%s'\n", src, dst);
+            return -1;
+        }
+    }
+
+    struct entry_t *dst_entry;
+    // Check if name with destination exists, if so, delete it.
+    if (find_child(dir, &dst_entry, name) != -1) { // This handles CoW as well.
+        if (dst_entry == res) return 0;
+        struct inode in = partitions[dst_entry->disk_index].inode_table[dst_entry->inode_index];
+        if ((in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) {
+            printf("rename: cannot overwrite directory '%s'\n", dst);
+            return -1;
+        }
+        if (delete_file(dir->disk_index, dir, name) == -1) {
+            printf("[ERROR] Could not delete %s\n", dst);
+            return -1;
         }
-        return rename_file(cur_dir->disk_index, res, dst); // Rename file.
     }
+    if (dir != res->parent && move_entry(res->disk_index, res, dir) == -1) return -1;
+    return strcmp(res->name, name) == 0 ? 0 : rename_file(res->disk_index, res, name); // Rename file.
 }
 
 
 /**
  * A function that performs file move.
- * For renaming files, use impl_rename instead.
+ * The file keeps its name and goes into the directory dst, in the same volume. For renaming files, use impl_rename.
  * @param cur_dir The current directory.
- * @param src The source to copy.
- * @param dst The destination to copy as.
+ * @param src The path of the source to move.
+ * @param dst The path of the directory to move into.
  * @return -1 if failure, 0 if successful.
  */
 int impl_move(struct entry_t* cur_dir, char* src, char* dst) {
-    struct entry_t* res;
-    if (find_entry(cur_dir->child, &res, src) == -1) { // If the file does not exist, we can't move it.
+    TRACE_OP(TRACE_MOVE);
+    struct entry_t *res, *dst_entry;
+    if (find_entry(cur_dir, &res, src) == -1 || res->parent == NULL) { // If the file does not exist, we can't move it.
         printf("mv: cannot stat '%s': No such file or directory\n", src);
         return -1;
-    } else {
-        struct entry_t *dst_entry;
-        // Check if name with destination exists, if so, also check if it is directory file.
-        if (find_entry(cur_dir->child, &dst_entry, dst) != -1 || (strcmp(dst, "..") == 0)) {
-            if ((strcmp(dst, "..") == 0)) return move_file(cur_dir->disk_index, res, dst); // For ..
-            struct inode in = partitions[dst_entry->disk_index].inode_table[dst_entry->inode_index]; // For normal case.
-            if ((in.mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) { // This was not a directory file, quit.
-                printf("mv: cannot move '%s': '%s' is not a directory\n", src, dst);
-                return -1;
-            } else {
-                return move_file(cur_dir->disk_index, res, dst); // move file.
-            }
-        } else { // If the target directory does not exist, we can't move the file.
-            printf("mv: cannot move '%s': '%s': No such file or directory\n", src, dst);
+    }
+    if (find_entry(cur_dir, &dst_entry, dst) == -1) { // If the target directory does not exist, we can't move the file.
+        printf("mv: cannot move '%s': '%s': No such file or directory\n", src, dst);
+        return -1;
+    }
+    struct inode in = partitions[dst_entry->disk_index].inode_table[dst_entry->inode_index];
+    if ((in.mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) { // This was not a directory file, quit.
+        printf("mv: cannot move '%s': '%s' is not a directory\n", src, dst);
+        return -1;
+    }
+    if (dst_entry->disk_index != res->disk_index) {
+        printf("mv: cannot move '%s' to '%s': Not in the same volume\n", src, dst);
+        return -1;
+    }
+    for (struct entry_t *cur = dst_entry ; cur != NULL ; cur = cur->parent) { // A directory can not go into itself.
+        if (cur == res) {
+            printf("mv: cannot move '%s' to a subdirectory of itself, '%s'\n", src, dst);
             return -1;
         }
     }
-}
+    if (dst_entry == res->parent) return 0; // Already there.
+
+    struct entry_t *existing;
+    if (find_child(dst_entry, &existing, res->name) != -1) {
+        printf("mv: cannot move '%s' to '%s': File exists\n", src, dst);
+        return -1;
+    }
+    return move_entry(res->disk_index, res, dst_entry); // move file.
+}
 
 
 /**
- * A function that writes data into a specific file.
- * This function provides following features:
- * 1. Write data to a specific file with provided buffer.
- * 2. If the written data's size was longer than the original blocks, this will automatically assign free blocks.
- *    Ex) If the original file had 1 block of data in it, however when the new written data was 3 blocks of data,
- *        This function will automatically get 2 free blocks.
- * 3. Update the inode of this file, this will update the file size and list of blocks.
+ * A function that starts writing a file.
+ * CoW is handled first, then the file is locked for writing. This must be paired with end_file_write.
+ * The whole write is a single operation of the journal.
+ * Since CoW is handled under the CoW lock, no new copy of the file can appear until the write is done.
  * @param target The target to write.
- * @param buffer_size The buffer size. Be aware that this buffer size should NOT pass more than 6 blocks.
- * @param buffer The buffer to write data.
  * @return -1 if failure, 0 if successful.
  */
-int write_file_data(struct entry_t* target, unsigned int buffer_size, unsigned char* buffer) {
-    if(buffer_size > sizeof(struct blocks) * 6) { // The max that we can write is 6 blocks.
-        printf("[ERROR] Write size is too big: %d\n", buffer_size);
+static int begin_file_write(struct entry_t* target) {
+    journal_begin(target->disk_index);
+    lock_cow(target->disk_index);
+    int ret = handle_cow(target->disk_index, target);
+    lock_inode_write(target->disk_index, target->inode_index);
+    unlock_cow(target->disk_index);
+
+    if (ret == -1 || target->deleted) { // CoW failed or the file was deleted by someone else.
+        unlock_inode(target->disk_index, target->inode_index);
+        journal_end(target->disk_index);
         return -1;
     }
+    return 0;
+}
 
-    struct inode *cur_in = &partitions[target->disk_index].inode_table[target->inode_index];
-    unsigned int disk_index = target->disk_index;
 
-    if (cur_in->locked) { // If the file was locked, we can't write it.
-        printf("[ERROR] Could not write file %s: The file is locked\n", target->name);
-        return -1;
-    }
+/**
+ * A function that finishes writing a file started by begin_file_write.
+ * @param target The target that was written.
+ */
+static void end_file_write(struct entry_t* target) {
+    unlock_inode(target->disk_index, target->inode_index);
+    journal_end(target->disk_index);
+}
 
-    // If the size of data we are writing right now exceeds current assigned blocks,
-    // get more blocks and assign them. This method will not prevent fragmentation!!
-    if (buffer_size > ((cur_in->size / 1024) + 1) * 1024) {
-        // If the assigned blocks were small then the new one, allocate more blocks.
-        unsigned int assigned_block[6] = {0};
-        if (assign_empty_blocks(disk_index, 1, assigned_block) == -1) {
-           printf("[ERROR] Could not allocate more disk blocks\n");
-           return -1;
-        }
 
-        for (int i = 0 ; i < 6 ; i++) { // Store assigned block.
-            if (cur_in->blocks[i] == 0) {
-                cur_in->blocks[i] = assigned_block[0];
-                break;
-            }
-        }
+/**
+ * A function that compresses the data of a file with the compression method of its disk.
+ * The data is compressed only when it takes at least a block less, so small files are always stored as they are.
+ * @param disk_index The disk index that the file is located at.
+ * @param size The size of the data.
+ * @param buffer The data.
+ * @param ret The pointer to store the compressed data into, starting with struct compress_header.
+ * @return The size of the compressed data including the header, -1 if the data shall be stored as it is.
+ */
+static int pack_file_data(unsigned int disk_index, unsigned int size, unsigned char* buffer, unsigned char** ret) {
+    unsigned int method = get_compression(disk_index), block_size = get_block_size(disk_index);
+    if (method == MYFS_COMPRESS_NONE || size <= block_size) return -1;
+
+    // Compressed data that does not fit into one block less than the data is not worth it.
+    unsigned int capacity = (size_to_blocks(disk_index, size) - 1) * block_size;
+    unsigned char *packed = malloc(capacity);
+    if (!packed) return -1;
+    struct compress_header header = {.size = size, .method = method};
+    int len = compress_data(method, buffer, size, packed + sizeof(header), capacity - sizeof(header));
+    if (len == -1) {
+        free(packed);
+        return -1;
     }
+    memcpy(packed, &header, sizeof(header));
+    *ret = packed;
+    return (int) (len + sizeof(header));
+}
 
-    // Declare that this file is locked. (like fopen)
-    cur_in->locked = 1;
-
-    // For physical buffer.
-    unsigned char* physical_buffer = (unsigned char*) malloc(sizeof(struct blocks) * 6);
-    memset(physical_buffer, 0, sizeof(struct blocks) * 6);
-    memcpy(physical_buffer, buffer, buffer_size); // Store data that was requested.
-
-    // Iterate and physically emit change to disk.
-    for (int i = 0 ; i < 6 ; i++) {
-        unsigned int block = cur_in->blocks[i];
-        if (block == 0) continue; // If 0, it was just unassigned block. Therefore, just pass.
-        write_data_block(disk_index, block, 1, &((struct blocks*) physical_buffer)[i]);
-    }
 
-    // Iterate and save change in the data table on the memory.
-    struct partition *cur_p = &partitions[disk_index];
-    for (int i = 0 ; i < 6 ; i++) {
-        unsigned int block = cur_in->blocks[i];
-        if (block == 0) continue; // If 0, it was just unassigned block. Therefore, just pass.
-        memcpy(cur_p->data_blocks + cur_in->blocks[i], &((struct blocks*) physical_buffer)[i], sizeof(struct blocks));
-    }
+/**
+ * A function that replaces the data of a file, the caller must hold the write lock of the file.
+ * The data is compressed when the disk has a compression method and it saves blocks.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param buffer_size The buffer size.
+ * @param buffer The buffer to write data.
+ * @return -1 if failure, 0 if successful.
+ */
+static int store_file_data(unsigned int disk_index, unsigned int inode_index, unsigned int buffer_size,
+                           unsigned char* buffer) {
+    struct inode *cur_in = &partitions[disk_index].inode_table[inode_index];
+    unsigned char *packed = NULL;
+    int packed_size = pack_file_data(disk_index, buffer_size, buffer, &packed);
+    int ret = packed_size == -1 ? write_inode_data(disk_index, inode_index, buffer_size, buffer)
+                                : write_inode_data(disk_index, inode_index, (unsigned int) packed_size, packed);
+    free(packed);
+    if (ret == -1) return -1;
 
     // Update inode information and also emit data to disk.
     unsigned char is_empty = (cur_in->mode & INODE_MODE_EMPTY_FILE) == INODE_MODE_EMPTY_FILE;
-    cur_in->size = buffer_size;
     cur_in->mode = is_empty ? cur_in->mode ^ INODE_MODE_EMPTY_FILE : cur_in->mode; // Set this as non empty file.
+    if (packed_size == -1) cur_in->mode = cur_in->mode & ~INODE_MODE_COMPRESSED;
+    else cur_in->mode = cur_in->mode | INODE_MODE_COMPRESSED;
+    write_inode(disk_index, inode_index, cur_in);
+    return 0;
+}
+
 
-    cur_in->locked = 0; // Unlock file since this is not being used. This works like fclose.
-    write_inode(disk_index, target->inode_index, cur_in);
-    free(physical_buffer);
+/**
+ * A function that stores the data of a compressed file as it is, so that parts of it can be written in place.
+ * The file is compressed again when it is written as a whole. The caller must hold the write lock of the file.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @return -1 if failure, 0 if successful.
+ */
+static int unpack_file_data(unsigned int disk_index, unsigned int inode_index) {
+    struct inode *cur_in = &partitions[disk_index].inode_table[inode_index];
+    if ((cur_in->mode & INODE_MODE_COMPRESSED) != INODE_MODE_COMPRESSED) return 0;
+
+    unsigned int size = get_inode_size(disk_index, inode_index);
+    unsigned char *data = NULL;
+    if (read_inode_data(disk_index, inode_index, &data) == -1) return -1;
+    int ret = write_inode_data(disk_index, inode_index, size, data);
+    free(data);
+    if (ret == -1) return -1;
+    cur_in->mode = cur_in->mode & ~INODE_MODE_COMPRESSED;
+    return write_inode(disk_index, inode_index, cur_in);
+}
 
+
+/**
+ * A function that writes data into a range of a file, the caller must hold the write lock of the file.
+ * Only the blocks in the range and the inode are written, see write_inode_range.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param offset The offset to write data at.
+ * @param buffer_size The buffer size.
+ * @param buffer The buffer to write data.
+ * @return -1 if failure, 0 if successful.
+ */
+static int store_file_range(unsigned int disk_index, unsigned int inode_index, unsigned int offset,
+                            unsigned int buffer_size, unsigned char* buffer) {
+    struct inode *cur_in = &partitions[disk_index].inode_table[inode_index];
+    if (buffer_size == 0) return 0; // Nothing changes, the file stays empty if it was.
+    if (write_inode_range(disk_index, inode_index, offset, buffer_size, buffer) == -1) return -1;
+
+    cur_in->mode = cur_in->mode & ~INODE_MODE_EMPTY_FILE; // Set this as non empty file.
+    write_inode(disk_index, inode_index, cur_in);
     return 0;
 }
 
 
+/**
+ * A function that replaces the data of a file with a resized copy of it.
+ * The caller must hold the write lock of the file.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param size The new size of the file.
+ * @param offset The offset to copy buffer into.
+ * @param buffer_size The size of buffer.
+ * @param buffer The buffer to copy after resizing, NULL for just resizing.
+ * @return -1 if failure, 0 if successful.
+ */
+static int splice_file_data(unsigned int disk_index, unsigned int inode_index, unsigned int size, unsigned int offset,
+                            unsigned int buffer_size, unsigned char* buffer) {
+    unsigned int old_size = get_inode_size(disk_index, inode_index);
+    unsigned char *old_data = NULL;
+    if (read_inode_data(disk_index, inode_index, &old_data) == -1) return -1;
+
+    unsigned char *new_data = calloc(size + 1, 1);
+    if (!new_data) {
+        free(old_data);
+        return -1;
+    }
+    memcpy(new_data, old_data, old_size < size ? old_size : size);
+    if (buffer != NULL) memcpy(new_data + offset, buffer, buffer_size);
+    free(old_data);
+
+    int ret = store_file_data(disk_index, inode_index, size, new_data);
+    free(new_data);
+    return ret;
+}
+
+
+/**
+ * A function that keeps appended data of a file in memory instead of writing it, see delalloc.h.
+ * Data is kept while the file has up to DELALLOC_FILE_BLOCKS blocks of pending data and the volume has up to
+ * DELALLOC_VOLUME_BYTES. Appends that would make the file too big or that the free blocks can not hold right now
+ * are not kept, so that they fail right away instead of when the data is written.
+ * The caller must hold the write lock of the file.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param buffer_size The buffer size.
+ * @param buffer The buffer to append.
+ * @return 1 if the data was kept, 0 if it must be written right now.
+ */
+static int delay_append(unsigned int disk_index, unsigned int inode_index, unsigned int buffer_size,
+                        unsigned char* buffer) {
+    struct delalloc_t *da = &delallocs[disk_index];
+    struct inode *cur_in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int old_size = (cur_in->mode & INODE_MODE_EMPTY_FILE) == INODE_MODE_EMPTY_FILE ? 0 : cur_in->size;
+    unsigned int pending = delalloc_pending(da, inode_index);
+    if (buffer_size == 0 || pending + buffer_size > DELALLOC_FILE_BLOCKS * get_block_size(disk_index)) return 0;
+    if (delalloc_total(da) + buffer_size > DELALLOC_VOLUME_BYTES) return 0;
+
+    unsigned int new_count = size_to_blocks(disk_index, old_size + pending + buffer_size);
+    unsigned int old_count = size_to_blocks(disk_index, cur_in->size);
+    if (new_count > max_file_blocks(disk_index)) return 0;
+    lock_alloc(disk_index);
+    unsigned int free_blocks = partitions[disk_index].s.num_free_blocks;
+    unlock_alloc(disk_index);
+    if (new_count > old_count + free_blocks) return 0;
+    return delalloc_add(da, inode_index, buffer_size, buffer) == 0;
+}
+
+
+/**
+ * A function that writes the delayed appends of a file, followed by more data to append.
+ * All of them are written at once after the end of the file, so the new blocks are assigned as a single run
+ * and only the last block of the file and the new blocks are written.
+ * The pending data is kept when this fails. The caller must hold the write lock of the file.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param extra_size The size of more data to append, 0 for just writing the pending data.
+ * @param extra More data to append.
+ * @return -1 if failure, 0 if successful.
+ */
+static int write_pending_data(unsigned int disk_index, unsigned int inode_index, unsigned int extra_size,
+                              unsigned char* extra) {
+    struct delalloc_t *da = &delallocs[disk_index];
+    struct inode *cur_in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int old_size = (cur_in->mode & INODE_MODE_EMPTY_FILE) == INODE_MODE_EMPTY_FILE ? 0 : cur_in->size;
+    unsigned int pending = delalloc_pending(da, inode_index);
+    if (pending == 0 && extra_size == 0) return 0;
+
+    unsigned char *data = pending == 0 ? extra : delalloc_data(da, inode_index);
+    if (pending > 0 && extra_size > 0) { // Put both of them in a single buffer.
+        data = malloc(pending + extra_size);
+        if (!data) return -1;
+        memcpy(data, delalloc_data(da, inode_index), pending);
+        memcpy(data + pending, extra, extra_size);
+    }
+    int ret = store_file_range(disk_index, inode_index, old_size, pending + extra_size, data);
+    if (pending > 0 && extra_size > 0) free(data);
+    if (ret == 0) delalloc_drop(da, inode_index);
+    return ret;
+}
+
+
+/**
+ * A function that writes data into a specific file.
+ * This function provides following features:
+ * 1. Write data to a specific file with provided buffer.
+ * 2. If the written data's size was longer than the original blocks, this will automatically assign free blocks.
+ *    Ex) If the original file had 1 block of data in it, however when the new written data was 3 blocks of data,
+ *        This function will automatically get 2 free blocks.
+ *    Files that need more than 6 blocks are stored with indirect blocks.
+ * 3. Update the inode of this file, this will update the file size and list of blocks.
+ * The file is locked for writing while this is running, so other readers and writers of the file will wait.
+ * Delayed appends of the file are thrown away, since the whole data is replaced.
+ * @param target The target to write.
+ * @param buffer_size The buffer size. This can be up to max_file_blocks blocks.
+ * @param buffer The buffer to write data.
+ * @return -1 if failure, 0 if successful.
+ */
+int write_file_data(struct entry_t* target, unsigned int buffer_size, unsigned char* buffer) {
+    if (begin_file_write(target) == -1) {
+        printf("[ERROR] Could not write file %s\n", target->name);
+        return -1;
+    }
+    delalloc_drop(&delallocs[target->disk_index], target->inode_index);
+    int ret = store_file_data(target->disk_index, target->inode_index, buffer_size, buffer);
+    end_file_write(target);
+    return ret;
+}
+
+
 /**
  * A function that appends data into a file.
  * The function will work like Append mode in fopen.
- * This will internally call write_file_data.
+ * Small appends are kept in memory by delay_append, the data is written when it gets big enough,
+ * when the file is read or written otherwise, or when the volume is synced or unmounted.
+ * Kept data lives only in memory, so a frontend must call flush_file, flush_delayed_writes or unmount_disk before
+ * it exits, journal_close alone does not write it (and refuses to mark the journal as clean while any is kept).
+ * Reading the old data and writing the new data is done under the same lock, so concurrent appends are not lost.
+ * Compressed files are stored as they are first, since only the end of the file is written.
  * @param target The target to write.
- * @param buffer_size The buffer size. Be aware that this buffer size should NOT pass more than 6 blocks.
+ * @param buffer_size The buffer size.
  * @param buffer The buffer to write data.
  * @return -1 if failure, 0 if successful.
  */
 int append_file_data(struct entry_t* target, unsigned int buffer_size, unsigned char* buffer) {
-    unsigned char* physical_buffer = (unsigned char*) malloc(sizeof(struct blocks) * 6);
-    struct inode *cur_in = &partitions[target->disk_index].inode_table[target->inode_index];
-    struct partition *cur_p = &partitions[target->disk_index];
-    unsigned char is_empty_file = (cur_in->mode & INODE_MODE_EMPTY_FILE) == INODE_MODE_EMPTY_FILE;
-
-    // Calculate new generated buffer size.
-    // If the file was empty and was trying to append data into the file, set size as buffer size since the file is empty.
-    unsigned int new_size = is_empty_file ? buffer_size : buffer_size + cur_in->size; //
-
-    // Copy previous blocks in the memory to the physical buffer.
-    // Also look for the last block that this file is stored at.
-    memset(physical_buffer, 0, sizeof(struct blocks) * 6);
-    unsigned int last_block_index = 0;
-    for (int i = 0 ; i < 6 ; i++) {
-        unsigned int block = cur_in->blocks[i];
-        if (block == 0) continue;
-        memcpy(&((struct blocks*) physical_buffer)[i], cur_p->data_blocks + cur_in->blocks[i], sizeof(struct blocks));
-        last_block_index = i;
-    }
-
-    // Copy the new appended data into the last block that was storing the data.
-    unsigned int offset = is_empty_file ? 0 : cur_in->size % 1024; // Get last block's offset.
-    memcpy(physical_buffer + last_block_index * sizeof(struct blocks) + offset, buffer, buffer_size);
-
-    // Call write file data internally and emit data to disk.
-    if (write_file_data(target, new_size, physical_buffer) == -1) {
+    if (begin_file_write(target) == -1) {
         printf("[ERROR] Could not append data to file\n");
-        free(physical_buffer);
         return -1;
     }
 
-    // Copy data into the data block table in memory.
-    for (int i = 0 ; i < 6 ; i++) {
-        unsigned int block = cur_in->blocks[i];
-        if (block == 0) continue;
-        memcpy(cur_p->data_blocks + cur_in->blocks[i], &((struct blocks*) physical_buffer)[i], sizeof(struct blocks));
+    int ret = unpack_file_data(target->disk_index, target->inode_index);
+    if (ret == 0 && !delay_append(target->disk_index, target->inode_index, buffer_size, buffer))
+        ret = write_pending_data(target->disk_index, target->inode_index, buffer_size, buffer);
+    end_file_write(target);
+
+    if (ret == -1) printf("[ERROR] Could not append data to file\n");
+    return ret;
+}
+
+
+/**
+ * A function that writes data into a file at a specific offset, like pwrite.
+ * The file grows if the data goes beyond the end of the file, only the blocks in the range are written.
+ * Writing right at the end of the file is an append, so it is delayed just like append_file_data,
+ * and must be written by flush_file, flush_delayed_writes or unmount_disk before the frontend exits.
+ * Compressed files are stored as they are first, see unpack_file_data.
+ * @param target The target to write.
+ * @param offset The offset to write data at.
+ * @param buffer_size The buffer size.
+ * @param buffer The buffer to write data.
+ * @return -1 if failure, 0 if successful.
+ */
+int write_file_range(struct entry_t* target, unsigned int offset, unsigned int buffer_size, unsigned char* buffer) {
+    if (begin_file_write(target) == -1) return -1;
+
+    unsigned int disk_index = target->disk_index, inode_index = target->inode_index;
+    if (unpack_file_data(disk_index, inode_index) == -1) {
+        end_file_write(target);
+        return -1;
+    }
+    unsigned int old_size = get_inode_size(disk_index, inode_index);
+    int ret = 0;
+    if (offset == old_size + delalloc_pending(&delallocs[disk_index], inode_index)) {
+        if (!delay_append(disk_index, inode_index, buffer_size, buffer))
+            ret = write_pending_data(disk_index, inode_index, buffer_size, buffer);
+    } else if ((ret = write_pending_data(disk_index, inode_index, 0, NULL)) == 0) {
+        ret = store_file_range(disk_index, inode_index, offset, buffer_size, buffer);
+    }
+    end_file_write(target);
+    return ret;
+}
+
+
+/**
+ * A function that changes the size of a file, like truncate.
+ * When the file grows, the new area is filled with 0.
+ * @param target The target to resize.
+ * @param size The new size of the file.
+ * @return -1 if failure, 0 if successful.
+ */
+int truncate_file_data(struct entry_t* target, unsigned int size) {
+    if (begin_file_write(target) == -1) return -1;
+    int ret = write_pending_data(target->disk_index, target->inode_index, 0, NULL);
+    if (ret == 0) ret = splice_file_data(target->disk_index, target->inode_index, size, 0, 0, NULL);
+    end_file_write(target);
+    return ret;
+}
+
+
+/**
+ * A function that writes the delayed appends of a file, so that the file can be read from the disk.
+ * A file with delayed appends is never shared by CoW copies, since copy_file writes them before sharing the blocks.
+ * Therefore this does not need CoW, just like readers.
+ * @param entry The entry to write.
+ * @return -1 if failure, 0 if successful.
+ */
+int flush_file(struct entry_t* entry) {
+    if (delalloc_pending(&delallocs[entry->disk_index], entry->inode_index) == 0) return 0;
+    journal_begin(entry->disk_index);
+    lock_inode_write(entry->disk_index, entry->inode_index);
+    int ret = entry->deleted ? 0 : write_pending_data(entry->disk_index, entry->inode_index, 0, NULL);
+    unlock_inode(entry->disk_index, entry->inode_index);
+    journal_end(entry->disk_index);
+    return ret;
+}
+
+
+/**
+ * A function that writes the delayed appends of all files in a volume.
+ * This is called before the journal is committed by sync, before taking a snapshot and before unmounting.
+ * @param disk_index The disk index to write.
+ * @return -1 if any of the files could not be written, 0 if successful.
+ */
+int flush_delayed_writes(unsigned int disk_index) {
+    struct delalloc_t *da = &delallocs[disk_index];
+    int ret = 0;
+    for (unsigned int i = 0 ; i < da->inode_count ; i++) {
+        if (delalloc_pending(da, i) == 0) continue;
+        journal_begin(disk_index);
+        lock_inode_write(disk_index, i); // Deleting a file drops its pending data under this lock.
+        if (write_pending_data(disk_index, i, 0, NULL) == -1) ret = -1;
+        unlock_inode(disk_index, i);
+        journal_end(disk_index);
     }
+    if (ret == -1) printf("[ERROR] Could not write delayed appends of disk %d\n", disk_index);
+    return ret;
+}
 
-    // Store inode data back to the disk and to the memory.
-    cur_in->size = new_size;
-    write_inode(target->disk_index, target->inode_index, cur_in);
 
-    free(physical_buffer);
-    return 0;
+/**
+ * A function that returns the size of the data that an inode is storing, before compression.
+ * Empty files are stored with a newline, but their size is 0.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode index.
+ * @return The size of the data.
+ */
+unsigned int get_inode_size(unsigned int disk_index, unsigned int inode_index) {
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
+    if ((in->mode & INODE_MODE_EMPTY_FILE) == INODE_MODE_EMPTY_FILE) return 0;
+    if ((in->mode & INODE_MODE_COMPRESSED) != INODE_MODE_COMPRESSED) return in->size;
+
+    struct compress_header header = {0};
+    unsigned int block = 0;
+    if (in->size < sizeof(header) || lookup_block(disk_index, in, 0, &block) == -1) return 0;
+    memcpy(&header, get_block(disk_index, block), sizeof(header));
+    return header.size;
+}
+
+
+/**
+ * A function that returns the size of a file, including its delayed appends.
+ * @param entry The entry to get size.
+ * @return The size of the file.
+ */
+unsigned int get_file_size(struct entry_t* entry) {
+    unsigned int size = get_inode_size(entry->disk_index, entry->inode_index);
+    return size + delalloc_pending(&delallocs[entry->disk_index], entry->inode_index);
 }
 
 
 /**
  * A function that reads data from file.
  * This function will physically read data from file and save it to the char buffer.
+ * The file is locked for reading, so multiple readers can read the same file at the same time.
  * @param entry The entry to read data from.
  * @param ret The char* address to store return value into.
  * @return -1 if unsuccessful, 0 if successful.
  */
 int read_file_data(struct entry_t* entry, unsigned char** ret) {
-    struct partition cur_p = partitions[entry->disk_index];
-    struct inode in = partitions[entry->disk_index].inode_table[entry->inode_index];
+    if (flush_file(entry) == -1) return -1;
+    lock_inode_read(entry->disk_index, entry->inode_index);
+    int result = entry->deleted ? -1 : read_inode_data(entry->disk_index, entry->inode_index, ret);
+    unlock_inode(entry->disk_index, entry->inode_index);
+    return result;
+}
 
-    unsigned char* buffer = (unsigned char*) malloc(sizeof (struct blocks) * 6);
-    memset(buffer, 0, sizeof(struct blocks) * 6);
-    // Generate buffer for loading data from disk.
-    if (!buffer) return -1;
 
-    // Read block one by one.
-    for (int i = 0 ; i < 6 ; i++) {
-        unsigned int block = in.blocks[i];
-        if (block == 0) continue;
-        memcpy(&buffer[i], &cur_p.data_blocks[block], sizeof(struct blocks));
+/**
+ * A function that decompresses the data of a compressed inode.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode index.
+ * @param packed The stored data of the inode, starting with struct compress_header.
+ * @param ret The char* address to store the data into, see read_inode_data.
+ * @return -1 if the compressed data was broken, 0 if successful.
+ */
+static int unpack_inode_data(unsigned int disk_index, unsigned int inode_index, unsigned char* packed,
+                             unsigned char** ret) {
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
+    struct compress_header header = {0};
+    unsigned char *buffer = NULL;
+    if (in->size >= sizeof(header)) {
+        memcpy(&header, packed, sizeof(header));
+        if (size_to_blocks(disk_index, header.size) <= max_file_blocks(disk_index))
+            buffer = calloc((size_t) size_to_blocks(disk_index, header.size) * get_block_size(disk_index) + 1, 1);
+    }
+    if (!buffer || decompress_data(header.method, packed + sizeof(header), in->size - sizeof(header), buffer,
+                                   header.size) == -1) {
+        printf("[ERROR] Compressed data of inode %d is broken\n", inode_index);
+        free(buffer);
+        return -1;
     }
+    *ret = buffer;
+    return 0;
+}
+
 
+/**
+ * A function that reads all data that an inode is storing.
+ * The returned buffer is always NULL terminated and is rounded up to the block size.
+ * Contiguous blocks are copied at once, compressed data is decompressed.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode index to read data from.
+ * @param ret The char* address to store return value into. This must be freed by the caller.
+ * @return -1 if unsuccessful, 0 if successful.
+ */
+int read_inode_data(unsigned int disk_index, unsigned int inode_index, unsigned char** ret) {
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int block_count = size_to_blocks(disk_index, in->size);
+
+    // Generate buffer for loading data from disk.
+    unsigned int *blocks = malloc(sizeof(unsigned int) * block_count);
+    unsigned char* buffer = (unsigned char*) calloc((size_t) block_count * get_block_size(disk_index) + 1, 1);
+    if (!blocks || !buffer) {
+        free(blocks);
+        free(buffer);
+        return -1;
+    }
+
+    block_count = read_block_map(disk_index, in, blocks, block_count);
+    read_block_runs(disk_index, blocks, block_count, buffer);
+    free(blocks);
+
+    if ((in->mode & INODE_MODE_COMPRESSED) == INODE_MODE_COMPRESSED) {
+        int ret_code = unpack_inode_data(disk_index, inode_index, buffer, ret);
+        free(buffer);
+        return ret_code;
+    }
     *ret = buffer;
     return 0;
 }
 
 
+/**
+ * A function that maps a range of the data that an inode is storing into views of the mounted blocks.
+ * Nothing is copied, each view points into the data blocks in memory and contiguous blocks share a single view.
+ * The caller must hold the lock of the inode while using the views, since writers can move the blocks.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode index to map.
+ * @param offset The offset to start mapping from.
+ * @param length The length to map, this is cut at the stored size of the inode.
+ * @param views The array to store views into.
+ * @param view_count The count of views that the array can hold. The range is cut when the views are not enough.
+ * @return The count of views stored, -1 if failure.
+ */
+int map_inode_range(unsigned int disk_index, unsigned int inode_index, unsigned int offset, unsigned int length,
+                    struct iovec* views, unsigned int view_count) {
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int block_size = get_block_size(disk_index);
+    if (offset >= in->size) return 0;
+    if (length > in->size - offset) length = in->size - offset;
+
+    unsigned int count = 0;
+    while (length > 0) {
+        unsigned int block = 0;
+        if (lookup_block(disk_index, in, offset / block_size, &block) == -1) return -1;
+        unsigned int in_block = offset % block_size;
+        unsigned int len = block_size - in_block < length ? block_size - in_block : length;
+        unsigned char *base = (unsigned char*) get_block(disk_index, block) + in_block;
+
+        if (count > 0 && (unsigned char*) views[count - 1].iov_base + views[count - 1].iov_len == base) {
+            views[count - 1].iov_len += len; // Next block of a contiguous run.
+        } else if (count < view_count) {
+            views[count].iov_base = base;
+            views[count].iov_len = len;
+            count++;
+        } else break; // Out of views.
+        offset = offset + len;
+        length = length - len;
+    }
+    return (int) count;
+}
+
+
+/**
+ * A function that maps a range of a file into views of the mounted blocks, see map_inode_range.
+ * The file is locked for reading when this succeeds, call release_file_view when done with the views.
+ * Compressed files can not be mapped, use read_file_data or read_file_range for them.
+ * @param entry The entry to map.
+ * @param offset The offset to start mapping from.
+ * @param length The length to map.
+ * @param views The array to store views into.
+ * @param view_count The count of views that the array can hold.
+ * @return The count of views stored, -1 if failure.
+ */
+int read_file_view(struct entry_t* entry, unsigned int offset, unsigned int length,
+                   struct iovec* views, unsigned int view_count) {
+    if (flush_file(entry) == -1) return -1;
+    lock_inode_read(entry->disk_index, entry->inode_index);
+    struct inode *in = &partitions[entry->disk_index].inode_table[entry->inode_index];
+    int ret = entry->deleted || (in->mode & INODE_MODE_COMPRESSED) == INODE_MODE_COMPRESSED ? -1
+            : map_inode_range(entry->disk_index, entry->inode_index, offset, length, views, view_count);
+    if (ret == -1) unlock_inode(entry->disk_index, entry->inode_index);
+    return ret;
+}
+
+
+/**
+ * A function that releases views returned by read_file_view.
+ * @param entry The entry that was mapped.
+ */
+void release_file_view(struct entry_t* entry) {
+    unlock_inode(entry->disk_index, entry->inode_index);
+}
+
+
+/**
+ * A function that reads a range of a file into a buffer, like pread.
+ * Only the requested bytes are copied. Empty and deleted files read as 0 bytes.
+ * @param entry The entry to read data from.
+ * @param offset The offset to start reading from.
+ * @param length The length to read.
+ * @param buffer The buffer to store data into, this must be at least length bytes.
+ * @return The count of bytes read, -1 if failure.
+ */
+int read_file_range(struct entry_t* entry, unsigned int offset, unsigned int length, unsigned char* buffer) {
+    struct inode *in = &partitions[entry->disk_index].inode_table[entry->inode_index];
+    struct iovec views[16];
+    int total = 0;
+
+    if (flush_file(entry) == -1) return -1;
+    lock_inode_read(entry->disk_index, entry->inode_index);
+    unsigned int size = entry->deleted ? 0 : get_inode_size(entry->disk_index, entry->inode_index);
+    if (offset >= size) length = 0;
+    else if (length > size - offset) length = size - offset;
+
+    // Compressed files are decompressed as a whole.
+    if (length > 0 && (in->mode & INODE_MODE_COMPRESSED) == INODE_MODE_COMPRESSED) {
+        unsigned char *data = NULL;
+        if (read_inode_data(entry->disk_index, entry->inode_index, &data) == -1) {
+            total = -1;
+        } else {
+            memcpy(buffer, data + offset, length);
+            total = (int) length;
+            free(data);
+        }
+        length = 0;
+    }
+
+    while (length > 0) {
+        int count = map_inode_range(entry->disk_index, entry->inode_index, offset, length, views, 16);
+        if (count <= 0) {
+            total = -1;
+            break;
+        }
+        for (int i = 0 ; i < count ; i++) {
+            memcpy(buffer + total, views[i].iov_base, views[i].iov_len);
+            total = total + (int) views[i].iov_len;
+            offset = offset + views[i].iov_len;
+            length = length - views[i].iov_len;
+        }
+    }
+    unlock_inode(entry->disk_index, entry->inode_index);
+    return total;
+}
+
+
+/**
+ * A function that replaces all data that an inode is storing.
+ * Blocks are assigned or released according to the new size and the data is emitted in contiguous runs.
+ * Growing files get blocks next to their own blocks by place_file_blocks, or are moved into a single run.
+ * This only updates the inode in memory, call write_inode to emit the inode itself.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode index to write data into.
+ * @param size The size of the new data.
+ * @param buffer The new data.
+ * @return -1 if failure, 0 if successful.
+ */
+int write_inode_data(unsigned int disk_index, unsigned int inode_index, unsigned int size, unsigned char* buffer) {
+    struct inode *cur_in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int new_count = size_to_blocks(disk_index, size);
+    if (new_count > max_file_blocks(disk_index)) { // The max that we can write is max_file_blocks blocks.
+        printf("[ERROR] Write size is too big: %d\n", size);
+        return -1;
+    }
+
+    unsigned int old_count = size_to_blocks(disk_index, cur_in->size);
+    unsigned int *blocks = malloc(sizeof(unsigned int) * (new_count > old_count ? new_count : old_count));
+    unsigned int *old_blocks = malloc(sizeof(unsigned int) * old_count);
+    if (!blocks || !old_blocks) {
+        free(blocks);
+        free(old_blocks);
+        return -1;
+    }
+    old_count = read_block_map(disk_index, cur_in, old_blocks, old_count);
+    memcpy(blocks, old_blocks, sizeof(unsigned int) * old_count);
+
+    // If the size of data we are writing right now exceeds current assigned blocks, get more blocks and assign them.
+    // If it got smaller, give the remaining blocks back.
+    unsigned char moved = 0;
+    if (new_count > old_count) {
+        if (place_file_blocks(disk_index, blocks, old_count, new_count, &moved) == -1) {
+            printf("[ERROR] Could not allocate more disk blocks\n");
+            free(blocks);
+            free(old_blocks);
+            return -1;
+        }
+    } else if (new_count < old_count) {
+        release_blocks(disk_index, old_count - new_count, blocks + new_count);
+    }
+
+    // Blocks kept by snapshots must not be overwritten, the file gets new blocks for them.
+    unsigned int *fresh = malloc(sizeof(unsigned int) * new_count);
+    int unshared = fresh ? unshare_blocks(disk_index, blocks, new_count, fresh) : -1;
+    if (unshared == -1 || write_block_map(disk_index, cur_in, blocks, new_count) == -1) {
+        printf("[ERROR] Could not store block list\n");
+        if (unshared > 0) release_blocks(disk_index, unshared, fresh);
+        if (moved) release_blocks(disk_index, new_count, blocks);
+        else if (new_count > old_count) release_blocks(disk_index, new_count - old_count, blocks + old_count);
+        free(fresh);
+        free(blocks);
+        free(old_blocks);
+        return -1;
+    }
+
+    // Physically emit change to disk, this also saves change in the data table on the memory.
+    store_block_runs(disk_index, blocks, new_count, buffer, size);
+    if (moved) release_blocks(disk_index, old_count, old_blocks); // Nothing refers to the old place anymore.
+    cur_in->size = size;
+    free(fresh);
+    free(blocks);
+    free(old_blocks);
+    return 0;
+}
+
+
+/**
+ * A function that writes data into a range of an inode, like pwrite.
+ * Only the blocks in the range are written, so appending a few bytes writes the last block (and new blocks) only.
+ * The blocks between the old end of the data and the offset are filled with 0, the inode grows when the range goes
+ * beyond the end. New blocks are placed after the last block by place_file_blocks, the file is never moved.
+ * This only updates the inode in memory, call write_inode to emit the inode itself.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode index to write data into.
+ * @param offset The offset to write data at.
+ * @param size The size of data.
+ * @param buffer The data.
+ * @return -1 if failure, 0 if successful.
+ */
+int write_inode_range(unsigned int disk_index, unsigned int inode_index, unsigned int offset, unsigned int size,
+                      unsigned char* buffer) {
+    struct inode *cur_in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int block_size = get_block_size(disk_index);
+    unsigned int old_size = (cur_in->mode & INODE_MODE_EMPTY_FILE) == INODE_MODE_EMPTY_FILE ? 0 : cur_in->size;
+    unsigned int end = offset + size;
+    if (size == 0) return 0;
+    if (end < offset || size_to_blocks(disk_index, end) > max_file_blocks(disk_index)) {
+        printf("[ERROR] Write size is too big: %u\n", end);
+        return -1;
+    }
+
+    unsigned int new_size = end > old_size ? end : old_size;
+    unsigned int new_count = size_to_blocks(disk_index, new_size);
+    unsigned int old_count = size_to_blocks(disk_index, cur_in->size);
+    unsigned int *blocks = malloc(sizeof(unsigned int) * (new_count > old_count ? new_count : old_count));
+    if (!blocks) return -1;
+    old_count = read_block_map(disk_index, cur_in, blocks, old_count);
+    if (new_count > old_count && place_file_blocks(disk_index, blocks, old_count, new_count, NULL) == -1) {
+        printf("[ERROR] Could not allocate more disk blocks\n");
+        free(blocks);
+        return -1;
+    }
+
+    // Build the blocks in the range, starting from the old data of them.
+    unsigned int start = offset < old_size ? offset : old_size; // The gap after the old data is written as well.
+    unsigned int first = start / block_size, last = (end - 1) / block_size;
+    unsigned int count = last - first + 1;
+    unsigned int old_in_range = old_count > first ? (old_count - first < count ? old_count - first : count) : 0;
+    unsigned char *data = calloc((size_t) count * block_size, 1);
+    unsigned int *fresh = malloc(sizeof(unsigned int) * count);
+    int unshared = -1;
+    if (data && fresh) {
+        read_block_runs(disk_index, blocks + first, old_in_range, data);
+        if (offset > old_size) memset(data + (old_size - first * block_size), 0, offset - old_size);
+        memcpy(data + (offset - first * block_size), buffer, size);
+
+        // Blocks kept by snapshots must not be overwritten, the file gets new blocks for them.
+        unshared = unshare_blocks(disk_index, blocks + first, old_in_range, fresh);
+    }
+    if (unshared == -1 || ((unshared > 0 || new_count > old_count)
+                           && write_block_map(disk_index, cur_in, blocks, new_count) == -1)) {
+        printf("[ERROR] Could not store block list\n");
+        if (unshared > 0) release_blocks(disk_index, unshared, fresh);
+        if (new_count > old_count) release_blocks(disk_index, new_count - old_count, blocks + old_count);
+        free(data);
+        free(fresh);
+        free(blocks);
+        return -1;
+    }
+
+    // Physically emit the range only, the rest of the last block of the file stays 0.
+    store_block_runs(disk_index, blocks + first, count, data, new_size - first * block_size);
+    cur_in->size = new_size;
+    free(data);
+    free(fresh);
+    free(blocks);
+    return 0;
+}
+
+
 /**
  * A function that updates logical inode with specific inode.
  * This will automatically update physical disk's data as well.
@@ -827,24 +1995,33 @@ int update_inode(unsigned int disk_index, unsigned int inode_index, struct inode
 
 /**
  * A function that writes inode value to disk.
- * This physically writes data into the inode into the disk.
+ * This physically writes data into the inode into the disk, through the journal.
  * @param disk_index The disk index to write inode into.
  * @param inode_index The index of inode to write inode into.
  * @param data The inode data to write.
  * @return -1 if failure, 0 if successful.
  */
 int write_inode(unsigned int disk_index, unsigned int inode_index, struct inode* data) {
+    TRACE_OP(TRACE_WRITE_INODE);
+    TRACE_BYTES(sizeof(struct inode));
     struct partition *cur_p = &partitions[disk_index];
-    unsigned char* buffer = (unsigned char*) data; // Typecast into buffer.
     unsigned int inode_size = cur_p->s.inode_size;
-    unsigned int real_offset = inode_size * inode_index + 0x400; // This is the offset of inode.
+    unsigned int real_offset = inode_size * inode_index + inode_table_offset(disk_index); // This is the offset of inode.
+    return journal_write(disk_index, real_offset, data, sizeof(struct inode));
+}
 
-    // Open file for specific offset write, special thanks to https://stackoverflow.com/a/2623210/5716511
-    FILE* fp = fopen(disks[disk_index], "rb+");
-    fseek(fp, real_offset, SEEK_SET); // Set offset
-    fwrite(buffer, sizeof(struct inode), 1, fp); // Write binary data.
-    fclose(fp); // Close file.
 
+/**
+ * A function that checks if a file name can be stored in directories of a disk.
+ * @param disk_index The disk index to look for.
+ * @param name The file name.
+ * @return -1 if the name was empty or too long, 0 if successful.
+ */
+static int check_name(unsigned int disk_index, char* name) {
+    if (name[0] == '\0' || strlen(name) > max_name_len(disk_index)) {
+        printf("[ERROR] File name must be 1 to %d characters long\n", max_name_len(disk_index));
+        return -1;
+    }
     return 0;
 }
 
@@ -866,6 +2043,8 @@ int write_inode(unsigned int disk_index, unsigned int inode_index, struct inode*
  * @return -1 if failure, 0 if successful.
  */
 int create_file(unsigned int disk_index, struct entry_t* cur_dir, char* file_name, unsigned char is_dir) {
+    if (check_name(disk_index, file_name) == -1) return -1;
+
     // Create new inode and entry structs.
     struct inode *new_in = malloc(sizeof(struct inode));
     struct entry_t *new_ent = malloc(sizeof(struct entry_t));
@@ -874,18 +2053,25 @@ int create_file(unsigned int disk_index, struct entry_t* cur_dir, char* file_nam
 
     if ((void*) new_in == (void*) new_ent) return -1; // Both malloc failed
     else {
-        unsigned int assigned_blocks[6] = {0xFFFF}; // Initialize with 0xFFFF since this index is impossible to be assigned.
+        journal_begin(disk_index); // Everything below is committed at once.
+        lock_dir(cur_dir); // Nobody else can add or remove entries of this directory until we are done.
+        unsigned int assigned_blocks[6] = {0}; // Only the first block will be assigned.
         unsigned int assigned_inode_index = 0xFFFF; // Initialize with 0xFFFF since this index is impossible to be assigned.
 
         // Get allocated 1 free block and 1 free inode for creating file.
         int ret = assign_empty_blocks(disk_index, 1, assigned_blocks); // Assign empty assigned_blocks.
         if (ret == -1) { // Assigning empty assigned_blocks failed.
             printf("[ERROR] Could not get free assigned_blocks assigned when creating file\n");
+            unlock_dir(cur_dir);
+            journal_end(disk_index);
             return -1;
         }
         ret = assign_empty_inodes(disk_index, &assigned_inode_index); // Assign empty inode.
         if (ret == -1) { // Assigning empty inode failed.
             printf("[ERROR] Could not get free inodes assigned when creating file\n");
+            release_blocks(disk_index, 1, assigned_blocks); // Give back the block we got.
+            unlock_dir(cur_dir);
+            journal_end(disk_index);
             return -1;
         }
 #ifdef DEBUG
@@ -903,14 +2089,20 @@ int create_file(unsigned int disk_index, struct entry_t* cur_dir, char* file_nam
         new_in->date = 0;
         new_in->indirect_inode = -1;
         new_in->locked = 0;
-        new_in->blocks[0] = assigned_blocks[0]; // Store block info.
 
-        // Store initial block data to actually emit to the disk.
+        // Store initial block data to actually emit to the disk, directly into the disk block table.
         // When creating a directory, default size is 0x40 since it includes . and ..
         // When creating a file, default size is set 0x3 since it just has \n + padding.
-        struct blocks tmp_block[1];
-        memset(tmp_block, 0, sizeof(struct blocks));
-        if (is_dir) { // For directory, add . and .. initially.
+        struct blocks *tmp_block = get_block(disk_index, assigned_blocks[0]);
+        memset(tmp_block, 0, get_block_size(disk_index));
+        if (is_dir && check_feature(disk_index, MYFS_FEATURE_DIR_ENTRY)) { // Variable length entries fill the block.
+            unsigned int block_size = get_block_size(disk_index), pos = 0;
+            unsigned char *data = (unsigned char*) tmp_block;
+            dir_block_init(data, block_size);
+            dir_block_insert(data, block_size, assigned_inode_index, DENTRY_TYPE_DIR_FILE, ".", &pos);
+            dir_block_insert(data, block_size, cur_dir->inode_index, DENTRY_TYPE_DIR_FILE, "..", &pos);
+            new_in->size = block_size;
+        } else if (is_dir) { // For directory, add . and .. initially.
             unsigned char initial_str[0x40] = {0};
             initial_str[0x10] = '.';
             initial_str[0x30] = '.';
@@ -924,44 +2116,25 @@ int create_file(unsigned int disk_index, struct entry_t* cur_dir, char* file_nam
         }
 
         new_in->mode = mode;
+        write_block_map(disk_index, new_in, assigned_blocks, 1); // Store block info, big disks need the indirect format.
         struct inode* in_table = partitions[disk_index].inode_table;
         memcpy(in_table + assigned_inode_index, new_in, sizeof(struct inode)); // Apply it to the inode table.
-        struct blocks* block_table = partitions[disk_index].data_blocks;
-
-        // Apply it to the disk block table.
-        memcpy(block_table + assigned_blocks[0], tmp_block, sizeof(struct blocks));
 
         // Store new entry's information.
         strcpy(new_ent->name, file_name);
         new_ent->disk_index = disk_index;
         new_ent->inode_index = assigned_inode_index;
-        new_ent->sibling = NULL;
         new_ent->child = NULL;
-        new_ent->parent = cur_dir;
-
-        // Set inode and block as being used.
-        inode_stats[assigned_inode_index][disk_index] = 1;
-        for (int i = 0 ; i < 6 ; i++) {
-            block_stats[assigned_blocks[i]][disk_index] = 1;
-        }
 
         // Insert entry into the LCRS tree for easy indexing in the future.
-        if (cur_dir->child == NULL) { // If current directory was an empty directory, just link this as child.
-            cur_dir->child = new_ent;
-            // printf("This is the first element: %s, parent %s\n", new_ent->name, cur_dir->name);
-        } else { // If current directory was not empty directory, find the last sibling and attach this as sibling.
-            struct entry_t *peer;
-            peer = cur_dir->child;
-            while (peer->sibling != NULL) { // Find the last sibling of current directory.
-                peer = peer->sibling;
-            }
-            peer->sibling = new_ent;
-        }
+        dir_link_entry(cur_dir, new_ent);
 
         // Physically emit data into the disk.
         write_inode(disk_index, assigned_inode_index, new_in); // Store inode.
-        write_data_block(disk_index, assigned_blocks[0], 1, tmp_block); // Store data block.
+        write_meta_block(disk_index, assigned_blocks[0], tmp_block); // Store data block.
         dir_add_child(disk_index, new_ent, cur_dir); // Add entry into the current directory file.
+        unlock_dir(cur_dir);
+        journal_end(disk_index);
 
         free(new_in);
         return 0;
@@ -971,6 +2144,7 @@ int create_file(unsigned int disk_index, struct entry_t* cur_dir, char* file_nam
 
 /**
  * A function that writes data into specific block in disk.
+ * The write is only submitted, the data reaches the disk before the next journal commit (see ioring_drain).
  * @param disk_index The disk index to write.
  * @param block_index The index of disk block.
  * @param block_count The count of disk blocks to write. For example, if we are writing 3.5 blocks, this shall be 4.
@@ -978,139 +2152,590 @@ int create_file(unsigned int disk_index, struct entry_t* cur_dir, char* file_nam
  * @return -1 if failure, 0 if successful.
  */
 int write_data_block(unsigned int disk_index, unsigned int block_index, unsigned int block_count, struct blocks* data) {
+    TRACE_OP(TRACE_WRITE_DATA_BLOCK);
     unsigned char* buffer = (unsigned char*) data; // Typecast into buffer.
-    unsigned int real_offset = 0x2000 + block_index * sizeof(struct blocks); // This is the offset of the whole disk.
+    unsigned int real_offset = block_offset(disk_index, block_index); // This is the offset of the whole disk.
+    unsigned int length = block_count * get_block_size(disk_index);
+    TRACE_BYTES(length);
 
 #ifdef DEBUG
-    printf("[DEBUG] Writing data from %x to %x (%d bytes)\n", real_offset, real_offset + block_count * sizeof(struct blocks), block_count * 400);
+    printf("[DEBUG] Writing data from %x to %x (%d bytes)\n", real_offset, real_offset + length, length);
 #endif
-    // Open file for specific offset write, special thanks to https://stackoverflow.com/a/2623210/5716511
-    FILE* fp = fopen(disks[disk_index], "rb+");
-    fseek(fp, real_offset, SEEK_SET); // Set offset
-    fwrite(buffer, block_count * sizeof(struct blocks), 1, fp); // Write binary data.
-    fclose(fp); // Close file.
+    journal_forget(disk_index, real_offset, length); // Blocks could have been metadata before.
+    count_image_write(disk_index, length);
+    return ioring_write(disk_index, real_offset, buffer, length); // Submitted asynchronously, see ioring.h.
+}
 
-    return 0;
+
+/**
+ * A function that writes a single metadata block (directory file or indirect block) into the disk.
+ * Unlike write_data_block, this goes through the journal, so it is committed together with the inodes.
+ * @param disk_index The disk index to write block into.
+ * @param block_index The block index to write.
+ * @param data The block to write.
+ * @return -1 if failure, 0 if successful.
+ */
+int write_meta_block(unsigned int disk_index, unsigned int block_index, struct blocks* data) {
+    TRACE_OP(TRACE_WRITE_META_BLOCK);
+    TRACE_BYTES(get_block_size(disk_index));
+    unsigned int real_offset = block_offset(disk_index, block_index); // This is the offset of the whole disk.
+    return journal_write(disk_index, real_offset, data, get_block_size(disk_index));
 }
 
 
 /**
  * A function that assigns empty blocks from disk.
+ * The blocks are looked up from the block bitmap, starting from the rotating next-fit cursor.
+ * This function will try assigning a contiguous run of blocks first so that the file can be read and written at once.
+ * If the disk was too fragmented to have such run, this will fall back to assigning blocks one by one.
  * @param disk_index The index of disk to look for empty blocks.
  * @param block_count The count of empty blocks to get assigned.
  * @param ret The array of unsigned int* to set assigned blocks to.
- *            The array MUST have at 6 elements. Size must be greater than sizeof(unsigned int) * 6.
+ *            The array MUST have at least block_count elements.
  * @return -1 if failure, 0 if success
  *         If the disk had no more space, this will return -1.
  *         Even if it had 'some' disk space left, this will return -1.
  *         Ex) Disk space left 3 blocks, required blocks 4 -> returns -1.
  */
 int assign_empty_blocks(unsigned int disk_index, unsigned int block_count, unsigned int* ret) {
+    TRACE_OP(TRACE_ASSIGN_EMPTY_BLOCKS);
+    TRACE_BYTES((unsigned long long) block_count * get_block_size(disk_index));
     struct partition *cur_p = &partitions[disk_index];
-    unsigned int free_blocks = cur_p->s.num_free_blocks;
-    unsigned int tmp_ret[6] = {0xFFFF};
-    unsigned int cur_count = 0;
-    if (free_blocks >= block_count) {
-        // Iterate over blocks till we satisfy the block count.
-        for (int i = 0 ; (i < MAX_BLOCK_COUNT) && (cur_count < block_count) ; i++) {
-            if (block_stats[i][disk_index] == 0) {
-                block_stats[i][disk_index] = 1; // Set as being used.
-                tmp_ret[cur_count] = i;
-                cur_count++;
-            }
-        }
-        for (int i = 0 ; i < 6 ; i++) // Copy values to ret.
-            ret[i] = tmp_ret[i];
-        //memcpy(*ret, tmp_ret, sizeof(unsigned int) * 6);
-        return 0;
-    } else { // When disk space was not enough.
+    struct bitmap_t *bm = &block_bitmaps[disk_index];
+    lock_alloc(disk_index);
+    if (cur_p->s.num_free_blocks < block_count || bm->free_count < block_count) { // When disk space was not enough.
+        unlock_alloc(disk_index);
         printf("[ERROR] No space left on device\n");
         return -1;
     }
+
+    unsigned int start = 0;
+    if (bitmap_find_run(bm, block_count, &start) == 0) { // Got a contiguous extent.
+        for (unsigned int i = 0 ; i < block_count ; i++)
+            ret[i] = start + i;
+    } else { // Could not find a long enough run, just take any free blocks.
+        for (unsigned int i = 0 ; i < block_count ; i++)
+            bitmap_find_free(bm, &ret[i]); // This will not fail since we checked the free count.
+    }
+
+    cur_p->s.num_free_blocks = cur_p->s.num_free_blocks - block_count;
+    write_super_block(disk_index); // Emit bitmap change to disk.
+    unlock_alloc(disk_index);
+    return 0;
+}
+
+
+/**
+ * A function that assigns blocks for a file growing from old_count blocks to new_count blocks.
+ * The blocks are placed in the following order of preference:
+ * 1. Right after the last block of the file, so the file keeps growing as a single run.
+ * 2. A free run that holds the whole file, nearest after the file. The file is moved there, since all blocks of
+ *    the file are written again anyway. The caller must release the old blocks once the file was written.
+ * 3. The nearest free run after the file that holds the new blocks.
+ * 4. The nearest free blocks after the file, one by one.
+ * New files with no blocks are placed by assign_empty_blocks. Callers that write only a part of the file must not
+ * move it, they pass NULL as moved to skip the 2nd case.
+ * @param disk_index The index of disk to look for empty blocks.
+ * @param blocks The blocks of the file, this MUST have at least new_count elements.
+ *               New blocks are stored after the old ones, or all of them are replaced when the file was moved.
+ * @param old_count The count of blocks that the file has.
+ * @param new_count The count of blocks that the file needs.
+ * @param moved The pointer to store whether if the file was moved into a new run, NULL not to move the file.
+ * @return -1 if failure, 0 if success.
+ */
+int place_file_blocks(unsigned int disk_index, unsigned int* blocks, unsigned int old_count, unsigned int new_count,
+                      unsigned char* moved) {
+    TRACE_OP(TRACE_PLACE_FILE_BLOCKS);
+    struct partition *cur_p = &partitions[disk_index];
+    struct bitmap_t *bm = &block_bitmaps[disk_index];
+    unsigned int need = new_count - old_count;
+    TRACE_BYTES((unsigned long long) need * get_block_size(disk_index));
+    if (moved != NULL) *moved = 0;
+    if (old_count == 0) return assign_empty_blocks(disk_index, need, blocks);
+
+    lock_alloc(disk_index);
+    if (cur_p->s.num_free_blocks < need || bm->free_count < need) { // When disk space was not enough.
+        unlock_alloc(disk_index);
+        printf("[ERROR] No space left on device\n");
+        return -1;
+    }
+
+    unsigned int goal = blocks[old_count - 1] + 1, start = 0;
+    if (bitmap_claim_run(bm, goal, need) == 0) { // Right after the file.
+        for (unsigned int i = 0 ; i < need ; i++)
+            blocks[old_count + i] = goal + i;
+    } else if (moved != NULL && cur_p->s.num_free_blocks >= new_count
+               && bitmap_find_run_near(bm, new_count, goal, &start) == 0) {
+        for (unsigned int i = 0 ; i < new_count ; i++)
+            blocks[i] = start + i;
+        need = new_count; // The old blocks are still used until the caller releases them.
+        *moved = 1;
+    } else if (bitmap_find_run_near(bm, need, goal, &start) == 0) {
+        for (unsigned int i = 0 ; i < need ; i++)
+            blocks[old_count + i] = start + i;
+    } else { // Free space is too fragmented, take the nearest ones.
+        for (unsigned int i = 0 ; i < need ; i++) {
+            bitmap_find_run_near(bm, 1, goal, &blocks[old_count + i]); // This will not fail, free count was checked.
+            goal = blocks[old_count + i] + 1;
+        }
+    }
+
+    cur_p->s.num_free_blocks = cur_p->s.num_free_blocks - need;
+    write_super_block(disk_index); // Emit bitmap change to disk.
+    unlock_alloc(disk_index);
+    return 0;
 }
 
 
 /**
  * A function that assigns empty inodes from disk.
- * This function will just simply grab an empty inode from the disk that was available in the fastest order.
+ * This function will grab the next free inode from the inode bitmap using next-fit.
  * @param disk_index The index of disk to look for empty inodes.
  * @param ret The pointer to unsigned int to store empty inode to.
  * @return -1 if failure (no free inodes), 0 if success.
  */
 int assign_empty_inodes(unsigned int disk_index, unsigned int* ret) {
+    TRACE_OP(TRACE_ASSIGN_EMPTY_INODES);
     struct partition *cur_p = &partitions[disk_index];
-    unsigned int free_inodes = cur_p->s.num_free_inodes;
-    if (free_inodes != 0) { // We at least had an inode to assign.
-        // Iterate over all inodes and look for an empty inode.
-        // This will be an O(n) operation.
-        for (int i = 0 ; i < MAX_INODE_COUNT ; i++) {
-            if (inode_stats[i][disk_index] == 0) { // If the inode was free, assign it.
-                inode_stats[i][disk_index] = 1; // Set the inode as being used.
-                cur_p->s.num_free_inodes = cur_p->s.num_free_inodes - 1; // Reduce one free inode.
-                *ret = i; // Set assigned inode.
-                return 0;
-            }
-        }
-        return -1; // Could not find any empty space.
-    } else { // When disk space was not enough.
+    lock_alloc(disk_index);
+    if (cur_p->s.num_free_inodes == 0 || bitmap_find_free(&inode_bitmaps[disk_index], ret) == -1) {
+        unlock_alloc(disk_index);
         printf("[ERROR] No space left on device\n");
         return -1;
     }
+
+    cur_p->s.num_free_inodes = cur_p->s.num_free_inodes - 1; // Reduce one free inode.
+    write_super_block(disk_index); // Emit bitmap change to disk.
+    unlock_alloc(disk_index);
+    return 0;
+}
+
+
+/**
+ * A function that releases blocks back to the disk.
+ * Block 0 is considered as an unassigned block, therefore will be ignored.
+ * Blocks kept by snapshots stay used, they are released when the snapshots are deleted.
+ * @param disk_index The index of disk to release blocks from.
+ * @param block_count The count of blocks in the array.
+ * @param blocks The array of blocks to release.
+ * @return 0.
+ */
+int release_blocks(unsigned int disk_index, unsigned int block_count, unsigned int* blocks) {
+    struct partition *cur_p = &partitions[disk_index];
+    struct bitmap_t *bm = &block_bitmaps[disk_index];
+    lock_alloc(disk_index);
+    for (unsigned int i = 0 ; i < block_count ; i++) {
+        if (blocks[i] == 0 || !bitmap_test(bm, blocks[i])) continue; // Unassigned or already free.
+        if (is_snapshot_block(disk_index, blocks[i])) continue; // Kept by a snapshot.
+        bitmap_clear(bm, blocks[i]);
+        cur_p->s.num_free_blocks = cur_p->s.num_free_blocks + 1;
+    }
+    write_super_block(disk_index); // Emit bitmap change to disk.
+    unlock_alloc(disk_index);
+    return 0;
+}
+
+
+/**
+ * A function that releases an inode back to the disk.
+ * @param disk_index The index of disk to release inode from.
+ * @param inode_index The inode to release.
+ * @return 0.
+ */
+int release_inode(unsigned int disk_index, unsigned int inode_index) {
+    struct partition *cur_p = &partitions[disk_index];
+    struct bitmap_t *bm = &inode_bitmaps[disk_index];
+    lock_alloc(disk_index);
+    if (bitmap_test(bm, inode_index)) {
+        bitmap_clear(bm, inode_index);
+        cur_p->s.num_free_inodes = cur_p->s.num_free_inodes + 1;
+        write_super_block(disk_index); // Emit bitmap change to disk.
+    }
+    unlock_alloc(disk_index);
+    return 0;
 }
 
 
 /**
- * A function that scans disk blocks and look marks each block is being used or not to the block_stats
+ * A function that loads block usage of a disk into the block bitmap.
+ * When the disk already has a persisted bitmap in its super block (or its own place in v2), that bitmap is used as is.
+ * Otherwise, this scans all inodes once and persists the bitmap, so that later mounts do not need to scan again.
  * @param disk_index The disk index to look for.
  * @return -1 if failure, 0 if success.
  */
 int scan_disk_blocks(unsigned int disk_index) {
-    if(disk_index >= disk_count) return -1;
+    if(disk_index >= (unsigned int) disk_count) return -1;
     else {
         struct partition *cur_p = &partitions[disk_index];
-        for (int i = 0 ; i < MAX_INODE_COUNT ; i++) {
-            struct inode cur_i = cur_p->inode_table[i];
-            for (int j = 0 ; j < 6 ; j++) {
-                block_stats[cur_i.blocks[j]][disk_index] = 1; // Set the block as being used.
+        struct bitmap_t *bm = &block_bitmaps[disk_index];
+        unsigned int block_count = cur_p->s.num_blocks;
+        if (bitmap_init(bm, block_count) == -1) return -1;
+
+        unsigned char is_persisted = check_feature(disk_index, MYFS_FEATURE_BLOCK_BITMAP);
+        if (is_persisted && check_feature(disk_index, MYFS_FEATURE_GEOMETRY)) { // v2, the bitmap has its own place.
+            bitmap_load(bm, cur_p->image + cur_p->s.block_bitmap_start, (block_count + 7) / 8);
+        } else if (is_persisted) { // Just load the bitmap.
+            bitmap_load(bm, cur_p->s.block_bitmap, sizeof(cur_p->s.block_bitmap));
+        } else { // Original format, scan all inodes and mark their blocks.
+            unsigned int *blocks = malloc(sizeof(unsigned int) * block_count);
+            if (!blocks) return -1;
+            for (unsigned int i = 0 ; i < cur_p->s.num_inodes ; i++) {
+                struct inode *cur_i = &cur_p->inode_table[i];
+                int count = read_block_map(disk_index, cur_i, blocks, block_count);
+                count += read_indirect_blocks(disk_index, cur_i, blocks + count, block_count - count);
+                for (int j = 0 ; j < count ; j++) {
+                    bitmap_set(bm, blocks[j]); // Set the block as being used.
+                }
             }
+            free(blocks);
+            if (check_feature(disk_index, MYFS_FEATURE_JOURNAL)) { // Journal blocks belong to no inode.
+                for (unsigned int j = 0 ; j < cur_p->s.journal_blocks ; j++) bitmap_set(bm, cur_p->s.journal_start + j);
+            }
+            set_feature(disk_index, MYFS_FEATURE_BLOCK_BITMAP);
         }
-        unsigned int count = 0;
-        for (int i = 0 ; i < MAX_BLOCK_COUNT ; i++) {
-            count += block_stats[i][disk_index] == 1; // Add total count of empty blocks.
-        }
+
+        unsigned int count = bm->bit_count - bm->free_count; // Total count of used blocks.
         cur_p->s.num_free_blocks = cur_p->s.num_blocks - count; // Store free block count
+        if (!is_persisted) write_super_block(disk_index);
         return 0;
     }
 }
 
 
 /**
- * A function that scans disk blocks and look marks each block is being used or not to the block_stats
+ * A function that loads inode usage of a disk into the inode bitmap.
+ * Just like scan_disk_blocks, this will only scan the inode table when the disk has no persisted bitmap.
  * @param disk_index The disk index to look for.
  * @return -1 if failure, 0 if success.
  */
 int scan_disk_inodes(unsigned int disk_index) {
-    if(disk_index >= disk_count) return -1;
+    if(disk_index >= (unsigned int) disk_count) return -1;
     else {
         struct partition *cur_p = &partitions[disk_index];
-        for (int i = 0 ; i < MAX_INODE_COUNT ; i++) { // Mark inodes that are being used.
-            struct inode cur_i = cur_p->inode_table[i];
-            inode_stats[i][disk_index] = (cur_i.size != 0 || i < 3);
+        struct bitmap_t *bm = &inode_bitmaps[disk_index];
+        if (bitmap_init(bm, cur_p->s.num_inodes) == -1) return -1;
+
+        unsigned char is_persisted = check_feature(disk_index, MYFS_FEATURE_INODE_BITMAP);
+        if (is_persisted && check_feature(disk_index, MYFS_FEATURE_GEOMETRY)) { // v2, the bitmap has its own place.
+            bitmap_load(bm, cur_p->image + cur_p->s.inode_bitmap_start, (cur_p->s.num_inodes + 7) / 8);
+        } else if (is_persisted) { // Just load the bitmap.
+            bitmap_load(bm, cur_p->s.inode_bitmap, sizeof(cur_p->s.inode_bitmap));
+        } else { // Original format, guess inode usage from the inode table.
+            for (unsigned int i = 0 ; i < cur_p->s.num_inodes ; i++) { // Mark inodes that are being used.
+                struct inode *cur_i = &cur_p->inode_table[i];
+                if (cur_i->size != 0 || i < 3) bitmap_set(bm, i);
+            }
+            set_feature(disk_index, MYFS_FEATURE_INODE_BITMAP);
         }
 
-        unsigned int count = 0; // Store count value.
-        for (int i = 0 ; i < MAX_INODE_COUNT ; i++) {
-            count += inode_stats[i][disk_index] == 1;
-        }
+        unsigned int count = bm->bit_count - bm->free_count; // Total count of used inodes.
         cur_p->s.num_free_inodes = cur_p->s.num_inodes - count; // Store free inode count.
+        if (!is_persisted) write_super_block(disk_index);
         return 0;
     }
 }
 
 
+/**
+ * A function that builds the CoW map of a disk from the inode table.
+ * Copies that direct another copy are directed to the actual original, so that every chain is a single step.
+ * @param disk_index The disk index to look for.
+ * @return -1 if failure, 0 if success.
+ */
+int scan_cow_inodes(unsigned int disk_index) {
+    if (disk_index >= (unsigned int) disk_count) return -1;
+    struct inode *inode_table = partitions[disk_index].inode_table;
+    struct cow_map_t *map = &cow_maps[disk_index];
+    int inode_count = (int) partitions[disk_index].s.num_inodes;
+    if (cow_map_init(map, inode_count) == -1) return -1;
+
+    for (int i = 0 ; i < inode_count ; i++) {
+        struct inode *cur_i = &inode_table[i];
+        if (cur_i->indirect_inode == -1 || !bitmap_test(&inode_bitmaps[disk_index], i)) continue;
+        if ((cur_i->mode & (INODE_MODE_REG_FILE | INODE_MODE_DIR_FILE)) == 0) continue; // Not a file.
+
+        // Follow the chain to the original, at most inode_count steps.
+        int original = cur_i->indirect_inode;
+        for (int steps = 0 ; steps < inode_count ; steps++) {
+            if (original < 0 || original >= inode_count || inode_table[original].indirect_inode == -1) break;
+            original = inode_table[original].indirect_inode;
+        }
+        if (original < 0 || original >= inode_count || inode_table[original].indirect_inode != -1) {
+            printf("[WARNING] Inode %d has a broken CoW indirection, ignoring it\n", i);
+            continue;
+        }
+        if (original != cur_i->indirect_inode) {
+            cur_i->indirect_inode = original;
+            write_inode(disk_index, i, cur_i);
+        }
+        cow_map_add(map, original, i);
+    }
+    return 0;
+}
+
+
+/**
+ * A function that reads a single 0x20 bytes directory entry from a directory file.
+ * Only the block containing the entry is touched.
+ * @param disk_index The disk index that the directory is located at.
+ * @param in The inode of the directory.
+ * @param offset The offset of the entry in the directory file.
+ * @param slot The buffer to store 0x20 bytes of entry into.
+ * @return -1 if failure, 0 if successful.
+ */
+static int read_dir_slot(unsigned int disk_index, struct inode* in, unsigned int offset, unsigned char* slot) {
+    unsigned int block = 0, block_size = get_block_size(disk_index);
+    if (lookup_block(disk_index, in, offset / block_size, &block) == -1) return -1;
+    unsigned char *data = (unsigned char*) get_block(disk_index, block);
+    memcpy(slot, data + offset % block_size, sizeof(unsigned char) * 0x20);
+    return 0;
+}
+
+
+/**
+ * A function that writes a single 0x20 bytes directory entry into a directory file.
+ * Only the block containing the entry is emitted to disk.
+ * If the block is kept by a snapshot, the directory gets its own copy of the block first.
+ * @param disk_index The disk index that the directory is located at.
+ * @param inode_index The inode of the directory.
+ * @param offset The offset of the entry in the directory file.
+ * @param slot The 0x20 bytes of entry to write.
+ * @return -1 if failure, 0 if successful.
+ */
+static int write_dir_slot(unsigned int disk_index, unsigned int inode_index, unsigned int offset, unsigned char* slot) {
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int block = 0, block_size = get_block_size(disk_index);
+    if (lookup_block(disk_index, in, offset / block_size, &block) == -1) return -1;
+    if (is_snapshot_block(disk_index, block)
+        && unshare_file_block(disk_index, inode_index, offset / block_size, &block) == -1) return -1;
+    struct blocks *data = get_block(disk_index, block);
+    memcpy((unsigned char*) data + offset % block_size, slot, sizeof(unsigned char) * 0x20);
+    return write_meta_block(disk_index, block, data);
+}
+
+
+/**
+ * A function that adds or removes the last block of a directory file.
+ * This must be called before updating the size of the directory.
+ * @param disk_index The disk index that the directory is located at.
+ * @param in The inode of the directory.
+ * @param grow 1 for adding a new empty block, 0 for releasing the last block.
+ * @return -1 if failure, 0 if successful.
+ */
+static int resize_dir_blocks(unsigned int disk_index, struct inode* in, unsigned char grow) {
+    unsigned int count = size_to_blocks(disk_index, in->size);
+    unsigned int *blocks = malloc(sizeof(unsigned int) * (count + 1));
+    if (!blocks) return -1;
+    count = read_block_map(disk_index, in, blocks, count);
+
+    if (grow) {
+        if (assign_empty_blocks(disk_index, 1, blocks + count) == -1) {
+            free(blocks);
+            return -1;
+        }
+        memset(get_block(disk_index, blocks[count]), 0, get_block_size(disk_index));
+        count++;
+    } else {
+        count--;
+        release_blocks(disk_index, 1, blocks + count);
+    }
+
+    int ret = write_block_map(disk_index, in, blocks, count);
+    if (ret == -1 && grow) release_blocks(disk_index, 1, blocks + count - 1);
+    free(blocks);
+    return ret;
+}
+
+
+/**
+ * A function that finds where an entry is located at in a directory file.
+ * The offset stored in the entry is checked first, then the directory file is searched.
+ * @param disk_index The disk index that the directory is located at.
+ * @param in The inode of the directory.
+ * @param entry The entry to look for.
+ * @param ret The pointer to store the offset into.
+ * @return -1 if failure, 0 if successful.
+ */
+static int find_dir_slot(unsigned int disk_index, struct inode* in, struct entry_t* entry, unsigned int* ret) {
+    unsigned char slot[0x20] = {0};
+    unsigned int offset = entry->dir_offset;
+    if (offset + 0x20 <= in->size && read_dir_slot(disk_index, in, offset, slot) == 0 &&
+        !strncmp((char*) slot + 0x10, entry->name, 0x10)) {
+        *ret = offset;
+        return 0;
+    }
+
+    // The stored offset was stale, search the whole directory file.
+    for (offset = 0 ; offset + 0x20 <= in->size ; offset += 0x20) {
+        if (read_dir_slot(disk_index, in, offset, slot) == 0 && !strncmp((char*) slot + 0x10, entry->name, 0x10)) {
+            *ret = offset;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * A function that returns a block of a directory file made of variable length entries, for updating entries in it.
+ * If the block is kept by a snapshot, the directory gets its own copy of the block first.
+ * @param disk_index The disk index that the directory is located at.
+ * @param inode_index The inode of the directory.
+ * @param index The index of the block in the directory file.
+ * @param ret The pointer to store the block index into.
+ * @return The block, NULL if failure.
+ */
+static unsigned char* dir_entry_block(unsigned int disk_index, unsigned int inode_index, unsigned int index,
+                                      unsigned int* ret) {
+    struct inode *in = &partitions[disk_index].inode_table[inode_index];
+    unsigned int block = 0;
+    if (lookup_block(disk_index, in, index, &block) == -1) return NULL;
+    if (is_snapshot_block(disk_index, block) && unshare_file_block(disk_index, inode_index, index, &block) == -1)
+        return NULL;
+    *ret = block;
+    return (unsigned char*) get_block(disk_index, block);
+}
+
+
+/**
+ * A function that scans the free space of each block of a directory file.
+ * This is done once, the free space is kept up to date by the entry operations afterwards.
+ * @param disk_index The disk index that the directory is located at.
+ * @param dir The directory.
+ * @return -1 if failure, 0 if successful.
+ */
+static int load_dir_space(unsigned int disk_index, struct entry_t* dir) {
+    struct inode *in = &partitions[disk_index].inode_table[dir->inode_index];
+    unsigned int block_size = get_block_size(disk_index), count = in->size / block_size, block = 0;
+    unsigned int *space = malloc(sizeof(unsigned int) * (count + 1));
+    if (!space) return -1;
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        if (lookup_block(disk_index, in, i, &block) == -1) space[i] = 0;
+        else space[i] = dir_block_space((unsigned char*) get_block(disk_index, block), block_size);
+    }
+    dir->dir_space = space;
+    dir->dir_space_count = count;
+    return 0;
+}
+
+
+/**
+ * A function that inserts a variable length entry into a directory file.
+ * The first block with enough free space takes the entry, the directory file grows by a block if none has.
+ * The caller must hold the directory lock, and write the inode of the directory if its size was changed.
+ * @param disk_index The disk index that the directory is located at.
+ * @param dir The directory.
+ * @param inode_index The inode of the entry.
+ * @param name The name of the entry.
+ * @param ret The pointer to store the offset of the new entry into.
+ * @return -1 if failure, 0 if successful.
+ */
+static int insert_dir_entry(unsigned int disk_index, struct entry_t* dir, unsigned int inode_index, char* name,
+                            unsigned int* ret) {
+    struct inode *in = &partitions[disk_index].inode_table[dir->inode_index];
+    unsigned int block_size = get_block_size(disk_index), need = dir_entry_size(strlen(name));
+    unsigned int index = 0, block = 0, pos = 0;
+    if (dir->dir_space == NULL && load_dir_space(disk_index, dir) == -1) return -1;
+    while (index < dir->dir_space_count && dir->dir_space[index] < need) index++;
+
+    // Every block is full, so the directory file needs one more block.
+    if (index == dir->dir_space_count) {
+        unsigned int *space = realloc(dir->dir_space, sizeof(unsigned int) * (index + 1));
+        if (!space) return -1;
+        dir->dir_space = space;
+        if (resize_dir_blocks(disk_index, in, 1) == -1) return -1;
+        in->size = in->size + block_size;
+        if (lookup_block(disk_index, in, index, &block) == -1) return -1;
+        dir_block_init((unsigned char*) get_block(disk_index, block), block_size);
+        dir->dir_space[index] = block_size;
+        dir->dir_space_count++;
+    }
+
+    unsigned char file_type = DENTRY_TYPE_REG_FILE;
+    if (partitions[disk_index].inode_table[inode_index].mode & INODE_MODE_DIR_FILE) file_type = DENTRY_TYPE_DIR_FILE;
+    unsigned char *data = dir_entry_block(disk_index, dir->inode_index, index, &block);
+    if (data == NULL || dir_block_insert(data, block_size, inode_index, file_type, name, &pos) == -1) return -1;
+    dir->dir_space[index] = dir_block_space(data, block_size);
+    *ret = index * block_size + pos;
+    return write_meta_block(disk_index, block, (struct blocks*) data);
+}
+
+
+/**
+ * A function that removes a variable length entry from a directory file.
+ * Empty blocks at the end of the directory file are given back, the first block always stays.
+ * The caller must hold the directory lock, and write the inode of the directory if its size was changed.
+ * @param disk_index The disk index that the directory is located at.
+ * @param dir The directory.
+ * @param offset The offset of the entry in the directory file.
+ * @return -1 if failure, 0 if successful.
+ */
+static int erase_dir_entry(unsigned int disk_index, struct entry_t* dir, unsigned int offset) {
+    struct inode *in = &partitions[disk_index].inode_table[dir->inode_index];
+    unsigned int block_size = get_block_size(disk_index), index = offset / block_size, block = 0;
+    unsigned char *data = dir_entry_block(disk_index, dir->inode_index, index, &block);
+    if (data == NULL || dir_block_remove(data, block_size, offset % block_size) == -1) return -1;
+    if (dir->dir_space != NULL && index < dir->dir_space_count)
+        dir->dir_space[index] = dir_block_space(data, block_size);
+
+    int ret = 0;
+    if (index + 1 != in->size / block_size || index == 0 || !dir_block_empty(data, block_size))
+        ret = write_meta_block(disk_index, block, (struct blocks*) data);
+
+    // Give back the empty blocks at the end of the directory file.
+    while (in->size / block_size > 1 && lookup_block(disk_index, in, in->size / block_size - 1, &block) == 0 &&
+           dir_block_empty((unsigned char*) get_block(disk_index, block), block_size)) {
+        if (resize_dir_blocks(disk_index, in, 0) == -1) return -1;
+        in->size = in->size - block_size;
+        if (dir->dir_space != NULL && dir->dir_space_count > in->size / block_size) dir->dir_space_count--;
+    }
+    return ret;
+}
+
+
+/**
+ * A function that finds where a variable length entry is located at in a directory file.
+ * The offset stored in the entry is checked first, then the directory file is searched.
+ * @param disk_index The disk index that the directory is located at.
+ * @param in The inode of the directory.
+ * @param entry The entry to look for.
+ * @param ret The pointer to store the offset into.
+ * @return -1 if failure, 0 if successful.
+ */
+static int find_dir_entry(unsigned int disk_index, struct inode* in, struct entry_t* entry, unsigned int* ret) {
+    unsigned int block_size = get_block_size(disk_index), name_len = strlen(entry->name), block = 0;
+    unsigned int offset = entry->dir_offset;
+    struct dir_entry *de = NULL;
+    if (offset < in->size && lookup_block(disk_index, in, offset / block_size, &block) == 0) {
+        de = dir_entry_at((unsigned char*) get_block(disk_index, block), block_size, offset % block_size);
+        if (de != NULL && de->inode != 0 && de->name_len == name_len && !memcmp(de + 1, entry->name, name_len)) {
+            *ret = offset;
+            return 0;
+        }
+    }
+
+    // The stored offset was stale, search the whole directory file.
+    for (unsigned int i = 0 ; i < in->size / block_size ; i++) {
+        if (lookup_block(disk_index, in, i, &block) == -1) continue;
+        unsigned char *data = (unsigned char*) get_block(disk_index, block);
+        for (unsigned int pos = 0 ; (de = dir_entry_at(data, block_size, pos)) != NULL ; pos += de->dir_length) {
+            if (de->inode != 0 && de->name_len == name_len && !memcmp(de + 1, entry->name, name_len)) {
+                *ret = i * block_size + pos;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+
 /**
  * A function that adds a file into a specific directory.
  * This function will add entry to the directory file.
+ * Directory files of 0x20 bytes slots do not have holes, so the new entry is always appended to the end of the file.
+ * If the last block of the directory file is full, the directory file will grow by a block.
+ * With MYFS_FEATURE_DIR_ENTRY, the entry goes into the first block with enough free space instead.
  * @param disk_index The disk index that current directory is located at
  * @param child The child entry to add.
  * @param dir The current directory to add new file into.
@@ -1118,33 +2743,26 @@ int scan_disk_inodes(unsigned int disk_index) {
  */
 int dir_add_child(unsigned int disk_index, struct entry_t* child, struct entry_t* dir) {
     struct inode *in = &partitions[dir->disk_index].inode_table[dir->inode_index];
-    struct partition *cur_p = &partitions[disk_index];
-    unsigned block_count = (in->size / sizeof(struct blocks)) + 1; // Calculate total block count.
-    unsigned int buffer_size = sizeof(struct blocks) * block_count; // Calculate total buffer size.
-
-    // Generate and copy buffer from original data.
-    unsigned char *buffer = malloc(sizeof(unsigned char) * buffer_size);
-    memcpy(buffer, cur_p->data_blocks + in->blocks[0], buffer_size);
-
-    // Search for empty space with 0x20 bytes to place our new entry into.
-    unsigned int offset = 0;
-    while (offset <= buffer_size) {
-        // Seek throughout the directory file and look for empty element.
-        unsigned char tmp_ent[0x20] = {0};
-        memcpy(tmp_ent, buffer + offset, sizeof(unsigned char) * 0x20);
-
-        // Check if the current entry that we are seeking in the file is empty.
-        unsigned int cur_sum = 0 ;
-        for (int i = 0 ; i < 0x20 ; i++) {
-            cur_sum += tmp_ent[i];
+    lock_dir(dir);
+    unsigned int offset = in->size;
+
+    // Directory files made of variable length entries take the entry wherever it fits.
+    if (check_feature(disk_index, MYFS_FEATURE_DIR_ENTRY)) {
+        if (insert_dir_entry(disk_index, dir, child->inode_index, child->name, &offset) == -1) {
+            printf("[ERROR] Could not add more files to current directory\n");
+            unlock_dir(dir);
+            return -1;
         }
-
-        if (cur_sum == 0) break; // If we have 0x20 bytes of empty space to write new directory entry into.
-        offset = offset + 0x20; // Otherwise, update offset and look for the next one.
+        write_inode(disk_index, dir->inode_index, in);
+        child->dir_offset = offset;
+        unlock_dir(dir);
+        return 0;
     }
 
-    if (offset == buffer_size) { // This means that there is not enough room for new file in this entry.
+    // If the last block is full, we need one more block for the new entry.
+    if (offset % get_block_size(disk_index) == 0 && resize_dir_blocks(disk_index, in, 1) == -1) {
         printf("[ERROR] Could not add more files to current directory\n");
+        unlock_dir(dir);
         return -1;
     }
 
@@ -1153,8 +2771,6 @@ int dir_add_child(unsigned int disk_index, struct entry_t* child, struct entry_t
     unsigned int inode_index = child->inode_index;
     memcpy(new_entry, &inode_index, sizeof(char) * 4); // Copy inode index.
     memcpy(new_entry + 0x10, child->name, sizeof(char) * 16); // Copy name into the entry.
-    memcpy(buffer + offset, new_entry, sizeof(char) * 0x20); // Store data into the buffer.
-    memcpy(cur_p->data_blocks + in->blocks[0], buffer, buffer_size);
 
 #ifdef DEBUG
     printf("[DEBUG] Found empty entry place from %0x to %0x.\n", offset, offset + 0x20 - 1);
@@ -1163,21 +2779,15 @@ int dir_add_child(unsigned int disk_index, struct entry_t* child, struct entry_t
     for (int i = 0 ; i < 0x20 ; i++)
         printf("%x", new_entry[i]);
     printf("\n");
-    printf("[DEBUG] Buffer : ");
-    for (int i = 0 ; i < 0x20 ; i++)
-        printf("%x", buffer[i + offset]);
-    printf("\n");
-    printf("[DEBUG] Block count : %d\n", block_count);
 #endif
 
-    in->size = in->size + 0x20;
-    //partitions[disk_index].inode_table[dir->inode_index].size = in->size + 0x20; // Update directory's size.
-
     // Physically emit data into the disk file.
     // We also need to update the inode metadata for the directory as well.
-    write_data_block(disk_index, in->blocks[0], block_count, (struct blocks*) buffer);
+    in->size = offset + 0x20;
+    write_dir_slot(disk_index, dir->inode_index, offset, new_entry);
     write_inode(disk_index, dir->inode_index, in);
-    free(buffer); // OS is my garbage collector but...
+    child->dir_offset = offset;
+    unlock_dir(dir);
 
     return 0;
 }
@@ -1185,12 +2795,14 @@ int dir_add_child(unsigned int disk_index, struct entry_t* child, struct entry_t
 
 /**
  * A function that removes specific child entry from the directory.
- * When deleting a file, there shall be two things that must be performed:
- * 1. Set the entry which spans over length of 0x20 as 0.
- * 2. Then shift all entries after the target to the target point.
- *    Ex) 1 2 3 4 was the file and we removed 3
- *        1 2 4 shall be the directory entry value.
+ * When deleting a file, there shall be three things that must be performed:
+ * 1. Move the last entry of the directory file into the target's place.
+ *    Ex) 1 2 3 4 was the file and we removed 2
+ *        1 4 3 shall be the directory entry value.
+ * 2. Set the last entry which spans over length of 0x20 as 0, release the last block if it became empty.
  * 3. Update inode size for the directory.
+ * This way, only the blocks containing the target and the last entry are touched.
+ * With MYFS_FEATURE_DIR_ENTRY, only the block containing the target is touched.
  * @param disk_index The disk index to search for the target.
  * @param dir The directory entry that the target is residing in.
  * @param target The name of the target.
@@ -1198,108 +2810,149 @@ int dir_add_child(unsigned int disk_index, struct entry_t* child, struct entry_t
  */
 int dir_remove_child(unsigned int disk_index, struct entry_t* dir, char* target) {
     struct inode *in = &partitions[dir->disk_index].inode_table[dir->inode_index];
-    struct partition *cur_p = &partitions[disk_index];
-    unsigned block_count = (in->size / sizeof(struct blocks)) + 1; // Calculate total block count.
-    unsigned int buffer_size = sizeof(struct blocks) * block_count; // Calculate total buffer size.
-    unsigned char found_target = 0;
-
-    // Generate and copy buffer from original data.
-    unsigned char *buffer = malloc(buffer_size);
-    memcpy(buffer, cur_p->data_blocks + in->blocks[0], buffer_size);
-
-    // Search for the place where our target is located at.
+    struct entry_t *target_entry = NULL;
     unsigned int offset = 0;
-    while (offset <= buffer_size) {
-        // Seek throughout the directory file and look for the file name
-        char file_name[0x10] = {0};
-        memcpy(file_name, buffer + offset + 0x10, sizeof(unsigned char) * 0x10);
-        if (!strcmp(file_name, target)) { // Meaning that we have found the name.
-            // If we have found the entry, there are two things that we shall perform.
-            // 1. Set the entry as 0.
-            // 2. Shift all entries after the found entry 0x20.
-            found_target = 1;
-            memset(buffer + offset, 0, sizeof(unsigned char) * 0x20); // Remove file entry.
-            //printf("shifting from %x to %x %x(%d -> %d)\n", offset, offset + 0x20, in->size - offset - 0x20, in->size - offset - 0x20, (int) (in->size - offset - 0x20) > 0 ? in->size - offset - 0x20 : 0);
-            // If the size is negative, set it as 0 since it will cause SEFGAULT.
-            memcpy(buffer + offset, buffer + offset + 0x20, (int) (in->size - offset - 0x20) > 0 ? in->size - offset - 0x20 : 0); // TODO Fix pointer.
-            break;
-        }
-        offset = offset + 0x20; // Otherwise, update offset and look for the next one.
-    }
+    lock_dir(dir);
 
-    if (!found_target) { // This means that there is not enough room for new file in this entry.
+    // Search for the place where our target is located at.
+    int found = find_child(dir, &target_entry, target);
+    if (found == 0 && check_feature(disk_index, MYFS_FEATURE_DIR_ENTRY))
+        found = find_dir_entry(disk_index, in, target_entry, &offset);
+    else if (found == 0) found = find_dir_slot(disk_index, in, target_entry, &offset);
+    if (found == -1) {
         printf("[ERROR] Could not find entry %s\n", target);
+        unlock_dir(dir);
         return -1;
     }
 
-    in->size = in->size - 0x20; // Remove size 0x20 since the file size was changed.
+    // Variable length entries just give their space to the previous entry.
+    if (check_feature(disk_index, MYFS_FEATURE_DIR_ENTRY)) {
+        unsigned int size = in->size;
+        int ret = erase_dir_entry(disk_index, dir, offset);
+        if (in->size != size) write_inode(disk_index, dir->inode_index, in);
+        unlock_dir(dir);
+        return ret;
+    }
 
-    // Physically emit data into the disk file.
-    // We also need to update the inode metadata for the directory as well.
-    memcpy(cur_p->data_blocks + in->blocks[0], buffer, buffer_size);
-    write_data_block(disk_index, in->blocks[0], block_count, (struct blocks*) buffer);
+    // Fill the hole with the last entry, so that the directory file does not have holes.
+    unsigned char slot[0x20] = {0};
+    unsigned int last = in->size - 0x20;
+    if (offset != last) {
+        read_dir_slot(disk_index, in, last, slot);
+        write_dir_slot(disk_index, dir->inode_index, offset, slot);
+
+        char moved_name[0x11] = {0};
+        struct entry_t *moved = NULL;
+        memcpy(moved_name, slot + 0x10, sizeof(unsigned char) * 0x10);
+        if (find_child(dir, &moved, moved_name) == 0) moved->dir_offset = offset;
+        memset(slot, 0, sizeof(slot));
+    }
+    write_dir_slot(disk_index, dir->inode_index, last, slot); // Remove the last entry.
+
+    // Remove size 0x20 since the file size was changed.
+    // If the last block became empty, give it back.
+    if (last % get_block_size(disk_index) == 0) resize_dir_blocks(disk_index, in, 0);
+    in->size = last;
     write_inode(disk_index, dir->inode_index, in);
-    free(buffer); // OS is my garbage collector but...
+    unlock_dir(dir);
 
     return 0;
 }
 
 
 /**
- * A function that deletes a single file or directory file.
+ * A function that releases blocks and inode of a file and removes it from its directory.
+ * The caller must hold the CoW lock, the directory lock and the write lock of the file.
  * @param disk_index The disk index that this file is located.
  * @param dir The directory that this file is located at.
- * @param target The target file.
+ * @param target_entry The target file.
  * @return -1 if failure, 0 if successful.
  */
-int delete_file(unsigned int disk_index, struct entry_t* dir, char* target) {
+static int remove_file(unsigned int disk_index, struct entry_t* dir, struct entry_t* target_entry) {
     // Store necessary data.
     struct inode *inode_table = partitions[disk_index].inode_table;
-    struct blocks *block_table = partitions[disk_index].data_blocks;
-    struct entry_t *target_entry = NULL;
-    find_entry(dir->child, &target_entry, target);
-    if (target_entry == NULL) return -1; // Could not find entry.
     struct inode target_in = partitions[target_entry->disk_index].inode_table[target_entry->inode_index];
 
     // Remove blocks from block table.
-    unsigned short block_arr[0x6] = {0};
-    memcpy(block_arr, target_in.blocks, sizeof(unsigned short) * 6);
-    for (int i = 0; i < 6; i++) {
-        if (block_arr[i] == 0) continue; // if block was 0 skip since this is unassigned block.
-        memset(block_table + block_arr[i], 0, sizeof(struct blocks)); // Clear block data in memory.
-        write_data_block(disk_index, block_arr[i], 1, block_table + block_arr[i]); // Emit change to disk.
+    // If this inode was an indirection (CoW copy), the blocks belong to the original inode. So leave them as is.
+    // Originals with copies were handed over to a copy by handoff_cow, so those are indirections here as well.
+    if (target_in.indirect_inode != -1) {
+        cow_map_remove(&cow_maps[disk_index], target_entry->inode_index);
+    } else {
+        unsigned int block_count = size_to_blocks(disk_index, target_in.size);
+        unsigned int *block_arr = malloc(sizeof(unsigned int) * block_count);
+        if (!block_arr) return -1;
+        block_count = read_block_map(disk_index, &target_in, block_arr, block_count);
+        for (unsigned int i = 0; i < block_count; i++) {
+            if (block_arr[i] == 0) continue; // if block was 0 skip since this is unassigned block.
+            if (is_snapshot_block(disk_index, block_arr[i])) continue; // Snapshots still need the data.
+            memset(get_block(disk_index, block_arr[i]), 0, get_block_size(disk_index)); // Clear block data in memory.
+        }
+        write_block_runs(disk_index, block_arr, block_count); // Emit change to disk.
+        release_block_map(disk_index, &target_in); // Set blocks including indirect blocks as available.
+        free(block_arr);
     }
 
-    // Remove inode from the inode table.
+    // Remove inode from the inode table, delayed appends are gone with it.
     unsigned int inode_index = target_entry->inode_index;
+    delalloc_drop(&delallocs[disk_index], inode_index);
     memset(inode_table + inode_index, 0, sizeof(struct inode)); // Clock inode data in memory.
     write_inode(disk_index, inode_index, &inode_table[inode_index]); // Emit change to disk.
-    inode_stats[inode_index][disk_index] = 0; // Set inode as available.
-
-    // Remove entry from the LCRS tree.
-    struct entry_t *peer = dir->child;
-    if (peer == target_entry) { // If this was the first child in the directory.
-        dir->child = peer->sibling; // Just unlink it.
-    } else { // If this was not the first child in the directory.
-        while (peer->sibling != NULL) { // Find the sibling that is connected to current entry.
-            if (peer->sibling == target_entry) {
-                peer->sibling = target_entry->sibling; // Connect before and next.
-                break;
-            }
-            peer = peer->sibling;
-        }
-    }
+    release_inode(disk_index, inode_index); // Set inode as available.
 
     // Remove file from the parent directory file.
-    if (dir_remove_child(disk_index, dir, target) == -1) {
-        printf("[ERROR] Could not delete file %s\n", target);
+    if (dir_remove_child(disk_index, dir, target_entry->name) == -1) {
+        printf("[ERROR] Could not delete file %s\n", target_entry->name);
         return -1;
     }
 
+    // Remove entry from the LCRS tree, other callers may still be holding it so it is freed later.
+    dir_unlink_entry(dir, target_entry);
+    release_entries(target_entry);
+    retire_entry(target_entry);
     return 0;
 }
 
 
+/**
+ * A function that deletes a single file or directory file.
+ * If other files are CoW copies of this file, one of them takes over the blocks before this file is deleted.
+ * @param disk_index The disk index that this file is located.
+ * @param dir The directory that this file is located at.
+ * @param target The target file.
+ * @return -1 if failure, 0 if successful.
+ */
+int delete_file(unsigned int disk_index, struct entry_t* dir, char* target) {
+    struct entry_t *target_entry = NULL;
+    journal_begin(disk_index);
+    lock_cow(disk_index);
+    lock_dir(dir);
+    find_child(dir, &target_entry, target);
+    if (target_entry == NULL) { // Could not find entry.
+        unlock_dir(dir);
+        unlock_cow(disk_index);
+        journal_end(disk_index);
+        return -1;
+    }
+    if (handoff_cow(disk_index, target_entry->inode_index) == -1) { // Copies of this file must not lose their blocks.
+        unlock_dir(dir);
+        unlock_cow(disk_index);
+        journal_end(disk_index);
+        return -1;
+    }
+
+    // Wait for readers and writers of this file, they will see the file as deleted afterwards.
+    unsigned int inode_index = target_entry->inode_index;
+    lock_inode_write(disk_index, inode_index);
+    int ret = remove_file(disk_index, dir, target_entry);
+    unlock_inode(disk_index, inode_index);
+    unlock_dir(dir);
+    unlock_cow(disk_index);
+    journal_end(disk_index);
+    return ret;
+}
+
+
 /**
  * A function that deletes directory recursively.
  * @param disk_index The volume index that this directory is located at.
@@ -1309,58 +2962,41 @@ int delete_file(unsigned int disk_index, struct entry_t* dir, char* target) {
  */
 int delete_directory(unsigned int disk_index, struct entry_t* cur_dir, char* target_dir) {
     struct entry_t *target_entry = NULL;
-    find_entry(cur_dir->child, &target_entry, target_dir);
-    if (target_entry == NULL) return -1; // Could not find entry.
-
-    r_delete_directory(disk_index, cur_dir, target_entry); // Delete directory recursively.
-    return 0;
+    journal_begin(disk_index);
+    lock_cow(disk_index);
+    lock_dir(cur_dir);
+    find_child(cur_dir, &target_entry, target_dir);
+    if (target_entry != NULL) r_delete_directory(disk_index, cur_dir, target_entry); // Delete directory recursively.
+    unlock_dir(cur_dir);
+    unlock_cow(disk_index);
+    journal_end(disk_index);
+    return target_entry == NULL ? -1 : 0;
 }
 
 
 /**
  * A recursive function that deletes all subdirectories and the files.
+ * All entries under the directory are deleted first, then the directory itself is deleted with delete_file.
+ * This way, the directory's blocks and inode are released just like a regular file.
+ * The caller must hold the CoW lock and the lock of cur_dir.
  * @param disk_index The index of disk.
  * @param cur_dir The current directory's entry.
  * @param child The child entry to delete.
  */
 void r_delete_directory(unsigned int disk_index, struct entry_t* cur_dir, struct entry_t* child) {
-    if (child->child == NULL) { // If the child was regular file, delete file.
-        delete_file(disk_index, cur_dir, child->name);
-        return;
-    } else { // If the child was a directory
-        struct entry_t *peer = child->child;
-        while (peer != NULL) { // For all s
-            struct inode tmp_in = partitions[disk_index].inode_table[peer->inode_index];
-            if ((tmp_in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) { // If this peer was inode
-                // Delete subdirectories and files, delete them all.
-                r_delete_directory(disk_index, child, peer);
-
-                // Once all the files in directory was deleted, delete the directory file as well.
-                struct partition *cur_p = &partitions[disk_index];
-                struct inode *in = &cur_p->inode_table[child->inode_index];
-
-                // Clear blocks that this directory was using.
-                unsigned block_count = (in->size / sizeof(struct blocks)) + 1; // Calculate total block count.
-                struct blocks empty_block;
-                memset(&empty_block, 0, sizeof(struct blocks));
-                for (int i = 0 ; i < block_count ; i++) { // Physically emit deletion.
-                    if (in->blocks[i] == 0) continue;
-                    else write_data_block(disk_index, in->blocks[i], 1, &empty_block);
-                }
-                // Delete entry in memory
-                memset(cur_p->data_blocks + in->blocks[0], 0, sizeof(struct blocks) * block_count);
-
-                // Delete inode that this directory was using.
-                struct inode empty_inode;
-                memset(&empty_inode, 0, sizeof(struct inode));
-                write_inode(disk_index, child->inode_index, &empty_inode); // Physically emit deletion.
-                memset(in, 0,sizeof(struct inode)); // Delete inode in the memory.
-            }
-            delete_file(disk_index, child, peer->name); // Delete entry from the higher directory.
-            peer = peer->sibling;
-        }
-        delete_file(disk_index, cur_dir, child->name); // Delete entry from the higher directory.
+    lock_dir(child);
+    struct entry_t *peer = dir_children(child);
+    while (peer != NULL) { // For all entries in this directory.
+        struct entry_t *next = peer->sibling; // Store next one since peer will be released.
+        struct inode tmp_in = partitions[disk_index].inode_table[peer->inode_index];
+        if ((tmp_in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) // If this peer was a directory
+            r_delete_directory(disk_index, child, peer); // Delete subdirectories and files, delete them all.
+        else
+            delete_file(disk_index, child, peer->name); // Delete entry from this directory.
+        peer = next;
     }
+    unlock_dir(child); // Parent must be locked before its children, so unlock before deleting from the parent.
+    delete_file(disk_index, cur_dir, child->name); // Delete entry from the higher directory.
 }
 
 
@@ -1369,21 +3005,22 @@ void r_delete_directory(unsigned int disk_index, struct entry_t* cur_dir, struct
  * Since this program uses CoW method, this will just generate inode and directory entry.
  * @param disk_index The volume index that this directory is located at.
  * @param src The source entry to copy.
+ * @param parent The directory to copy into, in the same volume as the source.
  * @param dst The destination file name to copy as.
  * @return -1 if failure, 0 if successful.
  */
-int copy_file(unsigned int disk_index, struct entry_t* src, char* dst) {
+int copy_file(unsigned int disk_index, struct entry_t* src, struct entry_t* parent, char* dst) {
     struct partition *cur_p = &partitions[disk_index];
+    if (check_name(disk_index, dst) == -1) return -1;
+    journal_begin(disk_index);
+    lock_cow(disk_index); // The original must not be written or deleted while it is being shared.
+    lock_dir(parent);
 
     // Find the original inode's index.
-    // This is for cases when copying a copied entry.
     // If we were copying a copied entry, we need to find the original entry.
-    unsigned int original_inode_index = 0xFFFF;
-    find_original_inode(disk_index, src->inode_index, &original_inode_index);
-    if (original_inode_index == 0xFFFF) { // We could not find original inode, quit
-        printf("[ERROR] Could not find original inode\n");
-        return -1;
-    }
+    // Copies always direct the original itself, so this is never more than a single step.
+    int indirection = cur_p->inode_table[src->inode_index].indirect_inode;
+    unsigned int original_inode_index = indirection == -1 ? src->inode_index : (unsigned int) indirection;
 
     struct inode *src_in = &cur_p->inode_table[original_inode_index];
     struct inode *dst_in = NULL;
@@ -1392,17 +3029,33 @@ int copy_file(unsigned int disk_index, struct entry_t* src, char* dst) {
     unsigned int assigned_inode = 0;
     if (assign_empty_inodes(disk_index, &assigned_inode) == -1) {
         printf("[ERROR] Could not assign inode\n");
+        unlock_dir(parent);
+        unlock_cow(disk_index);
+        journal_end(disk_index);
         return -1;
     }
 
     // Since we are performing CoW, just copy the whole inode into the new one.
+    // Wait for the writer of the original if there is one, so that the copy does not see a half written file.
+    // Delayed appends of the original are written first, so that the copy shares them as well.
     dst_in = &cur_p->inode_table[assigned_inode];
+    lock_inode_write(disk_index, original_inode_index);
+    if (write_pending_data(disk_index, original_inode_index, 0, NULL) == -1) {
+        printf("[ERROR] Could not write delayed appends of %s\n", src->name);
+        unlock_inode(disk_index, original_inode_index);
+        release_inode(disk_index, assigned_inode);
+        unlock_dir(parent);
+        unlock_cow(disk_index);
+        journal_end(disk_index);
+        return -1;
+    }
     memcpy(dst_in, src_in, sizeof(struct inode));
+    unlock_inode(disk_index, original_inode_index);
     dst_in->indirect_inode = (int) original_inode_index; // Set source inode as indirection.
     write_inode(disk_index, assigned_inode, dst_in); // Emit change to the disk.
+    cow_map_add(&cow_maps[disk_index], original_inode_index, assigned_inode);
 
     // Make new entry in the tree for the copied one.
-    struct entry_t* parent = src->parent;
     struct entry_t* new_ent = malloc(sizeof(struct entry_t));
     memset(new_ent, 0, sizeof(struct entry_t));
 
@@ -1410,42 +3063,21 @@ int copy_file(unsigned int disk_index, struct entry_t* src, char* dst) {
     new_ent->inode_index = assigned_inode;
     new_ent->disk_index = disk_index;
     new_ent->child = NULL;
-    new_ent->sibling = NULL;
-    new_ent->parent = parent;
     strcpy(new_ent->name, dst);
 
-    // Find last sibling and attach new entry to the new entry.
-    struct entry_t *peer = src;
-    while(peer->sibling != NULL) {
-        peer = peer->sibling;
-    }
-    peer->sibling  = new_ent;
+    // Attach new entry as the last sibling.
+    dir_link_entry(parent, new_ent);
 
     // add entry to the directory explicitly.
     dir_add_child(disk_index, new_ent, parent);
+    unlock_dir(parent);
+    unlock_cow(disk_index);
+    journal_end(disk_index);
 
     return 0;
 }
 
 
-/**
- * A function that finds original inode.
- * When we have recursive indirection, we need to find the original inode that is actually storing the disk data.
- * Ex) inode 3 (indirection) -> inode 2 (indirection) -> inode 1 (actual)
- * This function will works as a recursive function and find the index of the actual inode.
- * @param disk_index The disk index to look inode table from.
- * @param cur_inode The current inode that is directing another inode.
- * @param ret The pointer to store original inode's index.
- */
-void find_original_inode(unsigned int disk_index, unsigned int cur_inode, unsigned int* ret) {
-    struct inode in = partitions[disk_index].inode_table[cur_inode];
-    if (in.indirect_inode == -1) *ret = cur_inode; // We found the actual inode that is being redirected.
-    else {
-        find_original_inode(disk_index, in.indirect_inode, ret);
-    }
-}
-
-
 /**
  * A function that processes CoW (Copy on Write).
  * In this program, CoW will be triggered with following conditions:
@@ -1460,73 +3092,104 @@ void find_original_inode(unsigned int disk_index, unsigned int cur_inode, unsign
  * 3. Store data block physically.
  * 4. Update inode information.
  * 5. Store inode physically.
+ * The caller must hold the CoW lock.
  * @param disk_index The disk index to process CoW.
- * @param copied_entry The entry that was copied and is directing another inode.
+ * @param copied_index The inode that was copied and is directing another inode.
  * @return -1 if failure, 0 if successful.
  */
-int process_cow(unsigned int disk_index, struct entry_t* copied_entry) {
+int process_cow(unsigned int disk_index, unsigned int copied_index) {
 #ifdef DEBUG
-    printf("[DEBUG] CoW called for %s\n", copied_entry->name);
+    printf("[DEBUG] CoW called for inode %d\n", copied_index);
 #endif
-    struct inode *copied_in = &partitions[copied_entry->disk_index].inode_table[copied_entry->inode_index];
-    struct inode *original_in = &partitions[disk_index].inode_table[copied_in->indirect_inode];
-    struct partition *cur_p = &partitions[disk_index];
-    unsigned int block_count = (original_in->size / 1024) + 1;
+    struct inode *copied_in = &partitions[disk_index].inode_table[copied_index];
+    unsigned int original_index = copied_in->indirect_inode;
+    struct inode *original_in = &partitions[disk_index].inode_table[original_index];
+    unsigned int block_count = size_to_blocks(disk_index, original_in->size);
 
     // Assign free blocks just like the original source had.
-    struct blocks buffer[6];
-    memset(buffer, 0, sizeof(struct blocks) * 6);
-    unsigned int assigned_blocks[6] = {0};
+    unsigned int *original_blocks = malloc(sizeof(unsigned int) * block_count);
+    unsigned int *assigned_blocks = malloc(sizeof(unsigned int) * block_count);
+    if (!original_blocks || !assigned_blocks) {
+        free(original_blocks);
+        free(assigned_blocks);
+        return -1;
+    }
+
+    // Readers of the copy are reading the original's blocks, wait for them before giving the copy its own blocks.
+    lock_inode_write(disk_index, copied_index);
+    lock_inode_read(disk_index, original_index);
+    block_count = read_block_map(disk_index, original_in, original_blocks, block_count);
     if (assign_empty_blocks(disk_index, block_count, assigned_blocks) == -1) {
         printf("[ERROR] Could not assign empty blocks\n");
+        unlock_inode(disk_index, original_index);
+        unlock_inode(disk_index, copied_index);
+        free(original_blocks);
+        free(assigned_blocks);
         return -1;
     }
 
     // With the assigned free blocks, dump everything from the original source's blocks.
-    for (int i = 0 ; i < 6 ; i++) {
-        unsigned int block = assigned_blocks[i];
-        if (block == 0) continue;
-        memcpy(&buffer[i], &cur_p->data_blocks[original_in->blocks[i]], sizeof(struct blocks));
-    }
-
-    // Store data block physically and into the memory as well.
-    for (int i = 0 ; i < 6 ; i++) {
-        unsigned int block = assigned_blocks[i];
-        if (block == 0) continue;
-        memcpy(&cur_p->data_blocks[block], &buffer[i], sizeof(struct blocks));
-        write_data_block(disk_index, block, 1, &buffer[i]);
-    }
+    for (unsigned int i = 0 ; i < block_count ; i++)
+        memcpy(get_block(disk_index, assigned_blocks[i]), get_block(disk_index, original_blocks[i]),
+               get_block_size(disk_index));
+    write_block_runs(disk_index, assigned_blocks, block_count); // Store data block physically.
+    unlock_inode(disk_index, original_index);
 
     // Update inode information then store it to the disk as well.
-    for (int i = 0 ; i < 6 ; i++)
-        copied_in->blocks[i] = assigned_blocks[i]; // Can't use memcpy since this is unsigned short vs unsigned int.
+    // The copied inode was pointing at the original's (indirect) blocks, so start from an empty block list.
+    copied_in->mode = copied_in->mode & ~INODE_MODE_INDIRECT;
+    memset(copied_in->blocks, 0, sizeof(copied_in->blocks));
+    if (write_block_map(disk_index, copied_in, assigned_blocks, block_count) == -1) {
+        release_blocks(disk_index, block_count, assigned_blocks);
+        unlock_inode(disk_index, copied_index);
+        free(original_blocks);
+        free(assigned_blocks);
+        return -1;
+    }
     copied_in->indirect_inode = -1; // This is no longer indirection inode.
-    write_inode(disk_index, copied_entry->inode_index, copied_in);
+    write_inode(disk_index, copied_index, copied_in);
+    cow_map_remove(&cow_maps[disk_index], copied_index);
+    unlock_inode(disk_index, copied_index);
 
+    free(original_blocks);
+    free(assigned_blocks);
     return 0;
 }
 
 
 /**
- * A function that finds all inodes that has indirection to a specific inode.
- * Since this looks through all the entries in the inode table, this is O(n) operation.
- * Therefore, avoid using this function as much as possible.
- * @param disk_index The disk index to look for all inodes.
- * @param inode_index The target inode that we would like to indirections to.
- * @param ret The unsigned int array to store indirection information to.
- * @return The total count of indirections to this inode.
+ * A function that hands the blocks of an original inode over to one of its copies.
+ * The most recent copy becomes the new original, then other copies and the original itself are directed to it.
+ * Since copies already point at the same blocks, no data is copied and this takes O(copies).
+ * The caller must hold the CoW lock.
+ * @param disk_index The disk index to hand over blocks.
+ * @param original_index The original inode.
+ * @return -1 if failure, 0 if the original had no copies, 1 if blocks were handed over.
  */
-int find_indirection_inodes(unsigned int disk_index, unsigned int inode_index, unsigned int* ret) {
+int handoff_cow(unsigned int disk_index, unsigned int original_index) {
+    struct cow_map_t *map = &cow_maps[disk_index];
     struct inode *inode_table = partitions[disk_index].inode_table;
-    int cnt = 0;
-    // For all inodes in inode table search for all inodes that are directing target inode.
-    for (int i = 0 ; i < MAX_INODE_COUNT ; i++) {
-        if (inode_table[i].indirect_inode == inode_index) {
-            ret[cnt] = i;
-            cnt++;
-        }
+    if (inode_table[original_index].indirect_inode != -1) return 0; // This is a copy, not an original.
+    if (cow_map_count(map, original_index) == 0) return 0;
+    unsigned int *sharers = malloc(sizeof(unsigned int) * cow_map_count(map, original_index));
+    if (!sharers) return -1;
+    unsigned int count = cow_map_sharers(map, original_index, sharers);
+
+    // The new owner has the same block map as the original, it just stops being an indirection.
+    unsigned int owner = sharers[0];
+    cow_map_remove(map, owner);
+    inode_table[owner].indirect_inode = -1;
+    int ret = write_inode(disk_index, owner, &inode_table[owner]) == -1 ? -1 : 1;
+
+    // Direct everyone else to the new owner.
+    sharers[0] = original_index;
+    for (unsigned int i = 0 ; i < count && ret != -1 ; i++) {
+        inode_table[sharers[i]].indirect_inode = (int) owner;
+        if (write_inode(disk_index, sharers[i], &inode_table[sharers[i]]) == -1) ret = -1;
+        cow_map_add(map, owner, sharers[i]);
     }
-    return cnt;
+    free(sharers);
+    return ret;
 }
 
 
@@ -1536,48 +3199,25 @@ int find_indirection_inodes(unsigned int disk_index, unsigned int inode_index, u
  * When the target needs to be processed with CoW, this function will also perform CoW automatically.
  * There are two cases that this function will trigger CoW:
  * 1. The target was the original entry that some other inodes have indirection to:
- *    -> In this case, this function will perform CoW to all inodes that has indirection to the target.
+ *    -> In this case, blocks are handed over to a copy, then the target is processed just like a copy.
  * 2. The target entry was just an indirection to an original file:
  *    -> In this case, this function will just perform CoW to the target entry.
+ * Either way, only the target gets new blocks. Copies may be located in any directory.
  * @param disk_index The disk index to check CoW.
  * @param target The target entry to perform CoW.
  * @return -1 if failure, 0 if CoW was not performed, 1 if CoW was performed.
  */
 int handle_cow(unsigned int disk_index, struct entry_t* target) {
     struct inode *in = &partitions[disk_index].inode_table[target->inode_index];
-    if (in->indirect_inode != -1) {
-        // This means that this target entry directs to another inode.
-        if (process_cow(disk_index, target) == -1) { // CoW failed.
-            printf("[ERROR] CoW of %s failed\n", target->name);
-            return -1;
-        }
-        return 1; // CoW was performed.
-    } else {
-        // This means that this target entry is the original inode.
-        // Thus, check if there are indirections to this inode.
-        unsigned int inodes[MAX_INODE_COUNT] = {0};
-        int cnt = find_indirection_inodes(disk_index, target->inode_index, inodes);
-        if (cnt == 0) { // This means we do not need CoW
-            return 0;
-        } else { // This means we need CoW for all the indirections. (This is a bad case)
-            // TODO: Add recursive finding for entry search in other directories.
-            // This will find only the entries having the target as indirection inode within the same directory.
-            // Also, this works very stupid. O(n^2) will be the time complexity, this must be improved in the future.
-            struct entry_t *peer = target->parent->child; // Get all peers in the "SAME" directory.
-            while (peer != NULL) {
-                for (int i = 0 ; i < cnt ; i++) { // Look for matching cases.
-                    if (inodes[i] == peer->inode_index) { // If the peer has indirection to the target inode,
-                        if (process_cow(disk_index, peer) == -1) { // Perform CoW
-                            printf("[ERROR] CoW of %s failed\n", peer->name);
-                            return -1;
-                        }
-                    }
-                }
-                peer = peer->sibling;
-            }
-            return 1; // CoW was performed.
-        }
-    }
+    journal_begin(disk_index);
+    lock_cow(disk_index);
+    int ret = handoff_cow(disk_index, target->inode_index);
+    if (ret != -1 && in->indirect_inode != -1) // This target entry directs to another inode.
+        ret = process_cow(disk_index, target->inode_index) == -1 ? -1 : 1;
+    unlock_cow(disk_index);
+    journal_end(disk_index);
+    if (ret == -1) printf("[ERROR] CoW of %s failed\n", target->name); // CoW failed.
+    return ret;
 }
 
 
@@ -1593,47 +3233,52 @@ int handle_cow(unsigned int disk_index, struct entry_t* target) {
 int rename_file(unsigned int disk_index, struct entry_t* target, char* dst) {
     struct entry_t *parent = target->parent;
     struct inode *parent_in = &partitions[disk_index].inode_table[parent->inode_index];
-    struct partition *cur_p = &partitions[disk_index];
 
-    // Generate temp buffer for storing the parent directory file.
-    unsigned char *buffer = (unsigned char*) malloc(sizeof (struct blocks) * 6);
-    memset(buffer, 0, sizeof(struct blocks) * 6);
+    if (check_name(disk_index, dst) == -1) return -1;
 
-    for(int i = 0 ; i < 6 ; i++) {
-        unsigned int block = parent_in->blocks[i];
-        if ((block == 0) && target->parent->parent != NULL) continue; // If this was not a root directory, pass block #0
-        memcpy(&((struct blocks*) buffer)[i], cur_p->data_blocks + parent_in->blocks[i], sizeof(struct blocks));
+    // Find the entry in the parent directory file and change its name.
+    unsigned char slot[0x20] = {0};
+    unsigned int offset = 0;
+    unsigned char dir_entry = check_feature(disk_index, MYFS_FEATURE_DIR_ENTRY);
+    journal_begin(disk_index);
+    lock_dir(parent);
+    int ret = dir_entry ? find_dir_entry(disk_index, parent_in, target, &offset)
+                        : find_dir_slot(disk_index, parent_in, target, &offset);
+    if (ret == -1) {
+        printf("[ERROR] Could not find entry %s\n", target->name);
+        unlock_dir(parent);
+        journal_end(disk_index);
+        return -1;
     }
 
-    // Search for the entry and change its name.
-    unsigned int offset = 0;
-    while (offset <= parent_in->size) {
-        // Get entry's name
-        unsigned char tmp_ent[0x20] = {0};
-        unsigned char name[0x10] = {0};
-        memcpy(tmp_ent, (unsigned char*) buffer + offset, sizeof(unsigned char) * 0x20);
-        memcpy(name, tmp_ent + 0x10, sizeof(unsigned char) * 0x10);
-
-        // If name matches, change name.
-        if (!strcmp((char*) name, target->name)) {
-            strcpy((char*) tmp_ent + 0x10, dst);
-            memcpy(buffer + offset, tmp_ent, sizeof(unsigned char) * 0x20);
-            break;
+    if (dir_entry) {
+        // Rename in place if the new name fits into the entry, otherwise the entry moves to where it fits.
+        unsigned int block_size = get_block_size(disk_index), size = parent_in->size, block = 0;
+        unsigned char *data = dir_entry_block(disk_index, parent->inode_index, offset / block_size, &block);
+        if (data != NULL && dir_block_rename(data, block_size, offset % block_size, dst) == 0) {
+            if (parent->dir_space != NULL && offset / block_size < parent->dir_space_count)
+                parent->dir_space[offset / block_size] = dir_block_space(data, block_size);
+            ret = write_meta_block(disk_index, block, (struct blocks*) data);
+        } else {
+            ret = erase_dir_entry(disk_index, parent, offset);
+            if (ret == 0) ret = insert_dir_entry(disk_index, parent, target->inode_index, dst, &offset);
+            if (parent_in->size != size) write_inode(disk_index, parent->inode_index, parent_in);
         }
-        offset += 0x20;
-    }
+    } else {
+        read_dir_slot(disk_index, parent_in, offset, slot);
+        memset(slot + 0x10, 0, sizeof(unsigned char) * 0x10);
+        strncpy((char*) slot + 0x10, dst, 0x0F);
 
-    // Apply changes to the data blocks in the memory and store it to disk.
-    for (int i = 0 ; i < ((parent_in->size / 1024) + 1) ; i++) {
-        unsigned int block = parent_in->blocks[i];
-        if ((block == 0) && target->parent->parent != NULL) continue; // If this was not a root directory, pass block #0
-        memcpy(&cur_p->data_blocks[block], &((struct blocks*) buffer)[i], sizeof(struct blocks));
-        write_data_block(disk_index, block, 1, &((struct blocks*) buffer)[i]);
+        // Apply changes to the data block in the memory and store it to disk.
+        ret = write_dir_slot(disk_index, parent->inode_index, offset, slot);
     }
-
-    strcpy(target->name, dst); // Rename entry.
-    free(buffer);
-    return 0;
+    if (ret == 0) {
+        target->dir_offset = offset;
+        rename_entry(target, dst); // Rename entry.
+    }
+    unlock_dir(parent);
+    journal_end(disk_index);
+    return ret;
 }
 
 
@@ -1649,54 +3294,53 @@ int rename_file(unsigned int disk_index, struct entry_t* target, char* dst) {
  * @return -1 if failure, 0 if successful.
  */
 int move_file(unsigned int disk_index, struct entry_t* target, char* dst) {
-    // Remove entry from the original parent directory.
-    dir_remove_child(disk_index, target->parent, target->name);
-    // Unlink original entry from the LCRS tree.
-    if (target->parent->child == target) {
-        // If this was the first child in the directory, we need to update the child.
-        target->parent->child = target->sibling; // Set it as sibling of the target.
-    } else { // If this was an internal sibling, just disconnect this.
-        struct entry_t *peer = target->parent->child;
-        while (peer->sibling != NULL) { // Iterate and find the sibling that is connecting to the target
-            if (peer->sibling == target) break;
-            peer = peer->sibling;
-        }
-        if (peer->sibling == NULL) {
-            printf("[ERROR] Could not find sibling for %s\n", target->name);
-            return -1;
-        }
-        peer->sibling = target->sibling; // Unlink target
-    }
-    target->sibling = NULL;
+    struct entry_t* parent = target->parent;
 
-    // Add directory entry to the new directory.
+    // Find the destination directory.
     struct entry_t* dst_entry = NULL;
     if (strcmp(dst, "..") == 0) { // For .. directory
-        dst_entry = target->parent->parent;
+        dst_entry = parent->parent;
         if (dst_entry == NULL) { // If .. does not exist.
             printf("[ERROR] Could not move into ..\n");
             return -1;
         }
     }
     else { // For other cases.
-        if (find_entry(target->parent->child, &dst_entry, dst) ==
-            -1) { // Meaning that we could not find the target directory. // TODO FIX HERE
+        if (find_child(parent, &dst_entry, dst) == -1) { // Meaning that we could not find the target directory.
             printf("[ERROR] Could not find destination entry. Inconsistency occurred.\n");
             return -1;
         }
     }
-    dir_add_child(disk_index, target, dst_entry);
 
-    // Link new entry into the LCRS tree.
-    if (dst_entry->child == NULL) { // If the target directory had no child, set this as first child.
-        dst_entry->child = target;
-    } else { // Otherwise, find the last sibling and connect current entry to it.
-        struct entry_t *peer = dst_entry->child;
-        while (peer->sibling != NULL) {
-            peer = peer->sibling;
-        }
-        peer->sibling = target; // Link target.
-    }
+    return move_entry(disk_index, target, dst_entry);
+}
 
-    return 0;
+
+/**
+ * A function that moves an entry into another directory.
+ * @param disk_index The disk index that this target is located at.
+ * @param target The target file to move.
+ * @param dst_dir The destination directory entry.
+ * @return -1 if failure, 0 if successful.
+ */
+int move_entry(unsigned int disk_index, struct entry_t* target, struct entry_t* dst_dir) {
+    struct entry_t* parent = target->parent;
+    journal_begin(disk_index);
+    lock_dir_pair(parent, dst_dir);
+
+    // Remove entry from the original parent directory and unlink it from the LCRS tree.
+    if (dir_remove_child(disk_index, parent, target->name) == -1) {
+        unlock_dir_pair(parent, dst_dir);
+        journal_end(disk_index);
+        return -1;
+    }
+    dir_unlink_entry(parent, target);
+
+    // Link entry into the LCRS tree and add directory entry to the new directory.
+    // This must be linked first, since linking may load the destination directory from the disk.
+    dir_link_entry(dst_dir, target);
+    int ret = dir_add_child(disk_index, target, dst_dir);
+    unlock_dir_pair(parent, dst_dir);
+    journal_end(disk_index);
+    return ret;
 }
\ No newline at end of file
@@ -10,20 +10,65 @@
 #pragma once
 
 #include <dirent.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "fs.h"
 #include "utils.h"
 #include "disktree.h"
+#include "bitmap.h"
+#include "blockmap.h"
+#include "locks.h"
+#include "journal.h"
+#include "cow.h"
+#include "snapshot.h"
+#include "delalloc.h"
+#include "defrag.h"
+#include "direntry.h"
+#include "compress.h"
+#include "ioring.h"
+#include "trace.h"
 
 #define LS_SPLIT_COUNT 10
+#define CAT_VIEW_COUNT 16 // Views that cat maps at once.
+#define IMAGE_TRIM_BYTES (64 * 1024 * 1024) // Bytes written back before written pages of the mapping are dropped.
+
+
+/**
+ * A struct that implements a job for mounting a disk in a separate thread.
+ */
+struct mount_job_t {
+    int disk_index;        // The disk index to mount.
+    int result;            // The result of mount_disk.
+    unsigned char started; // Whether if the thread was created.
+    pthread_t thread;
+};
 
 // For initializing disk.
 int scan_disks(void);
 int load_super_block(int);
+int map_disk_image(int);
+void count_image_write(unsigned int, unsigned int);
+int trim_disk_image(unsigned int, struct journal_entry_t*, unsigned int);
 int load_inode_table(int);
 int load_data_blocks(int);
 int load_root(int);
+int mount_disk(int);
+int mount_disks(void);
+int unmount_disk(int);
+int write_super_block(unsigned int);
+int check_feature(unsigned int, unsigned int);
+void set_feature(unsigned int, unsigned int);
+unsigned int get_compression(unsigned int);
+int set_compression(unsigned int, unsigned int);
+
+// For disk geometry.
+unsigned int get_block_size(unsigned int);
+struct blocks* get_block(unsigned int, unsigned int);
+unsigned int block_offset(unsigned int, unsigned int);
+unsigned int inode_table_offset(unsigned int);
+unsigned int max_name_len(unsigned int);
 
 // For utility.
 int generate_prefix_str(unsigned int, char*);
@@ -47,7 +92,20 @@ int impl_move(struct entry_t*, char*, char*);
 // For abstract interface for file operation.
 int write_file_data(struct entry_t*, unsigned int, unsigned char*);
 int append_file_data(struct entry_t*, unsigned int, unsigned char*);
+int write_file_range(struct entry_t*, unsigned int, unsigned int, unsigned char*);
+int truncate_file_data(struct entry_t*, unsigned int);
 int read_file_data(struct entry_t*, unsigned char**);
+int read_inode_data(unsigned int, unsigned int, unsigned char**);
+int map_inode_range(unsigned int, unsigned int, unsigned int, unsigned int, struct iovec*, unsigned int);
+int read_file_view(struct entry_t*, unsigned int, unsigned int, struct iovec*, unsigned int);
+void release_file_view(struct entry_t*);
+int read_file_range(struct entry_t*, unsigned int, unsigned int, unsigned char*);
+int write_inode_data(unsigned int, unsigned int, unsigned int, unsigned char*);
+int write_inode_range(unsigned int, unsigned int, unsigned int, unsigned int, unsigned char*);
+int flush_file(struct entry_t*);
+int flush_delayed_writes(unsigned int);
+unsigned int get_inode_size(unsigned int, unsigned int);
+unsigned int get_file_size(struct entry_t*);
 
 // For abstract interface for inode update.
 int update_inode(unsigned int, unsigned int, struct inode*);
@@ -59,13 +117,18 @@ int create_file(unsigned int, struct entry_t*, char*, unsigned char);
 // For scanning empty disk blocks and empty inodes.
 int scan_disk_blocks(unsigned int);
 int scan_disk_inodes(unsigned int);
+int scan_cow_inodes(unsigned int);
 
 // For physical write in disk.
 int write_data_block(unsigned int, unsigned int, unsigned int, struct blocks*);
+int write_meta_block(unsigned int, unsigned int, struct blocks*);
 
 // For low level operations.
 int assign_empty_blocks(unsigned int, unsigned int, unsigned int*);
+int place_file_blocks(unsigned int, unsigned int*, unsigned int, unsigned int, unsigned char*);
 int assign_empty_inodes(unsigned int, unsigned int*);
+int release_blocks(unsigned int, unsigned int, unsigned int*);
+int release_inode(unsigned int, unsigned int);
 
 // For directory operations.
 int dir_add_child(unsigned int, struct entry_t*, struct entry_t*);
@@ -77,14 +140,14 @@ int delete_directory(unsigned int, struct entry_t*, char*);
 void r_delete_directory(unsigned int, struct entry_t*, struct entry_t*);
 
 // For copy operations especially CoW.
-int copy_file(unsigned int, struct entry_t*, char*);
-void find_original_inode(unsigned int, unsigned int, unsigned int*);
-int process_cow(unsigned int, struct entry_t*);
-int find_indirection_inodes(unsigned int, unsigned int, unsigned int*);
+int copy_file(unsigned int, struct entry_t*, struct entry_t*, char*);
+int process_cow(unsigned int, unsigned int);
+int handoff_cow(unsigned int, unsigned int);
 int handle_cow(unsigned int, struct entry_t*);
 
 // For other operations (especially mv).
 int move_file(unsigned int, struct entry_t*, char*);
+int move_entry(unsigned int, struct entry_t*, struct entry_t*);
 int rename_file(unsigned int, struct entry_t*, char*);
 
 #endif //MYFS_DISKUTIL_H
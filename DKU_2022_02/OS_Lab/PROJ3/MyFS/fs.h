@@ -35,22 +35,65 @@
 #define INODE_MODE_DIR_FILE		0x20000
 #define INODE_MODE_DEV_FILE		0x40000
 #define INODE_MODE_EMPTY_FILE   0x01000
+#define INODE_MODE_INDIRECT     0x02000 // blocks are stored as iblocks: direct, single indirect, double indirect.
+#define INODE_MODE_COMPRESSED   0x04000 // data starts with struct compress_header, followed by compressed data.
 
 #define DENTRY_TYPE_REG_FILE	0x1
 #define DENTRY_TYPE_DIR_FILE	0x2
 
-#define BLOCK_SIZE				0x400
+#define BLOCK_SIZE				0x400 // Block size of the original format.
+#define MIN_BLOCK_SIZE			0x400
+#define MAX_BLOCK_SIZE			0x10000
+#define MAX_VOLUME_SIZE			0xFFFFFFFFULL // Offsets in the disk are 32 bit.
+#define MAX_VOLUME_INODES		0xFFFF // Inode indexes must fit in 16 bits, see cow.h.
+#define INODE_TABLE_START		0x400 // The inode table of the original format comes right after the super block.
+
+#define MYFS_FEATURE_MAGIC		0x4D460000 // 'MF' in upper 16 bits, the lower 16 bits are feature flags.
+#define MYFS_FEATURE_MASK		0x0000FFFF
+#define MYFS_FEATURE_BLOCK_BITMAP	0x0001 // block_bitmap in the super block is valid.
+#define MYFS_FEATURE_INODE_BITMAP	0x0002 // inode_bitmap in the super block is valid.
+#define MYFS_FEATURE_JOURNAL		0x0004 // journal_start and journal_blocks in the super block are valid.
+#define MYFS_FEATURE_SNAPSHOT		0x0008 // snapshots in the super block are valid.
+#define MYFS_FEATURE_GEOMETRY		0x0010 // v2: geometry and bitmap locations come from the super block.
+#define MYFS_FEATURE_DIR_ENTRY		0x0020 // Directory files are made of variable length entries (struct dir_entry).
+#define MYFS_FEATURE_COMPRESSION	0x0040 // compression in the super block is valid.
+
+#define MYFS_COMPRESS_NONE		0 // Files are written as they are.
+#define MYFS_COMPRESS_LZ4		1 // Files are written as an LZ4 block when it saves blocks.
+
+#define DIR_SLOT_SIZE			0x20 // Directory entries of the original format: inode, then the name at 0x10.
+#define DIR_SLOT_NAME_MAX		15
+#define DIR_ENTRY_NAME_MAX		255
+
+#define MAX_SNAPSHOT_COUNT		8
+#define SNAPSHOT_TABLE_BLOCKS	7 // Blocks storing a frozen inode table, 224 * 32 bytes.
 /**
   Partition structure
-	ASSUME: data block size: 1K
-
+	Original format (v1):
 	partition: 4MB
 
 	Superblock: 1KB
 	Inode table (32 bytes inode array) * 224 entries = 7KB
 	data blocks: 1KB blocks array (~4K)
+
+	v2 (MYFS_FEATURE_GEOMETRY, made by mkfs.myfs):
+	Superblock: 1KB
+	Inode table (32 bytes inode array) * num_inodes entries, starting from inode_table_start
+	Inode bitmap and block bitmap, starting from inode_bitmap_start and block_bitmap_start
+	data blocks: block_size blocks array * num_blocks, starting from block first_data_block
 */
 
+/**
+  Snapshot record in the super block, a snapshot is a frozen inode table.
+  Blocks that the frozen inodes point at are never written or released while the snapshot exists.
+*/
+struct snapshot_t {
+    char name[16];                                // Empty name means that this record is not used.
+    unsigned int date;
+    unsigned short table[SNAPSHOT_TABLE_BLOCKS];  // Blocks storing the frozen inode table.
+    unsigned short padding;
+};
+
 /**
   Super block structure
 */
@@ -68,7 +111,19 @@ struct super_block {
     unsigned int num_free_blocks;
     unsigned int first_data_block;
     char volume_name[24];
-    unsigned char padding[960]; //1024-64
+
+    // MyFS extensions, these live in what used to be padding. Only valid when features has MYFS_FEATURE_MAGIC.
+    unsigned int features;
+    unsigned char inode_bitmap[32];  // 224 bits, one per inode.
+    unsigned char block_bitmap[512]; // 4088 bits, one per data block.
+    unsigned int journal_start;      // The first data block of the metadata journal.
+    unsigned int journal_blocks;     // The count of data blocks of the metadata journal.
+    struct snapshot_t snapshots[MAX_SNAPSHOT_COUNT]; // 36 bytes each.
+    unsigned int inode_table_start;  // v2: the offset of the inode table in the disk.
+    unsigned int inode_bitmap_start; // v2: the offset of the inode bitmap, instead of inode_bitmap.
+    unsigned int block_bitmap_start; // v2: the offset of the block bitmap, instead of block_bitmap.
+    unsigned int compression;        // MYFS_COMPRESS_*, the method that whole file writes use.
+    unsigned char padding[100]; //1024-64-4-32-512-8-288-12-4
 };
 
 /**
@@ -80,19 +135,33 @@ struct inode {
     unsigned int date;
     unsigned int size;
     int indirect_inode; 	// N.B. -1 for NULL
-    unsigned short blocks[0x6];
+    union {
+        unsigned short blocks[0x6];	// Original format: 6 direct blocks.
+        unsigned int iblocks[0x3];	// INODE_MODE_INDIRECT: 1 direct block, single indirect and double indirect block.
+    };
+};
+
+/**
+  Header of the data of a compressed file (INODE_MODE_COMPRESSED), size of the inode is the size of the stored data.
+*/
+struct compress_header {
+    unsigned int size;   // The size of the file before compression.
+    unsigned int method; // MYFS_COMPRESS_*.
 };
 
 struct blocks {
-    unsigned char d[1024];
+    unsigned char d[1024]; // This is the smallest block size, blocks are s.block_size bytes long in memory.
 };
 
 /* physical partition structure */
 struct partition {
     struct super_block s;
-    struct inode inode_table[224];
-    struct blocks data_blocks[4088]; //4096-8
+    struct inode *inode_table;     // s.num_inodes inodes.
+    unsigned char *block_data;     // s.num_blocks blocks, use get_block since blocks are s.block_size bytes long.
     unsigned int disk_index;
+    unsigned char *image;          // The whole disk mapped privately, the inode table and blocks point into this.
+    size_t image_size;
+    unsigned long long image_written; // Bytes written back since the mapping was last trimmed, see trim_disk_image.
 };
 
 /**
@@ -110,5 +179,17 @@ struct dentry {
 };
 
 
+/**
+  Variable length directory entry (MYFS_FEATURE_DIR_ENTRY), a compact form of struct dentry.
+  The name follows the entry without a terminating NULL. Entries are 4 byte aligned and never cross blocks.
+  dir_length reaches the next entry of the same block, so the space after the name is free space.
+  An entry with inode 0 is free space, this only happens at the start of a block.
+*/
+struct dir_entry {
+    unsigned short inode;
+    unsigned char name_len;
+    unsigned char file_type; // DENTRY_TYPE_REG_FILE or DENTRY_TYPE_DIR_FILE.
+    unsigned int dir_length;
+};
 
 #endif //MYFS_FS_H
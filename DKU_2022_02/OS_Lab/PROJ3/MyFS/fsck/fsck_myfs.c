@@ -0,0 +1,764 @@
+//
+// @file : fsck_myfs.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements consistency checker of MyFS images.
+//          The image is mapped privately, so nothing is ever written back. If the journal has a committed transaction
+//          that was not replayed yet, it is applied to the mapping first, so the image is checked as MyFS will see it.
+//          The directory tree is walked once, then every inode is checked in parallel and the results are reported
+//          in inode order.
+//
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "diskutil.h"
+
+
+#define FSCK_MAX_THREADS 8
+#define FSCK_REPORT_LEN 1024
+#define FSCK_V1_DATA_START 0x2000 // Super block and inode table of the original format.
+
+#define FSCK_EXIT_CLEAN 0
+#define FSCK_EXIT_PROBLEMS 1
+#define FSCK_EXIT_ERROR 8
+
+
+/**
+ * A struct that implements the check result of a single inode.
+ */
+struct inode_check_t {
+    unsigned char in_use;       // Whether if the inode bitmap (or the inode itself, for old images) says it is used.
+    unsigned char reachable;    // Whether if the inode was found in the directory tree.
+    unsigned int links;         // The count of directory entries pointing to this inode.
+    unsigned int *blocks;       // Data and indirect blocks that this inode owns.
+    unsigned int block_count;
+    unsigned int problems;
+    char report[FSCK_REPORT_LEN];
+};
+
+
+/**
+ * A struct that implements the state of a check.
+ */
+struct fsck_t {
+    unsigned char *image;        // The private mapping of the image.
+    size_t image_size;
+    struct super_block *sb;      // The super block in the mapping.
+    struct inode *inode_table;   // The inode table in the mapping.
+    unsigned int block_size;     // Geometry, the original format has fixed geometry.
+    unsigned int num_blocks;
+    unsigned int num_inodes;
+    size_t data_start;           // The offset of block 0.
+    unsigned int ptr_count;      // Block pointers in an indirect block.
+    unsigned int max_file_blocks;
+    struct inode_check_t *inodes;
+    unsigned int *block_refs;    // The count of owners of each block, updated by all threads.
+    unsigned char *snapshot_refs; // Whether if each block is kept by a snapshot.
+    unsigned int problems;       // Problems that are not about a single inode.
+    unsigned char has_block_bitmap;
+    unsigned char has_inode_bitmap;
+    struct bitmap_t block_bitmap;
+    struct bitmap_t inode_bitmap;
+    unsigned int thread_count;
+};
+
+static struct fsck_t fsck;
+
+
+/**
+ * A function that reports a problem that is not about a single inode.
+ * @param fmt The format string, just like printf.
+ */
+static void problem(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    printf("[ERROR] ");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    fsck.problems++;
+}
+
+
+/**
+ * A function that reports a problem of an inode. This is kept until all threads are done.
+ * @param inode_index The inode that has the problem.
+ * @param fmt The format string, just like printf.
+ */
+static void inode_problem(unsigned int inode_index, const char* fmt, ...) {
+    struct inode_check_t *check = &fsck.inodes[inode_index];
+    size_t len = strlen(check->report);
+    va_list args;
+    va_start(args, fmt);
+    if (len + 1 < FSCK_REPORT_LEN) {
+        len = len + snprintf(check->report + len, FSCK_REPORT_LEN - len, "[ERROR] Inode %d: ", inode_index);
+        if (len + 1 < FSCK_REPORT_LEN) len = len + vsnprintf(check->report + len, FSCK_REPORT_LEN - len, fmt, args);
+        if (len + 1 < FSCK_REPORT_LEN) strcat(check->report, "\n");
+    }
+    va_end(args);
+    check->problems++;
+}
+
+
+/**
+ * A function that checks if the image has a specific MyFS feature, just like check_feature.
+ * @param feature The feature flag to check.
+ * @return 1 if the feature was enabled, 0 if not.
+ */
+static int has_feature(unsigned int feature) {
+    unsigned int features = fsck.sb->features;
+    if ((features & ~MYFS_FEATURE_MASK) != MYFS_FEATURE_MAGIC) return 0;
+    return (features & feature) == feature;
+}
+
+
+/**
+ * A function that returns a block of the image.
+ * @param block The index of the block, this must be valid.
+ * @return The pointer to the block in the mapping.
+ */
+static unsigned char* get_image_block(unsigned int block) {
+    return fsck.image + fsck.data_start + (size_t) block * fsck.block_size;
+}
+
+
+/**
+ * A function that returns the count of blocks needed for a size, just like size_to_blocks.
+ * @param size The size in bytes.
+ * @return The count of blocks.
+ */
+static unsigned int image_size_to_blocks(unsigned int size) {
+    if (size == 0) return 1;
+    return (unsigned int) (((unsigned long long) size + fsck.block_size - 1) / fsck.block_size);
+}
+
+
+/**
+ * A function that checks a block pointer of an inode.
+ * @param inode_index The inode that has the pointer, reported when the pointer is invalid.
+ * @param block The block pointer.
+ * @param report Whether if problems are reported.
+ * @return 1 if the block pointer is valid, 0 if not.
+ */
+static int valid_block(unsigned int inode_index, unsigned int block, unsigned char report) {
+    if (block < fsck.num_blocks) return 1;
+    if (report) inode_problem(inode_index, "block pointer %u is out of range", block);
+    return 0;
+}
+
+
+/**
+ * A function that reads list of blocks of an inode, just like read_block_map and read_indirect_blocks.
+ * Unlike them, every pointer is checked before it is followed.
+ * @param in The inode to read, this can be an inode of a snapshot.
+ * @param inode_index The index of the inode, for reporting problems.
+ * @param data The array to store data blocks into, this must hold max_file_blocks.
+ * @param data_count The pointer to store the count of data blocks into.
+ * @param meta The array to store indirect blocks into, this must hold 2 + ptr_count.
+ * @param meta_count The pointer to store the count of indirect blocks into.
+ * @param report Whether if problems are reported.
+ */
+static void collect_blocks(struct inode* in, unsigned int inode_index, unsigned int* data, unsigned int* data_count,
+                           unsigned int* meta, unsigned int* meta_count, unsigned char report) {
+    unsigned int count = image_size_to_blocks(in->size);
+    *data_count = 0;
+    *meta_count = 0;
+
+    if ((in->mode & INODE_MODE_INDIRECT) != INODE_MODE_INDIRECT) { // Original format.
+        if (count > 6) {
+            if (report) inode_problem(inode_index, "size %u needs more than 6 direct blocks", in->size);
+            count = 6;
+        }
+        for (unsigned int i = 0 ; i < count ; i++) {
+            unsigned int block = (i == 0 || in->blocks[i] != 0) ? in->blocks[i] : in->blocks[0] + i;
+            if (valid_block(inode_index, block, report)) data[(*data_count)++] = block;
+        }
+        return;
+    }
+
+    if (count > fsck.max_file_blocks) {
+        if (report) inode_problem(inode_index, "size %u needs more than %u blocks", in->size, fsck.max_file_blocks);
+        count = fsck.max_file_blocks;
+    }
+    if (valid_block(inode_index, in->iblocks[0], report)) data[(*data_count)++] = in->iblocks[0]; // Direct block.
+    unsigned int remain = count - 1;
+
+    // Single indirect block.
+    if (remain > 0) {
+        if (in->iblocks[1] == 0) {
+            if (report) inode_problem(inode_index, "size %u needs a single indirect block, but it has none", in->size);
+            return;
+        }
+        if (!valid_block(inode_index, in->iblocks[1], report)) return;
+        meta[(*meta_count)++] = in->iblocks[1];
+        unsigned int *single = (unsigned int*) get_image_block(in->iblocks[1]);
+        for (unsigned int i = 0 ; i < fsck.ptr_count && remain > 0 ; i++, remain--)
+            if (valid_block(inode_index, single[i], report)) data[(*data_count)++] = single[i];
+    }
+
+    // Double indirect block.
+    if (remain > 0) {
+        if (in->iblocks[2] == 0) {
+            if (report) inode_problem(inode_index, "size %u needs a double indirect block, but it has none", in->size);
+            return;
+        }
+        if (!valid_block(inode_index, in->iblocks[2], report)) return;
+        meta[(*meta_count)++] = in->iblocks[2];
+        unsigned int *dbl = (unsigned int*) get_image_block(in->iblocks[2]);
+        for (unsigned int i = 0 ; i < fsck.ptr_count && remain > 0 ; i++) {
+            if (dbl[i] == 0 || !valid_block(inode_index, dbl[i], report)) {
+                if (dbl[i] == 0 && report) inode_problem(inode_index, "double indirect block is missing entry %u", i);
+                return;
+            }
+            meta[(*meta_count)++] = dbl[i];
+            unsigned int *child = (unsigned int*) get_image_block(dbl[i]);
+            for (unsigned int j = 0 ; j < fsck.ptr_count && remain > 0 ; j++, remain--)
+                if (valid_block(inode_index, child[j], report)) data[(*data_count)++] = child[j];
+        }
+    }
+}
+
+
+/**
+ * A function that checks the super block of the image and loads the geometry.
+ * The original format has fixed geometry, v2 (MYFS_FEATURE_GEOMETRY) keeps it in the super block.
+ * @return -1 if the image can't be checked any further, 0 if not.
+ */
+static int check_super_block(void) {
+    struct super_block *sb = fsck.sb;
+    if (sb->partition_type != SIMPLE_PARTITION) {
+        printf("[ERROR] Not a MyFS image (partition type %x)\n", sb->partition_type);
+        return -1;
+    }
+    if (!has_feature(MYFS_FEATURE_GEOMETRY)) {
+        if (sb->inode_size != sizeof(struct inode) || sb->num_inodes != MAX_INODE_COUNT
+            || sb->num_blocks != MAX_BLOCK_COUNT || sb->block_size != BLOCK_SIZE || sb->first_inode >= MAX_INODE_COUNT) {
+            printf("[ERROR] Unsupported geometry (inode size %d, %d inodes, block size %d, %d blocks, root inode %d)\n",
+                   sb->inode_size, sb->num_inodes, sb->block_size, sb->num_blocks, sb->first_inode);
+            return -1;
+        }
+        fsck.data_start = FSCK_V1_DATA_START;
+    } else {
+        unsigned long long data_start = (unsigned long long) sb->first_data_block * sb->block_size;
+        unsigned long long end = data_start + (unsigned long long) sb->num_blocks * sb->block_size;
+        if (sb->inode_size != sizeof(struct inode) || sb->block_size < MIN_BLOCK_SIZE || sb->block_size > MAX_BLOCK_SIZE
+            || (sb->block_size & (sb->block_size - 1)) || sb->num_inodes <= sb->first_inode
+            || sb->num_inodes > MAX_VOLUME_INODES || sb->num_blocks == 0 || end > MAX_VOLUME_SIZE
+            || sb->inode_table_start < sizeof(struct super_block)
+            || sb->inode_table_start + sb->num_inodes * sizeof(struct inode) > sb->inode_bitmap_start
+            || sb->inode_bitmap_start + (sb->num_inodes + 7) / 8 > sb->block_bitmap_start
+            || sb->block_bitmap_start + (sb->num_blocks + 7) / 8 > data_start) {
+            printf("[ERROR] Invalid geometry (block size %d, %d inodes, %d blocks from block %d)\n",
+                   sb->block_size, sb->num_inodes, sb->num_blocks, sb->first_data_block);
+            return -1;
+        }
+        fsck.data_start = data_start;
+    }
+    fsck.block_size = sb->block_size;
+    fsck.num_blocks = sb->num_blocks;
+    fsck.num_inodes = sb->num_inodes;
+    fsck.ptr_count = fsck.block_size / sizeof(unsigned int);
+    unsigned long long max_blocks = 1 + fsck.ptr_count + (unsigned long long) fsck.ptr_count * fsck.ptr_count;
+    unsigned long long limit = 0xFFFFFFFFULL / fsck.block_size;
+    fsck.max_file_blocks = (unsigned int) (max_blocks < limit ? max_blocks : limit);
+    if (fsck.data_start + (size_t) fsck.num_blocks * fsck.block_size > fsck.image_size) {
+        printf("[ERROR] Image is smaller than its geometry (%zu bytes)\n", fsck.data_start + (size_t) fsck.num_blocks * fsck.block_size);
+        return -1;
+    }
+    fsck.inode_table = (struct inode*) (fsck.image + (has_feature(MYFS_FEATURE_GEOMETRY) ? sb->inode_table_start
+                                                                                          : sizeof(struct super_block)));
+
+    if (has_feature(MYFS_FEATURE_JOURNAL)
+        && (sb->journal_blocks < 2 || sb->journal_start + sb->journal_blocks > fsck.num_blocks)) {
+        problem("Journal is out of range (start %d, %d blocks)", sb->journal_start, sb->journal_blocks);
+        sb->features = sb->features & ~MYFS_FEATURE_JOURNAL; // Do not trust it anymore.
+    }
+    return 0;
+}
+
+
+/**
+ * A function that applies the journal transaction that was not replayed yet to the mapping.
+ */
+static void apply_journal(void) {
+    struct super_block *sb = fsck.sb;
+    if (!has_feature(MYFS_FEATURE_JOURNAL)) return;
+    unsigned char *journal = get_image_block(sb->journal_start);
+    struct journal_txn_t *txn = journal_pending(journal, sb->journal_blocks, fsck.block_size);
+    if (txn == NULL) return;
+
+    // Copy the transaction first, records may overwrite the super block that tells where the journal is.
+    unsigned char *copy = malloc(txn->length);
+    if (!copy) return;
+    memcpy(copy, txn, txn->length);
+    txn = (struct journal_txn_t*) copy;
+
+    printf("[INFO] Journal transaction %d was not replayed yet, checking the image as it will be after replay\n", txn->seq);
+    struct journal_record_t record;
+    unsigned char *data = NULL;
+    unsigned int pos = 0;
+    while (journal_next_record(txn, &pos, &record, &data)) {
+        if (record.offset + record.length > fsck.image_size || record.offset + record.length < record.offset) {
+            problem("Journal record at %x (%d bytes) is out of the image", record.offset, record.length);
+            continue;
+        }
+        memcpy(fsck.image + record.offset, data, record.length);
+    }
+    free(copy);
+}
+
+
+/**
+ * A function that loads persisted bitmaps and decides which inodes are in use.
+ * Images without persisted inode bitmap are guessed just like scan_disk_inodes does.
+ * Bitmaps of v2 images have their own place, others are in the super block.
+ * @return -1 if failure, 0 if successful.
+ */
+static int load_bitmaps(void) {
+    struct super_block *sb = fsck.sb;
+    fsck.has_block_bitmap = has_feature(MYFS_FEATURE_BLOCK_BITMAP);
+    fsck.has_inode_bitmap = has_feature(MYFS_FEATURE_INODE_BITMAP);
+    fsck.inodes = calloc(fsck.num_inodes, sizeof(struct inode_check_t));
+    fsck.block_refs = calloc(fsck.num_blocks, sizeof(unsigned int));
+    fsck.snapshot_refs = calloc(fsck.num_blocks, 1);
+    if (!fsck.inodes || !fsck.block_refs || !fsck.snapshot_refs || bitmap_init(&fsck.block_bitmap, fsck.num_blocks) == -1
+        || bitmap_init(&fsck.inode_bitmap, fsck.num_inodes) == -1)
+        return -1;
+    if (has_feature(MYFS_FEATURE_GEOMETRY)) {
+        if (fsck.has_block_bitmap)
+            bitmap_load(&fsck.block_bitmap, fsck.image + sb->block_bitmap_start, (fsck.num_blocks + 7) / 8);
+        if (fsck.has_inode_bitmap)
+            bitmap_load(&fsck.inode_bitmap, fsck.image + sb->inode_bitmap_start, (fsck.num_inodes + 7) / 8);
+    } else {
+        if (fsck.has_block_bitmap) bitmap_load(&fsck.block_bitmap, sb->block_bitmap, sizeof(sb->block_bitmap));
+        if (fsck.has_inode_bitmap) bitmap_load(&fsck.inode_bitmap, sb->inode_bitmap, sizeof(sb->inode_bitmap));
+    }
+
+    for (unsigned int i = 0 ; i < fsck.num_inodes ; i++) {
+        struct inode *in = &fsck.inode_table[i];
+        fsck.inodes[i].in_use = fsck.has_inode_bitmap ? bitmap_test(&fsck.inode_bitmap, i) : (in->size != 0 || i < 3);
+    }
+    return 0;
+}
+
+
+/**
+ * A function that checks the inode that a directory entry points to, and queues it if it was a directory.
+ * @param dir The directory that the entry belongs to.
+ * @param name The name of the entry.
+ * @param child The inode that the entry points to.
+ * @param queue The queue of directories to visit.
+ * @param tail The pointer to the tail of the queue.
+ */
+static void check_dir_child(unsigned int dir, char* name, unsigned int child, unsigned int* queue, unsigned int* tail) {
+    if (child >= fsck.num_inodes || child < 3) {
+        inode_problem(dir, "entry '%s' points to invalid inode %u", name, child);
+        return;
+    }
+    unsigned int mode = fsck.inode_table[child].mode;
+    if ((mode & (INODE_MODE_REG_FILE | INODE_MODE_DIR_FILE)) == 0) {
+        inode_problem(dir, "entry '%s' points to unused inode %u", name, child);
+        return;
+    }
+
+    fsck.inodes[child].links++;
+    if (fsck.inodes[child].reachable) return; // Linked more than once, this is reported by check_inode.
+    fsck.inodes[child].reachable = 1;
+    if ((mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) queue[(*tail)++] = child;
+}
+
+
+/**
+ * A function that checks if a name appears before a variable length entry of a directory file.
+ * @param data The data blocks of the directory.
+ * @param index The index of the block that the entry is in.
+ * @param pos The offset of the entry in the block.
+ * @param name The name to look for.
+ * @return 1 if the name appeared before, 0 if not.
+ */
+static int has_earlier_entry(unsigned int* data, unsigned int index, unsigned int pos, char* name) {
+    unsigned int name_len = strlen(name);
+    for (unsigned int i = 0 ; i <= index ; i++) {
+        unsigned char *block = get_image_block(data[i]);
+        struct dir_entry *de = NULL;
+        for (unsigned int p = 0 ; (de = dir_entry_at(block, fsck.block_size, p)) != NULL ; p += de->dir_length) {
+            if (i == index && p >= pos) break;
+            if (de->inode != 0 && de->name_len == name_len && memcmp(de + 1, name, name_len) == 0) return 1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * A function that checks a directory file made of variable length entries (MYFS_FEATURE_DIR_ENTRY).
+ * Every block must be a chain of entries covering the whole block.
+ * @param dir The directory to check.
+ * @param in The inode of the directory.
+ * @param data The data blocks of the directory.
+ * @param data_count The count of the data blocks.
+ * @param queue The queue of directories to visit.
+ * @param tail The pointer to the tail of the queue.
+ */
+static void walk_dir_entries(unsigned int dir, struct inode* in, unsigned int* data, unsigned int data_count,
+                             unsigned int* queue, unsigned int* tail) {
+    unsigned int bs = fsck.block_size;
+    if (in->size % bs != 0) inode_problem(dir, "directory size %u is not a multiple of the block size", in->size);
+
+    for (unsigned int i = 0 ; i < in->size / bs && i < data_count ; i++) {
+        unsigned char *block = get_image_block(data[i]);
+        struct dir_entry *de = NULL;
+        unsigned int pos = 0;
+        for ( ; (de = dir_entry_at(block, bs, pos)) != NULL ; pos += de->dir_length) {
+            if (de->inode == 0) continue;
+            char name[DIR_ENTRY_NAME_MAX + 1] = {0};
+            memcpy(name, de + 1, de->name_len);
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+            if (strlen(name) != de->name_len)
+                inode_problem(dir, "entry '%s' at %x has a NULL in its name", name, i * bs + pos);
+            if (has_earlier_entry(data, i, pos, name)) inode_problem(dir, "entry '%s' appears more than once", name);
+            check_dir_child(dir, name, de->inode, queue, tail);
+        }
+        if (pos != bs) inode_problem(dir, "entries of directory block %u are broken at %x", i, pos);
+    }
+}
+
+
+/**
+ * A function that walks the directory tree from the root directory and checks every directory entry.
+ * Directories are visited in breadth first order, each directory only once.
+ */
+static void walk_tree(void) {
+    unsigned int *queue = malloc(sizeof(unsigned int) * fsck.num_inodes);
+    unsigned int head = 0, tail = 0;
+    unsigned int *data = malloc(sizeof(unsigned int) * fsck.max_file_blocks);
+    unsigned int *meta = malloc(sizeof(unsigned int) * (2 + fsck.ptr_count));
+    unsigned int bs = fsck.block_size;
+    if (!queue || !data || !meta) {
+        free(queue);
+        free(data);
+        free(meta);
+        return;
+    }
+
+    unsigned int root = fsck.sb->first_inode;
+    if ((fsck.inode_table[root].mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) {
+        problem("Root inode %d is not a directory", root);
+        free(queue);
+        free(data);
+        free(meta);
+        return;
+    }
+    fsck.inodes[root].reachable = 1;
+    fsck.inodes[root].links = 1;
+    queue[tail++] = root;
+
+    while (head < tail) {
+        unsigned int dir = queue[head++];
+        struct inode *in = &fsck.inode_table[dir];
+        unsigned int data_count = 0, meta_count = 0;
+        collect_blocks(in, dir, data, &data_count, meta, &meta_count, 0); // Problems are reported by check_inode.
+
+        if (has_feature(MYFS_FEATURE_DIR_ENTRY)) {
+            walk_dir_entries(dir, in, data, data_count, queue, &tail);
+            continue;
+        }
+
+        for (unsigned int offset = 0 ; offset + 0x20 <= in->size ; offset += 0x20) {
+            if (offset / bs >= data_count) break;
+            unsigned char *slot = get_image_block(data[offset / bs]) + offset % bs;
+            char *name = (char*) slot + 0x10;
+            if (name[0] == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+            char printable[0x10] = {0};
+            memcpy(printable, name, 0x0F);
+            if (memchr(name, 0, 0x10) == NULL) inode_problem(dir, "entry '%s' at %x has no terminating NULL", printable, offset);
+
+            // Look for the same name in the earlier entries.
+            for (unsigned int prev = 0 ; prev < offset ; prev += 0x20) {
+                if (prev / bs >= data_count) break;
+                unsigned char *other = get_image_block(data[prev / bs]) + prev % bs;
+                if (strncmp((char*) other + 0x10, name, 0x0F) == 0) {
+                    inode_problem(dir, "entry '%s' appears more than once", printable);
+                    break;
+                }
+            }
+            check_dir_child(dir, printable, slot[0] | (slot[1] << 8), queue, &tail);
+        }
+    }
+    free(queue);
+    free(data);
+    free(meta);
+}
+
+
+/**
+ * A function that checks a single inode: type, bitmap, links, CoW chain and blocks.
+ * Blocks that the inode owns are counted in block_refs, so that double allocation can be found afterwards.
+ * @param inode_index The inode to check.
+ * @param data The buffer for data blocks, this must hold max_file_blocks.
+ * @param meta The buffer for indirect blocks, this must hold 2 + ptr_count.
+ */
+static void check_inode(unsigned int inode_index, unsigned int* data, unsigned int* meta) {
+    struct inode_check_t *check = &fsck.inodes[inode_index];
+    struct inode *in = &fsck.inode_table[inode_index];
+    unsigned int root = fsck.sb->first_inode;
+    if (!check->in_use && !check->reachable) return;
+    if (inode_index < 3 && inode_index != root) return; // Reserved inodes.
+
+    unsigned int type = in->mode & (INODE_MODE_REG_FILE | INODE_MODE_DIR_FILE);
+    if (check->reachable && !check->in_use) inode_problem(inode_index, "is used but marked free in the inode bitmap");
+    if (!check->reachable) inode_problem(inode_index, "is orphan, no directory entry points to it");
+    if (check->links > 1) inode_problem(inode_index, "is linked by %u directory entries", check->links);
+    if (type != INODE_MODE_REG_FILE && type != INODE_MODE_DIR_FILE) {
+        inode_problem(inode_index, "unknown mode %x", in->mode);
+        return; // Nothing else can be trusted.
+    }
+
+    // CoW copies share blocks of the original inode, so they own nothing. Just check that the chain ends.
+    if (in->indirect_inode != -1) {
+        int cur = in->indirect_inode;
+        for (unsigned int steps = 0 ; cur != -1 ; steps++) {
+            if (cur < 0 || (unsigned int) cur >= fsck.num_inodes || steps >= fsck.num_inodes) {
+                inode_problem(inode_index, "CoW chain is broken or has a loop (at %d)", cur);
+                return;
+            }
+            if ((fsck.inode_table[cur].mode & (INODE_MODE_REG_FILE | INODE_MODE_DIR_FILE)) == 0) {
+                inode_problem(inode_index, "CoW original inode %d is not used", cur);
+                return;
+            }
+            cur = fsck.inode_table[cur].indirect_inode;
+        }
+        return;
+    }
+
+    unsigned int data_count = 0, meta_count = 0;
+    collect_blocks(in, inode_index, data, &data_count, meta, &meta_count, 1);
+    if ((in->mode & INODE_MODE_COMPRESSED) == INODE_MODE_COMPRESSED) { // The header tells how to read the data.
+        struct compress_header header = {0};
+        if (type == INODE_MODE_REG_FILE && in->size >= sizeof(header) && data_count > 0)
+            memcpy(&header, get_image_block(data[0]), sizeof(header));
+        else
+            inode_problem(inode_index, "is compressed but has no compression header");
+        if (header.size != 0 && header.method != MYFS_COMPRESS_LZ4)
+            inode_problem(inode_index, "unknown compression method %u", header.method);
+    }
+    check->blocks = malloc(sizeof(unsigned int) * (data_count + meta_count));
+    if (!check->blocks) return;
+    memcpy(check->blocks, data, sizeof(unsigned int) * data_count);
+    memcpy(check->blocks + data_count, meta, sizeof(unsigned int) * meta_count);
+    check->block_count = data_count + meta_count;
+    for (unsigned int i = 0 ; i < check->block_count ; i++)
+        __atomic_fetch_add(&fsck.block_refs[check->blocks[i]], 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * A function that is run by check threads, each thread checks every thread_count th inode.
+ * @param arg The index of the thread.
+ * @return NULL.
+ */
+static void* check_worker(void* arg) {
+    unsigned int id = (unsigned int) (uintptr_t) arg;
+    unsigned int *data = malloc(sizeof(unsigned int) * fsck.max_file_blocks);
+    unsigned int *meta = malloc(sizeof(unsigned int) * (2 + fsck.ptr_count));
+    if (data && meta)
+        for (unsigned int i = id ; i < fsck.num_inodes ; i += fsck.thread_count) check_inode(i, data, meta);
+    free(data);
+    free(meta);
+    return NULL;
+}
+
+
+/**
+ * A function that marks blocks kept by snapshots. Snapshots share blocks with the volume, so these are not owners.
+ */
+static void check_snapshots(void) {
+    struct super_block *sb = fsck.sb;
+    if (!has_feature(MYFS_FEATURE_SNAPSHOT)) return;
+    unsigned int table_size = fsck.num_inodes * sizeof(struct inode);
+    unsigned int table_blocks = (table_size + fsck.block_size - 1) / fsck.block_size;
+    if (table_blocks > SNAPSHOT_TABLE_BLOCKS) {
+        problem("Snapshots are enabled, but the inode table does not fit in %d blocks", SNAPSHOT_TABLE_BLOCKS);
+        return;
+    }
+    struct inode *table = malloc(table_size);
+    unsigned int *data = malloc(sizeof(unsigned int) * fsck.max_file_blocks);
+    unsigned int *meta = malloc(sizeof(unsigned int) * (2 + fsck.ptr_count));
+    if (!table || !data || !meta) {
+        free(table);
+        free(data);
+        free(meta);
+        return;
+    }
+
+    for (unsigned int i = 0 ; i < MAX_SNAPSHOT_COUNT ; i++) {
+        struct snapshot_t *snap = &sb->snapshots[i];
+        if (snap->name[0] == 0) continue;
+        unsigned char valid = 1;
+        for (unsigned int j = 0 ; j < table_blocks ; j++) {
+            if (snap->table[j] >= fsck.num_blocks) valid = 0;
+            else fsck.snapshot_refs[snap->table[j]] = 1;
+        }
+        if (!valid) {
+            problem("Snapshot %.15s has an inode table out of range", snap->name);
+            continue;
+        }
+        for (unsigned int j = 0 ; j < table_blocks ; j++) {
+            unsigned int len = table_size - j * fsck.block_size;
+            memcpy((unsigned char*) table + j * fsck.block_size, get_image_block(snap->table[j]),
+                   len < fsck.block_size ? len : fsck.block_size);
+        }
+
+        for (unsigned int j = 0 ; j < fsck.num_inodes ; j++) {
+            if ((table[j].mode & (INODE_MODE_REG_FILE | INODE_MODE_DIR_FILE)) == 0 || table[j].indirect_inode != -1)
+                continue;
+            unsigned int data_count = 0, meta_count = 0;
+            collect_blocks(&table[j], j, data, &data_count, meta, &meta_count, 0);
+            for (unsigned int k = 0 ; k < data_count ; k++) fsck.snapshot_refs[data[k]] = 1;
+            for (unsigned int k = 0 ; k < meta_count ; k++) fsck.snapshot_refs[meta[k]] = 1;
+        }
+    }
+    free(table);
+    free(data);
+    free(meta);
+}
+
+
+/**
+ * A function that reports a run of blocks that have the same bitmap problem.
+ * @param start The first block of the run.
+ * @param end The last block of the run.
+ * @param what The problem.
+ */
+static void block_range_problem(unsigned int start, unsigned int end, const char* what) {
+    if (start == end) problem("Block %u is %s", start, what);
+    else problem("Blocks %u-%u are %s", start, end, what);
+}
+
+
+/**
+ * A function that checks block ownership and the block bitmap, after all inodes were checked.
+ * @return The count of blocks in use.
+ */
+static unsigned int check_blocks(void) {
+    struct super_block *sb = fsck.sb;
+    unsigned char *journal = calloc(fsck.num_blocks, 1);
+    if (!journal) return 0;
+    if (has_feature(MYFS_FEATURE_JOURNAL)) {
+        for (unsigned int i = 0 ; i < sb->journal_blocks ; i++) {
+            journal[sb->journal_start + i] = 1;
+            fsck.block_refs[sb->journal_start + i]++;
+        }
+    }
+    // Block 0 stands for an unassigned block, it stays used once the root directory moved away from it.
+    if (fsck.block_refs[0] == 0 && fsck.has_block_bitmap && bitmap_test(&fsck.block_bitmap, 0)) fsck.block_refs[0]++;
+
+    // Blocks with more than one owner, sharing with snapshots is fine.
+    unsigned int used = 0;
+    for (unsigned int b = 0 ; b < fsck.num_blocks ; b++) {
+        if (fsck.block_refs[b] > 0 || fsck.snapshot_refs[b]) used++;
+        if (fsck.block_refs[b] < 2) continue;
+        char owners[256] = {0};
+        size_t len = 0;
+        if (journal[b]) len = snprintf(owners, sizeof(owners), ", journal");
+        for (unsigned int i = 0 ; i < fsck.num_inodes && len < sizeof(owners) ; i++) {
+            for (unsigned int j = 0 ; j < fsck.inodes[i].block_count ; j++)
+                if (fsck.inodes[i].blocks[j] == b && len < sizeof(owners))
+                    len = len + snprintf(owners + len, sizeof(owners) - len, ", inode %u", i);
+        }
+        problem("Block %u is used %u times, by %s", b, fsck.block_refs[b], owners + 2);
+    }
+    free(journal);
+
+    // Bitmap must match the owners, runs of mismatching blocks are reported at once.
+    if (fsck.has_block_bitmap) {
+        for (unsigned int b = 0 ; b < fsck.num_blocks ;) {
+            unsigned char marked = bitmap_test(&fsck.block_bitmap, b) != 0;
+            unsigned char owned = fsck.block_refs[b] > 0 || fsck.snapshot_refs[b];
+            unsigned int end = b;
+            while (end + 1 < fsck.num_blocks && (bitmap_test(&fsck.block_bitmap, end + 1) != 0) == marked
+                   && (fsck.block_refs[end + 1] > 0 || fsck.snapshot_refs[end + 1]) == owned) end++;
+            if (owned && !marked) block_range_problem(b, end, "used but marked free in the block bitmap");
+            if (!owned && marked) block_range_problem(b, end, "marked used in the block bitmap, but nothing uses it");
+            b = end + 1;
+        }
+    }
+    if (sb->num_free_blocks != sb->num_blocks - used)
+        problem("Super block says %d free blocks, but %d blocks are free", sb->num_free_blocks, sb->num_blocks - used);
+    return used;
+}
+
+
+/**
+ * The main function of fsck.myfs.
+ * @return 0 if the image was clean, 1 if problems were found, 8 if the image could not be checked.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <image>\n", argv[0]);
+        printf("The image is only read, problems are reported but never fixed.\n");
+        return FSCK_EXIT_ERROR;
+    }
+
+    // Map the image privately, applying the journal must not change the image.
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(struct super_block)) {
+        printf("[ERROR] Could not open %s or it is smaller than %zu bytes\n", argv[1], sizeof(struct super_block));
+        return FSCK_EXIT_ERROR;
+    }
+    fsck.image_size = st.st_size;
+    fsck.image = mmap(NULL, fsck.image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    close(fd);
+    if (fsck.image == MAP_FAILED) {
+        printf("[ERROR] Could not map %s\n", argv[1]);
+        return FSCK_EXIT_ERROR;
+    }
+    fsck.sb = (struct super_block*) fsck.image;
+
+    if (check_super_block() == -1) return FSCK_EXIT_ERROR;
+    apply_journal();
+    if (load_bitmaps() == -1) return FSCK_EXIT_ERROR;
+    walk_tree();
+
+    // Check inodes in parallel, each thread takes every thread_count th inode so that the work is balanced.
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    fsck.thread_count = cpus < 1 ? 1 : (cpus > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : (unsigned int) cpus);
+    pthread_t threads[FSCK_MAX_THREADS];
+    unsigned char started[FSCK_MAX_THREADS] = {0};
+    for (unsigned int i = 0 ; i < fsck.thread_count ; i++) {
+        started[i] = pthread_create(&threads[i], NULL, check_worker, (void*) (uintptr_t) i) == 0;
+        if (!started[i]) check_worker((void*) (uintptr_t) i); // Could not create thread, just check here.
+    }
+    for (unsigned int i = 0 ; i < fsck.thread_count ; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+
+    // Report in inode order, then blocks and counts.
+    unsigned int problems = 0, used_inodes = 0;
+    for (unsigned int i = 0 ; i < fsck.num_inodes ; i++) {
+        printf("%s", fsck.inodes[i].report);
+        problems = problems + fsck.inodes[i].problems;
+        if (i < 3 || fsck.inodes[i].in_use || fsck.inodes[i].reachable) used_inodes++;
+    }
+    check_snapshots();
+    unsigned int used_blocks = check_blocks();
+    struct super_block *sb = fsck.sb;
+    if (sb->num_free_inodes != sb->num_inodes - used_inodes)
+        problem("Super block says %d free inodes, but %d inodes are free", sb->num_free_inodes, sb->num_inodes - used_inodes);
+    problems = problems + fsck.problems;
+
+    printf("%s: %d inodes, %d blocks used (%d threads)\n", argv[1], used_inodes, used_blocks, fsck.thread_count);
+    printf("%s: %s\n", argv[1], problems == 0 ? "clean" : "problems found");
+    for (unsigned int i = 0 ; i < fsck.num_inodes ; i++) free(fsck.inodes[i].blocks);
+    free(fsck.inodes);
+    free(fsck.block_refs);
+    free(fsck.snapshot_refs);
+    bitmap_release(&fsck.block_bitmap);
+    bitmap_release(&fsck.inode_bitmap);
+    munmap(fsck.image, fsck.image_size);
+    return problems == 0 ? FSCK_EXIT_CLEAN : FSCK_EXIT_PROBLEMS;
+}
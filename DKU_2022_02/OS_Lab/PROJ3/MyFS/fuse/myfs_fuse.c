@@ -0,0 +1,523 @@
+//
+// @file : myfs_fuse.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements FUSE (libfuse3) frontend of MyFS.
+//          This exposes a MyFS image as a mountable file system, so that standard tools can be run against it.
+//          Usage: myfs-fuse <image> <mount point> [FUSE options]
+//
+
+#define FUSE_USE_VERSION 31
+
+#include <fuse.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "diskutil.h"
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern struct partition partitions[MAX_IMG_COUNT];
+extern int disk_count;
+extern struct entry_t* entries[MAX_IMG_COUNT];
+extern uint16_t loaded_partitions;
+
+// FUSE serves requests with multiple threads.
+// Every request is wrapped with enter_engine and leave_engine, then takes only the locks of what it touches.
+// Requests do not keep entries after they return, so deleted and unused entries are freed in leave_engine.
+static time_t mount_time;
+
+
+/**
+ * A function that converts MyFS permission (one hex digit per class) into POSIX permission.
+ * @param mode The mode of MyFS inode.
+ * @return The POSIX permission bits.
+ */
+static mode_t to_posix_perm(unsigned int mode) {
+    return (((mode >> 8) & 0x7) << 6) | (((mode >> 4) & 0x7) << 3) | (mode & 0x7);
+}
+
+
+/**
+ * A function that converts POSIX permission into MyFS permission (one hex digit per class).
+ * @param perm The POSIX permission bits.
+ * @return The permission bits of MyFS inode.
+ */
+static unsigned int to_myfs_perm(mode_t perm) {
+    return (((perm >> 6) & 0x7) << 8) | (((perm >> 3) & 0x7) << 4) | (perm & 0x7);
+}
+
+
+/**
+ * A function that finds the entry of a path. The path is always absolute in FUSE.
+ * Directories are lock coupled: the child is locked before the parent is unlocked,
+ * so that no directory on the way can be moved or removed while we are stepping into it.
+ * @param path The path to look for.
+ * @return The entry, NULL if the path does not exist.
+ */
+static struct entry_t* lookup_path(const char* path) {
+    char tmp[MAX_STRING_LEN] = {0};
+    strncpy(tmp, path, MAX_STRING_LEN - 1);
+
+    struct entry_t *cur = entries[0];
+    char *save = NULL;
+    lock_dir(cur);
+    for (char *name = strtok_r(tmp, "/", &save) ; name != NULL ; name = strtok_r(NULL, "/", &save)) {
+        struct entry_t *res = NULL;
+        if (find_child(cur, &res, name) == -1) {
+            unlock_dir(cur);
+            return NULL;
+        }
+        lock_dir(res);
+        unlock_dir(cur);
+        cur = res;
+    }
+    unlock_dir(cur);
+    return cur;
+}
+
+
+/**
+ * A function that finds the parent directory of a path and the last name of the path.
+ * @param path The path to look for.
+ * @param name The buffer to store the last name into. This must be at least DIR_ENTRY_NAME_MAX + 1 bytes.
+ * @param ret The pointer to store the parent directory into.
+ * @return 0 if successful, negative errno if failure.
+ */
+static int lookup_parent(const char* path, char* name, struct entry_t** ret) {
+    const char *last = strrchr(path, '/');
+    if (last == NULL || last[1] == 0) return -EINVAL;
+    if (strlen(last + 1) > DIR_ENTRY_NAME_MAX) return -ENAMETOOLONG;
+    strcpy(name, last + 1);
+
+    char parent[MAX_STRING_LEN] = {0};
+    strncpy(parent, path, last - path < MAX_STRING_LEN ? last - path : MAX_STRING_LEN - 1);
+    *ret = lookup_path(parent);
+    if (*ret == NULL) return -ENOENT;
+
+    struct inode *in = &partitions[(*ret)->disk_index].inode_table[(*ret)->inode_index];
+    if ((in->mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) return -ENOTDIR;
+    if (strlen(name) > max_name_len((*ret)->disk_index)) return -ENAMETOOLONG; // Depends on the directory format.
+    return 0;
+}
+
+
+/**
+ * A function that checks if an entry is a directory.
+ * @param entry The entry to check.
+ * @return 1 if the entry was a directory, 0 if not.
+ */
+static int is_dir(struct entry_t* entry) {
+    struct inode *in = &partitions[entry->disk_index].inode_table[entry->inode_index];
+    return (in->mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE;
+}
+
+
+/**
+ * FUSE getattr operation.
+ */
+static int myfs_getattr(const char* path, struct stat* st, struct fuse_file_info* fi) {
+    (void) fi;
+    enter_engine();
+    struct entry_t *entry = lookup_path(path);
+    if (entry == NULL) {
+        leave_engine(entries[0]);
+        return -ENOENT;
+    }
+
+    struct inode *in = &partitions[entry->disk_index].inode_table[entry->inode_index];
+    lock_inode_read(entry->disk_index, entry->inode_index);
+    memset(st, 0, sizeof(struct stat));
+    st->st_ino = entry->inode_index;
+    st->st_mode = (is_dir(entry) ? S_IFDIR : S_IFREG) | to_posix_perm(in->mode);
+    st->st_nlink = is_dir(entry) ? 2 : 1;
+    st->st_size = is_dir(entry) ? in->size : get_file_size(entry);
+    st->st_blksize = get_block_size(entry->disk_index);
+    st->st_blocks = size_to_blocks(entry->disk_index, in->size) * (get_block_size(entry->disk_index) / 512);
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_atime = st->st_mtime = st->st_ctime = mount_time;
+    unlock_inode(entry->disk_index, entry->inode_index);
+    leave_engine(entries[0]);
+    return 0;
+}
+
+
+/**
+ * FUSE readdir operation.
+ */
+static int myfs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+                        struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+    (void) offset;
+    (void) fi;
+    (void) flags;
+    enter_engine();
+    struct entry_t *dir = lookup_path(path);
+    if (dir == NULL || !is_dir(dir)) {
+        leave_engine(entries[0]);
+        return dir == NULL ? -ENOENT : -ENOTDIR;
+    }
+
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+    lock_dir(dir);
+    for (struct entry_t *cur = dir_children(dir) ; cur != NULL ; cur = cur->sibling)
+        filler(buf, cur->name, NULL, 0, 0);
+    unlock_dir(dir);
+    leave_engine(entries[0]);
+    return 0;
+}
+
+
+/**
+ * FUSE open operation.
+ */
+static int myfs_open(const char* path, struct fuse_file_info* fi) {
+    (void) fi;
+    enter_engine();
+    struct entry_t *entry = lookup_path(path);
+    int ret = entry == NULL ? -ENOENT : (is_dir(entry) ? -EISDIR : 0);
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE read operation.
+ */
+static int myfs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    (void) fi;
+    enter_engine();
+    struct entry_t *entry = lookup_path(path);
+    if (entry == NULL) {
+        leave_engine(entries[0]);
+        return -ENOENT;
+    }
+
+    // Only the requested range is copied, under the read lock so that the size and the data match.
+    int ret = offset > UINT_MAX ? 0 : read_file_range(entry, offset, size, (unsigned char*) buf);
+    if (ret == -1) ret = -EIO;
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE write operation.
+ */
+static int myfs_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    (void) fi;
+    enter_engine();
+    struct entry_t *entry = lookup_path(path);
+    if (entry == NULL) {
+        leave_engine(entries[0]);
+        return -ENOENT;
+    }
+
+    int ret = write_file_range(entry, offset, size, (unsigned char*) buf) == -1 ? -EFBIG : (int) size;
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE truncate operation.
+ */
+static int myfs_truncate(const char* path, off_t size, struct fuse_file_info* fi) {
+    (void) fi;
+    enter_engine();
+    struct entry_t *entry = lookup_path(path);
+    int ret = entry == NULL ? -ENOENT : (truncate_file_data(entry, size) == -1 ? -EFBIG : 0);
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * A function that creates a file or a directory for create and mkdir operations.
+ * @param path The path to create.
+ * @param mode The POSIX permission of the new entry.
+ * @param is_directory 1 for directory, 0 for regular file.
+ * @return 0 if successful, negative errno if failure.
+ */
+static int create_entry(const char* path, mode_t mode, unsigned char is_directory) {
+    char name[DIR_ENTRY_NAME_MAX + 1] = {0};
+    struct entry_t *dir = NULL, *res = NULL;
+    enter_engine();
+    int ret = lookup_parent(path, name, &dir);
+    if (ret != 0) {
+        leave_engine(entries[0]);
+        return ret;
+    }
+
+    journal_begin(dir->disk_index); // The journal handle comes before any lock.
+    lock_dir(dir); // Nobody else can create the same name until we are done.
+    if (find_child(dir, &res, name) == 0) ret = -EEXIST;
+    if (ret == 0 && create_file(dir->disk_index, dir, name, is_directory) == -1) ret = -ENOSPC;
+
+    if (ret == 0 && find_child(dir, &res, name) == 0) { // Apply requested permission.
+        lock_inode_write(res->disk_index, res->inode_index);
+        struct inode new_inode = partitions[res->disk_index].inode_table[res->inode_index];
+        new_inode.mode = (new_inode.mode & 0xFF000) | to_myfs_perm(mode & 0777);
+        update_inode(res->disk_index, res->inode_index, &new_inode);
+        unlock_inode(res->disk_index, res->inode_index);
+    }
+    unlock_dir(dir);
+    journal_end(dir->disk_index);
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE create operation.
+ */
+static int myfs_create(const char* path, mode_t mode, struct fuse_file_info* fi) {
+    (void) fi;
+    return create_entry(path, mode, 0);
+}
+
+
+/**
+ * FUSE mkdir operation.
+ */
+static int myfs_mkdir(const char* path, mode_t mode) {
+    return create_entry(path, mode, 1);
+}
+
+
+/**
+ * FUSE unlink operation.
+ */
+static int myfs_unlink(const char* path) {
+    char name[DIR_ENTRY_NAME_MAX + 1] = {0};
+    struct entry_t *dir = NULL, *res = NULL;
+    enter_engine();
+    int ret = lookup_parent(path, name, &dir);
+    if (ret != 0) {
+        leave_engine(entries[0]);
+        return ret;
+    }
+
+    journal_begin(dir->disk_index);
+    lock_cow(dir->disk_index); // CoW lock comes before directory locks.
+    lock_dir(dir);
+    if (find_child(dir, &res, name) == -1) ret = -ENOENT;
+    if (ret == 0 && is_dir(res)) ret = -EISDIR;
+    if (ret == 0 && delete_file(dir->disk_index, dir, name) == -1) ret = -EIO; // This handles CoW as well.
+    unlock_dir(dir);
+    unlock_cow(dir->disk_index);
+    journal_end(dir->disk_index);
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE rmdir operation.
+ */
+static int myfs_rmdir(const char* path) {
+    char name[DIR_ENTRY_NAME_MAX + 1] = {0};
+    struct entry_t *dir = NULL, *res = NULL;
+    enter_engine();
+    int ret = lookup_parent(path, name, &dir);
+    if (ret != 0) {
+        leave_engine(entries[0]);
+        return ret;
+    }
+
+    journal_begin(dir->disk_index);
+    lock_cow(dir->disk_index);
+    lock_dir(dir);
+    if (find_child(dir, &res, name) == -1) ret = -ENOENT;
+    if (ret == 0 && !is_dir(res)) ret = -ENOTDIR;
+    if (ret == 0 && dir_children(res) != NULL) ret = -ENOTEMPTY;
+    if (ret == 0 && delete_directory(dir->disk_index, dir, name) == -1) ret = -EIO;
+    unlock_dir(dir);
+    unlock_cow(dir->disk_index);
+    journal_end(dir->disk_index);
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE rename operation.
+ * The existing destination is replaced, just like rename(2).
+ */
+static int myfs_rename(const char* from, const char* to, unsigned int flags) {
+    if (flags != 0) return -EINVAL; // RENAME_NOREPLACE and RENAME_EXCHANGE are not supported.
+    char src_name[DIR_ENTRY_NAME_MAX + 1] = {0}, dst_name[DIR_ENTRY_NAME_MAX + 1] = {0};
+    struct entry_t *src_dir = NULL, *dst_dir = NULL, *src = NULL, *dst = NULL;
+    enter_engine();
+    int ret = lookup_parent(from, src_name, &src_dir);
+    if (ret == 0) ret = lookup_parent(to, dst_name, &dst_dir);
+    if (ret != 0) {
+        leave_engine(entries[0]);
+        return ret;
+    }
+
+    // Renames may delete the destination, so the CoW lock is taken first.
+    // Since every rename holds the CoW lock, renames never see each other in the middle.
+    journal_begin(src_dir->disk_index);
+    lock_cow(src_dir->disk_index);
+    lock_dir_pair(src_dir, dst_dir);
+    if (find_child(src_dir, &src, src_name) == -1) ret = -ENOENT;
+    for (struct entry_t *cur = dst_dir ; ret == 0 && cur != NULL ; cur = cur->parent)
+        if (cur == src) ret = -EINVAL; // Can't move a directory into itself.
+
+    // Remove the destination if it exists.
+    if (ret == 0 && find_child(dst_dir, &dst, dst_name) == 0 && dst != src) {
+        if (is_dir(dst) && dir_children(dst) != NULL) ret = -ENOTEMPTY;
+        else if (is_dir(dst) != is_dir(src)) ret = is_dir(dst) ? -EISDIR : -ENOTDIR;
+        else if (delete_file(dst_dir->disk_index, dst_dir, dst_name) == -1) ret = -EIO;
+    }
+
+    // Move into the destination directory, then rename.
+    if (ret == 0 && src_dir != dst_dir && move_entry(src->disk_index, src, dst_dir) == -1) ret = -EIO;
+    if (ret == 0 && strcmp(src->name, dst_name) != 0 && rename_file(src->disk_index, src, dst_name) == -1) ret = -EIO;
+    unlock_dir_pair(src_dir, dst_dir);
+    unlock_cow(src_dir->disk_index);
+    journal_end(src_dir->disk_index);
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE chmod operation.
+ */
+static int myfs_chmod(const char* path, mode_t mode, struct fuse_file_info* fi) {
+    (void) fi;
+    enter_engine();
+    struct entry_t *entry = lookup_path(path);
+    if (entry == NULL) {
+        leave_engine(entries[0]);
+        return -ENOENT;
+    }
+
+    journal_begin(entry->disk_index);
+    lock_inode_write(entry->disk_index, entry->inode_index); // Copies have their own inodes, so no CoW is needed.
+    struct inode new_inode = partitions[entry->disk_index].inode_table[entry->inode_index];
+    new_inode.mode = (new_inode.mode & 0xFF000) | to_myfs_perm(mode & 0777);
+    if (!entry->deleted) update_inode(entry->disk_index, entry->inode_index, &new_inode);
+    unlock_inode(entry->disk_index, entry->inode_index);
+    journal_end(entry->disk_index);
+    leave_engine(entries[0]);
+    return 0;
+}
+
+
+/**
+ * FUSE utimens operation. MyFS does not keep timestamps, so this just checks if the file exists.
+ */
+static int myfs_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
+    (void) tv;
+    (void) fi;
+    enter_engine();
+    int ret = lookup_path(path) == NULL ? -ENOENT : 0;
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+/**
+ * FUSE statfs operation.
+ */
+static int myfs_statfs(const char* path, struct statvfs* st) {
+    (void) path;
+    enter_engine();
+    lock_alloc(0);
+    struct super_block *s = &partitions[0].s;
+    memset(st, 0, sizeof(struct statvfs));
+    st->f_bsize = st->f_frsize = s->block_size;
+    st->f_blocks = s->num_blocks;
+    st->f_bfree = st->f_bavail = s->num_free_blocks;
+    st->f_files = s->num_inodes;
+    st->f_ffree = st->f_favail = s->num_free_inodes;
+    st->f_namemax = max_name_len(0);
+    unlock_alloc(0);
+    leave_engine(entries[0]);
+    return 0;
+}
+
+
+/**
+ * FUSE fsync operation. Writes delayed appends and commits the running journal transaction,
+ * so every operation so far survives a crash.
+ */
+static int myfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+    (void) path;
+    (void) datasync;
+    (void) fi;
+    return (flush_delayed_writes(0) == -1 || journal_flush(0) == -1) ? -EIO : 0;
+}
+
+
+/**
+ * FUSE flush operation, called on every close of the file.
+ * Delayed appends of the file are written, so data written before close is not lost when the image is unmounted.
+ */
+static int myfs_flush(const char* path, struct fuse_file_info* fi) {
+    (void) fi;
+    enter_engine();
+    struct entry_t *entry = lookup_path(path);
+    int ret = entry == NULL || flush_file(entry) == 0 ? 0 : -EIO; // A removed file has no delayed appends.
+    leave_engine(entries[0]);
+    return ret;
+}
+
+
+static const struct fuse_operations myfs_operations = {
+    .getattr = myfs_getattr,
+    .readdir = myfs_readdir,
+    .open = myfs_open,
+    .read = myfs_read,
+    .write = myfs_write,
+    .truncate = myfs_truncate,
+    .create = myfs_create,
+    .mkdir = myfs_mkdir,
+    .unlink = myfs_unlink,
+    .rmdir = myfs_rmdir,
+    .rename = myfs_rename,
+    .chmod = myfs_chmod,
+    .utimens = myfs_utimens,
+    .statfs = myfs_statfs,
+    .flush = myfs_flush,
+    .fsync = myfs_fsync,
+};
+
+
+/**
+ * The main function of FUSE frontend.
+ * The image is mounted as volume 0, then the rest of the arguments are passed to FUSE.
+ * @return 0 if terminated without any error, 1 if not.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s <image> <mount point> [FUSE options]\n", argv[0]);
+        return 1;
+    }
+
+    // FUSE changes working directory to / when running in background, so store the absolute path.
+    char image[PATH_MAX] = {0};
+    if (realpath(argv[1], image) == NULL || strlen(image) >= MAX_STRING_LEN) {
+        printf("[ERROR] Could not find image %s\n", argv[1]);
+        return 1;
+    }
+    strcpy(disks[0], image);
+    disk_count = 1;
+    if (mount_disk(0) == -1) return 1;
+    loaded_partitions = 0x1;
+    mount_time = time(NULL);
+
+    // Remove image from the arguments, FUSE takes the rest.
+    argv[1] = argv[0];
+    int ret = fuse_main(argc - 1, argv + 1, &myfs_operations, NULL);
+    if (unmount_disk(0) == -1) { // Unmounted, write delayed appends, commit everything and mark the journal as clean.
+        printf("[ERROR] Could not unmount %s\n", disks[0]);
+        return 1;
+    }
+    return ret;
+}
@@ -0,0 +1,32 @@
+//
+// @file : globals.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines global states of MyFS engine.
+//          These are kept out of main.c so that frontends other than the shell can link the engine.
+//
+
+
+#include "diskutil.h"
+#include "locks.h"
+#include "common.h"
+
+char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+struct partition partitions[MAX_IMG_COUNT];
+struct entry_t* entries[MAX_IMG_COUNT];
+struct dentry_cache_t dentry_cache = {NULL, NULL, 0, DENTRY_CACHE_MAX, NULL};
+struct bitmap_t block_bitmaps[MAX_IMG_COUNT];
+struct bitmap_t inode_bitmaps[MAX_IMG_COUNT];
+int disk_count;
+uint16_t loaded_partitions = 0x00;
+struct volume_locks_t volume_locks[MAX_IMG_COUNT];
+pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER; // Read locked by callers using entries.
+pthread_mutex_t dentry_lock = PTHREAD_MUTEX_INITIALIZER; // For LRU list and counts of dentry_cache.
+struct path_cache_t path_cache;
+pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER; // For slots and statistics of path_cache.
+struct journal_t journals[MAX_IMG_COUNT];
+struct cow_map_t cow_maps[MAX_IMG_COUNT];
+struct bitmap_t snapshot_blocks[MAX_IMG_COUNT]; // Blocks kept by snapshots, never written nor released.
+struct delalloc_t delallocs[MAX_IMG_COUNT]; // Appended data of each volume that was not written yet.
+struct defrag_t defrags[MAX_IMG_COUNT];
+struct ioring_t iorings[MAX_IMG_COUNT]; // Data writes in flight of each volume.
+struct trace_stat_t traces[TRACE_OP_COUNT]; // Counters of traced operations, see trace.h.
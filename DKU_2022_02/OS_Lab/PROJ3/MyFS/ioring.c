@@ -0,0 +1,389 @@
+//
+// @file : ioring.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements asynchronous writes of data blocks using io_uring.
+//          The ring is set up with raw system calls, so this needs nothing but the kernel headers.
+//          Callers only queue writes, the submitter thread hands them to the kernel in batches and collects
+//          completions. Callers wait only when IORING_DEPTH writes or IORING_MAX_BYTES are already in flight.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#undef BLOCK_SIZE // From linux/fs.h, fs.h defines the block size of the original format instead.
+#include "diskutil.h"
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern struct ioring_t iorings[MAX_IMG_COUNT];
+
+
+/**
+ * A function that writes data synchronously, for disks without io_uring.
+ * @param fd The disk to write into.
+ * @param offset The offset in the disk.
+ * @param data The data to write.
+ * @param length The length of the data.
+ * @return -1 if failure, 0 if successful.
+ */
+static int write_sync(int fd, unsigned int offset, unsigned char* data, unsigned int length) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        trace_syscall();
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return -1;
+        data = data + written;
+        offset = offset + written;
+        length = length - written;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that unmaps the queues of a ring and closes it.
+ * @param r The ring to release.
+ */
+static void release_ring(struct ioring_t* r) {
+    if (r->sqes != NULL) munmap(r->sqes, IORING_DEPTH * sizeof(struct io_uring_sqe));
+    if (r->cq_ring != NULL && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring != NULL) munmap(r->sq_ring, r->sq_ring_size);
+    if (r->ring_fd != -1) close(r->ring_fd);
+    r->sqes = NULL;
+    r->cq_ring = NULL;
+    r->sq_ring = NULL;
+    r->ring_fd = -1;
+    r->enabled = 0;
+}
+
+
+/**
+ * A function that sets up an io_uring and maps its queues.
+ * @param r The ring to set up.
+ * @return -1 if io_uring is not available, 0 if successful.
+ */
+static int setup_ring(struct ioring_t* r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(struct io_uring_params));
+    r->ring_fd = (int) syscall(__NR_io_uring_setup, IORING_DEPTH, &p);
+    if (r->ring_fd < 0 || p.sq_entries != IORING_DEPTH) {
+        release_ring(r);
+        return -1;
+    }
+
+    // Kernels with IORING_FEAT_SINGLE_MMAP map both rings at once.
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    unsigned char single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+    void *sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                         IORING_OFF_SQ_RING);
+    r->sq_ring = sq_ring == MAP_FAILED ? NULL : sq_ring;
+    void *cq_ring = single ? r->sq_ring : mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+    r->cq_ring = cq_ring == MAP_FAILED ? NULL : cq_ring;
+    void *sqes = mmap(NULL, IORING_DEPTH * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+    r->sqes = sqes == MAP_FAILED ? NULL : sqes;
+    if (r->sq_ring == NULL || r->cq_ring == NULL || r->sqes == NULL) {
+        release_ring(r);
+        return -1;
+    }
+
+    unsigned char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (unsigned int*) (sq + p.sq_off.head);
+    r->sq_tail = (unsigned int*) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int*) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int*) (sq + p.sq_off.array);
+    r->cq_head = (unsigned int*) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned int*) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int*) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    r->enabled = 1;
+    return 0;
+}
+
+
+/**
+ * A function that submits the queued writes to the kernel and waits for at least a single completion.
+ * This is called by the submitter thread only, without holding the lock of the ring.
+ * @param r The ring to enter.
+ * @return -1 if failure, 0 if successful.
+ */
+static int enter_ring(struct ioring_t* r) {
+    unsigned int to_submit = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    long ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, r->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+    return ret == -1 && errno != EAGAIN && errno != EBUSY ? -1 : 0; // The kernel is just busy, try again later.
+}
+
+
+/**
+ * A function that puts a queued write into the submission queue. The lock of the ring must be held.
+ * @param r The ring to submit into.
+ * @param slot The request to submit.
+ */
+static void queue_sqe(struct ioring_t* r, unsigned int slot) {
+    struct ioring_req_t *req = &r->reqs[slot];
+    unsigned int tail = *r->sq_tail, index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = r->fd;
+    sqe->addr = (unsigned long) req->data;
+    sqe->len = req->length;
+    sqe->off = req->offset;
+    sqe->flags = req->ordered ? IOSQE_IO_DRAIN : 0;
+    sqe->user_data = slot;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * A function that frees a request. The lock of the ring must be held.
+ * @param r The ring of the request.
+ * @param slot The request to free.
+ */
+static void finish_req(struct ioring_t* r, unsigned int slot) {
+    struct ioring_req_t *req = &r->reqs[slot];
+    free(req->data);
+    req->data = NULL;
+    req->busy = 0;
+    r->in_flight--;
+    r->bytes = r->bytes - req->length;
+}
+
+
+/**
+ * A function that collects completed writes and frees their requests. The lock of the ring must be held.
+ * A failed or short write is reported and remembered until the next ioring_drain.
+ * @param disk_index The disk index of the ring.
+ * @return The count of completed writes.
+ */
+static unsigned int reap_writes(unsigned int disk_index) {
+    struct ioring_t *r = &iorings[disk_index];
+    unsigned int head = *r->cq_head, count = 0;
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        struct ioring_req_t *req = &r->reqs[cqe->user_data];
+        if (cqe->res != (int) req->length) {
+            printf("[ERROR] Could not write %d bytes at %x of disk %d (%d)\n", req->length, req->offset, disk_index,
+                   cqe->res);
+            r->failed = 1;
+        }
+        finish_req(r, (unsigned int) cqe->user_data);
+        head++;
+        count++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+
+/**
+ * A function that is run by the submitter thread of a volume.
+ * Queued writes are handed to the kernel in order, then completions are collected until something is queued again.
+ * @param arg The disk index of the ring.
+ * @return NULL.
+ */
+static void* ioring_worker(void* arg) {
+    unsigned int disk_index = (unsigned int) (uintptr_t) arg;
+    struct ioring_t *r = &iorings[disk_index];
+    unsigned int submitted = 0; // Writes handed to the kernel that did not complete yet.
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stopping || r->in_flight > 0) {
+        if (r->queue_count == 0 && submitted == 0) {
+            pthread_cond_wait(&r->wake, &r->lock);
+            continue;
+        }
+        for (unsigned int i = 0 ; i < r->queue_count ; i++) queue_sqe(r, r->queue[(r->queue_head + i) % IORING_DEPTH]);
+        submitted = submitted + r->queue_count;
+        r->queue_head = (r->queue_head + r->queue_count) % IORING_DEPTH;
+        r->queue_count = 0;
+        if (submitted > r->max_in_flight) r->max_in_flight = submitted;
+
+        pthread_mutex_unlock(&r->lock);
+        int ret = enter_ring(r);
+        pthread_mutex_lock(&r->lock);
+        submitted = submitted - reap_writes(disk_index);
+        if (ret == -1) { // The writes in the kernel are lost, the rest of writes are synchronous.
+            printf("[ERROR] io_uring of disk %d failed, data will be written synchronously\n", disk_index);
+            for (unsigned int i = 0 ; i < IORING_DEPTH ; i++)
+                if (r->reqs[i].busy) finish_req(r, i);
+            r->failed = 1;
+            r->broken = 1;
+        }
+        pthread_cond_broadcast(&r->done);
+        if (r->broken) break;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+
+/**
+ * A function that initializes the ring of a volume and starts its submitter thread.
+ * If io_uring is not available, writes of the volume are synchronous instead.
+ * @param disk_index The disk index to initialize the ring of.
+ * @return -1 if failure, 0 if successful.
+ */
+int ioring_init(unsigned int disk_index) {
+    struct ioring_t *r = &iorings[disk_index];
+    memset(r, 0, sizeof(struct ioring_t));
+    r->ring_fd = -1;
+    if (pthread_mutex_init(&r->lock, NULL) != 0 || pthread_cond_init(&r->wake, NULL) != 0
+        || pthread_cond_init(&r->done, NULL) != 0) return -1;
+    r->fd = open(disks[disk_index], O_RDWR);
+    if (r->fd == -1) return -1;
+
+    if (setup_ring(r) == -1) {
+        printf("[WARNING] io_uring is not available for disk %d, data will be written synchronously\n", disk_index);
+    } else if (pthread_create(&r->thread, NULL, ioring_worker, (void*) (uintptr_t) disk_index) != 0) {
+        printf("[WARNING] Could not start the submitter of disk %d, data will be written synchronously\n", disk_index);
+        release_ring(r);
+    }
+    return 0;
+}
+
+
+/**
+ * A function that writes data into the disk asynchronously.
+ * The data is copied, so the caller can change it right after this returns.
+ * A write overlapping a write in flight is started only after the writes before it complete,
+ * so the same place of the disk always ends up with the last data written into it.
+ * @param disk_index The disk index to write into.
+ * @param offset The offset in the disk.
+ * @param data The data to write.
+ * @param length The length of the data.
+ * @return -1 if failure, 0 if successful. Errors of the write itself are returned by ioring_drain.
+ */
+int ioring_write(unsigned int disk_index, unsigned int offset, void* data, unsigned int length) {
+    struct ioring_t *r = &iorings[disk_index];
+    if (!r->enabled) return write_sync(r->fd, offset, data, length);
+    if (length == 0) return 0;
+    unsigned char *copy = malloc(length);
+    if (!copy) return -1;
+    memcpy(copy, data, length);
+
+    pthread_mutex_lock(&r->lock);
+    // Wait for room, a single write bigger than IORING_MAX_BYTES is still allowed when nothing is in flight.
+    while (!r->broken && (r->in_flight == IORING_DEPTH || (r->in_flight > 0 && r->bytes + length > IORING_MAX_BYTES)))
+        pthread_cond_wait(&r->done, &r->lock);
+    if (r->broken) {
+        pthread_mutex_unlock(&r->lock);
+        int ret = write_sync(r->fd, offset, copy, length);
+        free(copy);
+        return ret;
+    }
+
+    unsigned int slot = IORING_DEPTH;
+    unsigned char ordered = 0;
+    for (unsigned int i = 0 ; i < IORING_DEPTH ; i++) {
+        struct ioring_req_t *other = &r->reqs[i];
+        if (!other->busy) slot = slot == IORING_DEPTH ? i : slot;
+        else if (offset < other->offset + other->length && other->offset < offset + length) ordered = 1;
+    }
+
+    struct ioring_req_t *req = &r->reqs[slot];
+    req->data = copy;
+    req->offset = offset;
+    req->length = length;
+    req->busy = 1;
+    req->ordered = ordered;
+    r->queue[(r->queue_head + r->queue_count) % IORING_DEPTH] = slot;
+    r->queue_count++;
+    r->in_flight++;
+    r->bytes = r->bytes + length;
+    r->write_count++;
+    r->ordered_count = r->ordered_count + ordered;
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+
+/**
+ * A function that waits for every write in flight of a volume.
+ * The journal calls this before a commit, so that file data reaches the disk before metadata pointing to it.
+ * @param disk_index The disk index to wait for.
+ * @return -1 if a write failed since the last call, 0 if successful.
+ */
+int ioring_drain(unsigned int disk_index) {
+    struct ioring_t *r = &iorings[disk_index];
+    if (!r->enabled) return 0;
+
+    pthread_mutex_lock(&r->lock);
+    while (r->in_flight > 0) pthread_cond_wait(&r->done, &r->lock);
+    int ret = r->failed ? -1 : 0;
+    r->failed = 0;
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+
+/**
+ * A function that waits for every write in flight of a volume, like ioring_drain, but keeps failures for it.
+ * @param disk_index The disk index to wait for.
+ * @return -1 if a write failed since the last ioring_drain, 0 if successful.
+ */
+int ioring_wait(unsigned int disk_index) {
+    struct ioring_t *r = &iorings[disk_index];
+    if (!r->enabled) return 0;
+
+    pthread_mutex_lock(&r->lock);
+    while (r->in_flight > 0) pthread_cond_wait(&r->done, &r->lock);
+    int ret = r->failed ? -1 : 0;
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+
+/**
+ * A function that looks up the writes of a volume since the volume was mounted.
+ * @param disk_index The disk index to look for.
+ * @param writes The pointer to store the count of writes.
+ * @param ordered The pointer to store the count of writes that waited for an overlapping write.
+ * @param max_in_flight The pointer to store the most writes that were in the kernel at once.
+ * @return 1 if io_uring is used, 0 if writes are synchronous.
+ */
+int ioring_status(unsigned int disk_index, unsigned int* writes, unsigned int* ordered, unsigned int* max_in_flight) {
+    struct ioring_t *r = &iorings[disk_index];
+    pthread_mutex_lock(&r->lock);
+    *writes = r->write_count;
+    *ordered = r->ordered_count;
+    *max_in_flight = r->max_in_flight;
+    int enabled = r->enabled && !r->broken;
+    pthread_mutex_unlock(&r->lock);
+    return enabled;
+}
+
+
+/**
+ * A function that waits for the writes in flight, stops the submitter thread and releases the ring of a volume.
+ * @param disk_index The disk index to release the ring of.
+ * @return -1 if a write failed, 0 if successful.
+ */
+int ioring_release(unsigned int disk_index) {
+    struct ioring_t *r = &iorings[disk_index];
+    int ret = ioring_drain(disk_index);
+    if (r->enabled) {
+        pthread_mutex_lock(&r->lock);
+        r->stopping = 1;
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+    }
+    release_ring(r);
+    if (r->fd != -1) close(r->fd);
+    r->fd = -1;
+    pthread_cond_destroy(&r->wake);
+    pthread_cond_destroy(&r->done);
+    pthread_mutex_destroy(&r->lock);
+    return ret;
+}
@@ -0,0 +1,94 @@
+//
+// @file : ioring.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines asynchronous writes of data blocks using io_uring.
+//          Data writes are queued and the caller returns right away, so a single thread can keep many writes in
+//          flight. A submitter thread per volume hands them to the kernel, since io_uring cancels the writes of a
+//          thread that exits. Writes overlapping a write in flight are ordered after it, and ioring_drain waits for
+//          every write in flight, which the journal calls before a commit (ordered mode).
+//          If io_uring is not available, the same calls just write synchronously.
+//
+
+#ifndef MYFS_IORING_H
+#define MYFS_IORING_H
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+
+#define IORING_DEPTH 64                        // Writes that a single volume can have in flight.
+#define IORING_MAX_BYTES (8 * 1024 * 1024)     // Bytes that a single volume can have in flight.
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+
+/**
+ * A struct that implements a single write in flight. The data is a copy, so the caller can change its buffer.
+ */
+struct ioring_req_t {
+    unsigned char *data;
+    unsigned int offset;  // The offset in the disk.
+    unsigned int length;
+    unsigned char busy;   // Whether if this was queued and did not complete yet.
+    unsigned char ordered; // Whether if this must start after the writes before it complete.
+};
+
+
+/**
+ * A struct that implements the ring of a single volume.
+ * The queues shared with the kernel are used by the submitter thread only, everything else is guarded by lock.
+ */
+struct ioring_t {
+    int fd;                          // The disk opened for data writes.
+    unsigned char enabled;           // Whether if io_uring is used, otherwise writes are synchronous.
+    int ring_fd;
+
+    // The submission and completion queues shared with the kernel.
+    void *sq_ring;
+    void *cq_ring;
+    unsigned int sq_ring_size;
+    unsigned int cq_ring_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    struct ioring_req_t reqs[IORING_DEPTH];
+    unsigned int queue[IORING_DEPTH]; // Requests that were not handed to the kernel yet, in the order of writes.
+    unsigned int queue_head;
+    unsigned int queue_count;
+    unsigned int in_flight;          // The count of busy requests, queued or in the kernel.
+    unsigned int bytes;              // The bytes of busy requests.
+    unsigned char failed;            // Whether if a write failed since the last ioring_drain.
+    unsigned char broken;            // Whether if the kernel refused the ring, writes are synchronous from then on.
+
+    unsigned int write_count;        // Statistics: writes since mount.
+    unsigned int ordered_count;      // Statistics: writes that waited for an overlapping write in flight.
+    unsigned int max_in_flight;      // Statistics: the most writes that were in flight at once.
+
+    pthread_t thread;                // The submitter thread.
+    unsigned char stopping;          // Whether if the submitter thread must exit once nothing is in flight.
+    pthread_mutex_t lock;
+    pthread_cond_t wake;             // Signaled when a write is queued or the submitter thread must stop.
+    pthread_cond_t done;             // Signaled when writes complete.
+};
+
+
+// For mounting and unmounting.
+int ioring_init(unsigned int);
+int ioring_release(unsigned int);
+
+// For writing data.
+int ioring_write(unsigned int, unsigned int, void*, unsigned int);
+int ioring_drain(unsigned int);
+int ioring_wait(unsigned int);
+int ioring_status(unsigned int, unsigned int*, unsigned int*, unsigned int*);
+
+#endif //MYFS_IORING_H
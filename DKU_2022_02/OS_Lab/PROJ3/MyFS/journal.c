@@ -0,0 +1,579 @@
+//
+// @file : journal.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements metadata journal (write ahead log) of MyFS.
+//          The journal is a contiguous run of data blocks. The first block is the header, the rest stores the last
+//          committed transaction. Since each transaction is written to home locations right after being committed,
+//          only the last transaction can ever be missing from home locations.
+//
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "diskutil.h"
+
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern struct partition partitions[MAX_IMG_COUNT];
+extern struct journal_t journals[MAX_IMG_COUNT];
+extern struct delalloc_t delallocs[MAX_IMG_COUNT];
+
+static __thread unsigned int journal_depth[MAX_IMG_COUNT]; // Nested handles that the current thread holds.
+
+
+/**
+ * A function that calculates CRC32 of a buffer.
+ * @param crc The CRC32 to continue from, 0 for a new one.
+ * @param buf The buffer to calculate CRC32.
+ * @param len The length of the buffer.
+ * @return The CRC32 value.
+ */
+static unsigned int crc32(unsigned int crc, const unsigned char* buf, unsigned int len) {
+    crc = ~crc;
+    for (unsigned int i = 0 ; i < len ; i++) {
+        crc = crc ^ buf[i];
+        for (int k = 0 ; k < 8 ; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+
+/**
+ * A function that writes data into the disk directly, without the journal.
+ * This goes through the write ring, so it is ordered after file data written into the same place.
+ * @param disk_index The disk index to write data into.
+ * @param offset The offset in the disk.
+ * @param data The data to write.
+ * @param length The length of the data.
+ * @return -1 if failure, 0 if successful.
+ */
+static int write_direct(unsigned int disk_index, unsigned int offset, void* data, unsigned int length) {
+    return ioring_write(disk_index, offset, data, length);
+}
+
+
+/**
+ * A function that returns the last transaction of a journal that was loaded into memory, if it must be replayed.
+ * @param journal The journal blocks, starting from the header block.
+ * @param blocks The count of the journal blocks.
+ * @param block_size The block size of the disk.
+ * @return The transaction if it was committed but not checkpointed, NULL if there is nothing to replay.
+ */
+struct journal_txn_t* journal_pending(unsigned char* journal, unsigned int blocks, unsigned int block_size) {
+    struct journal_header_t *header = (struct journal_header_t*) journal;
+    struct journal_txn_t *txn = (struct journal_txn_t*) (journal + block_size);
+    unsigned int capacity = (blocks - 1) * block_size;
+    unsigned int checkpointed = header->magic == JOURNAL_MAGIC ? header->checkpointed_seq : 0;
+    if (txn->magic != JOURNAL_MAGIC || txn->seq <= checkpointed || txn->length > capacity
+        || txn->length < sizeof(struct journal_txn_t) + sizeof(struct journal_commit_t)) return NULL;
+
+    // The transaction is valid only if the commit block was written completely.
+    unsigned int body = txn->length - sizeof(struct journal_commit_t);
+    struct journal_commit_t commit;
+    memcpy(&commit, (unsigned char*) txn + body, sizeof(struct journal_commit_t));
+    if (commit.magic != JOURNAL_COMMIT_MAGIC || commit.seq != txn->seq || commit.checksum != crc32(0, (unsigned char*) txn, body))
+        return NULL;
+    return txn;
+}
+
+
+/**
+ * A function that reads records of a transaction returned by journal_pending one by one.
+ * @param txn The transaction to read.
+ * @param pos The position of the next record, this must be 0 for the first record.
+ * @param record The struct journal_record_t to store the record into.
+ * @param data The pointer to store the data of the record into.
+ * @return 1 if a record was read, 0 if there are no more records.
+ */
+int journal_next_record(struct journal_txn_t* txn, unsigned int* pos, struct journal_record_t* record, unsigned char** data) {
+    unsigned int body = txn->length - sizeof(struct journal_commit_t);
+    if (*pos == 0) *pos = sizeof(struct journal_txn_t);
+    if (*pos + sizeof(struct journal_record_t) > body) return 0;
+    memcpy(record, (unsigned char*) txn + *pos, sizeof(struct journal_record_t));
+    if (*pos + sizeof(struct journal_record_t) + record->length > body) return 0;
+
+    *data = (unsigned char*) txn + *pos + sizeof(struct journal_record_t);
+    *pos = *pos + sizeof(struct journal_record_t) + record->length;
+    return 1;
+}
+
+
+/**
+ * A function that replays the last committed transaction of a disk, if it was not checkpointed.
+ * This must be called right after load_super_block, before anything else is loaded from the disk.
+ * Transactions without valid commit block (crashed in the middle of the commit) are ignored.
+ * @param disk_index The disk index to replay journal.
+ * @return -1 if failure, 0 if successful.
+ */
+int journal_replay(unsigned int disk_index) {
+    struct super_block *sb = &partitions[disk_index].s;
+    struct journal_t *j = &journals[disk_index];
+    j->seq = 1;
+    if (!check_feature(disk_index, MYFS_FEATURE_JOURNAL)) return 0; // No journal yet.
+    if (sb->journal_blocks < 2 || sb->journal_start + sb->journal_blocks > sb->num_blocks) {
+        printf("[ERROR] Disk %d has invalid journal (start %d, %d blocks)\n", disk_index, sb->journal_start, sb->journal_blocks);
+        return -1;
+    }
+
+    int fd = open(disks[disk_index], O_RDWR);
+    if (fd == -1) return -1;
+    unsigned int base = block_offset(disk_index, sb->journal_start);
+    unsigned int size = sb->journal_blocks * sb->block_size;
+    unsigned char *journal = calloc(size, 1);
+    if (!journal) {
+        close(fd);
+        return -1;
+    }
+    (void)! pread(fd, journal, size, base);
+
+    struct journal_header_t header;
+    struct journal_txn_t *txn = journal_pending(journal, sb->journal_blocks, sb->block_size);
+    struct journal_txn_t *last = (struct journal_txn_t*) (journal + sb->block_size);
+    memcpy(&header, journal, sizeof(struct journal_header_t));
+    unsigned int checkpointed = header.magic == JOURNAL_MAGIC ? header.checkpointed_seq : 0;
+    j->seq = checkpointed + 1;
+    if (txn == NULL) { // Nothing to replay.
+        if (last->magic == JOURNAL_MAGIC && last->seq > checkpointed)
+            printf("[INFO] Disk %d has uncommitted journal transaction %d, discarding it\n", disk_index, last->seq);
+        free(journal);
+        close(fd);
+        return 0;
+    }
+
+    // Write all records into their home locations again.
+    struct journal_record_t record;
+    unsigned char *data = NULL;
+    unsigned int pos = 0;
+    while (journal_next_record(txn, &pos, &record, &data))
+        (void)! pwrite(fd, data, record.length, record.offset);
+    fsync(fd);
+
+    // Mark the transaction as checkpointed, so that it is not replayed again.
+    header.magic = JOURNAL_MAGIC;
+    header.checkpointed_seq = txn->seq;
+    (void)! pwrite(fd, &header, sizeof(struct journal_header_t), base);
+    fsync(fd);
+    close(fd);
+
+    printf("[INFO] Replayed journal transaction %d of disk %d (%d writes)\n", txn->seq, disk_index, txn->record_count);
+    j->seq = txn->seq + 1;
+    free(journal);
+    return load_super_block(disk_index); // The super block could have been replayed as well.
+}
+
+
+/**
+ * A function that reserves journal blocks in a disk that has no journal yet.
+ * @param disk_index The disk index to create journal.
+ * @return -1 if failure, 0 if successful.
+ */
+static int create_journal(unsigned int disk_index) {
+    struct super_block *sb = &partitions[disk_index].s;
+    unsigned int blocks[JOURNAL_BLOCKS];
+    if (assign_empty_blocks(disk_index, JOURNAL_BLOCKS, blocks) == -1) return -1;
+
+    // The journal must be contiguous, so that a transaction is a single sequential write.
+    for (int i = 1 ; i < JOURNAL_BLOCKS ; i++) {
+        if (blocks[i] != blocks[0] + i) {
+            release_blocks(disk_index, JOURNAL_BLOCKS, blocks);
+            return -1;
+        }
+    }
+
+    // Clear the header and the first transaction block, so that nothing left in the blocks is replayed.
+    struct blocks *data = get_block(disk_index, blocks[0]);
+    memset(data, 0, sb->block_size * 2);
+    write_data_block(disk_index, blocks[0], 2, data);
+
+    sb->journal_start = blocks[0];
+    sb->journal_blocks = JOURNAL_BLOCKS;
+    set_feature(disk_index, MYFS_FEATURE_JOURNAL);
+    return write_super_block(disk_index); // The journal is not enabled yet, so this is written directly.
+}
+
+
+/**
+ * A function that enables journal of a disk.
+ * Disks without a journal get one, if they have enough contiguous free blocks.
+ * This must be called after the bitmaps were loaded, since the journal blocks are assigned from them.
+ * @param disk_index The disk index to enable journal.
+ * @return -1 if failure, 0 if successful.
+ */
+int journal_init(unsigned int disk_index) {
+    struct super_block *sb = &partitions[disk_index].s;
+    struct journal_t *j = &journals[disk_index];
+    if (pthread_mutex_init(&j->lock, NULL) != 0 || pthread_cond_init(&j->cond, NULL) != 0) return -1;
+
+    if (!check_feature(disk_index, MYFS_FEATURE_JOURNAL) && create_journal(disk_index) == -1) {
+        printf("[WARNING] Could not create journal for disk %d, metadata will be written without journal\n", disk_index);
+        return 0;
+    }
+
+    j->fd = open(disks[disk_index], O_RDWR);
+    if (j->fd == -1) return -1;
+    j->start = sb->journal_start;
+    j->blocks = sb->journal_blocks;
+    j->enabled = 1;
+    return 0;
+}
+
+
+/**
+ * A function that compares two pending writes by their offsets, for qsort.
+ * @param a The first write.
+ * @param b The second write.
+ * @return Negative if a comes first, positive if b comes first.
+ */
+static int compare_records(const void* a, const void* b) {
+    unsigned int x = ((const struct journal_entry_t*) a)->offset, y = ((const struct journal_entry_t*) b)->offset;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * A function that writes the pending writes of the running transaction into home locations.
+ * Writes are sorted by their offsets, so writes right next to each other (Ex. inodes of the same inode table block)
+ * are done by a single pwritev. Records never overlap, so their order does not matter.
+ * The journal lock must be held, the records are kept.
+ * @param disk_index The disk index to write.
+ */
+static void checkpoint_records(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    struct iovec iov[JOURNAL_CHECKPOINT_IOVS];
+    qsort(j->records, j->record_count, sizeof(struct journal_entry_t), compare_records);
+    for (unsigned int i = 0 ; i < j->record_count ;) {
+        unsigned int offset = j->records[i].offset, end = offset, count = 0;
+        while (i < j->record_count && j->records[i].offset == end && count < JOURNAL_CHECKPOINT_IOVS) {
+            iov[count].iov_base = j->records[i].data;
+            iov[count].iov_len = j->records[i].length;
+            end = end + j->records[i].length;
+            count++;
+            i++;
+        }
+        (void)! pwritev(j->fd, iov, (int) count, offset);
+        trace_syscall();
+    }
+}
+
+
+/**
+ * A function that commits the running transaction, then writes it into home locations.
+ * The journal lock must be held and no operation must be in the middle of the transaction.
+ * If the transaction could not fit in the journal, it is just written into home locations.
+ * @param disk_index The disk index to commit.
+ * @return -1 if failure, 0 if successful.
+ */
+static int commit_transaction(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (j->record_count == 0) return 0;
+
+    unsigned int length = sizeof(struct journal_txn_t) + j->bytes + sizeof(struct journal_commit_t);
+    unsigned int capacity = (j->blocks - 1) * get_block_size(disk_index);
+    unsigned char *buffer = length <= capacity ? malloc(length) : NULL;
+    int ret = 0;
+
+    // File data is written asynchronously, make sure it reaches the disk before metadata pointing to it.
+    if (ioring_drain(disk_index) == -1) ret = -1;
+    fsync(j->fd);
+    trace_syscall();
+
+    if (buffer) {
+        struct journal_txn_t txn = {JOURNAL_MAGIC, j->seq, j->record_count, length};
+        unsigned int pos = sizeof(struct journal_txn_t);
+        memcpy(buffer, &txn, sizeof(struct journal_txn_t));
+        for (unsigned int i = 0 ; i < j->record_count ; i++) {
+            struct journal_record_t record = {j->records[i].offset, j->records[i].length};
+            memcpy(buffer + pos, &record, sizeof(struct journal_record_t));
+            pos = pos + sizeof(struct journal_record_t);
+            memcpy(buffer + pos, j->records[i].data, record.length);
+            pos = pos + record.length;
+        }
+        struct journal_commit_t commit = {JOURNAL_COMMIT_MAGIC, j->seq, crc32(0, buffer, pos)};
+        memcpy(buffer + pos, &commit, sizeof(struct journal_commit_t));
+
+        // A single sequential write and a single fsync for all operations in this transaction.
+        unsigned int offset = block_offset(disk_index, j->start + 1);
+        if (pwrite(j->fd, buffer, length, offset) != (ssize_t) length || fsync(j->fd) != 0) ret = -1;
+        trace_syscall(); // The pwrite,
+        trace_syscall(); // and the fsync.
+        free(buffer);
+    } else {
+        if (!j->bulk) {
+            printf("[ERROR] Journal transaction of disk %d is too big (%d bytes), writing without journal\n", disk_index, length);
+            ret = -1;
+        }
+        // The last committed transaction is already on its home locations, it must not be replayed over this one.
+        struct journal_header_t header = {JOURNAL_MAGIC, j->seq - 1};
+        if (pwrite(j->fd, &header, sizeof(struct journal_header_t), block_offset(disk_index, j->start))
+            != sizeof(struct journal_header_t) || fsync(j->fd) != 0) ret = -1;
+        trace_syscall(); // The pwrite,
+        trace_syscall(); // and the fsync.
+    }
+
+    // Checkpoint, the next commit's fsync makes sure that this reached the disk before the journal is reused.
+    checkpoint_records(disk_index);
+    for (unsigned int i = 0 ; i < j->record_count ; i++) free(j->records[i].data);
+    if (ret == -1 || !buffer) {
+        fsync(j->fd);
+        trace_syscall();
+    }
+
+    j->record_count = 0;
+    j->bytes = 0;
+    j->seq++;
+    j->commit_count++;
+    return ret;
+}
+
+
+/**
+ * A function that gives back memory of the disk mapping once enough was written back, see trim_disk_image.
+ * The journal lock must be held and no operation must be running. Writes in flight are waited for first, pending
+ * writes of the running transaction stay in memory, so this also bounds the memory of a long bulk load.
+ * @param disk_index The disk index to trim.
+ */
+static void trim_image(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (__atomic_load_n(&partitions[disk_index].image_written, __ATOMIC_RELAXED) < IMAGE_TRIM_BYTES) return;
+    if (ioring_wait(disk_index) == -1) return; // Failed writes are not on the disk, keep their pages.
+    qsort(j->records, j->record_count, sizeof(struct journal_entry_t), compare_records);
+    trim_disk_image(disk_index, j->records, j->record_count);
+}
+
+
+/**
+ * A function that starts an operation in the running transaction.
+ * Every write of the operation will be committed together, an operation is never split between transactions.
+ * This must be called before taking any engine lock, calls can be nested.
+ * @param disk_index The disk index that the operation is for.
+ */
+void journal_begin(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return;
+    if (journal_depth[disk_index]++ > 0) return; // Already in the middle of an operation.
+
+    pthread_mutex_lock(&j->lock);
+    // Do not let the running transaction grow forever, wait for the operations in it to finish then commit.
+    while (j->exclusive || (!j->bulk && j->bytes >= JOURNAL_COMMIT_BYTES && j->handles > 0))
+        pthread_cond_wait(&j->cond, &j->lock);
+    if (!j->bulk && j->bytes >= JOURNAL_COMMIT_BYTES) commit_transaction(disk_index);
+    j->handles++;
+    pthread_mutex_unlock(&j->lock);
+}
+
+
+/**
+ * A function that starts an operation that must not run together with any other operation, like taking a snapshot.
+ * This waits for running operations to finish, then new operations wait until this one calls journal_end.
+ * The caller must not be in the middle of another operation.
+ * @param disk_index The disk index that the operation is for.
+ */
+void journal_begin_exclusive(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return;
+    journal_depth[disk_index]++;
+
+    pthread_mutex_lock(&j->lock);
+    while (j->exclusive || j->handles > 0) pthread_cond_wait(&j->cond, &j->lock);
+    j->exclusive = 1;
+    j->handles++;
+    pthread_mutex_unlock(&j->lock);
+}
+
+
+/**
+ * A function that finishes an operation started by journal_begin or journal_begin_exclusive.
+ * The last operation that finishes commits the transaction, if it got big enough.
+ * @param disk_index The disk index that the operation is for.
+ */
+void journal_end(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return;
+    if (--journal_depth[disk_index] > 0) return;
+
+    pthread_mutex_lock(&j->lock);
+    j->handles--;
+    j->op_count++;
+    if (j->handles == 0) {
+        j->exclusive = 0;
+        if (!j->bulk && j->bytes >= JOURNAL_COMMIT_BYTES) commit_transaction(disk_index);
+        trim_image(disk_index);
+        pthread_cond_broadcast(&j->cond);
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+
+/**
+ * A function that adds a metadata write into the running transaction.
+ * The data is copied, so the caller can change it right after this returns.
+ * If the journal is not enabled, the data is written directly.
+ * @param disk_index The disk index to write into.
+ * @param offset The offset in the disk.
+ * @param data The data to write.
+ * @param length The length of the data.
+ * @return -1 if failure, 0 if successful.
+ */
+int journal_write(unsigned int disk_index, unsigned int offset, void* data, unsigned int length) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return write_direct(disk_index, offset, data, length);
+
+    pthread_mutex_lock(&j->lock);
+    // Writing the same place again just replaces the earlier write, so hot metadata does not grow the transaction.
+    for (unsigned int i = 0 ; i < j->record_count ; i++) {
+        if (j->records[i].offset == offset && j->records[i].length == length) {
+            memcpy(j->records[i].data, data, length);
+            pthread_mutex_unlock(&j->lock);
+            return 0;
+        }
+    }
+
+    if (j->record_count == j->record_capacity) {
+        unsigned int capacity = j->record_capacity == 0 ? 64 : j->record_capacity * 2;
+        struct journal_entry_t *records = realloc(j->records, sizeof(struct journal_entry_t) * capacity);
+        if (!records) {
+            pthread_mutex_unlock(&j->lock);
+            return -1;
+        }
+        j->records = records;
+        j->record_capacity = capacity;
+    }
+
+    unsigned char *copy = malloc(length);
+    if (!copy) {
+        pthread_mutex_unlock(&j->lock);
+        return -1;
+    }
+    memcpy(copy, data, length);
+    count_image_write(disk_index, length);
+    j->records[j->record_count].offset = offset;
+    j->records[j->record_count].length = length;
+    j->records[j->record_count].data = copy;
+    j->record_count++;
+    j->bytes = j->bytes + sizeof(struct journal_record_t) + length;
+    pthread_mutex_unlock(&j->lock);
+    return 0;
+}
+
+
+/**
+ * A function that drops pending writes of the running transaction in a range of the disk.
+ * This is called when file data is written directly into blocks that were metadata before (Ex. a released directory
+ * block), so that the stale metadata does not overwrite the file data later.
+ * @param disk_index The disk index.
+ * @param offset The offset of the range.
+ * @param length The length of the range.
+ */
+void journal_forget(unsigned int disk_index, unsigned int offset, unsigned int length) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return;
+
+    pthread_mutex_lock(&j->lock);
+    for (unsigned int i = 0 ; i < j->record_count ;) {
+        struct journal_entry_t *record = &j->records[i];
+        if (record->offset >= offset && record->offset + record->length <= offset + length) {
+            j->bytes = j->bytes - sizeof(struct journal_record_t) - record->length;
+            free(record->data);
+            *record = j->records[--j->record_count]; // Records never overlap, so their order does not matter.
+        } else i++;
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+
+/**
+ * A function that commits the running transaction right now, waiting for the operations in it.
+ * File data in flight is waited for as well, even if there is nothing to commit.
+ * This must not be called in the middle of an operation.
+ * @param disk_index The disk index to flush.
+ * @return -1 if failure, 0 if successful.
+ */
+int journal_flush(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return ioring_drain(disk_index);
+
+    pthread_mutex_lock(&j->lock);
+    while (j->handles > 0) pthread_cond_wait(&j->cond, &j->lock);
+    int ret = ioring_drain(disk_index);
+    if (commit_transaction(disk_index) == -1) ret = -1;
+    trim_image(disk_index);
+    pthread_mutex_unlock(&j->lock);
+    return ret;
+}
+
+
+/**
+ * A function that starts loading many files at once, like importing a directory tree into an image.
+ * From now on the running transaction is not committed when it gets big, every metadata write is kept in memory
+ * until journal_bulk_end writes all of them together. Writing the same place again replaces the earlier write, so the
+ * super block, bitmaps and directory blocks are written once instead of once per file.
+ * Nothing but file data reaches the disk before journal_bulk_end, so stopping in the middle leaves the metadata of
+ * the volume as it was.
+ * This must not be called in the middle of an operation.
+ * @param disk_index The disk index to load files into.
+ * @return -1 if failure, 0 if successful.
+ */
+int journal_bulk_begin(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return 0;
+    int ret = journal_flush(disk_index);
+    pthread_mutex_lock(&j->lock);
+    j->bulk = 1;
+    pthread_mutex_unlock(&j->lock);
+    return ret;
+}
+
+
+/**
+ * A function that finishes loading files started by journal_bulk_begin, waiting for the operations in it.
+ * File data is waited for, then the metadata is committed. If it is too big for the journal, it is written into home
+ * locations directly, so a crash while this is running may leave the volume half written.
+ * @param disk_index The disk index that files were loaded into.
+ * @return -1 if failure, 0 if successful.
+ */
+int journal_bulk_end(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return ioring_drain(disk_index);
+
+    pthread_mutex_lock(&j->lock);
+    while (j->handles > 0) pthread_cond_wait(&j->cond, &j->lock);
+    int ret = ioring_drain(disk_index);
+    if (commit_transaction(disk_index) == -1) ret = -1;
+    j->bulk = 0;
+    pthread_mutex_unlock(&j->lock);
+    return ret;
+}
+
+
+/**
+ * A function that flushes the journal and marks it as clean, so that nothing is replayed at next mount.
+ * Metadata writes after this go directly into the disk.
+ * Delayed appends are not written by this, call flush_delayed_writes first (unmount_disk does). While any of them
+ * is kept, the journal is flushed but left open, so that losing them is reported instead of looking like a clean unmount.
+ * @param disk_index The disk index to close journal.
+ * @return -1 if failure, 0 if successful.
+ */
+int journal_close(unsigned int disk_index) {
+    struct journal_t *j = &journals[disk_index];
+    if (!j->enabled) return 0;
+    int ret = journal_flush(disk_index);
+    if (delalloc_total(&delallocs[disk_index]) > 0) {
+        printf("[ERROR] Disk %d has delayed appends that were not written, not closing journal\n", disk_index);
+        return -1;
+    }
+
+    pthread_mutex_lock(&j->lock);
+    struct journal_header_t header = {JOURNAL_MAGIC, j->seq - 1};
+    if (ioring_drain(disk_index) == -1) ret = -1;
+    fsync(j->fd); // The last checkpoint must reach the disk before the header says so.
+    if (pwrite(j->fd, &header, sizeof(struct journal_header_t), block_offset(disk_index, j->start)) != sizeof(struct journal_header_t)
+        || fsync(j->fd) != 0) ret = -1;
+    close(j->fd);
+    free(j->records);
+    j->records = NULL;
+    j->record_capacity = 0;
+    j->enabled = 0;
+    pthread_mutex_unlock(&j->lock);
+    return ret;
+}
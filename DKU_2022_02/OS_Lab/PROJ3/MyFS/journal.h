@@ -0,0 +1,123 @@
+//
+// @file : journal.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines metadata journal (write ahead log) of MyFS.
+//          Metadata writes (super block, inodes, directory and indirect blocks) are collected into a running
+//          transaction in memory. The transaction is committed into the journal with a single sequential write,
+//          then written to the home locations. File data is written directly before the commit (ordered mode).
+//
+
+#ifndef MYFS_JOURNAL_H
+#define MYFS_JOURNAL_H
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+
+#define JOURNAL_BLOCKS 128                // Blocks reserved for the journal, including the header block.
+#define JOURNAL_COMMIT_BYTES (32 * 1024)  // The running transaction is committed when it gets bigger than this.
+#define JOURNAL_MAGIC 0x4C4E4A4D          // 'MJNL'
+#define JOURNAL_COMMIT_MAGIC 0x54494D43   // 'CMIT'
+#define JOURNAL_CHECKPOINT_IOVS 256       // Adjacent writes that a checkpoint merges into a single pwritev.
+
+
+/**
+ * A struct that implements the header block of the journal.
+ * Transactions with sequence numbers that are not bigger than checkpointed_seq are already on their home locations.
+ */
+struct journal_header_t {
+    unsigned int magic;
+    unsigned int checkpointed_seq;
+};
+
+
+/**
+ * A struct that implements the head of a committed transaction.
+ * This is followed by record_count records, each record is struct journal_record_t and its data.
+ */
+struct journal_txn_t {
+    unsigned int magic;
+    unsigned int seq;
+    unsigned int record_count;
+    unsigned int length;       // The length of the whole transaction, including the commit block.
+};
+
+
+/**
+ * A struct that implements a single write in a transaction.
+ */
+struct journal_record_t {
+    unsigned int offset;  // The offset in the disk to write data into.
+    unsigned int length;
+};
+
+
+/**
+ * A struct that implements the end of a committed transaction.
+ * A transaction is valid only if this is written and the checksum matches.
+ */
+struct journal_commit_t {
+    unsigned int magic;
+    unsigned int seq;
+    unsigned int checksum; // CRC32 of everything before this.
+};
+
+
+/**
+ * A struct that implements a pending write in the running transaction.
+ */
+struct journal_entry_t {
+    unsigned int offset;
+    unsigned int length;
+    unsigned char *data;
+};
+
+
+/**
+ * A struct that implements journal of a single volume.
+ */
+struct journal_t {
+    unsigned char enabled;          // Whether if metadata writes go through the journal.
+    int fd;                         // The disk opened for journal writes.
+    unsigned int start;             // The first data block of the journal.
+    unsigned int blocks;            // The count of blocks of the journal.
+    unsigned int seq;               // The sequence number of the running transaction.
+
+    struct journal_entry_t *records; // Pending writes of the running transaction.
+    unsigned int record_count;
+    unsigned int record_capacity;
+    unsigned int bytes;             // The size of the running transaction when it is committed.
+    unsigned int handles;           // The count of operations that are in the middle of the running transaction.
+    unsigned char exclusive;        // Whether if the running operation must be the only one, see journal_begin_exclusive.
+    unsigned char bulk;             // Whether if the running transaction is kept until journal_bulk_end.
+
+    unsigned int commit_count;      // Statistics: transactions committed since mount.
+    unsigned int op_count;          // Statistics: operations committed since mount.
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            // Signaled when handles becomes 0.
+};
+
+// For mounting and unmounting.
+int journal_replay(unsigned int);
+int journal_init(unsigned int);
+int journal_close(unsigned int);
+
+// For reading a journal loaded into memory.
+struct journal_txn_t* journal_pending(unsigned char*, unsigned int, unsigned int);
+int journal_next_record(struct journal_txn_t*, unsigned int*, struct journal_record_t*, unsigned char**);
+
+// For operations.
+void journal_begin(unsigned int);
+void journal_begin_exclusive(unsigned int);
+void journal_end(unsigned int);
+int journal_write(unsigned int, unsigned int, void*, unsigned int);
+void journal_forget(unsigned int, unsigned int, unsigned int);
+int journal_flush(unsigned int);
+
+// For loading many files at once.
+int journal_bulk_begin(unsigned int);
+int journal_bulk_end(unsigned int);
+
+#endif //MYFS_JOURNAL_H
@@ -0,0 +1,199 @@
+//
+// @file : locks.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements locks of MyFS engine for concurrent callers.
+//
+
+#include "locks.h"
+
+
+extern struct volume_locks_t volume_locks[MAX_IMG_COUNT];
+extern struct partition partitions[MAX_IMG_COUNT];
+extern pthread_rwlock_t tree_lock;
+
+
+/**
+ * A function that initializes all locks of a volume.
+ * This must be called before the volume is used, mount_disk does this right after loading the super block.
+ * @param disk_index The disk index to initialize locks for.
+ * @return -1 if failure, 0 if successful.
+ */
+int init_volume_locks(unsigned int disk_index) {
+    struct volume_locks_t *locks = &volume_locks[disk_index];
+    unsigned int inode_count = partitions[disk_index].s.num_inodes;
+    locks->inodes = malloc(sizeof(pthread_rwlock_t) * inode_count);
+    locks->dirs = malloc(sizeof(pthread_mutex_t) * inode_count);
+    pthread_mutexattr_t attr;
+    if (!locks->inodes || !locks->dirs || pthread_mutexattr_init(&attr) != 0) {
+        release_volume_locks(disk_index);
+        return -1;
+    }
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+    int ret = 0;
+    for (unsigned int i = 0 ; i < inode_count ; i++) {
+        if (pthread_rwlock_init(&locks->inodes[i], NULL) != 0) ret = -1;
+        if (pthread_mutex_init(&locks->dirs[i], &attr) != 0) ret = -1;
+    }
+    if (pthread_mutex_init(&locks->alloc, NULL) != 0) ret = -1;
+    if (pthread_mutex_init(&locks->cow, &attr) != 0) ret = -1;
+    pthread_mutexattr_destroy(&attr);
+
+    if (ret == -1) printf("[ERROR] Could not initialize locks for disk %d\n", disk_index);
+    return ret;
+}
+
+
+/**
+ * A function that releases the per inode locks of a volume.
+ * The caller must make sure that nobody is using the volume anymore, unmount_disk does this.
+ * @param disk_index The disk index to release locks for.
+ */
+void release_volume_locks(unsigned int disk_index) {
+    struct volume_locks_t *locks = &volume_locks[disk_index];
+    free(locks->inodes);
+    free(locks->dirs);
+    locks->inodes = NULL;
+    locks->dirs = NULL;
+}
+
+
+/**
+ * A function that locks an inode for reading its data.
+ * Multiple readers can hold this at the same time.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode to lock.
+ */
+void lock_inode_read(unsigned int disk_index, unsigned int inode_index) {
+    pthread_rwlock_rdlock(&volume_locks[disk_index].inodes[inode_index]);
+}
+
+
+/**
+ * A function that locks an inode for writing its data or the inode itself.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode to lock.
+ */
+void lock_inode_write(unsigned int disk_index, unsigned int inode_index) {
+    pthread_rwlock_wrlock(&volume_locks[disk_index].inodes[inode_index]);
+}
+
+
+/**
+ * A function that unlocks an inode locked by either lock_inode_read or lock_inode_write.
+ * @param disk_index The disk index that the inode is located at.
+ * @param inode_index The inode to unlock.
+ */
+void unlock_inode(unsigned int disk_index, unsigned int inode_index) {
+    pthread_rwlock_unlock(&volume_locks[disk_index].inodes[inode_index]);
+}
+
+
+/**
+ * A function that locks children of a directory.
+ * The lock is recursive, so engine functions can lock a directory that the caller already locked.
+ * @param dir The directory to lock.
+ */
+void lock_dir(struct entry_t* dir) {
+    pthread_mutex_lock(&volume_locks[dir->disk_index].dirs[dir->inode_index]);
+}
+
+
+/**
+ * A function that unlocks children of a directory.
+ * @param dir The directory to unlock.
+ */
+void unlock_dir(struct entry_t* dir) {
+    pthread_mutex_unlock(&volume_locks[dir->disk_index].dirs[dir->inode_index]);
+}
+
+
+/**
+ * A function that locks two directories, for moving entries between them.
+ * When one of them is the parent of another, the parent is locked first just like path traversal does.
+ * @param a The first directory to lock.
+ * @param b The second directory to lock.
+ */
+void lock_dir_pair(struct entry_t* a, struct entry_t* b) {
+    for (struct entry_t *cur = a->parent ; cur != NULL ; cur = cur->parent) {
+        if (cur == b) { // b is the parent of a.
+            lock_dir(b);
+            lock_dir(a);
+            return;
+        }
+    }
+    lock_dir(a);
+    lock_dir(b);
+}
+
+
+/**
+ * A function that unlocks two directories locked by lock_dir_pair.
+ * @param a The first directory to unlock.
+ * @param b The second directory to unlock.
+ */
+void unlock_dir_pair(struct entry_t* a, struct entry_t* b) {
+    unlock_dir(a);
+    unlock_dir(b);
+}
+
+
+/**
+ * A function that locks block and inode allocator of a volume.
+ * @param disk_index The disk index to lock.
+ */
+void lock_alloc(unsigned int disk_index) {
+    pthread_mutex_lock(&volume_locks[disk_index].alloc);
+}
+
+
+/**
+ * A function that unlocks block and inode allocator of a volume.
+ * @param disk_index The disk index to unlock.
+ */
+void unlock_alloc(unsigned int disk_index) {
+    pthread_mutex_unlock(&volume_locks[disk_index].alloc);
+}
+
+
+/**
+ * A function that locks CoW relations of a volume.
+ * This is held while inodes are copied, shared or released, so that no new copy appears in the middle.
+ * @param disk_index The disk index to lock.
+ */
+void lock_cow(unsigned int disk_index) {
+    pthread_mutex_lock(&volume_locks[disk_index].cow);
+}
+
+
+/**
+ * A function that unlocks CoW relations of a volume.
+ * @param disk_index The disk index to unlock.
+ */
+void unlock_cow(unsigned int disk_index) {
+    pthread_mutex_unlock(&volume_locks[disk_index].cow);
+}
+
+
+/**
+ * A function that marks that the caller started using entries of the engine.
+ * Entries that were deleted or unloaded are not freed while any caller is in the engine.
+ */
+void enter_engine(void) {
+    pthread_rwlock_rdlock(&tree_lock);
+}
+
+
+/**
+ * A function that marks that the caller stopped using entries of the engine.
+ * If nobody else is in the engine, this is a quiescent point: retired entries are freed and the cache is shrunk.
+ * Callers must not keep entries after this.
+ * @param pinned The entry to keep loaded, see dentry_cache_shrink.
+ */
+void leave_engine(struct entry_t* pinned) {
+    pthread_rwlock_unlock(&tree_lock);
+    if (pthread_rwlock_trywrlock(&tree_lock) == 0) { // Nobody is in the engine, reclaim now.
+        dentry_cache_shrink(pinned);
+        pthread_rwlock_unlock(&tree_lock);
+    }
+}
@@ -0,0 +1,55 @@
+//
+// @file : locks.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines locks of MyFS engine for concurrent callers.
+//          Locks must always be taken in this order to avoid dead locks:
+//          journal handle -> cow -> directories (parent before child) -> inodes -> alloc.
+//          The lock of the write ring (ioring.h) is taken last, it never takes other locks.
+//          The lock of the path cache (disktree.h) is never held while taking other locks.
+//
+
+#ifndef MYFS_LOCKS_H
+#define MYFS_LOCKS_H
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+#include "disktree.h"
+
+
+/**
+ * A struct that implements all locks of a single volume.
+ */
+struct volume_locks_t {
+    pthread_rwlock_t *inodes;                 // Data and inode of each file.
+    pthread_mutex_t *dirs;                    // Children of each directory, recursive.
+    pthread_mutex_t alloc;                    // Bitmaps and free counts in the super block.
+    pthread_mutex_t cow;                      // Indirections between inodes (CoW copies) and the CoW map, recursive.
+};
+
+int init_volume_locks(unsigned int);
+void release_volume_locks(unsigned int);
+
+// For file data.
+void lock_inode_read(unsigned int, unsigned int);
+void lock_inode_write(unsigned int, unsigned int);
+void unlock_inode(unsigned int, unsigned int);
+
+// For directory tree.
+void lock_dir(struct entry_t*);
+void unlock_dir(struct entry_t*);
+void lock_dir_pair(struct entry_t*, struct entry_t*);
+void unlock_dir_pair(struct entry_t*, struct entry_t*);
+
+// For allocator and CoW.
+void lock_alloc(unsigned int);
+void unlock_alloc(unsigned int);
+void lock_cow(unsigned int);
+void unlock_cow(unsigned int);
+
+// For reclaiming entries.
+void enter_engine(void);
+void leave_engine(struct entry_t*);
+
+#endif //MYFS_LOCKS_H
@@ -9,32 +9,39 @@
 #include "common.h"
 #include "ui.h"
 
-char disks[MAX_STRING_LEN][MAX_IMG_COUNT];
-struct partition partitions[MAX_IMG_COUNT];
-struct entry_t* entries[MAX_IMG_COUNT];
-unsigned char block_stats[MAX_BLOCK_COUNT][MAX_IMG_COUNT] = {0};
-unsigned char inode_stats[MAX_INODE_COUNT][MAX_IMG_COUNT] = {0};
-int disk_count;
-uint16_t loaded_partitions = 0x00;
 
 /**
  * The almighty main function.
- * @return 0 if terminated without any error, -1 if not.
+ * With a script argument, commands are read from the script without prompts (batch mode), - reads from stdin.
+ * @return 0 if terminated without any error, -1 if not. In batch mode, 1 if any command failed.
  */
-int main() {
+int main(int argc, char* argv[]) {
+    FILE* script = NULL;
+    if (argc > 1) {
+        script = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+        if (script == NULL) {
+            printf("[ERROR] Could not open script %s\n", argv[1]);
+            return -1;
+        }
+    }
+
     // Scan disks in directory
     if (scan_disks() == -1) {
         return -1;
     }
-    print_title();
+    if (script == NULL) print_title();
 
-    // Load super block, inode table, data blocks and root directory from partition.
+    // Load super block, inode table, data blocks and root directory from all partitions in parallel.
     // Also scan blocks and scan inodes.
-    if (load_super_block(0) || load_inode_table(0) || load_data_blocks(0)
-        || load_root(0) || scan_disk_blocks(0) || scan_disk_inodes(0)) {
+    if (mount_disks() == -1) {
         return -1; // Something went wrong.
     }
 
+    if (script != NULL) { // Batch mode, no prompts.
+        int failed = batch_loop(script);
+        if (script != stdin) fclose(script);
+        return (unmount_all() == -1 || failed > 0) ? 1 : 0;
+    }
     main_loop();
     return 0;
 }
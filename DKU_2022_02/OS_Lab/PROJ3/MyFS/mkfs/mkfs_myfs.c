@@ -0,0 +1,223 @@
+//
+// @file : mkfs_myfs.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements mkfs.myfs, which makes an empty v2 (MYFS_FEATURE_GEOMETRY) image.
+//          The image is made sparse, only the super block, the root inode, bitmaps and the root directory are written.
+//          The journal is reserved at the first mount, just like images in the original format.
+//
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs.h"
+
+
+#define MKFS_DEFAULT_BLOCK_SIZE 0x400
+#define MKFS_DEFAULT_INODES 224
+#define MKFS_DEFAULT_SIZE (4ULL * 1024 * 1024)
+#define MKFS_DEFAULT_LABEL "myfs"
+#define MKFS_MIN_INODES 16
+#define MKFS_MIN_BLOCKS 16
+#define MKFS_ROOT_INODE 2
+
+
+/**
+ * A function that parses a size with an optional K, M or G suffix.
+ * @param str The string to parse.
+ * @param ret The pointer to store the size in bytes into.
+ * @return -1 if the string was not a size, 0 if successful.
+ */
+static int parse_size(const char* str, unsigned long long* ret) {
+    char *end = NULL;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) return -1;
+    switch (*end) {
+        case 'k': case 'K': value = value << 10; end++; break;
+        case 'm': case 'M': value = value << 20; end++; break;
+        case 'g': case 'G': value = value << 30; end++; break;
+        default: break;
+    }
+    if (*end != 0) return -1;
+    *ret = value;
+    return 0;
+}
+
+
+/**
+ * A function that prints usage of mkfs.myfs.
+ * @param prog The name of the program.
+ */
+static void usage(const char* prog) {
+    printf("Usage: %s [-b block_size] [-i inodes] [-s size] [-L label] [-c method] <image>\n", prog);
+    printf("   -b  block size in bytes, a power of 2 from %d to %d (default %d)\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE,
+           MKFS_DEFAULT_BLOCK_SIZE);
+    printf("   -i  count of inodes, up to %d (default %d)\n", MAX_VOLUME_INODES, MKFS_DEFAULT_INODES);
+    printf("   -s  size of the image with K, M or G suffix, less than 4G (default 4M)\n");
+    printf("   -L  volume name, up to 23 characters (default %s)\n", MKFS_DEFAULT_LABEL);
+    printf("   -c  compression of file data, none or lz4 (default none)\n");
+}
+
+
+/**
+ * A function that lays out a v2 super block.
+ * The inode table comes right after the super block, then the inode bitmap, the block bitmap and data blocks.
+ * @param sb The super block to fill.
+ * @param block_size The block size.
+ * @param inodes The count of inodes.
+ * @param size The size of the image in bytes.
+ * @return -1 if the image is too small, 0 if successful.
+ */
+static int layout(struct super_block* sb, unsigned int block_size, unsigned int inodes, unsigned long long size) {
+    unsigned int total_blocks = (unsigned int) (size / block_size);
+    sb->partition_type = SIMPLE_PARTITION;
+    sb->block_size = block_size;
+    sb->inode_size = sizeof(struct inode);
+    sb->first_inode = MKFS_ROOT_INODE;
+    sb->num_inodes = inodes;
+    sb->num_inode_blocks = (inodes * sizeof(struct inode) + block_size - 1) / block_size;
+    sb->inode_table_start = INODE_TABLE_START;
+    sb->inode_bitmap_start = sb->inode_table_start + inodes * sizeof(struct inode);
+    sb->block_bitmap_start = sb->inode_bitmap_start + ((inodes + 63) / 64) * 8; // Bitmaps are arrays of 64 bit words.
+
+    // The block bitmap is sized for every block of the image, a bit more than the data blocks need.
+    unsigned long long meta_end = sb->block_bitmap_start + ((total_blocks + 63ULL) / 64) * 8;
+    sb->first_data_block = (unsigned int) ((meta_end + block_size - 1) / block_size);
+    if (total_blocks < sb->first_data_block + MKFS_MIN_BLOCKS) return -1;
+    sb->num_blocks = total_blocks - sb->first_data_block;
+    sb->num_free_inodes = inodes - (MKFS_ROOT_INODE + 1); // Inode 0 and 1 are reserved.
+    sb->num_free_blocks = sb->num_blocks - 1;             // The root directory.
+    sb->features = MYFS_FEATURE_MAGIC | MYFS_FEATURE_BLOCK_BITMAP | MYFS_FEATURE_INODE_BITMAP | MYFS_FEATURE_GEOMETRY
+                   | MYFS_FEATURE_DIR_ENTRY;
+    return 0;
+}
+
+
+/**
+ * A function that writes an empty file system into an image.
+ * @param path The path of the image.
+ * @param sb The super block made by layout.
+ * @return -1 if failure, 0 if successful.
+ */
+static int write_image(const char* path, struct super_block* sb) {
+    unsigned long long size = ((unsigned long long) sb->first_data_block + sb->num_blocks) * sb->block_size;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, (off_t) size) == -1) {
+        printf("[ERROR] Could not create %s\n", path);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    // The root directory has "." and ".." in block 0, as variable length entries covering the whole block.
+    struct inode root = {0};
+    root.mode = INODE_MODE_DIR_FILE | INODE_MODE_AC_ALL;
+    root.size = sb->block_size;
+    root.indirect_inode = -1;
+    unsigned char dir[0x18] = {0};
+    struct dir_entry *dot = (struct dir_entry*) dir, *dotdot = (struct dir_entry*) (dir + 0x0C);
+    dot->inode = MKFS_ROOT_INODE;
+    dot->name_len = 1;
+    dot->file_type = DENTRY_TYPE_DIR_FILE;
+    dot->dir_length = 0x0C;
+    dir[0x08] = '.';
+    dotdot->inode = MKFS_ROOT_INODE;
+    dotdot->name_len = 2;
+    dotdot->file_type = DENTRY_TYPE_DIR_FILE;
+    dotdot->dir_length = sb->block_size - 0x0C; // The rest of the block is free.
+    dir[0x14] = '.';
+    dir[0x15] = '.';
+    unsigned char inode_bitmap = 0x07; // Inode 0, 1 and the root inode.
+    unsigned char block_bitmap = 0x01; // The root directory.
+
+    off_t data_start = (off_t) sb->first_data_block * sb->block_size;
+    int ret = 0;
+    if (pwrite(fd, sb, sizeof(struct super_block), 0) != sizeof(struct super_block)
+        || pwrite(fd, &root, sizeof(struct inode), sb->inode_table_start + MKFS_ROOT_INODE * sizeof(struct inode))
+           != sizeof(struct inode)
+        || pwrite(fd, &inode_bitmap, 1, sb->inode_bitmap_start) != 1
+        || pwrite(fd, &block_bitmap, 1, sb->block_bitmap_start) != 1
+        || pwrite(fd, dir, sizeof(dir), data_start) != sizeof(dir) || fsync(fd) == -1) {
+        printf("[ERROR] Could not write %s\n", path);
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+
+/**
+ * The main function of mkfs.myfs.
+ * @return 0 if the image was made, 1 if not.
+ */
+int main(int argc, char* argv[]) {
+    unsigned long long block_size = MKFS_DEFAULT_BLOCK_SIZE, inodes = MKFS_DEFAULT_INODES, size = MKFS_DEFAULT_SIZE;
+    const char *label = MKFS_DEFAULT_LABEL;
+    int opt, compression = MYFS_COMPRESS_NONE;
+    while ((opt = getopt(argc, argv, "b:i:s:L:c:h")) != -1) {
+        switch (opt) {
+            case 'b':
+                if (parse_size(optarg, &block_size) == -1) block_size = 0;
+                break;
+            case 'i':
+                if (parse_size(optarg, &inodes) == -1) inodes = 0;
+                break;
+            case 's':
+                if (parse_size(optarg, &size) == -1) size = 0;
+                break;
+            case 'L':
+                label = optarg;
+                break;
+            case 'c':
+                if (!strcmp(optarg, "lz4")) compression = MYFS_COMPRESS_LZ4;
+                else if (!strcmp(optarg, "none")) compression = MYFS_COMPRESS_NONE;
+                else compression = -1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct super_block sb;
+    memset(&sb, 0, sizeof(struct super_block));
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1))) {
+        printf("[ERROR] Block size must be a power of 2 from %d to %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+        return 1;
+    }
+    if (inodes < MKFS_MIN_INODES || inodes > MAX_VOLUME_INODES) {
+        printf("[ERROR] Count of inodes must be from %d to %d\n", MKFS_MIN_INODES, MAX_VOLUME_INODES);
+        return 1;
+    }
+    if (size > MAX_VOLUME_SIZE) { // Offsets in the journal are 32 bit.
+        printf("[ERROR] Size must be less than 4G\n");
+        return 1;
+    }
+    if (strlen(label) >= sizeof(sb.volume_name)) {
+        printf("[ERROR] Volume name must be up to %zu characters\n", sizeof(sb.volume_name) - 1);
+        return 1;
+    }
+    if (compression == -1) {
+        printf("[ERROR] Compression must be none or lz4\n");
+        return 1;
+    }
+    if (layout(&sb, (unsigned int) block_size, (unsigned int) inodes, size) == -1) {
+        printf("[ERROR] Size %llu is too small for %llu inodes and %llu byte blocks\n", size, inodes, block_size);
+        return 1;
+    }
+    sb.features = sb.features | MYFS_FEATURE_COMPRESSION;
+    sb.compression = (unsigned int) compression;
+    strcpy(sb.volume_name, label);
+    if (write_image(argv[optind], &sb) == -1) return 1;
+
+    printf("%s: %s, %u blocks of %u bytes (data from block %u), %u inodes\n", argv[optind], sb.volume_name,
+           sb.num_blocks, sb.block_size, sb.first_data_block, sb.num_inodes);
+    return 0;
+}
@@ -0,0 +1,442 @@
+//
+// @file : snapshot.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements volume snapshots of MyFS.
+//          Taking a snapshot copies the inode table (up to 7 blocks) and marks every block in use as kept, nothing
+//          else is copied. Kept blocks are tracked in snapshot_blocks, rebuilt from the frozen inode tables at mount.
+//
+
+#include <time.h>
+#include <fcntl.h>
+
+#include "diskutil.h"
+
+extern struct partition partitions[MAX_IMG_COUNT];
+extern struct bitmap_t block_bitmaps[MAX_IMG_COUNT];
+extern struct bitmap_t snapshot_blocks[MAX_IMG_COUNT];
+
+
+/**
+ * A function that checks if a block is kept by any snapshot.
+ * @param disk_index The disk index that the block is located at.
+ * @param block The block index.
+ * @return 1 if the block is kept by a snapshot, 0 if not.
+ */
+int is_snapshot_block(unsigned int disk_index, unsigned int block) {
+    struct bitmap_t *bm = &snapshot_blocks[disk_index];
+    return bm->words != NULL && block < bm->bit_count && bitmap_test(bm, block);
+}
+
+
+/**
+ * A function that returns the count of blocks that a frozen inode table of a disk takes.
+ * @param disk_index The disk index to look for.
+ * @return The count of blocks, this is 7 for the original format.
+ */
+static unsigned int snapshot_table_blocks(unsigned int disk_index) {
+    struct super_block *sb = &partitions[disk_index].s;
+    return (sb->num_inodes * sizeof(struct inode) + sb->block_size - 1) / sb->block_size;
+}
+
+
+/**
+ * A function that marks every block used by an inode table, including indirect blocks.
+ * CoW copies are skipped since their blocks belong to the original inode.
+ * @param disk_index The disk index that the inode table is for.
+ * @param table The inode table, s.num_inodes inodes.
+ * @param bm The bitmap to mark blocks into.
+ * @return -1 if failure, 0 if successful.
+ */
+static int mark_table_blocks(unsigned int disk_index, struct inode* table, struct bitmap_t* bm) {
+    struct super_block *sb = &partitions[disk_index].s;
+    unsigned int *blocks = malloc(sizeof(unsigned int) * sb->num_blocks);
+    if (!blocks) return -1;
+    for (unsigned int i = 0 ; i < sb->num_inodes ; i++) {
+        struct inode *in = &table[i];
+        if ((in->mode & (INODE_MODE_REG_FILE | INODE_MODE_DIR_FILE)) == 0 || in->indirect_inode != -1) continue;
+        int count = read_block_map(disk_index, in, blocks, sb->num_blocks);
+        count += read_indirect_blocks(disk_index, in, blocks + count, sb->num_blocks - count);
+        for (int j = 0 ; j < count ; j++)
+            if (blocks[j] < sb->num_blocks) bitmap_set(bm, blocks[j]);
+    }
+    free(blocks);
+    return 0;
+}
+
+
+/**
+ * A function that loads the frozen inode table of a snapshot.
+ * @param disk_index The disk index that the snapshot is located at.
+ * @param snap The snapshot.
+ * @param table The array to store s.num_inodes inodes into.
+ */
+static void load_snapshot_table(unsigned int disk_index, struct snapshot_t* snap, struct inode* table) {
+    unsigned int size = partitions[disk_index].s.num_inodes * sizeof(struct inode);
+    unsigned int block_size = get_block_size(disk_index);
+    for (unsigned int i = 0 ; i < snapshot_table_blocks(disk_index) ; i++) {
+        unsigned int len = size - i * block_size < block_size ? size - i * block_size : block_size;
+        memcpy((unsigned char*) table + i * block_size, get_block(disk_index, snap->table[i]), len);
+    }
+}
+
+
+/**
+ * A function that builds the set of blocks kept by all snapshots of a disk.
+ * @param disk_index The disk index to look for.
+ * @param bm The bitmap to initialize and mark blocks into.
+ * @return -1 if failure, 0 if successful.
+ */
+static int build_snapshot_blocks(unsigned int disk_index, struct bitmap_t* bm) {
+    struct super_block *sb = &partitions[disk_index].s;
+    if (bitmap_init(bm, sb->num_blocks) == -1) return -1;
+    if (!check_feature(disk_index, MYFS_FEATURE_SNAPSHOT)) return 0;
+
+    struct inode *table = malloc(sizeof(struct inode) * sb->num_inodes);
+    if (!table) return -1;
+    for (unsigned int i = 0 ; i < MAX_SNAPSHOT_COUNT ; i++) {
+        struct snapshot_t *snap = &sb->snapshots[i];
+        if (snap->name[0] == 0) continue;
+        for (unsigned int j = 0 ; j < snapshot_table_blocks(disk_index) ; j++) bitmap_set(bm, snap->table[j]);
+        load_snapshot_table(disk_index, snap, table);
+        mark_table_blocks(disk_index, table, bm);
+    }
+    free(table);
+    return 0;
+}
+
+
+/**
+ * A function that finds a snapshot with its name.
+ * @param disk_index The disk index to look for.
+ * @param name The name of the snapshot.
+ * @return The snapshot, NULL if there was no such snapshot.
+ */
+static struct snapshot_t* find_snapshot(unsigned int disk_index, char* name) {
+    struct super_block *sb = &partitions[disk_index].s;
+    if (!check_feature(disk_index, MYFS_FEATURE_SNAPSHOT)) return NULL;
+    for (unsigned int i = 0 ; i < MAX_SNAPSHOT_COUNT ; i++)
+        if (sb->snapshots[i].name[0] != 0 && strncmp(sb->snapshots[i].name, name, sizeof(sb->snapshots[i].name)) == 0)
+            return &sb->snapshots[i];
+    return NULL;
+}
+
+
+/**
+ * A function that loads blocks kept by snapshots of a disk.
+ * Kept blocks are marked as being used in the block bitmap as well, so that they are never handed out.
+ * @param disk_index The disk index to look for.
+ * @return -1 if failure, 0 if successful.
+ */
+int scan_snapshots(unsigned int disk_index) {
+    struct bitmap_t *bm = &snapshot_blocks[disk_index];
+    struct bitmap_t *used = &block_bitmaps[disk_index];
+    if (build_snapshot_blocks(disk_index, bm) == -1) return -1;
+
+    unsigned int fixed = 0;
+    for (unsigned int i = 0 ; i < bm->bit_count ; i++) {
+        if (bitmap_test(bm, i) && !bitmap_test(used, i)) {
+            bitmap_set(used, i);
+            fixed++;
+        }
+    }
+    if (fixed != 0) {
+        printf("[WARNING] %d blocks kept by snapshots were marked free, marking them as used\n", fixed);
+        partitions[disk_index].s.num_free_blocks = partitions[disk_index].s.num_free_blocks - fixed;
+        write_super_block(disk_index);
+    }
+    return 0;
+}
+
+
+/**
+ * A function that creates a snapshot of a disk.
+ * The inode table is copied into up to 7 blocks, then every block that the volume is using is kept.
+ * No other operation runs while this is running, so the snapshot is a single point in time.
+ * @param disk_index The disk index to take snapshot of.
+ * @param name The name of the snapshot, up to 15 characters.
+ * @return -1 if failure, 0 if successful.
+ */
+int snapshot_create(unsigned int disk_index, char* name) {
+    struct partition *cur_p = &partitions[disk_index];
+    unsigned int table_blocks = snapshot_table_blocks(disk_index);
+    if (strlen(name) == 0 || strlen(name) >= sizeof(cur_p->s.snapshots[0].name)) {
+        printf("[ERROR] Snapshot name must be 1 to 15 characters\n");
+        return -1;
+    }
+    if (table_blocks > SNAPSHOT_TABLE_BLOCKS) { // The record has room for 7 blocks.
+        printf("[ERROR] Snapshots need the inode table to fit in %d blocks\n", SNAPSHOT_TABLE_BLOCKS);
+        return -1;
+    }
+
+    flush_delayed_writes(disk_index); // Appends so far belong to the snapshot.
+    journal_begin_exclusive(disk_index); // Nothing may change while the inode table is being frozen.
+    struct snapshot_t *snap = NULL;
+    for (unsigned int i = 0 ; i < MAX_SNAPSHOT_COUNT && snap == NULL ; i++)
+        if (!check_feature(disk_index, MYFS_FEATURE_SNAPSHOT) || cur_p->s.snapshots[i].name[0] == 0)
+            snap = &cur_p->s.snapshots[i];
+    if (find_snapshot(disk_index, name) != NULL || snap == NULL) {
+        printf("[ERROR] Snapshot %s already exists or there are already %d snapshots\n", name, MAX_SNAPSHOT_COUNT);
+        journal_end(disk_index);
+        return -1;
+    }
+    if (!check_feature(disk_index, MYFS_FEATURE_SNAPSHOT)) // Records are garbage until the feature is set.
+        memset(cur_p->s.snapshots, 0, sizeof(cur_p->s.snapshots));
+
+    // Store the inode table, the data is written before the super block refers to it.
+    unsigned int table[SNAPSHOT_TABLE_BLOCKS] = {0};
+    if (assign_empty_blocks(disk_index, table_blocks, table) == -1 || table[table_blocks - 1] > 0xFFFF) {
+        printf("[ERROR] Could not assign blocks for snapshot %s\n", name);
+        if (table[0] != 0) release_blocks(disk_index, table_blocks, table);
+        journal_end(disk_index);
+        return -1;
+    }
+    store_block_runs(disk_index, table, table_blocks, (unsigned char*) cur_p->inode_table,
+                     cur_p->s.num_inodes * sizeof(struct inode));
+
+    // Keep every block that the volume is using right now, including the table itself.
+    lock_alloc(disk_index);
+    for (unsigned int i = 0 ; i < table_blocks ; i++) bitmap_set(&snapshot_blocks[disk_index], table[i]);
+    int ret = mark_table_blocks(disk_index, cur_p->inode_table, &snapshot_blocks[disk_index]);
+    unlock_alloc(disk_index);
+
+    memset(snap, 0, sizeof(struct snapshot_t));
+    strcpy(snap->name, name);
+    snap->date = (unsigned int) time(NULL);
+    for (unsigned int i = 0 ; i < table_blocks ; i++) snap->table[i] = (unsigned short) table[i];
+    set_feature(disk_index, MYFS_FEATURE_SNAPSHOT);
+    if (write_super_block(disk_index) == -1) ret = -1;
+    journal_end(disk_index);
+    return ret;
+}
+
+
+/**
+ * A function that deletes a snapshot of a disk.
+ * Blocks that were kept only by this snapshot and are not used by the volume anymore are released.
+ * @param disk_index The disk index that the snapshot is located at.
+ * @param name The name of the snapshot.
+ * @return -1 if failure, 0 if successful.
+ */
+int snapshot_delete(unsigned int disk_index, char* name) {
+    struct partition *cur_p = &partitions[disk_index];
+    journal_begin_exclusive(disk_index);
+    struct snapshot_t *snap = find_snapshot(disk_index, name);
+    if (snap == NULL) {
+        printf("[ERROR] Could not find snapshot %s\n", name);
+        journal_end(disk_index);
+        return -1;
+    }
+    memset(snap, 0, sizeof(struct snapshot_t));
+
+    // Rebuild kept blocks from the remaining snapshots, then find blocks that nobody uses.
+    struct bitmap_t kept = {0}, live = {0};
+    unsigned int *released = malloc(sizeof(unsigned int) * cur_p->s.num_blocks);
+    if (!released || build_snapshot_blocks(disk_index, &kept) == -1 || bitmap_init(&live, cur_p->s.num_blocks) == -1
+        || mark_table_blocks(disk_index, cur_p->inode_table, &live) == -1) {
+        free(released);
+        bitmap_release(&kept);
+        bitmap_release(&live);
+        journal_end(disk_index);
+        return -1;
+    }
+    if (check_feature(disk_index, MYFS_FEATURE_JOURNAL)) // Journal blocks belong to no inode.
+        for (unsigned int i = 0 ; i < cur_p->s.journal_blocks ; i++) bitmap_set(&live, cur_p->s.journal_start + i);
+
+    unsigned int count = 0;
+    for (unsigned int i = 0 ; i < cur_p->s.num_blocks ; i++)
+        if (is_snapshot_block(disk_index, i) && !bitmap_test(&kept, i) && !bitmap_test(&live, i)) released[count++] = i;
+
+    // Swap kept blocks first, release_blocks does not release blocks kept by snapshots.
+    lock_alloc(disk_index);
+    struct bitmap_t old = snapshot_blocks[disk_index];
+    snapshot_blocks[disk_index] = kept;
+    unlock_alloc(disk_index);
+    bitmap_release(&old);
+    bitmap_release(&live);
+    release_blocks(disk_index, count, released); // This writes the super block as well.
+    free(released);
+    journal_end(disk_index);
+    return 0;
+}
+
+
+/**
+ * A function that prints out snapshots of a disk.
+ * @param disk_index The disk index to look for.
+ * @return 0.
+ */
+int snapshot_list(unsigned int disk_index) {
+    struct super_block *sb = &partitions[disk_index].s;
+    struct bitmap_t *bm = &snapshot_blocks[disk_index];
+    unsigned int count = 0;
+    for (unsigned int i = 0 ; i < MAX_SNAPSHOT_COUNT && check_feature(disk_index, MYFS_FEATURE_SNAPSHOT) ; i++) {
+        struct snapshot_t *snap = &sb->snapshots[i];
+        if (snap->name[0] == 0) continue;
+        char date[32] = {0};
+        time_t created = snap->date;
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&created));
+        printf("   %-15s Created: %s\n", snap->name, date);
+        count++;
+    }
+    printf("   %d snapshot(s), %d blocks kept\n", count, bm->words == NULL ? 0 : bm->bit_count - bm->free_count);
+    return 0;
+}
+
+
+/**
+ * A function that writes a bitmap into a standalone image.
+ * The original format keeps bitmaps in the super block, v2 keeps them in their own place.
+ * @param fd The image to write into.
+ * @param bm The bitmap to write.
+ * @param dst The bitmap in the super block, for the original format.
+ * @param dst_size The size of the bitmap in the super block.
+ * @param start The offset of the bitmap for v2, 0 for the original format.
+ * @return -1 if failure, 0 if successful.
+ */
+static int export_bitmap(int fd, struct bitmap_t* bm, unsigned char* dst, unsigned int dst_size, unsigned int start) {
+    if (start == 0) {
+        bitmap_store(bm, dst, dst_size);
+        return 0;
+    }
+    unsigned int size = (bm->bit_count + 7) / 8;
+    unsigned char *buffer = malloc(size);
+    if (!buffer) return -1;
+    bitmap_store(bm, buffer, size);
+    int ret = pwrite(fd, buffer, size, start) == (ssize_t) size ? 0 : -1;
+    free(buffer);
+    return ret;
+}
+
+
+/**
+ * A function that writes a snapshot as a standalone image, which can be mounted just like any other image.
+ * The image has the same geometry as the disk. Only blocks of the snapshot are written, others are left as holes.
+ * @param disk_index The disk index that the snapshot is located at.
+ * @param name The name of the snapshot.
+ * @param path The path of the image to write.
+ * @return -1 if failure, 0 if successful.
+ */
+int snapshot_export(unsigned int disk_index, char* name, char* path) {
+    struct partition *cur_p = &partitions[disk_index];
+    unsigned int block_size = cur_p->s.block_size;
+    journal_begin_exclusive(disk_index); // The snapshot must not be deleted while this is running.
+    struct snapshot_t *snap = find_snapshot(disk_index, name);
+    struct inode *table = malloc(sizeof(struct inode) * cur_p->s.num_inodes);
+    struct bitmap_t blocks = {0}, inodes = {0};
+    int fd = -1;
+    if (snap == NULL || !table || bitmap_init(&blocks, cur_p->s.num_blocks) == -1
+        || bitmap_init(&inodes, cur_p->s.num_inodes) == -1 || (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1
+        || ftruncate(fd, (off_t) cur_p->image_size) == -1) {
+        printf("[ERROR] Could not export snapshot %s\n", name);
+        if (fd != -1) close(fd);
+        free(table);
+        bitmap_release(&blocks);
+        bitmap_release(&inodes);
+        journal_end(disk_index);
+        return -1;
+    }
+
+    // Copy the frozen inode table and its blocks, contiguous blocks are written at once.
+    int ret = 0;
+    load_snapshot_table(disk_index, snap, table);
+    mark_table_blocks(disk_index, table, &blocks);
+    for (unsigned int i = 0 ; i < blocks.bit_count ;) {
+        unsigned int end = i;
+        if (!bitmap_test(&blocks, i)) {
+            i++;
+            continue;
+        }
+        while (end + 1 < blocks.bit_count && bitmap_test(&blocks, end + 1)) end++;
+        size_t len = (size_t) (end - i + 1) * block_size;
+        if (pwrite(fd, get_block(disk_index, i), len, block_offset(disk_index, i)) != (ssize_t) len) ret = -1;
+        i = end + 1;
+    }
+    for (unsigned int i = 0 ; i < cur_p->s.num_inodes ; i++)
+        if (i < 3 || (table[i].mode & (INODE_MODE_REG_FILE | INODE_MODE_DIR_FILE)) != 0)
+            bitmap_set(&inodes, i);
+    journal_end(disk_index);
+
+    // The image has no journal and no snapshots, only bitmaps. Directory files and compression are kept.
+    struct super_block sb = cur_p->s;
+    unsigned char is_v2 = check_feature(disk_index, MYFS_FEATURE_GEOMETRY);
+    sb.features = MYFS_FEATURE_MAGIC | MYFS_FEATURE_BLOCK_BITMAP | MYFS_FEATURE_INODE_BITMAP;
+    if (is_v2) sb.features = sb.features | MYFS_FEATURE_GEOMETRY;
+    if (check_feature(disk_index, MYFS_FEATURE_DIR_ENTRY)) sb.features = sb.features | MYFS_FEATURE_DIR_ENTRY;
+    if (check_feature(disk_index, MYFS_FEATURE_COMPRESSION)) sb.features = sb.features | MYFS_FEATURE_COMPRESSION;
+    if (export_bitmap(fd, &blocks, sb.block_bitmap, sizeof(sb.block_bitmap), is_v2 ? sb.block_bitmap_start : 0) == -1
+        || export_bitmap(fd, &inodes, sb.inode_bitmap, sizeof(sb.inode_bitmap), is_v2 ? sb.inode_bitmap_start : 0) == -1)
+        ret = -1;
+    sb.num_free_blocks = blocks.free_count;
+    sb.num_free_inodes = inodes.free_count;
+    sb.journal_start = 0;
+    sb.journal_blocks = 0;
+    memset(sb.snapshots, 0, sizeof(sb.snapshots));
+    bitmap_release(&blocks);
+    bitmap_release(&inodes);
+
+    unsigned int table_size = cur_p->s.num_inodes * sizeof(struct inode);
+    if (pwrite(fd, &sb, sizeof(struct super_block), 0) != sizeof(struct super_block)
+        || pwrite(fd, table, table_size, inode_table_offset(disk_index)) != (ssize_t) table_size) ret = -1;
+    if (ret == -1) printf("[ERROR] Could not write %s\n", path);
+    close(fd);
+    free(table);
+    return ret;
+}
+
+
+/**
+ * A function that replaces blocks kept by snapshots in a block list with new blocks.
+ * This is for writes that overwrite whole blocks, so data is not copied.
+ * @param disk_index The disk index that the blocks are located at.
+ * @param blocks The block list, kept blocks are replaced in place.
+ * @param count The count of blocks in the list.
+ * @param fresh The array to store new blocks into, this must hold count blocks. These can be released on failure.
+ * @return -1 if failure, the count of replaced blocks if successful.
+ */
+int unshare_blocks(unsigned int disk_index, unsigned int* blocks, unsigned int count, unsigned int* fresh) {
+    unsigned int kept = 0;
+    for (unsigned int i = 0 ; i < count ; i++)
+        if (is_snapshot_block(disk_index, blocks[i])) kept++;
+    if (kept == 0) return 0;
+    if (assign_empty_blocks(disk_index, kept, fresh) == -1) return -1;
+
+    unsigned int n = 0;
+    for (unsigned int i = 0 ; i < count ; i++)
+        if (is_snapshot_block(disk_index, blocks[i])) blocks[i] = fresh[n++];
+    return (int) kept;
+}
+
+
+/**
+ * A function that gives a file its own copy of a single block that is kept by a snapshot.
+ * The data of the block is copied into a new block, then the block map and the inode are written.
+ * @param disk_index The disk index that the file is located at.
+ * @param inode_index The inode of the file.
+ * @param file_block The index of the block in the file.
+ * @param ret The pointer to store the new block into.
+ * @return -1 if failure, 0 if successful.
+ */
+int unshare_file_block(unsigned int disk_index, unsigned int inode_index, unsigned int file_block, unsigned int* ret) {
+    struct partition *cur_p = &partitions[disk_index];
+    struct inode *in = &cur_p->inode_table[inode_index];
+    unsigned int count = size_to_blocks(disk_index, in->size);
+    unsigned int *blocks = malloc(sizeof(unsigned int) * count);
+    unsigned int fresh = 0;
+    if (!blocks) return -1;
+    count = read_block_map(disk_index, in, blocks, count);
+    if (file_block >= count || assign_empty_blocks(disk_index, 1, &fresh) == -1) {
+        free(blocks);
+        return -1;
+    }
+
+    memcpy(get_block(disk_index, fresh), get_block(disk_index, blocks[file_block]), get_block_size(disk_index));
+    blocks[file_block] = fresh;
+    if (write_block_map(disk_index, in, blocks, count) == -1) {
+        release_blocks(disk_index, 1, &fresh);
+        free(blocks);
+        return -1;
+    }
+    free(blocks);
+    *ret = fresh;
+    return write_inode(disk_index, inode_index, in);
+}
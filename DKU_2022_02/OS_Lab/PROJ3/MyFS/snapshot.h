@@ -0,0 +1,29 @@
+//
+// @file : snapshot.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines volume snapshots of MyFS.
+//          A snapshot is a frozen copy of the inode table, sharing every block with the volume.
+//          Blocks kept by snapshots are never overwritten or released, writes that would change them get new blocks.
+//
+
+#ifndef MYFS_SNAPSHOT_H
+#define MYFS_SNAPSHOT_H
+#pragma once
+
+#include "common.h"
+
+// For mounting.
+int scan_snapshots(unsigned int);
+
+// For snapshot commands.
+int snapshot_create(unsigned int, char*);
+int snapshot_delete(unsigned int, char*);
+int snapshot_list(unsigned int);
+int snapshot_export(unsigned int, char*, char*);
+
+// For writes, so that the volume diverges from snapshots one block at a time.
+int is_snapshot_block(unsigned int, unsigned int);
+int unshare_blocks(unsigned int, unsigned int*, unsigned int, unsigned int*);
+int unshare_file_block(unsigned int, unsigned int, unsigned int, unsigned int*);
+
+#endif //MYFS_SNAPSHOT_H
@@ -0,0 +1,119 @@
+//
+// @file : delalloc_test.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements a test of delayed appends surviving an unmount.
+//          A file is written with write_file_range so that its end is kept in memory, the image is unmounted without
+//          a sync, then mounted again and the file must have all of its data.
+//          Usage: myfs-delalloc-test <mkfs.myfs> <image>, the image is made by mkfs.myfs and overwritten.
+//
+
+#include <limits.h>
+
+#include "diskutil.h"
+
+
+#define TEST_FILE "delalloc"
+#define TEST_CHUNK 100   // Bytes of each write, small enough to be kept by delay_append.
+#define TEST_CHUNKS 20
+
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern int disk_count;
+extern struct entry_t* entries[MAX_IMG_COUNT];
+extern struct delalloc_t delallocs[MAX_IMG_COUNT];
+
+
+/**
+ * A function that fills the expected data of the test file.
+ * @param data The buffer to fill, TEST_CHUNK * TEST_CHUNKS bytes.
+ */
+static void fill_expected(unsigned char* data) {
+    for (unsigned int i = 0 ; i < TEST_CHUNK * TEST_CHUNKS ; i++) data[i] = (unsigned char) ('a' + (i * 7) % 26);
+}
+
+
+/**
+ * A function that writes the test file into the root directory of volume 0, a chunk at a time at its end.
+ * @param expected The data to write.
+ * @return -1 if failure, 0 if successful.
+ */
+static int write_test_file(unsigned char* expected) {
+    struct entry_t *file = NULL;
+    if (create_file(0, entries[0], TEST_FILE, 0) == -1 || find_child(entries[0], &file, TEST_FILE) == -1) {
+        printf("[FAIL] Could not create %s\n", TEST_FILE);
+        return -1;
+    }
+    for (unsigned int i = 0 ; i < TEST_CHUNKS ; i++) {
+        if (write_file_range(file, i * TEST_CHUNK, TEST_CHUNK, expected + i * TEST_CHUNK) == -1) {
+            printf("[FAIL] Could not write chunk %u\n", i);
+            return -1;
+        }
+    }
+    if (delalloc_pending(&delallocs[0], file->inode_index) == 0) {
+        printf("[FAIL] Nothing was kept by delayed allocation, the test does not test anything\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * A function that checks if the test file in volume 0 has the expected data.
+ * @param expected The expected data.
+ * @return -1 if failure, 0 if successful.
+ */
+static int check_test_file(unsigned char* expected) {
+    struct entry_t *file = NULL;
+    unsigned char *data = NULL;
+    if (find_child(entries[0], &file, TEST_FILE) == -1 || read_file_data(file, &data) == -1) {
+        printf("[FAIL] Could not read %s after remount\n", TEST_FILE);
+        return -1;
+    }
+    unsigned int size = get_file_size(file);
+    int ret = size == TEST_CHUNK * TEST_CHUNKS && !memcmp(data, expected, size) ? 0 : -1;
+    if (ret == -1) printf("[FAIL] %s has %u bytes after remount, expected %d\n", TEST_FILE, size, TEST_CHUNK * TEST_CHUNKS);
+    free(data);
+    return ret;
+}
+
+
+/**
+ * The main function of the test.
+ * @return 0 if the test passed, 1 if not.
+ */
+int main(int argc, char* argv[]) {
+    if (argc != 3 || strlen(argv[2]) >= MAX_STRING_LEN) {
+        printf("Usage: %s <mkfs.myfs> <image>\n", argv[0]);
+        return 1;
+    }
+    char command[PATH_MAX * 2 + 32];
+    snprintf(command, sizeof(command), "'%s' '%s' > /dev/null", argv[1], argv[2]);
+    if (system(command) != 0) {
+        printf("[FAIL] Could not make %s\n", argv[2]);
+        return 1;
+    }
+
+    unsigned char expected[TEST_CHUNK * TEST_CHUNKS];
+    fill_expected(expected);
+    strcpy(disks[0], argv[2]);
+    disk_count = 1;
+    if (mount_disk(0) == -1) return 1;
+    if (write_test_file(expected) == -1) return 1;
+
+    // The journal must not be marked as clean while delayed appends are only in memory.
+    if (journal_close(0) != -1) {
+        printf("[FAIL] Journal was closed with delayed appends kept in memory\n");
+        return 1;
+    }
+    if (unmount_disk(0) == -1) { // No sync, unmounting must write the delayed appends.
+        printf("[FAIL] Could not unmount %s\n", argv[2]);
+        return 1;
+    }
+
+    if (mount_disk(0) == -1) return 1;
+    int ret = check_test_file(expected);
+    if (unmount_disk(0) == -1) ret = -1;
+    if (ret == -1) return 1;
+    printf("[PASS] Delayed appends survived unmount and remount\n");
+    return 0;
+}
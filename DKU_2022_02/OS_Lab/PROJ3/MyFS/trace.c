@@ -0,0 +1,177 @@
+//
+// @file : trace.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements tracing of MyFS operations.
+//          Spans are inclusive, a write inside impl_write counts for both impl_write and write_data_block.
+//
+
+#include <time.h>
+
+#include "trace.h"
+
+extern struct trace_stat_t traces[TRACE_OP_COUNT];
+
+static __thread unsigned long long thread_syscalls = 0; // System calls for I/O made by this thread.
+
+static const char* trace_names[TRACE_OP_COUNT] = {
+        "ls", "cat", "chmod", "stat", "touch", "mkdir", "rm", "vstat", "rmdir",
+        "write", "append", "cp", "rename", "mv",
+        "write_inode", "write_data_block", "write_meta_block", "assign_empty_blocks",
+        "place_file_blocks", "assign_empty_inodes"
+};
+
+
+/**
+ * A function that returns the current time of the monotonic clock.
+ * @return The time in nano seconds.
+ */
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+
+/**
+ * A function that returns the histogram bucket of a latency.
+ * @param ns The latency in nano seconds.
+ * @return The bucket, the last bucket also holds everything longer.
+ */
+static unsigned int bucket_of(unsigned long long ns) {
+    unsigned int bucket = 63 - __builtin_clzll(ns | 1);
+    return bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1;
+}
+
+
+/**
+ * A function that starts a span of an operation, use TRACE_OP instead of calling this directly.
+ * @param op The operation.
+ * @return The span.
+ */
+struct trace_span_t trace_begin(enum trace_op op) {
+    struct trace_span_t span = {op, now_ns(), thread_syscalls, 0};
+    return span;
+}
+
+
+/**
+ * A function that ends a span and adds it into the counters of its operation.
+ * @param span The span started by trace_begin.
+ */
+void trace_end(struct trace_span_t* span) {
+    unsigned long long ns = now_ns() - span->start_ns;
+    struct trace_stat_t *t = &traces[span->op];
+    __atomic_fetch_add(&t->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->bytes, span->bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->syscalls, thread_syscalls - span->syscalls, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->hist[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+
+    unsigned long long max = __atomic_load_n(&t->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&t->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+/**
+ * A function that counts a system call for I/O (pwrite, fsync and so on) of the calling thread.
+ * Writes handed to the submitter thread of io_uring are not counted here, vstat shows them as async writes.
+ */
+void trace_syscall(void) {
+    thread_syscalls++;
+}
+
+
+/**
+ * A function that returns the name of an operation.
+ * @param op The operation.
+ * @return The name, the command name for impl_* and the function name for the others.
+ */
+const char* trace_name(enum trace_op op) {
+    return trace_names[op];
+}
+
+
+/**
+ * A function that copies the counters of all operations.
+ * Counters are read one by one while others may update them, so a copy is only consistent when nothing runs.
+ * @param ret The array to store counters to, this MUST have TRACE_OP_COUNT elements.
+ */
+void trace_snapshot(struct trace_stat_t* ret) {
+    for (unsigned int i = 0 ; i < TRACE_OP_COUNT ; i++) {
+        unsigned long long *src = (unsigned long long*) &traces[i], *dst = (unsigned long long*) &ret[i];
+        for (unsigned int j = 0 ; j < sizeof(struct trace_stat_t) / sizeof(unsigned long long) ; j++)
+            dst[j] = __atomic_load_n(&src[j], __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ * A function that estimates a percentile of the latency of an operation from its histogram.
+ * @param stat The counters of the operation.
+ * @param percent The percentile, from 1 to 100.
+ * @return The upper bound of the bucket holding the percentile in nano seconds, capped by the longest latency.
+ *         0 if the operation was never called.
+ */
+unsigned long long trace_percentile(struct trace_stat_t* stat, unsigned int percent) {
+    if (stat->count == 0) return 0;
+    unsigned long long goal = (stat->count * percent + 99) / 100, seen = 0;
+    for (unsigned int i = 0 ; i < TRACE_BUCKETS ; i++) {
+        seen = seen + stat->hist[i];
+        if (seen >= goal) {
+            unsigned long long upper = (2ULL << i) - 1;
+            return upper < stat->max_ns ? upper : stat->max_ns;
+        }
+    }
+    return stat->max_ns;
+}
+
+
+/**
+ * A function that clears the counters of all operations.
+ */
+void trace_reset(void) {
+    for (unsigned int i = 0 ; i < TRACE_OP_COUNT ; i++) {
+        unsigned long long *counter = (unsigned long long*) &traces[i];
+        for (unsigned int j = 0 ; j < sizeof(struct trace_stat_t) / sizeof(unsigned long long) ; j++)
+            __atomic_store_n(&counter[j], 0, __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ * A function that saves the counters of all operations as JSON.
+ * Operations that were never called are omitted. Latencies are in nano seconds, the histogram lists
+ * non-empty buckets as [lower bound, count].
+ * @param path The path of the file to write.
+ * @return -1 if failure, 0 if successful.
+ */
+int trace_save(const char* path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        printf("[ERROR] Could not open %s\n", path);
+        return -1;
+    }
+
+    struct trace_stat_t stats[TRACE_OP_COUNT];
+    trace_snapshot(stats);
+    fprintf(fp, "{\n  \"ops\": [");
+    unsigned char first = 1;
+    for (unsigned int i = 0 ; i < TRACE_OP_COUNT ; i++) {
+        struct trace_stat_t *t = &stats[i];
+        if (t->count == 0) continue;
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"count\": %llu, \"bytes\": %llu, \"syscalls\": %llu, "
+                    "\"total_ns\": %llu, \"max_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"hist\": [",
+                first ? "" : ",", trace_names[i], t->count, t->bytes, t->syscalls, t->total_ns, t->max_ns,
+                trace_percentile(t, 50), trace_percentile(t, 99));
+        unsigned char first_bucket = 1;
+        for (unsigned int j = 0 ; j < TRACE_BUCKETS ; j++) {
+            if (t->hist[j] == 0) continue;
+            fprintf(fp, "%s[%llu, %llu]", first_bucket ? "" : ", ", 1ULL << j, t->hist[j]);
+            first_bucket = 0;
+        }
+        fprintf(fp, "]}");
+        first = 0;
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,72 @@
+//
+// @file : trace.h
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that defines tracing of MyFS operations.
+//          Each traced operation counts its calls, bytes, system calls and latency into a histogram of powers of 2.
+//          A traced function just starts with TRACE_OP, the span ends when the function returns.
+//          Counters are updated with relaxed atomics, so tracing takes no locks and is always on.
+//
+
+#ifndef MYFS_TRACE_H
+#define MYFS_TRACE_H
+#pragma once
+
+#include "common.h"
+
+#define TRACE_BUCKETS 32          // Bucket i holds latencies from 2^i to 2^(i+1) - 1 nano seconds.
+#define TRACE_ENV "MYFS_TRACE"    // The environment variable for the path of the JSON dump at exit.
+
+
+/**
+ * An enum that defines the traced operations.
+ */
+enum trace_op {
+    TRACE_LS, TRACE_CAT, TRACE_CHMOD, TRACE_STAT, TRACE_TOUCH, TRACE_MKDIR, TRACE_RM, TRACE_VSTAT, TRACE_RMDIR,
+    TRACE_WRITE, TRACE_APPEND, TRACE_CP, TRACE_RENAME, TRACE_MOVE,
+    TRACE_WRITE_INODE, TRACE_WRITE_DATA_BLOCK, TRACE_WRITE_META_BLOCK, TRACE_ASSIGN_EMPTY_BLOCKS,
+    TRACE_PLACE_FILE_BLOCKS, TRACE_ASSIGN_EMPTY_INODES,
+    TRACE_OP_COUNT
+};
+
+
+/**
+ * A struct that implements the counters of a single operation.
+ */
+struct trace_stat_t {
+    unsigned long long count;
+    unsigned long long bytes;
+    unsigned long long syscalls;      // System calls for I/O made by the calling thread, see trace_syscall.
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long hist[TRACE_BUCKETS];
+};
+
+
+/**
+ * A struct that implements a single call of an operation in progress.
+ */
+struct trace_span_t {
+    enum trace_op op;
+    unsigned long long start_ns;
+    unsigned long long syscalls;      // System calls of this thread when the span started.
+    unsigned long long bytes;
+};
+
+// Starts a span that ends when the enclosing function returns, at most one per scope.
+#define TRACE_OP(op) struct trace_span_t trace_span __attribute__((cleanup(trace_end))) = trace_begin(op)
+// Sets the bytes of the span started by TRACE_OP.
+#define TRACE_BYTES(n) (trace_span.bytes = (n))
+
+// For traced functions.
+struct trace_span_t trace_begin(enum trace_op);
+void trace_end(struct trace_span_t*);
+void trace_syscall(void);
+
+// For perf command.
+const char* trace_name(enum trace_op);
+void trace_snapshot(struct trace_stat_t*);
+unsigned long long trace_percentile(struct trace_stat_t*, unsigned int);
+void trace_reset(void);
+int trace_save(const char*);
+
+#endif //MYFS_TRACE_H
@@ -7,34 +7,50 @@
 #include "ui.h"
 
 
-extern char disks[MAX_STRING_LEN][MAX_IMG_COUNT];
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
 extern struct partition partitions[MAX_IMG_COUNT];
 extern int disk_count;
 extern struct entry_t* entries[MAX_IMG_COUNT];
 extern uint16_t loaded_partitions;
-extern unsigned char block_stats[MAX_BLOCK_COUNT][MAX_IMG_COUNT];
-extern unsigned char inode_stats[MAX_INODE_COUNT][MAX_IMG_COUNT];
+extern struct bitmap_t block_bitmaps[MAX_IMG_COUNT];
+extern struct bitmap_t inode_bitmaps[MAX_IMG_COUNT];
 
 char cwd[MAX_STRING_LEN];
 
 /**
- * A function that is for SIGINT handling.
- * This function will release entries in the directory tree and prepare exit.
- * @param ignored SIGINT, this will be ignored.
+ * A function that unmounts all loaded partitions.
+ * Pending metadata is committed, then entries in the directory tree are released.
+ * If MYFS_TRACE is set, the counters of traced operations are saved there as JSON afterwards.
+ * @return -1 if any of partitions could not be unmounted, 0 if successful.
  */
-void sig_handler(int ignored) {
-    (void)! ignored;
-    printf("[INFO] Exit handler called.\n");
+int unmount_all(void) {
+    int ret = 0;
     for (int i = 0 ; i < MAX_IMG_COUNT ; i++) {
         if ((loaded_partitions >> i) & 0x1) { // If the partition was loaded
-            int ret = release_entries(entries[i]); // Then release entries from the partition.
-            if (ret == 0) {
+            if (unmount_disk(i) == 0) {
                 printf("[INFO] Unmounted disk %d: %s\n", i, disks[i]);
             } else {
                 printf("[ERROR] Could not unmount disk %d: %s\n", i, disks[i]);
+                ret = -1;
             }
         }
     }
+    char *trace_path = getenv(TRACE_ENV);
+    if (trace_path != NULL && trace_path[0] != 0 && trace_save(trace_path) == 0)
+        printf("[INFO] Saved trace to %s\n", trace_path);
+    return ret;
+}
+
+
+/**
+ * A function that is for SIGINT handling.
+ * This function will release entries in the directory tree and prepare exit.
+ * @param ignored SIGINT, this will be ignored.
+ */
+void sig_handler(int ignored) {
+    (void)! ignored;
+    printf("[INFO] Exit handler called.\n");
+    unmount_all();
     printf("MyFS: Good bye!\n");
     exit(0);
 }
@@ -182,25 +198,41 @@ void print_colored_christmas_tree() {
 
 /**
  * A function that performs 'ls' command.
- * The 'ls' command offers -al, -ald, and plain ls.
+ * The 'ls' command offers -al, -ald, and plain ls, of the current directory or of a directory given as a path.
  * @param full The full command that the user requested
  * @param cur_dir The entry_t* that represents the current directory.
  * @return -1 if failure, 0 if successful.
  */
 int ls(char* args, struct entry_t* cur_dir) {
-    if (args == NULL) { // Just default ls.
-        impl_ls(cur_dir, 1);
-    } else {
-        if (!strcmp(args, "-al")) { // Perform ls -al
-            impl_ls(cur_dir, 2);
-        } else if (!strcmp(args, "-ald")) { // Perform ls -al + inode and disk status
-            impl_ls(cur_dir, 3);
+    (void)! strtok(args, " ");
+    char* option = strtok(NULL, " ");
+    char* path = NULL;
+    unsigned char level = 1; // Just default ls.
+    if (option != NULL && option[0] == '-') {
+        path = strtok(NULL, " ");
+        if (!strcmp(option, "-al")) { // Perform ls -al
+            level = 2;
+        } else if (!strcmp(option, "-ald")) { // Perform ls -al + inode and disk status
+            level = 3;
         } else { // Invalid args for ls.
-            printf("ls: invalid option %s\n", args);
+            printf("ls: invalid option %s\n", option);
             return -1;
         }
+    } else {
+        path = option;
     }
-    return 0;
+
+    struct entry_t* dir = cur_dir;
+    if (path != NULL && find_entry(cur_dir, &dir, path) == -1) {
+        printf("ls: cannot access '%s': No such file or directory\n", path);
+        return -1;
+    }
+    struct inode in = partitions[dir->disk_index].inode_table[dir->inode_index];
+    if ((in.mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) {
+        printf("ls: cannot open '%s': Not a directory\n", path);
+        return -1;
+    }
+    return impl_ls(dir, level);
 }
 
 
@@ -215,7 +247,7 @@ int cat(char* args, struct entry_t* cur_dir) {
         printf("cat: cat <FILE>\n");
         return -1;
     } else {
-        return impl_cat(cur_dir->child, args);
+        return impl_cat(cur_dir, args);
     }
 }
 
@@ -231,7 +263,7 @@ int stat(char* args, struct entry_t* cur_dir) {
         printf("stat: missing operand\n");
         return -1;
     } else {
-        return impl_stat(cur_dir->child, args);
+        return impl_stat(cur_dir, args);
     }
 }
 
@@ -262,7 +294,7 @@ int chmod(char* args, struct entry_t* cur_dir) {
     errno = 0; // Reset errno for checking strtol's error.
     unsigned int real_perm = strtol(permission, NULL, 16);
     if ((errno == 0) && (real_perm <= (0x777))){ // Meaning that the permission was ok.
-        return impl_chmod(cur_dir->child, file_name, real_perm); // Perform chmod internally.
+        return impl_chmod(cur_dir, file_name, real_perm); // Perform chmod internally.
     } else { // Meaning that the permission was invalid.
         printf("chmod: invalid mode: ‘%s’\n", permission);
         return -1;
@@ -311,7 +343,8 @@ int vstat(char* arg) {
     if (arg != NULL && strlen(arg) >= 1) {
         errno = 0; // Reset errno for checking strtol's error.
         unsigned int vol_index = strtol(arg, NULL, 10);
-        if ((errno == 0) && (vol_index < (disk_count))) { // Meaning that the volume was valid.
+        unsigned char is_loaded = vol_index < MAX_IMG_COUNT && ((loaded_partitions >> vol_index) & 0x1);
+        if ((errno == 0) && (vol_index < (unsigned int) disk_count) && is_loaded) { // Meaning that the volume was valid.
             return impl_vstat(vol_index);
         } else { // Meaning that the volume was invalid.
             printf("vstat: invalid volume: ‘%s’\n", arg);
@@ -324,6 +357,24 @@ int vstat(char* arg) {
 }
 
 
+/**
+ * A function that performs 'sync' command.
+ * This writes delayed appends, then commits running journal transactions of all volumes right now.
+ * @return -1 if failure, 0 if successful.
+ */
+int sync_(void) {
+    int ret = 0;
+    for (int i = 0 ; i < disk_count ; i++) {
+        if (!((loaded_partitions >> i) & 0x1)) continue;
+        if (flush_delayed_writes(i) == -1 || journal_flush(i) == -1) {
+            printf("sync: could not commit journal of volume %d\n", i);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+
 /**
  * A function that performs 'rm' command.
  * This is not for removing a directory.
@@ -360,10 +411,29 @@ int rmdir_(char* args, struct entry_t* cur_dir) {
 }
 
 
+/**
+ * A function that sets the prompt message according to the current directory.
+ * Volume 0 is shown as root, other volumes are shown as volN.
+ * @param dir The current directory.
+ */
+void update_cwd(struct entry_t* dir) {
+    if (dir->parent == NULL) { // Root directory of a volume.
+        if (dir->disk_index == 0) strcpy(cwd, "root");
+        else snprintf(cwd, MAX_STRING_LEN, "vol%d", dir->disk_index);
+        return;
+    }
+    update_cwd(dir->parent);
+    strncat(cwd, "/", MAX_STRING_LEN - strlen(cwd) - 1);
+    strncat(cwd, dir->name, MAX_STRING_LEN - strlen(cwd) - 1);
+}
+
+
 /**
  * A function that performs 'cd' command.
  * This will update cur_dir entry in main_loop function.
  * Also this will set the prompt message accordingly.
+ * Paths can have multiple directories. Ex) cd a/b/../c
+ * Absolute paths start from the root of current volume, /volN selects volume N. Ex) cd /vol1/a
  * @param args The file name to perform rmdir.
  * @param cur_dir The current directory.
  * @param ret The pointer address to set return value to.
@@ -376,34 +446,20 @@ int cd(char* args, struct entry_t* cur_dir, struct entry_t** ret) {
         return 0;
     }
 
-    struct entry_t* res = NULL;
-    if (!strcmp(args, "..")) { // ".." directory
-        if (cur_dir->parent == NULL) {
-            strcpy(cwd, "root");
-            return 0;
-        }
-
-        *ret = cur_dir->parent;
-        char* new_dir = strrchr(cwd, '/'); // find last directory and remove it.
-        cwd[new_dir - cwd] = 0;
-        return 0;
-    } else { // Otherwise, just navigate
-        if (find_entry(cur_dir->child, &res, args) == -1) {
-            printf("cd: %s: No such file or directory\n", args);
-            return -1;
-        }
-
-        struct inode in = partitions[res->disk_index].inode_table[res->inode_index];
-        if ((in.mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE) {
-            *ret = res;
-            strcat(cwd, "/");
-            strcat(cwd, args);
-            return 0;
-        } else {
-            printf("cd: %s: Not a directory\n", args);
-            return -1;
-        }
+    struct entry_t* dir = NULL;
+    if (find_entry(cur_dir, &dir, args) == -1) {
+        printf("cd: %s: No such file or directory\n", args);
+        return -1;
     }
+    struct inode in = partitions[dir->disk_index].inode_table[dir->inode_index];
+    if ((in.mode & INODE_MODE_DIR_FILE) != INODE_MODE_DIR_FILE) {
+        printf("cd: %s: Not a directory\n", args);
+        return -1;
+    }
+
+    *ret = dir;
+    update_cwd(dir);
+    return 0;
 }
 
 
@@ -431,11 +487,16 @@ int write_(char* args, struct entry_t* cur_dir) {
         return -1;
     }
 
-    if (data_end == NULL || data_start == NULL) { // Check input.
+    if (data_end == NULL || data_start == NULL || data_end == data_start) { // Check input.
         printf("write: invalid arguments: \" is not closed\n");
         return -1;
     }
 
+    if (data_end - data_start >= MAX_STRING_LEN - 1) { // The data and its new line must fit in input_string.
+        printf("write: invalid arguments: data is too long\n");
+        return -1;
+    }
+
     // Copy input and add new line.
     memcpy(input_string, data_start + 1, data_end - data_start - 1);
     input_string[strlen(input_string)] = '\n';
@@ -467,11 +528,16 @@ int append(char* args, struct entry_t* cur_dir) {
         return -1;
     }
 
-    if (data_end == NULL || data_start == NULL) { // Check input.
+    if (data_end == NULL || data_start == NULL || data_end == data_start) { // Check input.
         printf("append: invalid arguments: \" is not closed\n");
         return -1;
     }
 
+    if (data_end - data_start >= MAX_STRING_LEN - 1) { // The data and its new line must fit in input_string.
+        printf("append: invalid arguments: data is too long\n");
+        return -1;
+    }
+
     // Copy input and add new line.
     memcpy(input_string, data_start + 1, data_end - data_start - 1);
     input_string[strlen(input_string)] = '\n';
@@ -531,7 +597,9 @@ int rename_(char* args, struct entry_t* cur_dir) {
         }
     }
 
-    return impl_rename(cur_dir, before, after);
+    if (impl_rename(cur_dir, before, after) == -1) return -1;
+    update_cwd(cur_dir); // The current directory could have been renamed.
+    return 0;
 }
 
 
@@ -559,7 +627,277 @@ int mv(char* args, struct entry_t* cur_dir) {
         }
     }
 
-    return impl_move(cur_dir, target, dst);
+    if (impl_move(cur_dir, target, dst) == -1) return -1;
+    update_cwd(cur_dir); // The current directory could have been moved along.
+    return 0;
+}
+
+
+/**
+ * A function that performs 'snapshot' command, for the volume of the current directory.
+ * snapshot create <name>, snapshot delete <name>, snapshot list and snapshot export <name> <image>.
+ * @param args The arguments of snapshot.
+ * @param cur_dir The current directory.
+ * @return -1 if failure, 0 if successful.
+ */
+int snapshot(char* args, struct entry_t* cur_dir) {
+    (void)! strtok(args, " ");
+    char* action = strtok(NULL, " ");
+    char* name = strtok(NULL, " ");
+    char* path = strtok(NULL, " ");
+    unsigned int disk_index = cur_dir->disk_index;
+
+    if (action != NULL && !strcmp(action, "list")) return snapshot_list(disk_index);
+    if (action == NULL || name == NULL) {
+        printf("snapshot: usage: snapshot create|delete|export <name> [image], snapshot list\n");
+        return -1;
+    }
+    if (!strcmp(action, "create")) return snapshot_create(disk_index, name);
+    if (!strcmp(action, "delete")) return snapshot_delete(disk_index, name);
+    if (!strcmp(action, "export")) {
+        if (path == NULL) {
+            printf("snapshot: missing image operand after '%s'\n", name);
+            return -1;
+        }
+        return snapshot_export(disk_index, name, path);
+    }
+    printf("snapshot: invalid action: '%s'\n", action);
+    return -1;
+}
+
+
+/**
+ * A function that performs 'defrag' command.
+ * defrag <volume> [blocks] runs a single round, defrag <volume> start [blocks] and defrag <volume> stop
+ * start and stop the background defragmenter. blocks is the budget of a round.
+ * @param args The arguments of defrag.
+ * @return -1 if failure, 0 if successful.
+ */
+int defrag(char* args) {
+    (void)! strtok(args, " ");
+    char* volume = strtok(NULL, " ");
+    char* action = strtok(NULL, " ");
+    char* budget_str = action != NULL && !strcmp(action, "start") ? strtok(NULL, " ") : action;
+    if (volume == NULL) {
+        printf("defrag: usage: defrag <volume> [blocks], defrag <volume> start [blocks], defrag <volume> stop\n");
+        return -1;
+    }
+
+    errno = 0; // Reset errno for checking strtol's error.
+    unsigned int vol_index = strtol(volume, NULL, 10);
+    unsigned char is_loaded = vol_index < MAX_IMG_COUNT && ((loaded_partitions >> vol_index) & 0x1);
+    if (errno != 0 || vol_index >= (unsigned int) disk_count || !is_loaded) {
+        printf("defrag: invalid volume: ‘%s’\n", volume);
+        return -1;
+    }
+    if (action != NULL && !strcmp(action, "stop")) {
+        if (defrag_stop(vol_index) == -1) {
+            printf("defrag: volume %d is not being defragmented\n", vol_index);
+            return -1;
+        }
+        return 0;
+    }
+
+    unsigned int budget = DEFRAG_DEFAULT_BUDGET;
+    if (budget_str != NULL) {
+        char *end = NULL;
+        long value = strtol(budget_str, &end, 10);
+        if (*end != 0 || value <= 0) {
+            printf("defrag: invalid count of blocks: ‘%s’\n", budget_str);
+            return -1;
+        }
+        budget = (unsigned int) value;
+    }
+    if (action != NULL && !strcmp(action, "start")) return defrag_start(vol_index, budget);
+
+    unsigned int files = 0;
+    int moved = defrag_volume(vol_index, budget, &files);
+    if (moved == -1) return -1;
+    printf("defrag: moved %d files (%d blocks)\n", files, moved);
+    return 0;
+}
+
+
+/**
+ * A function that performs 'compress' command.
+ * compress <volume> prints the compression method of a volume, compress <volume> <none|lz4> changes it.
+ * Files are compressed or stored as they are the next time they are written as a whole.
+ * @param args The arguments of compress.
+ * @return -1 if failure, 0 if successful.
+ */
+int compress(char* args) {
+    (void)! strtok(args, " ");
+    char* volume = strtok(NULL, " ");
+    char* method_str = strtok(NULL, " ");
+    if (volume == NULL) {
+        printf("compress: usage: compress <volume> [none|lz4]\n");
+        return -1;
+    }
+
+    errno = 0; // Reset errno for checking strtol's error.
+    unsigned int vol_index = strtol(volume, NULL, 10);
+    unsigned char is_loaded = vol_index < MAX_IMG_COUNT && ((loaded_partitions >> vol_index) & 0x1);
+    if (errno != 0 || vol_index >= (unsigned int) disk_count || !is_loaded) {
+        printf("compress: invalid volume: ‘%s’\n", volume);
+        return -1;
+    }
+    if (method_str == NULL) {
+        printf("compress: volume %d uses %s\n", vol_index, compress_name(get_compression(vol_index)));
+        return 0;
+    }
+
+    int method = compress_method(method_str);
+    if (method == -1) {
+        printf("compress: invalid method: ‘%s’\n", method_str);
+        return -1;
+    }
+    return set_compression(vol_index, (unsigned int) method);
+}
+
+
+/**
+ * A function that performs 'perf' command.
+ * perf prints the counters of traced operations, perf reset clears them and perf json <file> saves them as JSON.
+ * Latencies are in micro seconds, percentiles are upper bounds of histogram buckets.
+ * @param args The arguments of perf.
+ * @return -1 if failure, 0 if successful.
+ */
+int perf(char* args) {
+    (void)! strtok(args, " ");
+    char* action = strtok(NULL, " ");
+    if (action != NULL && !strcmp(action, "reset")) {
+        trace_reset();
+        return 0;
+    }
+    if (action != NULL && !strcmp(action, "json")) {
+        char* path = strtok(NULL, " ");
+        if (path == NULL) {
+            printf("perf: missing file operand\n");
+            return -1;
+        }
+        return trace_save(path);
+    }
+    if (action != NULL) {
+        printf("perf: usage: perf, perf reset, perf json <file>\n");
+        return -1;
+    }
+
+    struct trace_stat_t stats[TRACE_OP_COUNT];
+    trace_snapshot(stats);
+    printf("%-20s %10s %12s %10s %10s %10s %10s %10s\n", "Operation", "Count", "Bytes", "Syscalls", "Avg(us)",
+           "p50(us)", "p99(us)", "Max(us)");
+    for (unsigned int i = 0 ; i < TRACE_OP_COUNT ; i++) {
+        struct trace_stat_t *t = &stats[i];
+        if (t->count == 0) continue;
+        printf("%-20s %10llu %12llu %10llu %10.1f %10.1f %10.1f %10.1f\n", trace_name(i), t->count, t->bytes,
+               t->syscalls, t->total_ns / 1000.0 / t->count, trace_percentile(t, 50) / 1000.0,
+               trace_percentile(t, 99) / 1000.0, t->max_ns / 1000.0);
+    }
+
+    unsigned int hits = 0, negative_hits = 0, misses = 0;
+    path_cache_status(&hits, &negative_hits, &misses); // Since the start, perf reset does not clear these.
+    printf("Path cache: %d hits, %d negative hits, %d misses\n", hits, negative_hits, misses);
+    return 0;
+}
+
+
+/**
+ * A function that runs a single command line, just like the user typed it in the shell.
+ * @param input The command line without the newline, this may be modified.
+ * @param cur_dir The pointer of the current directory, this is updated by cd.
+ * @return 1 if the command was quit or exit, -1 if the command failed, 0 if successful.
+ */
+int run_command(char* input, struct entry_t** cur_dir) {
+    char tmp_input[MAX_STRING_LEN];
+    strcpy(tmp_input, input);
+    char* tmp = strtok(tmp_input, " "); // Get first command.
+    if (tmp == NULL) return 0;
+    if (!strcmp(tmp, "quit") || !strcmp(tmp, "exit")) return 1;
+
+    int ret = 0;
+    if (!(strcmp(tmp, "ls"))) { // For 'ls' command.
+        ret = ls(input, *cur_dir);
+    } else if (!(strcmp(tmp, "cat"))) { // For 'cat' command.
+        char* args = strtok(NULL, " ");
+        ret = cat(args, *cur_dir);
+    } else if (!(strcmp(tmp, "stat"))) { // For 'cat' command.
+        char* args = strtok(NULL, " ");
+        ret = stat(args, *cur_dir);
+    } else if (!(strcmp(tmp, "chmod"))) { // For 'chmod' command.
+        ret = chmod(input, *cur_dir);
+    } else if (!(strcmp(tmp, "vstat"))) { // For 'vstat' command.
+        char* arg = strtok(NULL, " ");
+        ret = vstat(arg);
+    } else if (!(strcmp(tmp, "sync"))) { // For 'sync' command.
+        ret = sync_();
+    } else if (!(strcmp(tmp, "touch"))) { // For 'touch' command.
+        char* arg = strtok(NULL, " ");
+        ret = touch(arg, *cur_dir);
+    } else if (!(strcmp(tmp, "mkdir"))) { // For 'mkdir' command.
+        char* arg = strtok(NULL, " ");
+        ret = mkdir(arg, *cur_dir);
+    } else if (!(strcmp(tmp, "rm"))) { // For 'rm' command.
+        char* arg = strtok(NULL, " ");
+        ret = rm(arg, *cur_dir);
+    } else if (!(strcmp(tmp, "rmdir"))) { // For 'rmdir' command.
+        char* arg = strtok(NULL, " ");
+        ret = rmdir_(arg, *cur_dir);
+    } else if (!(strcmp(tmp, "cd"))) { // For 'cd' command.
+        char* arg = strtok(NULL, " ");
+        ret = cd(arg, *cur_dir, cur_dir);
+    } else if (!(strcmp(tmp, "cwd"))) { // For 'cwd' command.
+        printf("%s\n", cwd);
+    } else if (!(strcmp(tmp, "write"))) { // For 'write' command.
+        ret = write_(input, *cur_dir);
+    } else if (!(strcmp(tmp, "append"))) { // For 'append' command.
+        ret = append(input, *cur_dir);
+    } else if (!(strcmp(tmp, "xmas"))) { // For 'xmas' command.
+        print_christmas();
+    } else if (!(strcmp(tmp, "cxmas"))) { // For 'cxmas' command.
+        print_colored_christmas_tree();
+    } else if (!(strcmp(tmp, "cp"))) { // For 'cp' command.
+        ret = cp(input, *cur_dir);
+    } else if (!(strcmp(tmp, "rename"))) { // For 'rename' command.
+        ret = rename_(input, *cur_dir);
+    } else if (!(strcmp(tmp, "mv"))) { // For 'mv' command.
+        ret = mv(input, *cur_dir);
+    } else if (!(strcmp(tmp, "snapshot"))) { // For 'snapshot' command.
+        ret = snapshot(input, *cur_dir);
+    } else if (!(strcmp(tmp, "defrag"))) { // For 'defrag' command.
+        ret = defrag(input);
+    } else if (!(strcmp(tmp, "compress"))) { // For 'compress' command.
+        ret = compress(input);
+    } else if (!(strcmp(tmp, "perf"))) { // For 'perf' command.
+        ret = perf(input);
+    } else {
+        printf("%s: command not found\n", tmp);
+        ret = -1;
+    }
+    return ret == -1 ? -1 : 0;
+}
+
+
+/**
+ * A function that reads a line of commands, without the new line.
+ * Lines that do not fit in MAX_STRING_LEN are read until their end and thrown away,
+ * so the rest of a long line is never run as another command.
+ * @param fp The file to read from.
+ * @param input The buffer to store the line, MAX_STRING_LEN bytes.
+ * @return -1 if end of input, 1 if the line was too long, 0 if successful.
+ */
+int read_line(FILE* fp, char* input) {
+    if (fgets(input, MAX_STRING_LEN * sizeof(char), fp) == NULL) return -1;
+    char* newline = strchr(input, '\n');
+    if (newline != NULL) {
+        *newline = 0; // Remove newline from the input.
+        return 0;
+    }
+
+    int c = fgetc(fp);
+    if (c == EOF || c == '\n') return 0; // The line just fit, or it was the last line without a new line.
+    while (c != EOF && c != '\n') c = fgetc(fp);
+    printf("[ERROR] Line is longer than %d characters, ignoring it\n", MAX_STRING_LEN - 1);
+    return 1;
 }
 
 
@@ -573,67 +911,40 @@ void main_loop() {
     struct entry_t* cur_dir = entries[0]; // Load root directory
     char input[MAX_STRING_LEN];
     do {
+        dentry_cache_shrink(cur_dir); // Unload directories that were not used recently.
         printf("MyFS@%s >> ", cwd);
-        (void)! fgets(input, MAX_STRING_LEN * sizeof(char), stdin); // Get output but ignore it.
-
-        if (strlen(input) <= 1) continue;
-        *strchr(input, '\n') = 0; // Remove newline from the user input.
-        char tmp_input[MAX_STRING_LEN];
-        strcpy(tmp_input, input);
-
-        if (strcmp(tmp_input, "quit") != 0 && strcmp(tmp_input, "exit") != 0) { // If this was normal command
-            char* tmp = strtok(tmp_input, " "); // Get first command.
-            if (!(strcmp(tmp, "ls"))) { // For 'ls' command.
-                char* args = strtok(NULL, " ");
-                ls(args, cur_dir);
-            } else if (!(strcmp(tmp, "cat"))) { // For 'cat' command.
-                char* args = strtok(NULL, " ");
-                cat(args, cur_dir);
-            } else if (!(strcmp(tmp, "stat"))) { // For 'cat' command.
-                char* args = strtok(NULL, " ");
-                stat(args, cur_dir);
-            } else if (!(strcmp(tmp, "chmod"))) { // For 'chmod' command.
-                chmod(input, cur_dir);
-            } else if (!(strcmp(tmp, "vstat"))) { // For 'vstat' command.
-                char* arg = strtok(NULL, " ");
-                vstat(arg);
-            } else if (!(strcmp(tmp, "touch"))) { // For 'touch' command.
-                char* arg = strtok(NULL, " ");
-                touch(arg, cur_dir);
-            } else if (!(strcmp(tmp, "mkdir"))) { // For 'mkdir' command.
-                char* arg = strtok(NULL, " ");
-                mkdir(arg, cur_dir);
-            } else if (!(strcmp(tmp, "rm"))) { // For 'rm' command.
-                char* arg = strtok(NULL, " ");
-                rm(arg, cur_dir);
-            } else if (!(strcmp(tmp, "rmdir"))) { // For 'rmdir' command.
-                char* arg = strtok(NULL, " ");
-                rmdir_(arg, cur_dir);
-            } else if (!(strcmp(tmp, "cd"))) { // For 'cd' command.
-                char* arg = strtok(NULL, " ");
-                cd(arg, cur_dir, &cur_dir);
-            } else if (!(strcmp(tmp, "cwd"))) { // For 'cwd' command.
-               printf("%s\n", cwd);
-            } else if (!(strcmp(tmp, "write"))) { // For 'write' command.
-                write_(input, cur_dir);
-            } else if (!(strcmp(tmp, "append"))) { // For 'append' command.
-                append(input, cur_dir);
-            } else if (!(strcmp(tmp, "xmas"))) { // For 'xmas' command.
-                print_christmas();
-            } else if (!(strcmp(tmp, "cxmas"))) { // For 'cxmas' command.
-                print_colored_christmas_tree();
-            } else if (!(strcmp(tmp, "cp"))) { // For 'cp' command.
-                cp(input, cur_dir);
-            } else if (!(strcmp(tmp, "rename"))) { // For 'rename' command.
-                rename_(input, cur_dir);
-            } else if (!(strcmp(tmp, "mv"))) { // For 'mv' command.
-                mv(input, cur_dir);
-            } else {
-                printf("%s: command not found\n", tmp);
-            }
-        } else { // If command was quit, exit break loop.
-            break;
-        }
+        int line = read_line(stdin, input);
+        if (line == -1) break; // End of input, just like exit.
+        if (line == 1 || strlen(input) == 0) continue;
+        if (run_command(input, &cur_dir) == 1) break; // If command was quit, exit break loop.
     } while(1);
     sig_handler(0);
-}
\ No newline at end of file
+}
+
+
+/**
+ * A function that runs commands from a script without prompts, one command per line.
+ * Empty lines and lines starting with # are skipped. This stops at the end of the script or at quit.
+ * @param fp The script to run.
+ * @return The count of commands that failed.
+ */
+int batch_loop(FILE* fp) {
+    strcpy(cwd, "root");
+    struct entry_t* cur_dir = entries[0]; // Load root directory
+    char input[MAX_STRING_LEN];
+    int failed = 0;
+    int line;
+    while ((line = read_line(fp, input)) != -1) {
+        if (line == 1) { // Too long to run, count it as a failed command.
+            failed++;
+            continue;
+        }
+        if (input[0] == 0 || input[0] == '#') continue;
+
+        dentry_cache_shrink(cur_dir); // Unload directories that were not used recently.
+        int ret = run_command(input, &cur_dir);
+        if (ret == 1) break;
+        if (ret == -1) failed++;
+    }
+    return failed;
+}
@@ -16,7 +16,11 @@
 #include "common.h"
 
 void main_loop();
+int batch_loop(FILE*);
+int read_line(FILE*, char*);
+int run_command(char*, struct entry_t**);
 void sig_handler(int);
+int unmount_all(void);
 void print_title();
 void print_christmas();
 void print_colored_christmas_tree();
@@ -30,11 +34,17 @@ int mkdir(char*, struct entry_t*);
 int rm(char*, struct entry_t*);
 int rmdir_(char*, struct entry_t*); // rmdir is already defined in unistd.h :(
 int vstat(char*);
+int sync_(void); // sync is already defined in unistd.h :(
 int write_(char*, struct entry_t*); // write is already defined in unistd.h :(
 int append(char*, struct entry_t*);
 int cd(char*, struct entry_t*, struct entry_t**);
+void update_cwd(struct entry_t*);
 int cp(char*, struct entry_t*);
 int rename_(char*, struct entry_t*); // rename is already defined in stdio.h :(
 int mv(char*, struct entry_t*);
+int snapshot(char*, struct entry_t*);
+int defrag(char*);
+int compress(char*);
+int perf(char*);
 
 #endif //MYFS_UI_H
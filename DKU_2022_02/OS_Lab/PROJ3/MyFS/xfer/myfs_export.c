@@ -0,0 +1,182 @@
+//
+// @file : myfs_export.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements exporting the directory tree of a MyFS image into a directory of the host.
+//          The tree is walked once, each file is read and written to the host as soon as it is found.
+//          Directories that were exported are unloaded right away, so big images do not fill the memory.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "diskutil.h"
+
+
+#define EXPORT_EXIT_OK 0
+#define EXPORT_EXIT_PROBLEMS 1   // Some files could not be exported, the others were.
+#define EXPORT_EXIT_ERROR 8      // The image could not be mounted.
+
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern struct partition partitions[MAX_IMG_COUNT];
+extern int disk_count;
+extern struct entry_t* entries[MAX_IMG_COUNT];
+
+
+/**
+ * A struct that implements the state of an export.
+ */
+struct export_t {
+    unsigned int files;
+    unsigned int dirs;
+    unsigned int failed;
+    unsigned long long bytes;
+    unsigned char verbose;
+};
+
+static struct export_t export_state;
+
+
+/**
+ * A function that returns current monotonic time in seconds.
+ * @return Current time in seconds.
+ */
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * A function that checks if an entry is a directory.
+ * @param entry The entry to check.
+ * @return 1 if the entry was a directory, 0 if not.
+ */
+static int is_dir(struct entry_t* entry) {
+    struct inode *in = &partitions[entry->disk_index].inode_table[entry->inode_index];
+    return (in->mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE;
+}
+
+
+/**
+ * A function that exports a single file of the image into a file of the host.
+ * A file that already exists in the host is overwritten.
+ * @param entry The file to export.
+ * @param path The path of the file in the host.
+ * @return -1 if failure, 0 if successful.
+ */
+static int export_file(struct entry_t* entry, const char* path) {
+    unsigned char *data = NULL;
+    if (read_file_data(entry, &data) == -1) return -1;
+    unsigned int size = get_file_size(entry); // Delayed appends were written by read_file_data.
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        free(data);
+        return -1;
+    }
+    unsigned int done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n <= 0) break;
+        done = done + (unsigned int) n;
+    }
+    free(data);
+    if (close(fd) != 0 || done != size) return -1;
+
+    export_state.files++;
+    export_state.bytes = export_state.bytes + size;
+    if (export_state.verbose) printf("%s\n", path);
+    return 0;
+}
+
+
+/**
+ * A function that exports a directory of the image and everything under it into a directory of the host.
+ * @param dir The directory of the image to export.
+ * @param path The path of the directory in the host, this is extended in place for the entries under it.
+ */
+static void export_dir(struct entry_t* dir, char* path) {
+    size_t path_len = strlen(path);
+    for (struct entry_t *cur = dir_children(dir) ; cur != NULL ; cur = cur->sibling) {
+        if (path_len + 1 + strlen(cur->name) >= PATH_MAX) {
+            printf("[ERROR] Path of %s is too long\n", cur->name);
+            export_state.failed++;
+            continue;
+        }
+        sprintf(path + path_len, "/%s", cur->name);
+
+        if (is_dir(cur)) {
+            if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+                printf("[ERROR] Could not make directory %s\n", path);
+                export_state.failed++;
+            } else {
+                export_state.dirs++;
+                if (export_state.verbose) printf("%s/\n", path);
+                export_dir(cur, path);
+                dentry_cache_shrink(dir); // Directories that were exported are not needed anymore.
+            }
+        } else if (export_file(cur, path) == -1) {
+            printf("[ERROR] Could not export %s\n", path);
+            export_state.failed++;
+        }
+        path[path_len] = '\0';
+    }
+}
+
+
+/**
+ * The main function of the exporter.
+ * @return 0 if everything was exported, 1 if some files could not be exported, 8 if the image could not be used.
+ */
+int main(int argc, char* argv[]) {
+    int arg = 1;
+    if (argc > 1 && !strcmp(argv[1], "-v")) {
+        export_state.verbose = 1;
+        arg++;
+    }
+    if (argc - arg != 2) {
+        printf("Usage: %s [-v] <image> <host dir>\n", argv[0]);
+        printf("Exports everything under the root directory of the image into the host directory.\n");
+        printf("The host directory is made if it does not exist, -v prints each exported file.\n");
+        return EXPORT_EXIT_ERROR;
+    }
+
+    char path[PATH_MAX];
+    if (strlen(argv[arg]) >= MAX_STRING_LEN || strlen(argv[arg + 1]) >= PATH_MAX) {
+        printf("[ERROR] Invalid arguments\n");
+        return EXPORT_EXIT_ERROR;
+    }
+    strcpy(path, argv[arg + 1]);
+    while (strlen(path) > 1 && path[strlen(path) - 1] == '/') path[strlen(path) - 1] = '\0';
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        printf("[ERROR] Could not make directory %s\n", path);
+        return EXPORT_EXIT_ERROR;
+    }
+    strcpy(disks[0], argv[arg]);
+    disk_count = 1;
+    if (mount_disk(0) == -1) return EXPORT_EXIT_ERROR;
+
+    double start = now_s();
+    export_dir(entries[0], path);
+    double elapsed = now_s() - start;
+    int ret = unmount_disk(0);
+
+    printf("Exported %u files (%llu bytes) and %u directories in %.2f s (%.0f files/s, %.1f MB/s)\n",
+           export_state.files, export_state.bytes, export_state.dirs, elapsed,
+           elapsed > 0 ? export_state.files / elapsed : 0,
+           elapsed > 0 ? export_state.bytes / elapsed / (1024 * 1024) : 0);
+    if (ret == -1) {
+        printf("[ERROR] Could not unmount %s\n", disks[0]);
+        return EXPORT_EXIT_ERROR;
+    }
+    if (export_state.failed > 0) {
+        printf("[ERROR] %u entries could not be exported\n", export_state.failed);
+        return EXPORT_EXIT_PROBLEMS;
+    }
+    return EXPORT_EXIT_OK;
+}
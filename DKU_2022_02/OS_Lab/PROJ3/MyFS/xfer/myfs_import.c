@@ -0,0 +1,251 @@
+//
+// @file : myfs_import.c
+// @author : Isu Kim @ isu@isu.kim | Github @ https://github.com/isu-kim
+// @brief : A file that implements importing a directory tree of the host into a MyFS image.
+//          The host tree is walked once and each file is created and written as soon as it is found. The journal is
+//          put into bulk mode for the whole import, so the super block, bitmaps and directory blocks are written once
+//          at the end instead of once per file, and the disk is flushed only once.
+//
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "diskutil.h"
+
+
+#define IMPORT_EXIT_OK 0
+#define IMPORT_EXIT_PROBLEMS 1   // Some files could not be imported, the others were.
+#define IMPORT_EXIT_ERROR 8      // The image could not be mounted or written.
+
+
+extern char disks[MAX_IMG_COUNT][MAX_STRING_LEN];
+extern struct partition partitions[MAX_IMG_COUNT];
+extern int disk_count;
+extern struct entry_t* entries[MAX_IMG_COUNT];
+
+
+/**
+ * A struct that implements the state of an import_state.
+ */
+struct import_t {
+    unsigned int files;
+    unsigned int dirs;
+    unsigned int skipped;          // Entries that are not regular files or directories, like symbolic links.
+    unsigned int failed;
+    unsigned long long bytes;
+    unsigned int max_size;         // The biggest file that the image can store.
+    unsigned char *buffer;         // The data of the file being imported, max_size bytes.
+    unsigned char verbose;
+};
+
+static struct import_t import_state;
+
+
+/**
+ * A function that returns current monotonic time in seconds.
+ * @return Current time in seconds.
+ */
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * A function that checks if an entry is a directory.
+ * @param entry The entry to check.
+ * @return 1 if the entry was a directory, 0 if not.
+ */
+static int is_dir(struct entry_t* entry) {
+    struct inode *in = &partitions[entry->disk_index].inode_table[entry->inode_index];
+    return (in->mode & INODE_MODE_DIR_FILE) == INODE_MODE_DIR_FILE;
+}
+
+
+/**
+ * A function that reads a whole file of the host into the import buffer.
+ * @param path The path of the file.
+ * @param size The size of the file.
+ * @return -1 if failure, 0 if successful.
+ */
+static int read_host_file(const char* path, unsigned int size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    unsigned int done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, import_state.buffer + done, size - done);
+        if (n <= 0) break; // The file got shorter while reading, keep what was read.
+        done = done + (unsigned int) n;
+    }
+    close(fd);
+    return done == size ? 0 : -1;
+}
+
+
+/**
+ * A function that imports a single file of the host into a directory of the image.
+ * A file that already exists in the image is overwritten.
+ * @param path The path of the file.
+ * @param dir The directory of the image to import into.
+ * @param name The name of the file.
+ * @param size The size of the file.
+ * @return -1 if failure, 0 if successful.
+ */
+static int import_file(const char* path, struct entry_t* dir, char* name, unsigned long long size) {
+    if (size > import_state.max_size) {
+        printf("[ERROR] %s is too big (%llu bytes), the image can store up to %u bytes\n", path, size, import_state.max_size);
+        return -1;
+    }
+    if (read_host_file(path, (unsigned int) size) == -1) {
+        printf("[ERROR] Could not read %s\n", path);
+        return -1;
+    }
+
+    struct entry_t *target = NULL;
+    int ret = 0;
+    if (find_child(dir, &target, name) == -1) {
+        if (create_file(dir->disk_index, dir, name, 0) == -1 || find_child(dir, &target, name) == -1) return -1;
+        if (size > 0) ret = write_file_data(target, (unsigned int) size, import_state.buffer); // New files start empty.
+    } else if (is_dir(target)) {
+        printf("[ERROR] %s is a directory in the image\n", path);
+        return -1;
+    } else {
+        ret = size > 0 ? write_file_data(target, (unsigned int) size, import_state.buffer) : truncate_file_data(target, 0);
+    }
+    if (ret == -1) return -1;
+
+    import_state.files++;
+    import_state.bytes = import_state.bytes + size;
+    if (import_state.verbose) printf("%s\n", path);
+    return 0;
+}
+
+
+/**
+ * A function that imports a directory of the host and everything under it into a directory of the image.
+ * Entries are imported in the order that readdir returns them, each one as soon as it is found.
+ * @param path The path of the directory, this is extended in place for the entries under it.
+ * @param dir The directory of the image to import into.
+ */
+static void import_dir(char* path, struct entry_t* dir) {
+    DIR *host_dir = opendir(path);
+    if (host_dir == NULL) {
+        printf("[ERROR] Could not open directory %s\n", path);
+        import_state.failed++;
+        return;
+    }
+
+    size_t path_len = strlen(path);
+    struct dirent *de;
+    while ((de = readdir(host_dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        if (path_len + 1 + strlen(de->d_name) >= PATH_MAX) {
+            printf("[ERROR] Path of %s is too long\n", de->d_name);
+            import_state.failed++;
+            continue;
+        }
+        sprintf(path + path_len, "/%s", de->d_name);
+
+        struct stat st;
+        if (lstat(path, &st) == -1) {
+            printf("[ERROR] Could not stat %s\n", path);
+            import_state.failed++;
+        } else if (S_ISDIR(st.st_mode)) {
+            struct entry_t *child = NULL;
+            if (find_child(dir, &child, de->d_name) == -1
+                && (create_file(dir->disk_index, dir, de->d_name, 1) == -1 || find_child(dir, &child, de->d_name) == -1)) {
+                printf("[ERROR] Could not make directory %s\n", path);
+                import_state.failed++;
+            } else if (!is_dir(child)) {
+                printf("[ERROR] %s is a file in the image\n", path);
+                import_state.failed++;
+            } else {
+                import_state.dirs++;
+                if (import_state.verbose) printf("%s/\n", path);
+                import_dir(path, child);
+                dentry_cache_shrink(dir); // Directories that were imported are not needed anymore.
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            if (import_file(path, dir, de->d_name, (unsigned long long) st.st_size) == -1) {
+                printf("[ERROR] Could not import %s\n", path);
+                import_state.failed++;
+            }
+        } else {
+            printf("[WARNING] Skipping %s, only regular files and directories are imported\n", path);
+            import_state.skipped++;
+        }
+        path[path_len] = '\0';
+    }
+    closedir(host_dir);
+}
+
+
+/**
+ * The main function of the importer.
+ * @return 0 if everything was imported, 1 if some files could not be imported, 8 if the image could not be used.
+ */
+int main(int argc, char* argv[]) {
+    int arg = 1;
+    if (argc > 1 && !strcmp(argv[1], "-v")) {
+        import_state.verbose = 1;
+        arg++;
+    }
+    if (argc - arg != 2) {
+        printf("Usage: %s [-v] <host dir> <image>\n", argv[0]);
+        printf("Imports everything under the host directory into the root directory of the image.\n");
+        printf("Files that already exist in the image are overwritten, -v prints each imported file.\n");
+        return IMPORT_EXIT_ERROR;
+    }
+
+    char path[PATH_MAX];
+    struct stat st;
+    if (strlen(argv[arg]) >= PATH_MAX || stat(argv[arg], &st) == -1 || !S_ISDIR(st.st_mode)) {
+        printf("[ERROR] %s is not a directory\n", argv[arg]);
+        return IMPORT_EXIT_ERROR;
+    }
+    if (strlen(argv[arg + 1]) >= MAX_STRING_LEN) {
+        printf("[ERROR] Invalid image path\n");
+        return IMPORT_EXIT_ERROR;
+    }
+    strcpy(path, argv[arg]);
+    while (strlen(path) > 1 && path[strlen(path) - 1] == '/') path[strlen(path) - 1] = '\0';
+    strcpy(disks[0], argv[arg + 1]);
+    disk_count = 1;
+    if (mount_disk(0) == -1) return IMPORT_EXIT_ERROR;
+
+    unsigned long long max_blocks = max_file_blocks(0);
+    unsigned long long max_size = max_blocks * get_block_size(0);
+    import_state.max_size = max_size > UINT_MAX - 1 ? UINT_MAX - 1 : (unsigned int) max_size;
+    import_state.buffer = malloc((size_t) import_state.max_size + 1);
+    if (!import_state.buffer) {
+        printf("[ERROR] Could not allocate buffer of %u bytes\n", import_state.max_size);
+        unmount_disk(0);
+        return IMPORT_EXIT_ERROR;
+    }
+
+    double start = now_s();
+    int ret = journal_bulk_begin(0);
+    import_dir(path, entries[0]);
+    if (journal_bulk_end(0) == -1) ret = -1;
+    if (unmount_disk(0) == -1) ret = -1;
+    double elapsed = now_s() - start;
+    free(import_state.buffer);
+
+    printf("Imported %u files (%llu bytes) and %u directories in %.2f s (%.0f files/s, %.1f MB/s)\n",
+           import_state.files, import_state.bytes, import_state.dirs, elapsed, elapsed > 0 ? import_state.files / elapsed : 0,
+           elapsed > 0 ? import_state.bytes / elapsed / (1024 * 1024) : 0);
+    if (import_state.skipped > 0) printf("Skipped %u entries that are not regular files or directories\n", import_state.skipped);
+    if (ret == -1) {
+        printf("[ERROR] Could not write %s\n", disks[0]);
+        return IMPORT_EXIT_ERROR;
+    }
+    if (import_state.failed > 0) {
+        printf("[ERROR] %u entries could not be imported\n", import_state.failed);
+        return IMPORT_EXIT_PROBLEMS;
+    }
+    return IMPORT_EXIT_OK;
+}